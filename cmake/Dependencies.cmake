@@ -9,6 +9,10 @@ list(APPEND Caffe_LINKER_LIBS ${Boost_LIBRARIES})
 # ---[ Threads
 find_package(Threads REQUIRED)
 list(APPEND Caffe_LINKER_LIBS ${CMAKE_THREAD_LIBS_INIT})
+if(UNIX AND NOT APPLE)
+  # shm_open for the shared memory ring transport
+  list(APPEND Caffe_LINKER_LIBS rt)
+endif()
 
 # ---[ Google-glog
 include("cmake/External/glog.cmake")
@@ -117,6 +121,7 @@ if(NOT APPLE)
     find_package(OpenBLAS REQUIRED)
     include_directories(SYSTEM ${OpenBLAS_INCLUDE_DIR})
     list(APPEND Caffe_LINKER_LIBS ${OpenBLAS_LIB})
+    add_definitions(-DUSE_OPENBLAS)
   elseif(BLAS STREQUAL "MKL" OR BLAS STREQUAL "mkl")
     find_package(MKL REQUIRED)
     include_directories(SYSTEM ${MKL_INCLUDE_DIR})
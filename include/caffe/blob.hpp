@@ -292,6 +292,12 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to point to the SyncedMemory data, which
+   *        must hold at least the current capacity of this Blob -- used by
+   *        Net to let blobs with disjoint lifetimes share one buffer.
+   */
+  void ShareDataMemory(const shared_ptr<SyncedMemory>& data);
 
   bool ShapeEquals(const BlobProto& other);
 
@@ -79,6 +79,7 @@ namespace cv {class Mat;}
 namespace caffe {
 
 class device;
+class MemoryPool;
 
 // We will use the boost shared_ptr instead of the new C++11 one mainly
 // because cuda does not work (at least now) well with C++11 features.
@@ -173,6 +174,12 @@ class Caffe {
   inline static void set_solver_count(int val) { Get().solver_count_ = val; }
   inline static bool root_solver() { return Get().root_solver_; }
   inline static void set_root_solver(bool val) { Get().root_solver_ = val; }
+  // Rank of the process among rank_count() processes training together,
+  // each reading its own share of the data.
+  inline static int rank() { return Get().rank_; }
+  inline static void set_rank(int val) { Get().rank_ = val; }
+  inline static int rank_count() { return Get().rank_count_; }
+  inline static void set_rank_count(int val) { Get().rank_count_ = val; }
 
   // Get the default device
   static device *GetDefaultDevice();
@@ -188,6 +195,11 @@ class Caffe {
   // Get a device context
   static device *GetDevice(int id);
 
+  // The process-wide pool caching host memory of all SyncedMemory objects
+  static MemoryPool& host_memory_pool();
+  // Releases the memory cached by the host and all device memory pools
+  static void TrimMemoryPools();
+
   // Get a device OpenCL program
 #ifdef USE_GREENTEA
   viennacl::ocl::program & GetDeviceProgram(int id);
@@ -213,6 +225,8 @@ class Caffe {
 
   int solver_count_;
   bool root_solver_;
+  int rank_;
+  int rank_count_;
 };
 
 }  // namespace caffe
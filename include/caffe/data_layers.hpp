@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -22,6 +23,8 @@
 
 namespace caffe {
 
+class DecodedCache;
+
 /**
  * @brief Provides base for data layers that feed blobs to the Net.
  *
@@ -77,18 +80,42 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  // Prefetches batches (asynchronously if to GPU memory)
+  // Default number of batches prefetched (asynchronously if to GPU memory)
   static const int_tp PREFETCH_COUNT = 3;
+  // Number of batches popped between two logs of the prefetch waits.
+  static const int_tp PREFETCH_LOG_INTERVAL = 1000;
+
+  // Milliseconds Forward spent waiting for the prefetch thread, and the
+  // number of batches it had to wait for, since the layer was set up.
+  double prefetch_wait_ms() const;
+  int_tp prefetch_waits() const;
 
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
-
-  Batch<Dtype> prefetch_[PREFETCH_COUNT];
+  // Number of workers decoding and transforming the items of a batch.
+  virtual inline int_tp transform_threads() const { return 1; }
+  // Number of batches staged ahead of Forward.
+  virtual inline int_tp prefetch_count() const { return PREFETCH_COUNT; }
+  // Pops the next loaded batch and accounts the time spent waiting for it.
+  Batch<Dtype>* PopFullBatch();
+
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
   BlockingQueue<Batch<Dtype>*> prefetch_full_;
 
   Blob<Dtype> transformed_data_;
+  // One transformer, with its own RNG, and one view of the batch per worker.
+  // Worker w handles items w, w + transform_threads(), ... so that the random
+  // transformations do not depend on thread scheduling. Worker 0 uses
+  // data_transformer_.
+  vector<shared_ptr<DataTransformer<Dtype> > > worker_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > worker_transformed_data_;
+
+  // Updated atomically, as solvers sharing the layer pop concurrently.
+  int64_t prefetch_wait_us_;
+  int_tp prefetch_waits_;
+  int_tp prefetch_pops_;
 };
 
 template <typename Dtype>
@@ -104,11 +131,21 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int_tp ExactNumBottomBlobs() const { return 0; }
   virtual inline int_tp MinTopBlobs() const { return 1; }
   virtual inline int_tp MaxTopBlobs() const { return 2; }
+  /// @brief The decoded cache, or NULL without data_param.cache_bytes.
+  inline const DecodedCache* cache() const { return cache_.get(); }
 
  protected:
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual inline int_tp transform_threads() const {
+    return this->layer_param_.data_param().transform_threads();
+  }
+  virtual inline int_tp prefetch_count() const {
+    return this->layer_param_.data_param().prefetch();
+  }
 
   DataReader reader_;
+  // Decoded encoded datums by database position, if data_param.cache_bytes.
+  shared_ptr<DecodedCache> cache_;
 };
 
 /**
@@ -188,6 +225,151 @@ class HDF5DataLayer : public Layer<Dtype> {
   std::vector<uint_tp> file_permutation_;
 };
 
+/**
+ * @brief A batch of every top of a data layer.
+ */
+template <typename Dtype>
+class TopBatch {
+ public:
+  vector<shared_ptr<Blob<Dtype> > > blobs_;
+};
+
+/**
+ * @brief Base of data layers that read a TopBatch of all their tops on a
+ *        prefetch thread, optionally at random patch positions of their
+ *        sources.
+ *
+ * For patch sampling, every source is added with the extent of its patch
+ * axes; each position of the box that fits in a source is drawn with the
+ * same probability, so sources are drawn in proportion to their positions.
+ */
+template <typename Dtype>
+class BaseTopPrefetchingLayer : public Layer<Dtype>, public InternalThread {
+ public:
+  explicit BaseTopPrefetchingLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  // Data layers should be shared by multiple solvers in parallel
+  virtual inline bool ShareInParallel() const { return true; }
+  // Data layers have no bottoms, so reshaping is trivial.
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {}
+
+  virtual inline int_tp ExactNumBottomBlobs() const { return 0; }
+  virtual inline int_tp MinTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
+  virtual void InternalThreadEntry();
+  virtual void load_batch(TopBatch<Dtype>* batch) = 0;
+  // Reshapes the tops, and prefetch batches of them, to top_shapes and
+  // starts the prefetch thread. The caller has stopped it before.
+  void StartPrefetch(const vector<vector<int_tp> >& top_shapes,
+                     int_tp prefetch, const vector<Blob<Dtype>*>& top);
+
+  // Starts over the patch sources, with patches of box_shape.
+  void ClearPatchSources(const vector<int_tp>& box_shape);
+  // Adds the next source, whose patch axes have the sizes in space.
+  void AddPatchSource(const vector<int_tp>& space, const string& name);
+  // Draws a patch position: returns its source, and sets offset along the
+  // patch axes. Runs on the prefetch thread, with its RNG.
+  int_tp SamplePatch(vector<int_tp>* offset);
+
+  vector<shared_ptr<TopBatch<Dtype> > > prefetch_;
+  BlockingQueue<TopBatch<Dtype>*> prefetch_free_;
+  BlockingQueue<TopBatch<Dtype>*> prefetch_full_;
+
+  vector<int_tp> patch_box_;
+  // The patch axes of each source.
+  vector<vector<int_tp> > patch_spaces_;
+  // Patch positions in each source and the sources before it.
+  vector<uint_tp> patch_positions_;
+};
+
+/**
+ * @brief Provides data to the Net from HDF5 files, reading only what each
+ *        batch needs on a prefetch thread instead of loading whole files.
+ *
+ * Without hdf5_data_param.patch_shape, batches are the rows of the first
+ * axis, in the order of HDF5DataLayer. With it, every item is a patch at a
+ * random position of the trailing axes of the datasets of a file, which
+ * share these axes; the files are drawn in proportion to their number of
+ * positions, and the leading axes are read whole. Datasets are read by
+ * hyperslab, so chunked datasets are only read and decompressed where
+ * needed. Reads hold the HDF5Lock, so other HDF5 users may run meanwhile.
+ */
+template <typename Dtype>
+class HDF5StreamDataLayer : public BaseTopPrefetchingLayer<Dtype> {
+ public:
+  explicit HDF5StreamDataLayer(const LayerParameter& param)
+      : BaseTopPrefetchingLayer<Dtype>(param) {}
+  virtual ~HDF5StreamDataLayer();
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "HDF5StreamData"; }
+
+ protected:
+  virtual void InternalThreadEntry();
+  virtual void load_batch(TopBatch<Dtype>* batch);
+  void LoadRows(TopBatch<Dtype>* batch);
+  void LoadPatches(TopBatch<Dtype>* batch);
+  void StartFile();
+  void CloseFiles();
+
+  std::vector<std::string> hdf_filenames_;
+  std::vector<hid_t> file_ids_;
+  // The dataset of each top in each file, and its shape.
+  std::vector<std::vector<hid_t> > dataset_ids_;
+  std::vector<std::vector<std::vector<hsize_t> > > dataset_shapes_;
+  std::vector<hsize_t> patch_shape_;
+  // Reading position of the prefetch thread.
+  uint_tp current_file_;
+  hsize_t current_row_;
+  std::vector<uint_tp> data_permutation_;
+  std::vector<uint_tp> file_permutation_;
+};
+
+template <typename Dtype>
+class PatchVolume;
+
+/**
+ * @brief Provides the Net with N-D patches sampled on the fly from
+ *        memory-mapped NumPy volumes or chunked HDF5 datasets, e.g. for
+ *        training volumetric segmentation without precomputed patches.
+ *
+ * Every item is drawn from a random position of a random volume, with
+ * patches of different sizes per top sharing their center. Each top reads
+ * from one dataset or .npy file per volume, whose trailing axes are the
+ * patch axes and whose leading axes, such as channels, are read whole.
+ * In training, the patches can be mirrored and transposed the same way for
+ * all tops. A prefetch thread samples the batches, and
+ * patch_data_param.threads workers read and augment their items.
+ */
+template <typename Dtype>
+class PatchDataLayer : public BaseTopPrefetchingLayer<Dtype> {
+ public:
+  explicit PatchDataLayer(const LayerParameter& param)
+      : BaseTopPrefetchingLayer<Dtype>(param) {}
+  virtual ~PatchDataLayer();
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "PatchData"; }
+
+ protected:
+  virtual void load_batch(TopBatch<Dtype>* batch);
+
+  // The volume of each top in each line of the source.
+  std::vector<std::vector<shared_ptr<PatchVolume<Dtype> > > > volumes_;
+  // The patch axes of each top; patch_box_ holds their largest sizes.
+  std::vector<std::vector<int_tp> > patch_shapes_;
+  // Groups of patch axes that have equal sizes in every top.
+  std::vector<std::vector<int_tp> > transpose_groups_;
+};
+
 /**
  * @brief Write blobs to disk as HDF5 files.
  *
@@ -254,9 +436,22 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual inline int_tp transform_threads() const {
+    return this->layer_param_.image_data_param().transform_threads();
+  }
+  virtual inline int_tp prefetch_count() const {
+    return this->layer_param_.image_data_param().prefetch();
+  }
 
   vector<std::pair<std::string, int_tp> > lines_;
   int_tp lines_id_;
+  // Decoded images by their first line in the source, which does not change
+  // when the lines are shuffled, if image_data_param.cache_bytes is set.
+  inline int_tp cache_index(const string& filename) const {
+    return cache_ ? cache_index_.find(filename)->second : 0;
+  }
+  shared_ptr<DecodedCache> cache_;
+  std::map<string, int_tp> cache_index_;
 };
 
 /**
@@ -333,6 +528,9 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   virtual uint_tp PrefetchRand();
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual inline int_tp prefetch_count() const {
+    return this->layer_param_.window_data_param().prefetch();
+  }
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int_tp> > > image_database_;
@@ -12,6 +12,21 @@
 
 namespace caffe {
 
+/**
+ * @brief A Datum read by a DataReader. The raw uint8 pixels of a datum read
+ * through a cursor whose views persist (LMDB) are not copied: pixels_ points
+ * at them in the mapped database page, and datum_.data() is left empty.
+ * Otherwise pixels_ is NULL and datum_ holds all of the data. index_ is the
+ * position of the datum in the database.
+ */
+class DatumSample {
+ public:
+  DatumSample() : pixels_(NULL), index_(0) {}
+  Datum datum_;
+  const char* pixels_;
+  int_tp index_;
+};
+
 /**
  * @brief Reads data from a source to queues available to data layers.
  * A single reading thread is created per source, even if multiple solvers
@@ -19,16 +34,24 @@ namespace caffe {
  * databases are read sequentially, and that each solver accesses a different
  * subset of the database. Data is distributed to solvers in a round-robin
  * way to keep parallel training deterministic.
+ * With data_param.shards = N > 1, the source is read from the databases
+ * source_0 ... source_{N-1}, as written by convert_imageset --shards, each on
+ * its own thread. The body takes their datums round-robin, which keeps the
+ * order deterministic and, while the shards have the same size, equal to
+ * the order of the unsharded list. A warning is logged when they do not.
+ * With Caffe::rank_count() = R > 1 processes, e.g. in ring training, rank r
+ * only reads datums r, r + R, r + 2R, ... of a training source, so that
+ * every process trains on its own share.
  */
 class DataReader {
  public:
   explicit DataReader(const LayerParameter& param);
   ~DataReader();
 
-  inline BlockingQueue<Datum*>& free() const {
+  inline BlockingQueue<DatumSample*>& free() const {
     return queue_pair_->free_;
   }
-  inline BlockingQueue<Datum*>& full() const {
+  inline BlockingQueue<DatumSample*>& full() const {
     return queue_pair_->full_;
   }
 
@@ -39,12 +62,29 @@ class DataReader {
     explicit QueuePair(int_tp size);
     ~QueuePair();
 
-    BlockingQueue<Datum*> free_;
-    BlockingQueue<Datum*> full_;
+    BlockingQueue<DatumSample*> free_;
+    BlockingQueue<DatumSample*> full_;
 
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
 
+  // Reads one database of a sharded source ahead of the body
+  class Shard : public InternalThread {
+   public:
+    Shard(const LayerParameter& param, int_tp id);
+    virtual ~Shard();
+
+    QueuePair queue_pair_;
+
+   protected:
+    void InternalThreadEntry();
+
+    const LayerParameter param_;
+    const int_tp id_;
+
+  DISABLE_COPY_AND_ASSIGN(Shard);
+  };
+
   // A single body is created per source
   class Body : public InternalThread {
    public:
@@ -54,9 +94,18 @@ class DataReader {
    protected:
     void InternalThreadEntry();
     void read_one(db::Cursor* cursor, QueuePair* qp);
+    // Reads the next datum of the source into sample, or skips it if NULL.
+    void read(db::Cursor* cursor, DatumSample* sample);
+    void skip(db::Cursor* cursor, int_tp count);
 
     const LayerParameter param_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
+    int_tp index_;
+    // The shard readers if the source is sharded, and the next to take from.
+    vector<shared_ptr<Shard> > shards_;
+    int_tp next_shard_;
+    // Number of ranks reading the source in turn.
+    int_tp rank_count_;
 
     friend class DataReader;
 
@@ -39,6 +39,21 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation to a raw datum whose uint8 pixels are
+   * stored outside of it, e.g. in a mapped database page.
+   *
+   * @param datum
+   *    Datum holding the shape of the data.
+   * @param pixels
+   *    The channels x height x width uint8 pixels, read instead of
+   *    datum.data(). If NULL, datum.data() or datum.float_data() is used.
+   * @param transformed_blob
+   *    This is destination blob. See data_layer.cpp for an example.
+   */
+  void Transform(const Datum& datum, const char* pixels,
+                 Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -140,7 +155,8 @@ class DataTransformer {
    */
   virtual int_tp Rand(int_tp n);
 
-  void Transform(const Datum& datum, Dtype* transformed_data);
+  void Transform(const Datum& datum, const char* pixels,
+                 Dtype* transformed_data);
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -17,6 +17,7 @@
 #include <vector>
 #include "caffe/blob.hpp"
 #include "caffe/greentea/greentea.hpp"
+#include "caffe/util/memory_pool.hpp"
 
 
 using std::vector;
@@ -47,6 +48,7 @@ class device {
 
   void Init();
 
+  // Bytes allocated on the device, including blocks cached in the pool.
   uint_tp memory_usage();
   uint_tp peak_memory_usage();
   void IncreaseMemoryUsage(uint_tp bytes);
@@ -54,7 +56,21 @@ class device {
   void ResetPeakMemoryUsage();
   bool CheckCapability(std::string cap);
 
+  // Allocates SizeClass(size) bytes of device memory (a CUDA pointer or a
+  // cl_mem), reusing a block cached in the memory pool if possible. If the
+  // driver is out of memory, the pool is trimmed and the allocation retried.
+  void* MallocMemory(uint_tp size);
+  // Returns memory from MallocMemory of the same size to the memory pool.
+  void FreeMemory(void* ptr, uint_tp size);
+  // Releases all memory cached in the pool back to the driver.
+  void TrimMemoryPool();
+  MemoryPool& memory_pool();
+
  private:
+  // Allocates bytes from the driver, returning NULL if it fails.
+  void* AllocateMemory(uint_tp bytes);
+  void ReleaseMemory(void* ptr, uint_tp bytes);
+
   int current_queue_id_;
   std::vector<int> workgroup_sizes_;
   int id_;
@@ -62,6 +78,7 @@ class device {
   Backend backend_;
   uint_tp memory_usage_;
   uint_tp peak_memory_usage_;
+  shared_ptr<MemoryPool> memory_pool_;
   std::vector< shared_ptr< Blob<float> > > buff_f_;
   std::vector< shared_ptr< Blob<double> > > buff_d_;
 #ifdef USE_GREENTEA
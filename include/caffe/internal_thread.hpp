@@ -51,7 +51,7 @@ class InternalThread {
 
  private:
   void entry(device* device_context, Caffe::Brew mode, int_tp rand_seed,
-             int_tp solver_count, bool root_solver);
+             int_tp solver_count, bool root_solver, int rank, int rank_count);
 
   shared_ptr<boost::thread> thread_;
 };
@@ -803,18 +803,9 @@ class MalisLossLayer : public LossLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
  private:
-  void Malis(const Dtype* conn_data, const int_tp conn_num_dims,
-             const int_tp* conn_dims,
-             const int_tp* nhood_data, const int_tp* nhood_dims,
-             const Dtype* seg_data,
-             const bool pos, Dtype* dloss_data, Dtype* loss_out,
-             Dtype *classerr_out, Dtype *rand_index_out);
-
   int_tp nedges_;
-  int_tp conn_num_dims_;
   std::vector<int_tp> conn_dims_;
   std::vector<int_tp> nhood_data_;
-  std::vector<int_tp> nhood_dims_;
 
   Blob<Dtype> affinity_pos_;
   Blob<Dtype> affinity_neg_;
@@ -65,6 +65,10 @@ class Net {
    *        Should be run before Backward.
    */
   void ClearParamDiffs();
+  /// @brief Returns the sum of squares of the diffs of all net parameters.
+  Dtype SumsqParamDiffs() const;
+  /// @brief Scales the diffs of all net parameters.
+  void ScaleParamDiffs(Dtype scale);
 
   /**
    * The network backward should take no input and output, since it solely
@@ -93,6 +97,12 @@ class Net {
 
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
+  /**
+   * @brief Bumps the data version of every learnable param. Call it after
+   *        writing the weights through flat_param_data() or another alias,
+   *        so that layers caching values derived from them recompute them.
+   */
+  void MarkParamsWritten();
   /**
    * @brief Shares weight data of owner blobs with shared blobs.
    *
@@ -191,6 +201,9 @@ class Net {
   inline const vector<int_tp>& param_owners() const {
     return param_owners_;
   }
+  inline const vector<pair<int_tp, int_tp> >& param_layer_indices() const {
+    return param_layer_indices_;
+  }
   /// @brief Input and output blob numbers
   inline int_tp num_inputs() const {
     return net_input_blobs_.size();
@@ -219,6 +232,50 @@ class Net {
     debug_info_ = value;
   }
 
+  /**
+   * @brief Invoked by Backward after each layer, in the order Backward runs
+   *        them, so that the gradients of parameters owned by that layer and
+   *        the layers above it can be used before the whole pass is done.
+   *        A parameter shared between layers is owned by the lowest one.
+   */
+  class Callback {
+   protected:
+    virtual void on_layer_gradients_ready(int_tp layer_id) = 0;
+
+    template <typename T>
+    friend class Net;
+  };
+  const vector<Callback*>& after_backward() const { return after_backward_; }
+  void add_after_backward(Callback* value) {
+    after_backward_.push_back(value);
+  }
+  /// @brief returns the bytes of data held by the net's blobs, without and
+  ///        with the memory plan of optimize_memory
+  inline uint_tp memory_used() const {
+    return memory_used_ * sizeof(Dtype);
+  }
+  inline uint_tp memory_planned() const {
+    return memory_planned_;
+  }
+  /**
+   * @brief returns the arenas of contiguous_params, or NULL without them.
+   *        Learnable param i is a view of flat_param_count values at
+   *        flat_param_offsets()[i], each starting at a cache line; the
+   *        padding between them stays zero.
+   */
+  inline Dtype* flat_param_data() const { return flat_param_data_; }
+  inline Dtype* flat_param_diff() const { return flat_param_diff_; }
+  inline uint_tp flat_param_count() const { return flat_param_count_; }
+  inline const vector<uint_tp>& flat_param_offsets() const {
+    return flat_param_offsets_;
+  }
+  /**
+   * @brief Whether the learnable params are still views of the arenas in CPU
+   *        mode, so that the arenas hold their current values. Sharing the
+   *        params with another net or a parallel buffer replaces the views.
+   */
+  bool FlatParamsInUse() const;
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
@@ -244,6 +301,17 @@ class Net {
   void AppendParam(const NetParameter& param, const int_tp layer_id,
                    const int_tp param_id);
 
+  /**
+   * @brief Lets blobs whose lifetimes do not overlap share data buffers.
+   *
+   * Blobs that already share a SyncedMemory (in-place tops, split and
+   * reshape outputs) are planned as one. Inputs, outputs and the tops of
+   * source layers keep their own memory.
+   */
+  void PlanMemory();
+  /// @brief Moves the learnable params into the arenas of contiguous_params.
+  void FlattenParams();
+
   /// @brief Helper for displaying debug info in Forward about input Blobs.
   void InputDebugInfo(const int_tp layer_id);
   /// @brief Helper for displaying debug info in Forward.
@@ -308,8 +376,25 @@ class Net {
   vector<bool> has_params_decay_;
   /// The bytes of memory used by this net
   uint_tp memory_used_;
+  /// Whether blobs share buffers according to PlanMemory
+  bool optimize_memory_;
+  /// The bytes of data memory after PlanMemory
+  uint_tp memory_planned_;
+  /// The buffers shared by blobs, and each blob's group and size in the plan
+  vector<shared_ptr<SyncedMemory> > memory_buffers_;
+  vector<int_tp> blob_memory_group_;
+  vector<uint_tp> blob_memory_bytes_;
+  /// The arenas holding the learnable params, and each param's offset
+  shared_ptr<SyncedMemory> flat_param_data_memory_;
+  shared_ptr<SyncedMemory> flat_param_diff_memory_;
+  Dtype* flat_param_data_;
+  Dtype* flat_param_diff_;
+  uint_tp flat_param_count_;
+  vector<uint_tp> flat_param_offsets_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Invoked after the Backward of each layer
+  vector<Callback*> after_backward_;
 
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
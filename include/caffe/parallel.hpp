@@ -7,6 +7,7 @@
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <utility>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -17,12 +18,14 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/ring.hpp"
 
 namespace caffe {
 
 // Represents a net parameters. Once a net is created, its parameter buffers can
 // be replaced by ones from Params, to allow parallelization. Params ensures
-// parameters are allocated in one consecutive array.
+// parameters are allocated in one consecutive array, laid out like the param
+// arena of the net when it has contiguous params.
 template<typename Dtype>
 class Params {
  public:
@@ -39,9 +42,14 @@ class Params {
   inline Dtype* diff() const {
     return diff_;
   }
+  // Offset of each learnable param in the buffers.
+  inline const vector<uint_tp>& offsets() const {
+    return offsets_;
+  }
 
  protected:
-  const uint_tp size_;           // Size of buffers
+  uint_tp size_;                // Size of buffers
+  vector<uint_tp> offsets_;
   Dtype* data_;                 // Network parameters
   Dtype* diff_;                 // Gradient
 
@@ -63,6 +71,28 @@ class GPUParams : public Params<Dtype> {
   using Params<Dtype>::diff_;
 };
 
+// Params stored in host memory, one copy per solver replica.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  // With adopt_arena, the replica running root_solver itself uses the param
+  // arenas of its net as buffers when they are in use.
+  CPUParams(shared_ptr<Solver<Dtype> > root_solver, bool adopt_arena);
+  virtual ~CPUParams();
+
+  void configure(Solver<Dtype>* solver) const;
+
+ protected:
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+  // Whether data_ and diff_ are the param arenas of the root net, which then
+  // holds the only copy of the root params.
+  bool flat_;
+  int_tp data_flags_;
+  int_tp diff_flags_;
+};
+
 class DevicePair {
  public:
   DevicePair(device* parent, device* dev)
@@ -120,6 +150,107 @@ class P2PSync : public GPUParams<Dtype>, public Solver<Dtype>::Callback,
   using Params<Dtype>::diff_;
 };
 
+// Synchronous data parallelism between solver replicas on threads of the
+// host. Replica i > 0 is the child of replica (i - 1) / 2; parameters are
+// broadcast down and gradients summed up this tree as in P2PSync. Each
+// replica thread is pinned to its own range of cores, and runs as many
+// OpenMP and BLAS threads.
+template<typename Dtype>
+class CPUSync : public CPUParams<Dtype>, public Solver<Dtype>::Callback,
+    public InternalThread {
+ public:
+  explicit CPUSync(shared_ptr<Solver<Dtype> > root_solver,
+                   CPUSync<Dtype>* parent, const SolverParameter& param,
+                   int replica);
+  virtual ~CPUSync();
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+  // Trains with Caffe::solver_count() replicas, the root one on the calling
+  // thread.
+  void run();
+  // Pins the calling thread to the cores of the root replica, and sizes its
+  // OpenMP and BLAS threads to them. OpenMP workers keep the cores of the
+  // thread that started them, so call it before the root net is created.
+  static void PinRoot();
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+
+  void InternalThreadEntry();
+
+  CPUSync<Dtype>* parent_;
+  vector<CPUSync<Dtype>*> children_;
+  BlockingQueue<CPUSync<Dtype>*> queue_;
+  const int initial_iter_;
+  const int replica_;
+  // Gradients sent to the parent, which sums them into its own.
+  Dtype* parent_grads_;
+  int_tp parent_grads_flags_;
+  shared_ptr<Solver<Dtype> > solver_;
+  // Cores the replica thread runs on, empty to leave it unpinned.
+  vector<int> cores_;
+
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+// Synchronous data parallelism between processes, possibly on other hosts,
+// each running one CPU solver. Rank 0 broadcasts the parameters once, then
+// the ranks sum their gradients with a ring allreduce before every update,
+// bucket_size values at a time. All ranks apply the same update to the same
+// sums, so their parameters stay equal without further broadcasts.
+// Buckets are summed on a communication thread. With iter_size 1, a bucket
+// is queued as soon as Backward has finalized it, so it is summed while the
+// layers below are still computing theirs.
+template<typename Dtype>
+class RingSync : public CPUParams<Dtype>, public Solver<Dtype>::Callback,
+    public Net<Dtype>::Callback, public InternalThread {
+ public:
+  RingSync(shared_ptr<Solver<Dtype> > solver,
+           shared_ptr<RingTransport> transport, uint_tp bucket_size);
+  virtual ~RingSync();
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+  void run();
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+  void on_layer_gradients_ready(int_tp layer_id);
+  // Queues the whole buckets of diff_ between offset and reduced_, and with
+  // partial the values left below the last whole bucket too.
+  void reduce(uint_tp offset, bool partial);
+  // Sums the queued buckets over the ring.
+  void InternalThreadEntry();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  shared_ptr<RingTransport> transport_;
+  const uint_tp bucket_size_;
+  // Learnable params are laid out in the order of the layers owning them,
+  // so once the Backward of layer i is done, diff_ is final from
+  // layer_ready_[i] on.
+  vector<uint_tp> layer_ready_;
+  // diff_ is queued for summing from reduced_ on.
+  uint_tp reduced_;
+  // Offset and count of the buckets to sum, in the same order on every
+  // rank. A count of 0 ends the iteration, and is passed back on drained_
+  // once the buckets before it are summed.
+  BlockingQueue<std::pair<uint_tp, uint_tp> > buckets_;
+  BlockingQueue<std::pair<uint_tp, uint_tp> > drained_;
+
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
 }  // namespace caffe
 
 #endif
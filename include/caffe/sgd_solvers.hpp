@@ -27,9 +27,20 @@ class SGDSolver : public Solver<Dtype> {
   void PreSolve();
   Dtype GetLearningRate();
   virtual void ApplyUpdate();
-  virtual void Normalize(uint_tp param_id);
-  virtual void Regularize(uint_tp param_id);
+  // Gets the scalars of the gradient preprocessing fused into every update:
+  // the diff is scaled by 1 / iter_size, then l2_decay * data and
+  // l1_decay * sign(data) are added to it.
+  void GetRegularization(uint_tp param_id, Dtype* scale, Dtype* l2_decay,
+                         Dtype* l1_decay);
+  // Preprocesses the diff of a learnable param, updates the history, leaves
+  // the update value in the diff and subtracts it from the data, all in one
+  // pass over the blob.
   virtual void ComputeUpdateValue(uint_tp param_id, Dtype rate);
+  // Runs the update of ComputeUpdateValue over the whole param arena of the
+  // net at once, with the scalars of each param. Returns false when the net
+  // has no arena in use, or when the solver has no flat update, so that
+  // ApplyUpdate goes param by param.
+  virtual bool ApplyFlatUpdate(Dtype rate);
   virtual void ClipGradients();
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
@@ -37,10 +48,10 @@ class SGDSolver : public Solver<Dtype> {
   virtual void RestoreSolverStateFromHDF5(const string& state_file);
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file);
   // history maintains the historical momentum data.
-  // update maintains update related data and is not needed in snapshots.
-  // temp maintains other information that might be needed in computation
-  //   of gradients/updates and is not needed in snapshots
-  vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  vector<shared_ptr<Blob<Dtype> > > history_;
+  // Backs the first history blobs when the net has contiguous params.
+  shared_ptr<SyncedMemory> flat_history_memory_;
+  Dtype* flat_history_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -56,6 +67,7 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(uint_tp param_id, Dtype rate);
+  virtual inline bool ApplyFlatUpdate(Dtype rate) { return false; }
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -71,6 +83,7 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(uint_tp param_id, Dtype rate);
+  virtual inline bool ApplyFlatUpdate(Dtype rate) { return false; }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -91,6 +104,7 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(uint_tp param_id, Dtype rate);
+  virtual inline bool ApplyFlatUpdate(Dtype rate) { return false; }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -115,6 +129,7 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(uint_tp param_id, Dtype rate);
+  virtual inline bool ApplyFlatUpdate(Dtype rate) { return false; }
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -139,10 +154,18 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(uint_tp param_id, Dtype rate);
+  virtual inline bool ApplyFlatUpdate(Dtype rate) { return false; }
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
 
+// Blobs with fewer values are updated on one thread, as starting the OpenMP
+// threads would take longer than the update.
+const int_tp kParallelUpdateMin = 1 << 16;
+// Values of the param arena per OpenMP iteration of the flat SGD update, a
+// whole number of cache lines.
+const int_tp kFlatUpdateBlock = 1 << 12;
+
 }  // namespace caffe
 
 #endif  // CAFFE_SGD_SOLVERS_HPP_
@@ -12,9 +12,18 @@
 
 namespace caffe {
 
-void CaffeMallocHost(void** ptr, int_tp size);
+// How a host block was allocated, so that it is freed the same way and only
+// reused by the host memory pool for allocations of the same kind.
+#define CAFFE_HOST_MALLOC 0
+#define CAFFE_HOST_ALIGNED 1
+#define CAFFE_HOST_PINNED 2
 
-void CaffeFreeHost(void* ptr);
+void CaffeMallocHost(void** ptr, int_tp size, int_tp* flags);
+
+void CaffeFreeHost(void* ptr, int_tp size, int_tp flags);
+
+// Frees the host memory cached in Caffe::host_memory_pool().
+void CaffeTrimHostPool();
 
 /**
  * @brief Manages memory allocation and synchronization between the host (CPU)
@@ -32,6 +41,8 @@ class SyncedMemory {
         head_(UNINITIALIZED),
         own_cpu_data_(false),
         own_gpu_data_(false),
+        cpu_malloc_flags_(CAFFE_HOST_MALLOC),
+        version_(0),
         device_(Caffe::GetDefaultDevice()),
         cl_gpu_mem_(NULL) {
   }
@@ -42,6 +53,8 @@ class SyncedMemory {
         head_(UNINITIALIZED),
         own_cpu_data_(false),
         own_gpu_data_(false),
+        cpu_malloc_flags_(CAFFE_HOST_MALLOC),
+        version_(0),
         device_(device_context),
         cl_gpu_mem_(NULL) {
   }
@@ -52,6 +65,8 @@ class SyncedMemory {
         head_(UNINITIALIZED),
         own_cpu_data_(false),
         own_gpu_data_(false),
+        cpu_malloc_flags_(CAFFE_HOST_MALLOC),
+        version_(0),
         device_(device_context),
         cl_gpu_mem_(NULL) {
   }
@@ -63,6 +78,8 @@ class SyncedMemory {
         head_(UNINITIALIZED),
         own_cpu_data_(false),
         own_gpu_data_(false),
+        cpu_malloc_flags_(CAFFE_HOST_MALLOC),
+        version_(0),
         device_(Caffe::GetDefaultDevice()) {
   }
   explicit SyncedMemory(device *device_context)
@@ -72,6 +89,8 @@ class SyncedMemory {
         head_(UNINITIALIZED),
         own_cpu_data_(false),
         own_gpu_data_(false),
+        cpu_malloc_flags_(CAFFE_HOST_MALLOC),
+        version_(0),
         device_(device_context) {
   }
   explicit SyncedMemory(uint_tp size, device *device_context)
@@ -81,6 +100,8 @@ class SyncedMemory {
         head_(UNINITIALIZED),
         own_cpu_data_(false),
         own_gpu_data_(false),
+        cpu_malloc_flags_(CAFFE_HOST_MALLOC),
+        version_(0),
         device_(device_context) {
   }
 #endif
@@ -104,11 +125,21 @@ class SyncedMemory {
   uint_tp size() {
     return size_;
   }
+  // Counts the calls that may have changed the data: mutable_cpu_data,
+  // mutable_gpu_data, set_cpu_data and set_gpu_data.
+  uint_tp version() const {
+    return version_;
+  }
 
 #ifndef CPU_ONLY
 #ifdef USE_CUDA
   void async_gpu_push(const cudaStream_t& stream);
 #endif  // USE_CUDA
+#ifdef USE_GREENTEA
+  // Enqueues a non-blocking upload on queue; the caller finishes the queue
+  // before the data is used on the device.
+  void async_gpu_push(const viennacl::ocl::command_queue& queue);
+#endif  // USE_GREENTEA
 #endif  // !CPU_ONLY
 
  private:
@@ -121,6 +152,8 @@ class SyncedMemory {
   SyncedHead head_;
   bool own_cpu_data_;
   bool own_gpu_data_;
+  int_tp cpu_malloc_flags_;
+  uint_tp version_;
   device *device_;
 
 #ifdef USE_GREENTEA
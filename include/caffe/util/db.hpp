@@ -18,6 +18,13 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // Views of the current key and value, without copying them. They are valid
+  // until the cursor moves, or as long as the cursor lives if views_persist().
+  virtual const char* key_data() = 0;
+  virtual int_tp key_size() = 0;
+  virtual const char* value_data() = 0;
+  virtual int_tp value_size() = 0;
+  virtual bool views_persist() { return false; }
   virtual bool valid() = 0;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
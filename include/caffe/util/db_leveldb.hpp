@@ -20,6 +20,10 @@ class LevelDBCursor : public Cursor {
   virtual void Next() { iter_->Next(); }
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
+  virtual const char* key_data() { return iter_->key().data(); }
+  virtual int_tp key_size() { return iter_->key().size(); }
+  virtual const char* value_data() { return iter_->value().data(); }
+  virtual int_tp value_size() { return iter_->value().size(); }
   virtual bool valid() { return iter_->Valid(); }
 
  private:
@@ -33,6 +33,17 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  virtual const char* key_data() {
+    return static_cast<const char*>(mdb_key_.mv_data);
+  }
+  virtual int_tp key_size() { return mdb_key_.mv_size; }
+  virtual const char* value_data() {
+    return static_cast<const char*>(mdb_value_.mv_data);
+  }
+  virtual int_tp value_size() { return mdb_value_.mv_size; }
+  // The views point into the memory map, where the pages read stay until the
+  // read-only transaction, held by the cursor, ends.
+  virtual bool views_persist() { return true; }
   virtual bool valid() { return valid_; }
 
  private:
@@ -0,0 +1,88 @@
+#ifndef CAFFE_UTIL_DECODED_CACHE_HPP_
+#define CAFFE_UTIL_DECODED_CACHE_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Caches decoded uint8 images by sample index, so that epochs after
+ *        the first skip the JPEG/PNG decode.
+ *
+ * Images are added until the byte budget is used up and are never evicted:
+ * data layers read their samples in epochs, for which any eviction order
+ * would miss on every access once the data set does not fit. The cache lives
+ * in anonymous memory, or in a file mapped in shared mode so that the
+ * training processes of a host decode each image once between them. The
+ * file keeps the cache across runs; it has to be removed when the images
+ * change. Find and Insert are thread and process safe.
+ */
+class DecodedCache {
+ public:
+  /**
+   * @param key Identifies the images, e.g. the source and decode settings.
+   *        A file created for another key or size is refused.
+   * @param num_entries Capacity of the index table.
+   * @param bytes Budget for the image data.
+   * @param file The file to share the cache through, or empty.
+   */
+  DecodedCache(const string& key, int_tp num_entries, uint_tp bytes,
+               const string& file);
+  ~DecodedCache();
+
+  /**
+   * @brief Returns the cached height x width x channels image for index,
+   *        or NULL on a miss. The image stays valid as long as the cache.
+   */
+  const uint8_t* Find(int_tp index, int_tp* height, int_tp* width,
+                      int_tp* channels);
+  /**
+   * @brief Copies an image into the cache. Returns false if index is already
+   *        cached, the budget is used up or the table is 3/4 full.
+   */
+  bool Insert(int_tp index, const uint8_t* data, int_tp height, int_tp width,
+              int_tp channels);
+#ifdef USE_OPENCV
+  /// @brief Wraps the cached image of index, or returns an empty cv::Mat.
+  cv::Mat FindMat(int_tp index);
+  /// @brief Inserts a uint8 image.
+  bool InsertMat(int_tp index, const cv::Mat& cv_img);
+#endif  // USE_OPENCV
+
+  inline int_tp num_entries() const { return num_entries_; }
+  inline uint_tp bytes() const { return bytes_; }
+  /// @brief Bytes used by all users of the cache.
+  uint_tp bytes_used() const;
+  /// @brief Images cached by all users of the cache.
+  int_tp entries_used() const;
+  /// @brief Lookups of this process since the last ResetCounters.
+  inline uint_tp hits() const { return hits_; }
+  inline uint_tp misses() const { return misses_; }
+  void ResetCounters();
+
+ private:
+  struct Header;
+  struct Entry;
+
+  // Entries the table is filled up to.
+  int_tp max_entries() const;
+
+  int_tp num_entries_;
+  uint_tp bytes_;
+  uint_tp mapped_size_;
+  int fd_;
+  char* memory_;
+  Header* header_;
+  Entry* entries_;
+  uint8_t* data_;
+  uint_tp hits_;
+  uint_tp misses_;
+
+  DISABLE_COPY_AND_ASSIGN(DecodedCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DECODED_CACHE_HPP_
@@ -0,0 +1,36 @@
+#ifndef CAFFE_UTIL_FOLD_LAYERS_HPP_
+#define CAFFE_UTIL_FOLD_LAYERS_HPP_
+
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Writes an inference version of a trained net to folded: BatchNorm
+ *        layers using their stored statistics are folded into the weights and
+ *        bias of the Convolution or InnerProduct layer before them, and ReLU
+ *        or PReLU layers after a Convolution are fused into its output.
+ *
+ * A layer is only folded if the blob between it and the layer before has no
+ * other consumer and the weights of the layer before are not shared. folded
+ * holds the weights and input shapes of net. Returns the number of layers
+ * removed.
+ */
+template <typename Dtype>
+int_tp FoldInferenceLayers(const Net<Dtype>& net, NetParameter* folded);
+
+/**
+ * @brief Runs a net and its folded version on the same inputs and returns
+ *        the largest absolute difference between their outputs.
+ *
+ * Net inputs are filled with uniform noise in [-1, 1]. The tops of the data
+ * layers at the start of folded are copied from net, so that both nets see
+ * the same batch.
+ */
+template <typename Dtype>
+Dtype VerifyFoldedNet(Net<Dtype>* net, Net<Dtype>* folded);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FOLD_LAYERS_HPP_
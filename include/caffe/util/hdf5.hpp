@@ -2,6 +2,7 @@
 #define CAFFE_UTIL_HDF5_H_
 
 #include <string>
+#include <vector>
 
 #include "hdf5.h"
 #include "hdf5_hl.h"
@@ -10,6 +11,21 @@
 
 namespace caffe {
 
+/**
+ * @brief Holds the lock that serializes all HDF5 calls of the process, as
+ *        the library is only thread safe when built so. The functions below
+ *        take it themselves; code calling the library directly holds one
+ *        for the sequence of calls. Locks nest on the same thread.
+ */
+class HDF5Lock {
+ public:
+  HDF5Lock();
+  ~HDF5Lock();
+
+ private:
+  DISABLE_COPY_AND_ASSIGN(HDF5Lock);
+};
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -25,6 +41,15 @@ void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob<Dtype>& blob,
     bool write_diff = false);
 
+// Reads the hyperslab of count elements per axis at offset, converted to
+// Dtype, without loading the rest of the dataset.
+template <typename Dtype>
+void hdf5_read_hyperslab(
+    hid_t dataset_id, const vector<hsize_t>& offset,
+    const vector<hsize_t>& count, Dtype* data);
+
+vector<hsize_t> hdf5_get_dataset_shape(hid_t dataset_id);
+
 int hdf5_load_int(hid_t loc_id, const string& dataset_name);
 void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i);
 string hdf5_load_string(hid_t loc_id, const string& dataset_name);
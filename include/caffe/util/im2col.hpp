@@ -30,6 +30,38 @@ void col2im_nd_cpu(const Dtype* data_col, const int_tp num_spatial_axes,
                    const int_tp* kernel_shape, const int_tp* pad,
                    const int_tp* stride, Dtype* data_im);
 
+template<typename Dtype>
+void im2col_sk_cpu(const Dtype* data_im, const int_tp channels,
+                   const int_tp height, const int_tp width,
+                   const int_tp kernel_h, const int_tp kernel_w,
+                   const int_tp pad_h, const int_tp pad_w,
+                   const int_tp stride_h, const int_tp stride_w,
+                   const int_tp kstride_h, const int_tp kstride_w,
+                   Dtype* data_col);
+
+template<typename Dtype>
+void col2im_sk_cpu(const Dtype* data_col, const int_tp channels,
+                   const int_tp height, const int_tp width,
+                   const int_tp patch_h, const int_tp patch_w,
+                   const int_tp pad_h, const int_tp pad_w,
+                   const int_tp stride_h, const int_tp stride_w,
+                   const int_tp kstride_h, const int_tp kstride_w,
+                   Dtype* data_im);
+
+template<typename Dtype>
+void im2col_ndsk_cpu(const Dtype* data_im, const int_tp num_spatial_axes,
+                     const int_tp* im_shape, const int_tp* col_shape,
+                     const int_tp* kernel_shape, const int_tp* pad,
+                     const int_tp* stride, const int_tp* kstride,
+                     Dtype* data_col);
+
+template<typename Dtype>
+void col2im_ndsk_cpu(const Dtype* data_col, const int_tp num_spatial_axes,
+                     const int_tp* im_shape, const int_tp* col_shape,
+                     const int_tp* kernel_shape, const int_tp* pad,
+                     const int_tp* stride, const int_tp* kstride,
+                     Dtype* data_im);
+
 template<typename Dtype>
 void im2col_gpu(const Dtype* data_im, const int_tp channels,
                 const int_tp height, const int_tp width, const int_tp kernel_h,
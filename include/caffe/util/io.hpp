@@ -74,6 +74,13 @@ inline void WriteProtoToBinaryFile(
 
 bool ReadFileToDatum(const string& filename, const int_tp label, Datum* datum);
 
+/**
+ * @brief Parses a serialized Datum without copying its data field, which is
+ *        returned as a view into serialized instead (NULL and 0 if absent).
+ */
+bool ParseDatumView(const char* serialized, int_tp size, Datum* datum,
+                    const char** data, int_tp* data_size);
+
 inline bool ReadFileToDatum(const string& filename, Datum* datum) {
   return ReadFileToDatum(filename, -1, datum);
 }
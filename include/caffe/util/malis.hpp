@@ -0,0 +1,46 @@
+#ifndef CAFFE_UTIL_MALIS_HPP_
+#define CAFFE_UTIL_MALIS_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "caffe/definitions.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Collects the edges of an affinity graph whose neighbor lies inside
+ *        the volume, sorted by decreasing affinity.
+ *
+ * The affinity graph is shaped (#edges, Z, Y, X) as given by conn_dims and
+ * nhood_data holds the (z, y, x) offset of every edge direction. Edges are
+ * stored as indices into conn_data. The sort is a parallel LSD radix sort
+ * on the bit patterns of the weights and is stable, so ties keep the order
+ * of the affinity array.
+ */
+template <typename Dtype>
+void malis_sort_edges(const Dtype* conn_data, const int_tp* conn_dims,
+                      const int_tp* nhood_data, std::vector<int64_t>* edges);
+
+/**
+ * @brief Computes the MALIS loss and its gradient for one affinity graph
+ *        from its edges sorted by malis_sort_edges.
+ *
+ * Runs Kruskal's algorithm over a flat union-find with path halving. Every
+ * set keeps a sorted array of (label, voxel count) pairs; sets that were
+ * never merged use their voxel's label directly and merged sets move the
+ * smaller array into the larger one. With pos set, pairs of voxels with the
+ * same label are counted on the maximin edge joining them, otherwise pairs
+ * with different labels. Adds the gradient to dloss_data, which must be
+ * zeroed by the caller.
+ */
+template <typename Dtype>
+void malis_loss_cpu(const Dtype* conn_data, const int_tp* conn_dims,
+                    const int_tp* nhood_data, const Dtype* seg_data,
+                    const std::vector<int64_t>& edges, const bool pos,
+                    Dtype* dloss_data, Dtype* loss_out, Dtype* classerr_out,
+                    Dtype* rand_index_out);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MALIS_HPP_
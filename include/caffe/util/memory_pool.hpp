@@ -0,0 +1,82 @@
+#ifndef CAFFE_UTIL_MEMORY_POOL_HPP_
+#define CAFFE_UTIL_MEMORY_POOL_HPP_
+
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+/**
+ Forward declare boost::mutex instead of including boost/thread.hpp
+ to avoid a boost/NVCC issues (#1009, #1010) on OSX.
+ */
+namespace boost { class mutex; }
+
+namespace caffe {
+
+/**
+ * @brief Caches freed memory blocks by size class, so that blobs which are
+ *        reshaped or recreated reuse earlier allocations instead of going
+ *        back to malloc, cudaMalloc or clCreateBuffer.
+ *
+ * The pool only does the bookkeeping: its owner allocates a block of
+ * SizeClass(size) bytes on a miss, and frees the blocks returned by Trim
+ * (or refused by Give). Blocks carry owner-defined flags, e.g. how a host
+ * block was allocated, and are only handed out again for the same flags.
+ * All methods are thread safe.
+ */
+class MemoryPool {
+ public:
+  struct Block {
+    void* ptr;
+    uint_tp size;
+    int_tp flags;
+  };
+
+  MemoryPool();
+  ~MemoryPool();
+
+  /**
+   * @brief Rounds size up to its size class: 64 bytes at least, above that
+   *        multiples of 64 bytes with four classes per power of two, so at
+   *        most 64 bytes or 25% are wasted.
+   */
+  static uint_tp SizeClass(uint_tp size);
+
+  /**
+   * @brief Returns a cached block of SizeClass(size) bytes with the given
+   *        flags, or NULL on a miss.
+   */
+  void* Take(uint_tp size, int_tp flags);
+  /**
+   * @brief Caches a block of SizeClass(size) bytes for reuse. Returns false,
+   *        and the caller has to free the block, if caching it would exceed
+   *        the limit.
+   */
+  bool Give(void* ptr, uint_tp size, int_tp flags);
+  /// @brief Empties the pool, returning the cached blocks to be freed.
+  vector<Block> Trim();
+
+  /// @brief Maximum number of bytes to keep cached; 0 disables caching.
+  void set_limit(uint_tp bytes);
+  uint_tp limit();
+
+  uint_tp hits();
+  uint_tp misses();
+  uint_tp bytes_cached();
+  void ResetCounters();
+
+ private:
+  std::map<uint_tp, vector<Block> > blocks_;
+  uint_tp limit_;
+  uint_tp hits_;
+  uint_tp misses_;
+  uint_tp bytes_cached_;
+  shared_ptr<boost::mutex> mutex_;
+
+DISABLE_COPY_AND_ASSIGN(MemoryPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MEMORY_POOL_HPP_
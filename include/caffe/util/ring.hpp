@@ -0,0 +1,101 @@
+#ifndef CAFFE_UTIL_RING_HPP_
+#define CAFFE_UTIL_RING_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Links one rank of a ring of processes to its neighbours: a rank
+ * sends to rank + 1 and receives from rank - 1, modulo the number of ranks.
+ */
+class RingTransport {
+ public:
+  virtual ~RingTransport() {}
+
+  // Sends send_bytes to the next rank while receiving recv_bytes from the
+  // previous one, so that ranks doing both at once do not block each other.
+  virtual void SendRecv(const void* send, uint_tp send_bytes, void* recv,
+                        uint_tp recv_bytes) = 0;
+
+  inline int rank() const { return rank_; }
+  inline int ranks() const { return ranks_; }
+
+  // Creates the transport for address, which is "shm:NAME" for ranks on one
+  // host, or "tcp:HOST:PORT,HOST:PORT,..." with the address of every rank.
+  static RingTransport* Create(const string& address, int rank, int ranks);
+
+ protected:
+  RingTransport(int rank, int ranks);
+
+  const int rank_;
+  const int ranks_;
+
+  DISABLE_COPY_AND_ASSIGN(RingTransport);
+};
+
+/**
+ * @brief Ring over POSIX shared memory. The link from rank r to rank r + 1
+ * is a single producer, single consumer byte queue in the segment NAME_r.
+ * Rank r replaces any segment left by an earlier run before creating its
+ * own, and removes it when it is done; rank r + 1 only attaches to a fresh
+ * segment.
+ */
+class ShmRingTransport : public RingTransport {
+ public:
+  ShmRingTransport(const string& name, int rank, int ranks,
+                   uint_tp capacity = 4 << 20);
+  virtual ~ShmRingTransport();
+
+  virtual void SendRecv(const void* send, uint_tp send_bytes, void* recv,
+                        uint_tp recv_bytes);
+
+ protected:
+  struct Link;
+  // Creates the segment of the link to the next rank.
+  Link* CreateLink(const string& name);
+  // Waits for the previous rank to create the segment of its link, and
+  // claims it.
+  Link* AttachLink(const string& name);
+
+  const uint_tp capacity_;
+  const uint_tp mapped_size_;
+  string send_name_;
+  Link* send_;
+  Link* recv_;
+};
+
+/**
+ * @brief Ring over TCP connections, one to the next rank and one from the
+ * previous rank.
+ */
+class TCPRingTransport : public RingTransport {
+ public:
+  // addresses holds "HOST:PORT" for every rank; a rank listens on its port.
+  TCPRingTransport(const vector<string>& addresses, int rank);
+  virtual ~TCPRingTransport();
+
+  virtual void SendRecv(const void* send, uint_tp send_bytes, void* recv,
+                        uint_tp recv_bytes);
+
+ protected:
+  int send_fd_;
+  int recv_fd_;
+};
+
+// Sums data over all ranks, leaving the sum on every rank. Each rank sends
+// and receives 2 * (ranks - 1) / ranks * count values, whatever the number
+// of ranks.
+template <typename Dtype>
+void ring_allreduce(RingTransport* transport, Dtype* data, uint_tp count);
+
+// Copies data of rank 0 to all ranks, pipelined in chunks along the ring.
+template <typename Dtype>
+void ring_broadcast(RingTransport* transport, Dtype* data, uint_tp count);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_RING_HPP_
@@ -56,6 +56,15 @@ class AffinityLayer : public Layer<Dtype> {
 
 /**
  * @brief Computes a connected components map from a segmentation map.
+ *
+ * Voxels with the same nonzero label that touch (see
+ * ConnectedComponentParameter.connectivity) form one component. Components
+ * are numbered in raster order of their first voxel, starting above the
+ * largest label of each (N, C) slice; background (0) stays 0. Works on 2D
+ * (N, C, H, W) and 3D (N, C, D, H, W) blobs with a union-find that runs in
+ * parallel over slices, or over blocks of rows/planes of a large slice.
+ * The union-find needs 4 bytes per voxel of a slice (8 above 2^32 voxels),
+ * 512 MB for a 512^3 volume on top of the bottom and top blobs.
  */
 template<typename Dtype>
 class ConnectedComponentLayer : public Layer<Dtype> {
@@ -90,7 +99,13 @@ class ConnectedComponentLayer : public Layer<Dtype> {
                               const vector<Blob<Dtype>*>& bottom);
 
  private:
-     cv::Mat FindBlobs(const int_tp maxlabel, const cv::Mat &input);
+  // Labels one slice; chunks > 1 splits it into blocks labeled in parallel.
+  template <typename Index>
+  void LabelSlice(const Dtype* data, const Dtype first_label,
+                  const int_tp chunks, Dtype* labels);
+
+  bool full_connectivity_;
+  int_tp depth_, height_, width_;
 };
 
 /**
@@ -167,11 +182,19 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   // we just called weight_cpu_gemm with the same input.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output,
                         bool skip_im2col = false);
+  // Adds the bias (unless NULL) and applies the fused ReLU in one pass.
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
                          Dtype* output);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Batched variants of forward_cpu_gemm and weight_cpu_gemm for batch
+  // consecutive images, each issuing a single GEMM per group.
+  // Use col_batch_size_ to pick batch; a batch of 1 is the per-image path.
+  void forward_cpu_gemm_batch(const Dtype* input, const Dtype* weights,
+                              Dtype* output, const int_tp batch);
+  void weight_cpu_gemm_batch(const Dtype* input, const Dtype* output,
+                             Dtype* weights, const int_tp batch);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const int_tp col_input_off,
@@ -187,6 +210,8 @@ class BaseConvolutionLayer : public Layer<Dtype> {
                        Dtype* weights);
   void backward_gpu_bias(Dtype* bias, const Dtype* input,
                          const int_tp input_off);
+  // Applies the fused ReLU to the tops, through an internal PReLULayer.
+  void forward_gpu_relu(const vector<Blob<Dtype>*>& top);
 
   shared_ptr< Blob<Dtype> > col_buffer();
 #endif
@@ -231,35 +256,81 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  /// @brief The number of images sharing one column buffer in CPU mode.
+  int_tp col_batch_size_;
+  /// @brief Whether a ReLU folded into the layer follows the bias.
+  bool fused_relu_;
+  /// @brief The negative slope of the fused ReLU for every output channel.
+  Blob<Dtype> fused_relu_slope_;
+#ifndef CPU_ONLY
+  shared_ptr<PReLULayer<Dtype> > fused_relu_layer_;
+#endif
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
   inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
-      im2col_cpu(data, conv_in_channels_,
-          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
-          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
-          pad_.cpu_data()[0], pad_.cpu_data()[1],
-          stride_.cpu_data()[0], stride_.cpu_data()[1], col_buff);
+      if (this->use_skernel_) {
+        im2col_sk_cpu(data, conv_in_channels_,
+            conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+            kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+            pad_.cpu_data()[0], pad_.cpu_data()[1],
+            stride_.cpu_data()[0], stride_.cpu_data()[1],
+            kstride_.cpu_data()[0], kstride_.cpu_data()[1], col_buff);
+      } else {
+        im2col_cpu(data, conv_in_channels_,
+            conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+            kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+            pad_.cpu_data()[0], pad_.cpu_data()[1],
+            stride_.cpu_data()[0], stride_.cpu_data()[1], col_buff);
+      }
     } else {
-      im2col_nd_cpu(data, num_spatial_axes_, conv_input_shape_.cpu_data(),
-          col_buffer_shape_.data(), kernel_shape_.cpu_data(),
-          pad_.cpu_data(), stride_.cpu_data(), col_buff);
+      if (this->use_skernel_) {
+        im2col_ndsk_cpu(data, num_spatial_axes_, conv_input_shape_.cpu_data(),
+            col_buffer_shape_.data(), kernel_shape_.cpu_data(),
+            pad_.cpu_data(), stride_.cpu_data(), kstride_.cpu_data(),
+            col_buff);
+      } else {
+        im2col_nd_cpu(data, num_spatial_axes_, conv_input_shape_.cpu_data(),
+            col_buffer_shape_.data(), kernel_shape_.cpu_data(),
+            pad_.cpu_data(), stride_.cpu_data(), col_buff);
+      }
     }
   }
   inline void conv_col2im_cpu(const Dtype* col_buff, Dtype* data) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
-      col2im_cpu(col_buff, conv_in_channels_,
-          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
-          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
-          pad_.cpu_data()[0], pad_.cpu_data()[1],
-          stride_.cpu_data()[0], stride_.cpu_data()[1], data);
+      if (this->use_skernel_) {
+        col2im_sk_cpu(col_buff, conv_in_channels_,
+            conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+            kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+            pad_.cpu_data()[0], pad_.cpu_data()[1],
+            stride_.cpu_data()[0], stride_.cpu_data()[1],
+            kstride_.cpu_data()[0], kstride_.cpu_data()[1], data);
+      } else {
+        col2im_cpu(col_buff, conv_in_channels_,
+            conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+            kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+            pad_.cpu_data()[0], pad_.cpu_data()[1],
+            stride_.cpu_data()[0], stride_.cpu_data()[1], data);
+      }
     } else {
-      col2im_nd_cpu(col_buff, num_spatial_axes_, conv_input_shape_.cpu_data(),
-          col_buffer_shape_.data(), kernel_shape_.cpu_data(),
-          pad_.cpu_data(), stride_.cpu_data(), data);
+      if (this->use_skernel_) {
+        col2im_ndsk_cpu(col_buff, num_spatial_axes_,
+            conv_input_shape_.cpu_data(), col_buffer_shape_.data(),
+            kernel_shape_.cpu_data(), pad_.cpu_data(), stride_.cpu_data(),
+            kstride_.cpu_data(), data);
+      } else {
+        col2im_nd_cpu(col_buff, num_spatial_axes_,
+            conv_input_shape_.cpu_data(), col_buffer_shape_.data(),
+            kernel_shape_.cpu_data(), pad_.cpu_data(), stride_.cpu_data(),
+            data);
+      }
     }
   }
+  // Lays out the column buffers of batch images side by side, so that row r
+  // of col_buff holds row r of the column buffer of every image.
+  void conv_im2col_batch_cpu(const Dtype* data, const int_tp batch,
+                             Dtype* col_buff);
 
 #ifndef CPU_ONLY
 #ifdef USE_CUDA
@@ -462,6 +533,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  // Column and output buffers holding col_batch_size_ images side by side.
+  Blob<Dtype> batch_col_buffer_;
+  Blob<Dtype> batch_output_buffer_;
 };
 
 
@@ -530,6 +604,87 @@ class DeconvolutionLayer : public BaseConvolutionLayer<Dtype> {
   virtual void compute_output_shape();
 };
 
+/**
+ * @brief Direct (im2col-free) CPU implementation of ConvolutionLayer.
+ *        Uses ConvolutionLayer for GPU mode.
+ *
+ * Convolves 1D, 2D and 3D inputs by accumulating whole output rows, blocked
+ * over several output channels so every input row that is loaded feeds more
+ * than one output. No column buffer is materialized, which saves the
+ * kernel_dim x out_spatial_dim buffer per image and the memory traffic of
+ * writing and re-reading it. This works best for small kernels (3x3, 3x3x3)
+ * where im2col expands the input the most relative to the GEMM work.
+ * Supports stride, pad, kstride and group.
+ */
+template <typename Dtype>
+class DirectConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit DirectConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+ private:
+  // Spatial geometry padded to three axes (depth, height, width).
+  void direct_geometry(int_tp* in_shape, int_tp* out_shape, int_tp* kernel,
+                       int_tp* pad, int_tp* stride, int_tp* kstride);
+};
+
+/**
+ * @brief Winograd F(m x m, 3 x 3) CPU implementation of ConvolutionLayer.
+ *        Uses ConvolutionLayer for GPU mode.
+ *
+ * The output is computed in m x m tiles (m = winograd_tile, 2 or 4). Input
+ * tiles and filters are transformed into an (m + 2) x (m + 2) domain where
+ * the convolution becomes an element-wise product, summed over the input
+ * channels with one GEMM per transformed element. The filter transform is
+ * computed in LayerSetUp and recomputed whenever the weights change.
+ *
+ * Only 2D, 3x3, stride 1 convolutions without kstride take this path; all
+ * other shapes, and the backward pass, use ConvolutionLayer.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), winograd_weights_memory_(),
+        winograd_weights_version_(0) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ private:
+  // Recomputes winograd_weights_ if blobs_[0] was written to, or replaced,
+  // since the last call.
+  void winograd_transform_weights();
+
+  bool use_winograd_;
+  int_tp tile_;
+  int_tp tiles_h_, tiles_w_;
+  // Transformed filters: group x (tile + 2)^2 x (num_output / group) x
+  // (channels / group).
+  Blob<Dtype> winograd_weights_;
+  // Memory and version of the weights winograd_weights_ was computed from.
+  // Holding the memory keeps its address from being reused by another one.
+  shared_ptr<SyncedMemory> winograd_weights_memory_;
+  uint_tp winograd_weights_version_;
+  // Transformed input tiles of one image: (tile + 2)^2 x channels x tiles.
+  Blob<Dtype> winograd_input_;
+  // Transformed output tiles of one image: (tile + 2)^2 x num_output x tiles.
+  Blob<Dtype> winograd_output_;
+};
+
 #ifdef USE_CUDNN
 /*
  * @brief cuDNN implementation of ConvolutionLayer.
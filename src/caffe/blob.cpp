@@ -154,6 +154,12 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template<typename Dtype>
+void Blob<Dtype>::ShareDataMemory(const shared_ptr<SyncedMemory>& data) {
+  CHECK_GE(data->size(), capacity_ * sizeof(Dtype));
+  data_ = data;
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int_tp> or Blob<uint_tp>.
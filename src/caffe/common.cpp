@@ -11,6 +11,8 @@
 #include "caffe/common.hpp"
 
 #include "caffe/device.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/memory_pool.hpp"
 #include "caffe/util/rng.hpp"
 
 #ifdef USE_GREENTEA
@@ -93,6 +95,19 @@ device *Caffe::GetCPUDevice() {
   return Get().cpu_device_.get();
 }
 
+MemoryPool& Caffe::host_memory_pool() {
+  // Never destroyed, so blobs freed during static destruction still work.
+  static MemoryPool* pool = new MemoryPool();
+  return *pool;
+}
+
+void Caffe::TrimMemoryPools() {
+  CaffeTrimHostPool();
+  for (int i = 0; i < Get().devices_.size(); ++i) {
+    Get().devices_[i]->TrimMemoryPool();
+  }
+}
+
 // Copy constructor for thread-local copy
 Caffe::Caffe(const Caffe &obj) {
   mode_ = obj.mode_;
@@ -100,6 +115,8 @@ Caffe::Caffe(const Caffe &obj) {
   cpu_device_ = obj.cpu_device_;
   root_solver_ = obj.root_solver_;
   solver_count_ = obj.solver_count_;
+  rank_ = obj.rank_;
+  rank_count_ = obj.rank_count_;
 
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
@@ -141,7 +158,9 @@ Caffe::Caffe()
 mode_(Caffe::CPU),
 default_device_(nullptr),
 solver_count_(1),
-root_solver_(true) {}
+root_solver_(true),
+rank_(0),
+rank_count_(1) {}
 
 Caffe::~Caffe() {}
 
@@ -199,7 +218,7 @@ Caffe::Caffe()
       mode_(Caffe::CPU),
       cpu_device_(new device(-1, -1, Backend::BACKEND_CPU)),
       default_device_(cpu_device_.get()),
-      solver_count_(1), root_solver_(true) {
+      solver_count_(1), root_solver_(true), rank_(0), rank_count_(1) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
 #ifdef USE_CUDA
@@ -1,5 +1,7 @@
 #include <boost/thread.hpp>
+#include <algorithm>
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -7,11 +9,34 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/data_reader.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
 
 namespace caffe {
 
 using boost::weak_ptr;
 
+// Parses the datum at the cursor into sample, see DatumSample.
+static void ReadDatum(db::Cursor* cursor, DatumSample* sample) {
+  Datum* datum = &sample->datum_;
+  sample->pixels_ = NULL;
+  if (cursor->views_persist()) {
+    // Parse in place, leaving raw pixels in the mapped page.
+    const char* data;
+    int_tp data_size;
+    CHECK(ParseDatumView(cursor->value_data(), cursor->value_size(), datum,
+                         &data, &data_size)) << "Could not parse datum";
+    if (data != NULL && datum->encoded()) {
+      datum->set_data(data, data_size);
+    } else if (data != NULL) {
+      CHECK_EQ(data_size, datum->channels() * datum->height()
+               * datum->width()) << "Datum size does not match its shape";
+      sample->pixels_ = data;
+    }
+  } else {
+    datum->ParseFromArray(cursor->value_data(), cursor->value_size());
+  }
+}
+
 map<const string, weak_ptr<DataReader::Body> > DataReader::bodies_;
 static boost::mutex bodies_mutex_;
 
@@ -44,17 +69,60 @@ DataReader::~DataReader() {
 DataReader::QueuePair::QueuePair(int_tp size) {
   // Initialize the free queue with requested number of datums
   for (int_tp i = 0; i < size; ++i) {
-    free_.push(new Datum());
+    free_.push(new DatumSample());
   }
 }
 
 DataReader::QueuePair::~QueuePair() {
-  Datum* datum;
-  while (free_.try_pop(&datum)) {
-    delete datum;
+  DatumSample* sample;
+  while (free_.try_pop(&sample)) {
+    delete sample;
   }
-  while (full_.try_pop(&datum)) {
-    delete datum;
+  while (full_.try_pop(&sample)) {
+    delete sample;
+  }
+}
+
+//
+
+DataReader::Shard::Shard(const LayerParameter& param, int_tp id)
+    : queue_pair_(
+        param.data_param().prefetch() * param.data_param().batch_size()),
+      param_(param),
+      id_(id) {
+  StartInternalThread(Caffe::Get().GetDefaultDevice());
+}
+
+DataReader::Shard::~Shard() {
+  StopInternalThread();
+}
+
+void DataReader::Shard::InternalThreadEntry() {
+  const int_tp shards = param_.data_param().shards();
+  std::ostringstream source;
+  source << param_.data_param().source() << "_" << id_;
+  shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
+  db->Open(source.str(), db::READ);
+  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  int_tp position = 0;
+  try {
+    while (!must_stop()) {
+      DatumSample* sample = queue_pair_.free_.pop();
+      ReadDatum(cursor.get(), sample);
+      // Datum k of shard s is datum k * shards + s of the unsharded source.
+      sample->index_ = position++ * shards + id_;
+      queue_pair_.full_.push(sample);
+
+      // go to the next iter
+      cursor->Next();
+      if (!cursor->valid()) {
+        DLOG(INFO) << "Restarting shard " << id_ << " from start.";
+        cursor->SeekToFirst();
+        position = 0;
+      }
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
   }
 }
 
@@ -62,7 +130,10 @@ DataReader::QueuePair::~QueuePair() {
 
 DataReader::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      new_queue_pairs_(),
+      index_(0),
+      next_shard_(0),
+      rank_count_(1) {
   StartInternalThread(Caffe::Get().GetDefaultDevice());
 }
 
@@ -71,12 +142,28 @@ DataReader::Body::~Body() {
 }
 
 void DataReader::Body::InternalThreadEntry() {
-  shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
-  db->Open(param_.data_param().source(), db::READ);
-  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  const int_tp shards = param_.data_param().shards();
+  CHECK_GT(shards, 0) << "shards must be positive";
+  shared_ptr<db::DB> db;
+  shared_ptr<db::Cursor> cursor;
+  if (shards == 1) {
+    db.reset(db::GetDB(param_.data_param().backend()));
+    db->Open(param_.data_param().source(), db::READ);
+    cursor.reset(db->NewCursor());
+  } else {
+    for (int_tp i = 0; i < shards; ++i) {
+      shards_.push_back(shared_ptr<Shard>(new Shard(param_, i)));
+    }
+  }
   vector<shared_ptr<QueuePair> > qps;
   try {
     int_tp solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
+    // In training, ranks take the datums of the source in turn, starting at
+    // their rank.
+    const int_tp rank = param_.phase() == TRAIN ? Caffe::rank() : 0;
+    rank_count_ = param_.phase() == TRAIN ? Caffe::rank_count() : 1;
+    CHECK_LT(rank, rank_count_);
+    skip(cursor.get(), rank);
 
     // To ensure deterministic runs, only start running once all solvers
     // are ready. But solvers need to peek on one item during initialization,
@@ -100,19 +187,64 @@ void DataReader::Body::InternalThreadEntry() {
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+  shards_.clear();
 }
 
 void DataReader::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
-  Datum* datum = qp->free_.pop();
-  // TODO deserialize in-place instead of copy?
-  datum->ParseFromString(cursor->value());
-  qp->full_.push(datum);
+  DatumSample* sample = qp->free_.pop();
+  try {
+    read(cursor, sample);
+  } catch (boost::thread_interrupted&) {
+    qp->free_.push(sample);
+    throw;
+  }
+  qp->full_.push(sample);
+  // Skip the datums of the other ranks.
+  skip(cursor, rank_count_ - 1);
+}
+
+void DataReader::Body::skip(db::Cursor* cursor, int_tp count) {
+  for (int_tp i = 0; i < count; ++i) {
+    read(cursor, NULL);
+  }
+}
+
+void DataReader::Body::read(db::Cursor* cursor, DatumSample* sample) {
+  if (!shards_.empty()) {
+    // Swap the datum out of the next shard's sample, whichever shard reader
+    // is ahead.
+    QueuePair& shard = shards_[next_shard_]->queue_pair_;
+    DatumSample* taken = shard.full_.pop();
+    // Shards of equal sizes all restart together, on the first shard.
+    // Otherwise a shard restarts early, and the order departs from the
+    // unsharded list from then on.
+    if (taken->index_ != index_ && !(next_shard_ == 0 && taken->index_ == 0)) {
+      LOG_FIRST_N(WARNING, 1) << "The shards of "
+          << param_.data_param().source()
+          << " have unequal sizes, so they are not read in list order";
+    }
+    index_ = taken->index_ + 1;
+    if (sample) {
+      sample->datum_.Swap(&taken->datum_);
+      std::swap(sample->pixels_, taken->pixels_);
+      sample->index_ = taken->index_;
+    }
+    shard.free_.push(taken);
+    next_shard_ = (next_shard_ + 1) % shards_.size();
+    return;
+  }
+  if (sample) {
+    ReadDatum(cursor, sample);
+    sample->index_ = index_;
+  }
+  ++index_;
 
   // go to the next iter
   cursor->Next();
   if (!cursor->valid()) {
     DLOG(INFO) << "Restarting data prefetching from start.";
     cursor->SeekToFirst();
+    index_ = 0;
   }
 }
 
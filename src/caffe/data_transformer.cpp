@@ -40,10 +40,70 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
   }
 }
 
+// Transforms one row of width pixels, read every stride elements from in,
+// to (pixel - mean) * scale, where the mean is either a row of the mean file
+// or a single value. The row is stored reversed if mirror. The branches are
+// taken once per row, leaving simple loops that are vectorized with OpenMP
+// simd; kStride > 0 makes the input stride a compile time constant.
+template<typename Dtype, typename Stype, int_tp kStride>
+static void transform_row_stride(const Stype* in, const int_tp stride,
+                                 const Dtype* mean_row, const Dtype mean_value,
+                                 const Dtype scale, const bool mirror,
+                                 const int_tp width, Dtype* out) {
+  const int_tp s = kStride > 0 ? kStride : stride;
+  Dtype* out_last = out + width - 1;
+  if (mean_row) {
+    if (mirror) {
+#pragma omp simd
+      for (int_tp w = 0; w < width; ++w) {
+        out_last[-w] = (static_cast<Dtype>(in[w * s]) - mean_row[w]) * scale;
+      }
+    } else {
+#pragma omp simd
+      for (int_tp w = 0; w < width; ++w) {
+        out[w] = (static_cast<Dtype>(in[w * s]) - mean_row[w]) * scale;
+      }
+    }
+  } else {
+    if (mirror) {
+#pragma omp simd
+      for (int_tp w = 0; w < width; ++w) {
+        out_last[-w] = (static_cast<Dtype>(in[w * s]) - mean_value) * scale;
+      }
+    } else {
+#pragma omp simd
+      for (int_tp w = 0; w < width; ++w) {
+        out[w] = (static_cast<Dtype>(in[w * s]) - mean_value) * scale;
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename Stype>
+static void transform_row(const Stype* in, const int_tp stride,
+                          const Dtype* mean_row, const Dtype mean_value,
+                          const Dtype scale, const bool mirror,
+                          const int_tp width, Dtype* out) {
+  switch (stride) {
+  case 1:
+    transform_row_stride<Dtype, Stype, 1>(in, stride, mean_row, mean_value,
+                                          scale, mirror, width, out);
+    break;
+  case 3:
+    transform_row_stride<Dtype, Stype, 3>(in, stride, mean_row, mean_value,
+                                          scale, mirror, width, out);
+    break;
+  default:
+    transform_row_stride<Dtype, Stype, 0>(in, stride, mean_row, mean_value,
+                                          scale, mirror, width, out);
+  }
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
+                                       const char* pixels,
                                        Dtype* transformed_data) {
-  const string& data = datum.data();
+  const char* data = pixels ? pixels : datum.data().data();
   const int_tp datum_channels = datum.channels();
   const int_tp datum_height = datum.height();
   const int_tp datum_width = datum.width();
@@ -52,19 +112,19 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
   const bool has_mean_file = param_.has_mean_file();
-  const bool has_uint8 = data.size() > 0;
+  const bool has_uint8 = pixels || datum.data().size() > 0;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(datum_channels, 0);
   CHECK_GE(datum_height, crop_size);
   CHECK_GE(datum_width, crop_size);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(datum_channels, data_mean_.channels());
     CHECK_EQ(datum_height, data_mean_.height());
     CHECK_EQ(datum_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
   if (has_mean_values) {
     CHECK(mean_values_.size() == 1 || mean_values_.size() == datum_channels)
@@ -96,45 +156,39 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     }
   }
 
-  Dtype datum_element;
-  int_tp top_index, data_index;
+  const uint8_t* uint8_data = reinterpret_cast<const uint8_t*>(data);
+  const float* float_data = datum.float_data().data();
   for (int_tp c = 0; c < datum_channels; ++c) {
+    const Dtype mean_value = has_mean_values ? mean_values_[c] : Dtype(0);
     for (int_tp h = 0; h < height; ++h) {
-      for (int_tp w = 0; w < width; ++w) {
-        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        if (has_uint8) {
-          datum_element =
-              static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-        } else {
-          datum_element = datum.float_data(data_index);
-        }
-        if (has_mean_file) {
-          transformed_data[top_index] = (datum_element - mean[data_index])
-              * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] = (datum_element - mean_values_[c])
-                * scale;
-          } else {
-            transformed_data[top_index] = datum_element * scale;
-          }
-        }
+      const int_tp data_index =
+          (c * datum_height + h_off + h) * datum_width + w_off;
+      const Dtype* mean_row = has_mean_file ? mean + data_index : NULL;
+      Dtype* top_row = transformed_data + (c * height + h) * width;
+      if (has_uint8) {
+        transform_row(uint8_data + data_index, 1, mean_row, mean_value,
+                      scale, do_mirror, width, top_row);
+      } else {
+        transform_row(float_data + data_index, 1, mean_row, mean_value,
+                      scale, do_mirror, width, top_row);
       }
     }
   }
 }
 
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const Datum& datum,
+                                       Blob<Dtype>* transformed_blob) {
+  Transform(datum, NULL, transformed_blob);
+}
 
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
+                                       const char* pixels,
                                        Blob<Dtype>* transformed_blob) {
   // If datum is encoded, decoded and transform the cv::image.
   if (datum.encoded()) {
+    CHECK(pixels == NULL) << "Encoded datum must hold its data";
 #ifdef USE_OPENCV
     CHECK(!(param_.force_color() && param_.force_gray()))
         << "cannot set both force_color and force_gray";
@@ -181,7 +235,7 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   }
 
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-  Transform(datum, transformed_data);
+  Transform(datum, pixels, transformed_data);
 }
 
 template<typename Dtype>
@@ -257,12 +311,12 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK_GE(img_height, crop_size);
   CHECK_GE(img_width, crop_size);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(img_channels, data_mean_.channels());
     CHECK_EQ(img_height, data_mean_.height());
     CHECK_EQ(img_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
   if (has_mean_values) {
     CHECK(mean_values_.size() == 1 || mean_values_.size() == img_channels)
@@ -300,36 +354,21 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK(cv_cropped_img.data);
 
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-  int_tp top_index;
+  const bool is_uint8 = cv_img.depth() == CV_8U;
   for (int_tp h = 0; h < height; ++h) {
     const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
-    int_tp img_index = 0;
-    for (int_tp w = 0; w < width; ++w) {
-      for (int_tp c = 0; c < img_channels; ++c) {
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        // int_tp top_index = (c * height + h) * width + w;
-        Dtype pixel;
-        if (cv_img.depth() == CV_8U) {
-          pixel = static_cast<Dtype>(ptr[img_index++]);
-        } else {
-          pixel = static_cast<Dtype>((reinterpret_cast<const float*>(ptr))
-                                     [img_index++]);
-        }
-        if (has_mean_file) {
-          int_tp mean_index = (c * img_height + h_off + h) * img_width + w_off
-              + w;
-          transformed_data[top_index] = (pixel - mean[mean_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] = (pixel - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = pixel * scale;
-          }
-        }
+    for (int_tp c = 0; c < img_channels; ++c) {
+      // The pixels of the image are interleaved, the blob is planar.
+      const Dtype mean_value = has_mean_values ? mean_values_[c] : Dtype(0);
+      const Dtype* mean_row = has_mean_file ?
+          mean + (c * img_height + h_off + h) * img_width + w_off : NULL;
+      Dtype* top_row = transformed_data + (c * height + h) * width;
+      if (is_uint8) {
+        transform_row(ptr + c, img_channels, mean_row, mean_value, scale,
+                      do_mirror, width, top_row);
+      } else {
+        transform_row(reinterpret_cast<const float*>(ptr) + c, img_channels,
+                      mean_row, mean_value, scale, do_mirror, width, top_row);
       }
     }
   }
@@ -21,12 +21,14 @@ namespace caffe {
 
 device::device()
     : current_queue_id_(0), workgroup_sizes_(3, 0), id_(0), list_id_(0),
-      backend_(Backend::BACKEND_CPU), memory_usage_(0), peak_memory_usage_(0) {
+      backend_(Backend::BACKEND_CPU), memory_usage_(0), peak_memory_usage_(0),
+      memory_pool_(new MemoryPool()) {
 }
 
 device::device(int id, int list_id, Backend backend)
     : current_queue_id_(0), workgroup_sizes_(3, 0), id_(id), list_id_(list_id),
-      backend_(backend), memory_usage_(0), peak_memory_usage_(0) {
+      backend_(backend), memory_usage_(0), peak_memory_usage_(0),
+      memory_pool_(new MemoryPool()) {
 }
 
 void device::Init() {
@@ -163,6 +165,109 @@ void device::ResetPeakMemoryUsage() {
   peak_memory_usage_ = memory_usage_;
 }
 
+void* device::MallocMemory(uint_tp size) {
+  const uint_tp bytes = MemoryPool::SizeClass(size);
+  void* ptr = memory_pool_->Take(bytes, 0);
+  if (ptr) {
+    return ptr;
+  }
+  ptr = AllocateMemory(bytes);
+  if (!ptr) {
+    // The cached blocks of other sizes may hold the memory we need.
+    LOG(INFO) << "Device " << id_ << " is out of memory for " << bytes
+              << " bytes, releasing the memory pool";
+    TrimMemoryPool();
+    ptr = AllocateMemory(bytes);
+  }
+  CHECK(ptr) << "Device memory allocation of size " << bytes << " failed.";
+  IncreaseMemoryUsage(bytes);
+  return ptr;
+}
+
+void* device::AllocateMemory(uint_tp bytes) {
+  void* ptr = NULL;
+#ifndef CPU_ONLY
+  if (backend_ == BACKEND_CUDA) {
+#ifdef USE_CUDA
+    const cudaError_t err = cudaMalloc(&ptr, bytes);
+    if (err == cudaErrorMemoryAllocation) {
+      // Clear the error, so that the next call does not report it.
+      cudaGetLastError();
+      return NULL;
+    }
+    CUDA_CHECK(err);
+#endif  // USE_CUDA
+  } else {
+#ifdef USE_GREENTEA
+    viennacl::ocl::context &ctx = viennacl::ocl::get_context(id_);
+    cl_int err;
+    if (ctx.devices()[0].type() == CL_DEVICE_TYPE_CPU) {
+      ptr = clCreateBuffer(ctx.handle().get(),
+                           CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                           bytes, nullptr, &err);
+    } else {
+      ptr = clCreateBuffer(ctx.handle().get(), CL_MEM_READ_WRITE,
+                           bytes, nullptr, &err);
+    }
+    if (err == CL_MEM_OBJECT_ALLOCATION_FAILURE
+        || err == CL_OUT_OF_RESOURCES || err == CL_OUT_OF_HOST_MEMORY) {
+      return NULL;
+    }
+    CHECK_EQ(0, err) << "OpenCL buffer allocation of size "
+                     << bytes << " failed.";
+#endif  // USE_GREENTEA
+  }
+#else
+  NO_GPU;
+#endif  // !CPU_ONLY
+  return ptr;
+}
+
+void device::FreeMemory(void* ptr, uint_tp size) {
+  const uint_tp bytes = MemoryPool::SizeClass(size);
+#ifdef USE_GREENTEA
+  if (backend_ == BACKEND_OpenCL) {
+    // Kernels on other queues may still use the buffer.
+    viennacl::ocl::get_context(id_).get_queue().finish();
+  }
+#endif  // USE_GREENTEA
+  if (!memory_pool_->Give(ptr, bytes, 0)) {
+    ReleaseMemory(ptr, bytes);
+  }
+}
+
+void device::ReleaseMemory(void* ptr, uint_tp bytes) {
+#ifndef CPU_ONLY
+  if (backend_ == BACKEND_CUDA) {
+#ifdef USE_CUDA
+    // The memory belongs to this device, not necessarily the current one.
+    int initial_device;
+    cudaGetDevice(&initial_device);
+    cudaSetDevice(id_);
+    cudaFree(ptr);
+    cudaSetDevice(initial_device);
+#endif  // USE_CUDA
+  } else {
+#ifdef USE_GREENTEA
+    CHECK_EQ(CL_SUCCESS, clReleaseMemObject(static_cast<cl_mem>(ptr)))
+        << "OpenCL memory corruption";
+#endif  // USE_GREENTEA
+  }
+#endif  // !CPU_ONLY
+  DecreaseMemoryUsage(bytes);
+}
+
+void device::TrimMemoryPool() {
+  vector<MemoryPool::Block> blocks = memory_pool_->Trim();
+  for (int_tp i = 0; i < blocks.size(); ++i) {
+    ReleaseMemory(blocks[i].ptr, blocks[i].size);
+  }
+}
+
+MemoryPool& device::memory_pool() {
+  return *memory_pool_;
+}
+
 bool device::CheckCapability(std::string cap) {
   if (backend_ == BACKEND_OpenCL) {
 #ifdef USE_GREENTEA
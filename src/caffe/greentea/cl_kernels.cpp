@@ -30,6 +30,7 @@ std::string pooling_nd_float = "#ifndef __OPENCL_VERSION__\n#include \"header.cl
 std::string pooling_sk_float = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(max_pool_forward_sk,Dtype)(const int_tp nthreads,\n__global Dtype* bottom_data,\n                                                  const int_tp num,\n                                                  const int_tp channels,\n                                                  const int_tp height,\n                                                  const int_tp width,\n                                                  const int_tp pooled_height,\n                                                  const int_tp pooled_width,\n                                                  const int_tp kernel_h,\n                                                  const int_tp kernel_w,\n                                                  const int_tp ext_kernel_h,\n                                                  const int_tp ext_kernel_w,\n                                                  const int_tp stride_h,\n                                                  const int_tp stride_w,\n                                                  const int_tp kstride_h,\n                                                  const int_tp kstride_w,\n                                                  const int_tp pad_h,\n                                                  const int_tp pad_w,\n                                                  __global Dtype* top_data,\n                                                  const int use_mask,\n                                                  __global int_tp* mask,\n                                                  __global Dtype* top_mask) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h - pad_h;\n    int_tp wstart = pw * stride_w - pad_w;\n    int_tp hend = min(hstart + ext_kernel_h, height);\n    int_tp wend = min(wstart + ext_kernel_w, width);\n    hstart = max(hstart, (int_tp) 0);\n    wstart = max(wstart, (int_tp) 0);\n    Dtype maxval = -FLT_MAX;\n    int_tp maxidx = -1;\n    __global Dtype* bottom_data_ptr = bottom_data\n        + (n * channels + c) * height * width;\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        if (bottom_data_ptr[h * width + w] > maxval) {\n          maxidx = h * width + w;\n          maxval = bottom_data_ptr[maxidx];\n        }\n      }\n    }\n    top_data[index] = maxval;\n    if (use_mask == 1) {\n      mask[index] = maxidx;\n    } else {\n      top_mask[index] = maxidx;\n    }\n  }\n}\n\n__kernel void TEMPLATE(max_pool_backward_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* top_diff, const int use_mask,\n    __global const int_tp* mask, __global const Dtype* top_mask, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w, const int_tp pad_h, const int_tp pad_w,\n    __global Dtype* bottom_diff) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n\n    __global const int_tp* mask_ptr = mask;\n    __global const Dtype* top_diff_ptr = top_diff;\n\n// find out the local index\n// find out the local offset\n    int_tp w = index % width;\n    int_tp h = (index / width) % height;\n    int_tp c = (index / width / height) % channels;\n    int_tp n = index / width / height / channels;\n\n    int_tp pooled_height_1 = pooled_height - 1;\n    int_tp pooled_width_1 = pooled_width - 1;\n    int_tp phstart = (h < ext_kernel_h) ? h % kstride_h : (h - ext_kernel_h) + 1;\n    int_tp phend =\n        (h >= pooled_height) ?\n            pooled_height_1 - (pooled_height_1 - phstart) % kstride_h : h;\n    int_tp pwstart = (w < ext_kernel_w) ? w % kstride_w : (w - ext_kernel_w) + 1;\n    int_tp pwend =\n        (w >= pooled_width) ?\n            pooled_width_1 - (pooled_width_1 - pwstart) % kstride_w : w;\n\n    Dtype gradient = 0;\n    int_tp offset = (n * channels + c) * pooled_height * pooled_width;\n    top_diff_ptr += offset;\n    if (use_mask == 1) {\n      mask_ptr += offset;\n      for (int_tp ph = phstart; ph <= phend; ph += kstride_h) {\n        for (int_tp pw = pwstart; pw <= pwend; pw += kstride_w) {\n          if (mask_ptr[ph * pooled_width + pw] == h * width + w) {\n            gradient += top_diff_ptr[ph * pooled_width + pw];\n          }\n        }\n      }\n    } else {\n      for (int_tp ph = phstart; ph <= phend; ph += kstride_h) {\n        for (int_tp pw = pwstart; pw <= pwend; pw += kstride_w) {\n          if (top_mask[ph * pooled_width + pw] == h * width + w) {\n            gradient += top_diff_ptr[ph * pooled_width + pw];\n          }\n        }\n      }\n    }\n    bottom_diff[index] = gradient;\n  }\n}\n\n__kernel void TEMPLATE(ave_pool_forward_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* bottom_data, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w, const int_tp pad_h, const int_tp pad_w,\n    __global Dtype* top_data) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h - pad_h;\n    int_tp wstart = pw * stride_w - pad_w;\n    int_tp hend = min(hstart + ext_kernel_h, height + pad_h);\n    int_tp wend = min(wstart + ext_kernel_w, width + pad_w);\n    hstart = max(hstart, 0L);\n    wstart = max(wstart, 0L);\n    hend = min(hend, height);\n    wend = min(wend, width);\n    Dtype aveval = 0;\n    __global const Dtype* bottom_data_ptr = bottom_data;\n    bottom_data_ptr += (n * channels + c) * height * width;\n    int_tp pool_size = 0;\n    for (int_tp h = hstart; h < hend; ++h) {\n      for (int_tp w = wstart; w < wend; ++w) {\n        aveval += bottom_data_ptr[h * width + w];\n        ++pool_size;\n      }\n    }\n    top_data[index] = aveval / pool_size;\n  }\n}\n\n__kernel void TEMPLATE(sto_pool_forward_train_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* bottom_data, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w, __global Dtype* rand_idx,\n    __global Dtype* top_data) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h;\n    int_tp hend = min(hstart + ext_kernel_h, height);\n    int_tp wstart = pw * stride_w;\n    int_tp wend = min(wstart + ext_kernel_w, width);\n    Dtype cumsum = 0.;\n    __global const Dtype* bottom_data_ptr = bottom_data;\n    bottom_data_ptr += (n * channels + c) * height * width;\n    // First pass: get sum\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        cumsum += bottom_data_ptr[h * width + w];\n      }\n    }\n    float thres = rand_idx[index] * cumsum;\n    // Second pass: get value, and set index.\n    cumsum = 0;\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        cumsum += bottom_data_ptr[h * width + w];\n        if (cumsum >= thres) {\n          rand_idx[index] = ((n * channels + c) * height + h) * width + w;\n          top_data[index] = bottom_data_ptr[h * width + w];\n          h = hend;\n          w = wend;\n        }\n      }\n    }\n  }\n}\n\n__kernel void TEMPLATE(sto_pool_forward_test_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* bottom_data, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w,\n    __global Dtype* top_data) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h;\n    int_tp hend = min(hstart + ext_kernel_h, height);\n    int_tp wstart = pw * stride_w;\n    int_tp wend = min(wstart + ext_kernel_w, width);\n    // We set cumsum to be 0 to avoid divide-by-zero problems\n    Dtype cumsum = FLT_MIN;\n    Dtype cumvalues = 0.;\n    __global const Dtype* bottom_data_ptr = bottom_data;\n    bottom_data_ptr += (n * channels + c) * height * width;\n    // First pass: get sum\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        cumsum += bottom_data_ptr[h * width + w];\n        cumvalues += bottom_data_ptr[h * width + w]\n            * bottom_data_ptr[h * width + w];\n      }\n    }\n    top_data[index] = cumvalues / cumsum;\n  }\n\n}";  // NOLINT
 std::string slice_float = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(slice,Dtype)(const int_tp nthreads,\n                                    __global const Dtype* in_data,\n                                    const int forward, const int_tp num_slices,\n                                    const int_tp slice_size,\n                                    const int_tp bottom_slice_axis,\n                                    const int_tp top_slice_axis,\n                                    const int_tp offset_slice_axis,\n                                    __global Dtype* out_data) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    const int_tp total_slice_size = slice_size * top_slice_axis;\n    const int_tp slice_num = index / total_slice_size;\n    const int_tp slice_index = index % total_slice_size;\n    const int_tp bottom_index = slice_index\n        + (slice_num * bottom_slice_axis + offset_slice_axis) * slice_size;\n    if (forward == 1) {\n      out_data[index] = in_data[bottom_index];\n    } else {\n      out_data[bottom_index] = in_data[index];\n    }\n  }\n}";  // NOLINT
 std::string softmax_loss_float = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(softmax_loss_forward,Dtype)(\n    int_tp n, __global const Dtype* prob_data, __global const Dtype* label,\n    __global Dtype* loss,\n    const int_tp num, const int_tp dim, const int_tp spatial_dim,\n    const int has_ignore_label_, const int_tp ignore_label_,\n    __global Dtype* counts) {\n\n  for (int_tp index = get_global_id(0); index < n;\n      index += get_global_size(0)) {\n    const int_tp n = index / spatial_dim;\n    const int_tp s = index % spatial_dim;\n    const int_tp label_value = (int_tp) (label[n * spatial_dim + s]);\n    if (has_ignore_label_ == 1 && label_value == ignore_label_) {\n      loss[index] = 0;\n      counts[index] = 0;\n    } else {\n      loss[index] = -log(\n          max((Dtype) (prob_data[n * dim + label_value * spatial_dim + s]),\n              (Dtype) FLT_MIN));\n      counts[index] = 1;\n    }\n  }\n}\n\n__kernel void TEMPLATE(softmax_loss_backward,Dtype)(const int_tp nthreads,\n                                                    __global const Dtype* top,\n                                                    __global const Dtype* label,\n                                                    __global Dtype* bottom_diff,\n                                                    const int_tp num,\n                                                    const int_tp dim,\n                                                    const int_tp spatial_dim,\n                                                    const int has_ignore_label_,\n                                                    const int_tp ignore_label_,\n                                                    __global Dtype* counts) {\n\n  const int_tp channels = dim / spatial_dim;\n\n  for (int_tp index = get_global_id(0); index < nthreads; index +=\n      get_global_size(0)) {\n    {\n      const int_tp n = index / spatial_dim;\n      const int_tp s = index % spatial_dim;\n      const int_tp label_value = (int_tp) (label[n * spatial_dim + s]);\n\n      if (has_ignore_label_ == 1 && label_value == ignore_label_) {\n        for (int_tp c = 0; c < channels; ++c) {\n          bottom_diff[n * dim + c * spatial_dim + s] = 0;\n        }\n        counts[index] = 0;\n      } else {\n        bottom_diff[n * dim + label_value * spatial_dim + s] -= 1;\n        counts[index] = 1;\n      }\n    }\n  }\n}";  // NOLINT
+std::string solvers_float = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n// Fused solver updates. Each kernel scales the gradient g for iter_size,\n// adds the L2 and L1 weight decay of the parameter w, updates the history,\n// and leaves the update value in g after subtracting it from w.\n\n__kernel void TEMPLATE(sgd_update,Dtype)(const int_tp n, __global Dtype* w,\n                                         __global Dtype* g,\n                                         __global Dtype* h,\n                                         const Dtype scale,\n                                         const Dtype l2_decay,\n                                         const Dtype l1_decay,\n                                         const Dtype momentum,\n                                         const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = momentum * h[i] + local_rate * gi;\n    h[i] = hi;\n    g[i] = hi;\n    w[i] = wi - hi;\n  }\n}\n\n__kernel void TEMPLATE(nesterov_update,Dtype)(const int_tp n,\n                                              __global Dtype* w,\n                                              __global Dtype* g,\n                                              __global Dtype* h,\n                                              const Dtype scale,\n                                              const Dtype l2_decay,\n                                              const Dtype l1_decay,\n                                              const Dtype momentum,\n                                              const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi_old = h[i];\n    const Dtype hi = momentum * hi_old + local_rate * gi;\n    const Dtype ui = ((Dtype)1 + momentum) * hi - momentum * hi_old;\n    h[i] = hi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}\n\n__kernel void TEMPLATE(adagrad_update,Dtype)(const int_tp n,\n                                             __global Dtype* w,\n                                             __global Dtype* g,\n                                             __global Dtype* h,\n                                             const Dtype scale,\n                                             const Dtype l2_decay,\n                                             const Dtype l1_decay,\n                                             const Dtype delta,\n                                             const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = h[i] + gi * gi;\n    const Dtype ui = local_rate * (gi / (sqrt(hi) + delta));\n    h[i] = hi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}\n\n__kernel void TEMPLATE(rmsprop_update,Dtype)(const int_tp n,\n                                             __global Dtype* w,\n                                             __global Dtype* g,\n                                             __global Dtype* h,\n                                             const Dtype scale,\n                                             const Dtype l2_decay,\n                                             const Dtype l1_decay,\n                                             const Dtype rms_decay,\n                                             const Dtype delta,\n                                             const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = rms_decay * h[i] + ((Dtype)1 - rms_decay) * gi * gi;\n    const Dtype ui = local_rate * (gi / (sqrt(hi) + delta));\n    h[i] = hi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}\n\n__kernel void TEMPLATE(adadelta_update,Dtype)(const int_tp n,\n                                              __global Dtype* w,\n                                              __global Dtype* g,\n                                              __global Dtype* h,\n                                              __global Dtype* h2,\n                                              const Dtype scale,\n                                              const Dtype l2_decay,\n                                              const Dtype l1_decay,\n                                              const Dtype momentum,\n                                              const Dtype delta,\n                                              const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = momentum * h[i] + ((Dtype)1 - momentum) * gi * gi;\n    const Dtype ui = gi * sqrt((h2[i] + delta) / (hi + delta));\n    h[i] = hi;\n    h2[i] = momentum * h2[i] + ((Dtype)1 - momentum) * ui * ui;\n    g[i] = local_rate * ui;\n    w[i] = wi - local_rate * ui;\n  }\n}\n\n__kernel void TEMPLATE(adam_update,Dtype)(const int_tp n, __global Dtype* w,\n                                          __global Dtype* g,\n                                          __global Dtype* m,\n                                          __global Dtype* v,\n                                          const Dtype scale,\n                                          const Dtype l2_decay,\n                                          const Dtype l1_decay,\n                                          const Dtype beta1,\n                                          const Dtype beta2,\n                                          const Dtype eps_hat,\n                                          const Dtype corrected_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype mi = beta1 * m[i] + ((Dtype)1 - beta1) * gi;\n    const Dtype vi = beta2 * v[i] + ((Dtype)1 - beta2) * gi * gi;\n    const Dtype ui = corrected_rate * (mi / (sqrt(vi) + eps_hat));\n    m[i] = mi;\n    v[i] = vi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}";  // NOLINT
 std::string tile_float = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n\n__kernel void TEMPLATE(tile,Dtype)(const int_tp nthreads, __global const Dtype* bottom_data,\n                                   const int_tp tile_size, const int_tp num_tiles,\n                                   const int_tp bottom_tile_axis,\n                                   __global Dtype* top_data) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    const int_tp d = index % tile_size;\n    const int_tp b = (index / tile_size / num_tiles) % bottom_tile_axis;\n    const int_tp n = index / tile_size / num_tiles / bottom_tile_axis;\n    const int_tp bottom_index = (n * bottom_tile_axis + b) * tile_size + d;\n    top_data[index] = bottom_data[bottom_index];\n  }\n}\n\n\n__kernel void TEMPLATE(tile_backward,Dtype)(const int_tp nthreads,\n                                            __global const Dtype* top_diff,\n                                            const int_tp tile_size,\n                                            const int_tp num_tiles,\n                                            const int_tp bottom_tile_axis,\n                                            __global Dtype* bottom_diff) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    const int_tp d = index % tile_size;\n    const int_tp b = (index / tile_size) % bottom_tile_axis;\n    const int_tp n = index / tile_size / bottom_tile_axis;\n    bottom_diff[index] = 0;\n    int_tp top_index = (n * num_tiles * bottom_tile_axis + b) * tile_size + d;\n    for (int_tp t = 0; t < num_tiles; ++t) {\n      bottom_diff[index] += top_diff[top_index];\n      top_index += bottom_tile_axis * tile_size;\n    }\n  }\n}";  // NOLINT
 std::string activation_double = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(relu_forward,Dtype)(const int_tp n,\n                                           __global const Dtype* in,\n                                           __global Dtype* out,\n                                           Dtype negative_slope) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    out[index] = in[index] > 0 ? in[index] : in[index] * negative_slope;\n  }\n}\n\n__kernel void TEMPLATE(relu_backward,Dtype)(const int_tp n,\n                                            __global const Dtype* in_diff,\n                                            __global const Dtype* in_data,\n                                            __global Dtype* out_diff,\n                                            Dtype negative_slope) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    out_diff[index] = in_diff[index]\n        * ((in_data[index] > 0) + (in_data[index] <= 0) * negative_slope);\n  }\n}\n\n__kernel void TEMPLATE(tanh_forward,Dtype)(const int_tp n,\n                                           __global const Dtype* in,\n                                           __global Dtype* out) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    out[index] = tanh(in[index]);\n  }\n}\n\n__kernel void TEMPLATE(tanh_backward,Dtype)(const int_tp n,\n                                            __global const Dtype* in_diff,\n                                            __global const Dtype* out_data,\n                                            __global Dtype* out_diff) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    Dtype tanhx = out_data[index];\n    out_diff[index] = in_diff[index] * (1 - tanhx * tanhx);\n  }\n}\n\n__kernel void TEMPLATE(sigmoid_forward,Dtype)(const int_tp n,\n                                              __global const Dtype* in,\n                                              __global Dtype* out) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    out[index] = 1. / (1. + exp(-in[index]));\n  }\n}\n\n__kernel void TEMPLATE(sigmoid_backward,Dtype)(const int_tp n,\n                                               __global const Dtype* in_diff,\n                                               __global const Dtype* out_data,\n                                               __global Dtype* out_diff) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    const Dtype sigmoid_x = out_data[index];\n    out_diff[index] = in_diff[index] * sigmoid_x * (1 - sigmoid_x);\n  }\n}\n\n__kernel void TEMPLATE(threshold,Dtype)(const int_tp n, const Dtype threshold,\n                                        __global const Dtype* in,\n                                        __global Dtype* out) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    out[index] = in[index] > threshold ? 1 : 0;\n  }\n}\n\n__kernel void TEMPLATE(prelu_forward,Dtype)(const int_tp n, const int_tp channels,\n                                            const int_tp dim,\n                                            __global const Dtype* in,\n                                            __global Dtype* out,\n                                            __global const Dtype* slope_data,\n                                            const int_tp div_factor) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    int_tp c = (index / dim) % channels / div_factor;\n    out[index] = in[index] > 0 ? in[index] : in[index] * slope_data[c];\n  }\n}\n\n__kernel void TEMPLATE(prelu_backward,Dtype)(const int_tp n, const int_tp channels,\n                                             const int_tp dim,\n                                             __global const Dtype* in_diff,\n                                             __global const Dtype* in_data,\n                                             __global Dtype* out_diff,\n                                             __global const Dtype* slope_data,\n                                             const int_tp div_factor) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    int_tp c = (index / dim) % channels / div_factor;\n    out_diff[index] = in_diff[index]\n        * ((in_data[index] > 0) + (in_data[index] <= 0) * slope_data[c]);\n  }\n}\n\n__kernel void TEMPLATE(prelu_param_backward,Dtype)(const int_tp n, const int_tp rows,\n                                                   const int_tp rowPitch,\n                                                   __global const Dtype* in_diff,\n                                                   __global const Dtype* in_data,\n                                                   __global Dtype* out_diff) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    out_diff[index] = in_diff[index] * in_data[index] * (in_data[index] <= 0);\n    for (int k = 1; k < rows; k++) {\n      out_diff[index] += in_diff[index + k * rowPitch]\n          * in_data[index + k * rowPitch]\n          * (in_data[index + k * rowPitch] <= 0);\n    }\n  }\n}";  // NOLINT
 std::string auxiliary_double = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(gpu_set,Dtype)(const int_tp n, const Dtype alpha, __global Dtype* y) {\n  for (int_tp index = get_global_id(0); index < n; index += get_global_size(0)) {\n    y[index] = alpha;\n  }\n}";  // NOLINT
@@ -54,6 +55,7 @@ std::string pooling_nd_double = "#ifndef __OPENCL_VERSION__\n#include \"header.c
 std::string pooling_sk_double = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(max_pool_forward_sk,Dtype)(const int_tp nthreads,\n__global Dtype* bottom_data,\n                                                  const int_tp num,\n                                                  const int_tp channels,\n                                                  const int_tp height,\n                                                  const int_tp width,\n                                                  const int_tp pooled_height,\n                                                  const int_tp pooled_width,\n                                                  const int_tp kernel_h,\n                                                  const int_tp kernel_w,\n                                                  const int_tp ext_kernel_h,\n                                                  const int_tp ext_kernel_w,\n                                                  const int_tp stride_h,\n                                                  const int_tp stride_w,\n                                                  const int_tp kstride_h,\n                                                  const int_tp kstride_w,\n                                                  const int_tp pad_h,\n                                                  const int_tp pad_w,\n                                                  __global Dtype* top_data,\n                                                  const int use_mask,\n                                                  __global int_tp* mask,\n                                                  __global Dtype* top_mask) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h - pad_h;\n    int_tp wstart = pw * stride_w - pad_w;\n    int_tp hend = min(hstart + ext_kernel_h, height);\n    int_tp wend = min(wstart + ext_kernel_w, width);\n    hstart = max(hstart, (int_tp) 0);\n    wstart = max(wstart, (int_tp) 0);\n    Dtype maxval = -FLT_MAX;\n    int_tp maxidx = -1;\n    __global Dtype* bottom_data_ptr = bottom_data\n        + (n * channels + c) * height * width;\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        if (bottom_data_ptr[h * width + w] > maxval) {\n          maxidx = h * width + w;\n          maxval = bottom_data_ptr[maxidx];\n        }\n      }\n    }\n    top_data[index] = maxval;\n    if (use_mask == 1) {\n      mask[index] = maxidx;\n    } else {\n      top_mask[index] = maxidx;\n    }\n  }\n}\n\n__kernel void TEMPLATE(max_pool_backward_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* top_diff, const int use_mask,\n    __global const int_tp* mask, __global const Dtype* top_mask, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w, const int_tp pad_h, const int_tp pad_w,\n    __global Dtype* bottom_diff) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n\n    __global const int_tp* mask_ptr = mask;\n    __global const Dtype* top_diff_ptr = top_diff;\n\n// find out the local index\n// find out the local offset\n    int_tp w = index % width;\n    int_tp h = (index / width) % height;\n    int_tp c = (index / width / height) % channels;\n    int_tp n = index / width / height / channels;\n\n    int_tp pooled_height_1 = pooled_height - 1;\n    int_tp pooled_width_1 = pooled_width - 1;\n    int_tp phstart = (h < ext_kernel_h) ? h % kstride_h : (h - ext_kernel_h) + 1;\n    int_tp phend =\n        (h >= pooled_height) ?\n            pooled_height_1 - (pooled_height_1 - phstart) % kstride_h : h;\n    int_tp pwstart = (w < ext_kernel_w) ? w % kstride_w : (w - ext_kernel_w) + 1;\n    int_tp pwend =\n        (w >= pooled_width) ?\n            pooled_width_1 - (pooled_width_1 - pwstart) % kstride_w : w;\n\n    Dtype gradient = 0;\n    int_tp offset = (n * channels + c) * pooled_height * pooled_width;\n    top_diff_ptr += offset;\n    if (use_mask == 1) {\n      mask_ptr += offset;\n      for (int_tp ph = phstart; ph <= phend; ph += kstride_h) {\n        for (int_tp pw = pwstart; pw <= pwend; pw += kstride_w) {\n          if (mask_ptr[ph * pooled_width + pw] == h * width + w) {\n            gradient += top_diff_ptr[ph * pooled_width + pw];\n          }\n        }\n      }\n    } else {\n      for (int_tp ph = phstart; ph <= phend; ph += kstride_h) {\n        for (int_tp pw = pwstart; pw <= pwend; pw += kstride_w) {\n          if (top_mask[ph * pooled_width + pw] == h * width + w) {\n            gradient += top_diff_ptr[ph * pooled_width + pw];\n          }\n        }\n      }\n    }\n    bottom_diff[index] = gradient;\n  }\n}\n\n__kernel void TEMPLATE(ave_pool_forward_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* bottom_data, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w, const int_tp pad_h, const int_tp pad_w,\n    __global Dtype* top_data) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h - pad_h;\n    int_tp wstart = pw * stride_w - pad_w;\n    int_tp hend = min(hstart + ext_kernel_h, height + pad_h);\n    int_tp wend = min(wstart + ext_kernel_w, width + pad_w);\n    hstart = max(hstart, 0L);\n    wstart = max(wstart, 0L);\n    hend = min(hend, height);\n    wend = min(wend, width);\n    Dtype aveval = 0;\n    __global const Dtype* bottom_data_ptr = bottom_data;\n    bottom_data_ptr += (n * channels + c) * height * width;\n    int_tp pool_size = 0;\n    for (int_tp h = hstart; h < hend; ++h) {\n      for (int_tp w = wstart; w < wend; ++w) {\n        aveval += bottom_data_ptr[h * width + w];\n        ++pool_size;\n      }\n    }\n    top_data[index] = aveval / pool_size;\n  }\n}\n\n__kernel void TEMPLATE(sto_pool_forward_train_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* bottom_data, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w, __global Dtype* rand_idx,\n    __global Dtype* top_data) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h;\n    int_tp hend = min(hstart + ext_kernel_h, height);\n    int_tp wstart = pw * stride_w;\n    int_tp wend = min(wstart + ext_kernel_w, width);\n    Dtype cumsum = 0.;\n    __global const Dtype* bottom_data_ptr = bottom_data;\n    bottom_data_ptr += (n * channels + c) * height * width;\n    // First pass: get sum\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        cumsum += bottom_data_ptr[h * width + w];\n      }\n    }\n    float thres = rand_idx[index] * cumsum;\n    // Second pass: get value, and set index.\n    cumsum = 0;\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        cumsum += bottom_data_ptr[h * width + w];\n        if (cumsum >= thres) {\n          rand_idx[index] = ((n * channels + c) * height + h) * width + w;\n          top_data[index] = bottom_data_ptr[h * width + w];\n          h = hend;\n          w = wend;\n        }\n      }\n    }\n  }\n}\n\n__kernel void TEMPLATE(sto_pool_forward_test_sk,Dtype)(\n    const int_tp nthreads, __global const Dtype* bottom_data, const int_tp num,\n    const int_tp channels, const int_tp height, const int_tp width,\n    const int_tp pooled_height, const int_tp pooled_width, const int_tp kernel_h,\n    const int_tp kernel_w, const int_tp ext_kernel_h, const int_tp ext_kernel_w,\n    const int_tp stride_h, const int_tp stride_w, const int_tp kstride_h,\n    const int_tp kstride_w,\n    __global Dtype* top_data) {\n\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    int_tp pw = index % pooled_width;\n    int_tp ph = (index / pooled_width) % pooled_height;\n    int_tp c = (index / pooled_width / pooled_height) % channels;\n    int_tp n = index / pooled_width / pooled_height / channels;\n    int_tp hstart = ph * stride_h;\n    int_tp hend = min(hstart + ext_kernel_h, height);\n    int_tp wstart = pw * stride_w;\n    int_tp wend = min(wstart + ext_kernel_w, width);\n    // We set cumsum to be 0 to avoid divide-by-zero problems\n    Dtype cumsum = FLT_MIN;\n    Dtype cumvalues = 0.;\n    __global const Dtype* bottom_data_ptr = bottom_data;\n    bottom_data_ptr += (n * channels + c) * height * width;\n    // First pass: get sum\n    for (int_tp h = hstart; h < hend; h += kstride_h) {\n      for (int_tp w = wstart; w < wend; w += kstride_w) {\n        cumsum += bottom_data_ptr[h * width + w];\n        cumvalues += bottom_data_ptr[h * width + w]\n            * bottom_data_ptr[h * width + w];\n      }\n    }\n    top_data[index] = cumvalues / cumsum;\n  }\n\n}";  // NOLINT
 std::string slice_double = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(slice,Dtype)(const int_tp nthreads,\n                                    __global const Dtype* in_data,\n                                    const int forward, const int_tp num_slices,\n                                    const int_tp slice_size,\n                                    const int_tp bottom_slice_axis,\n                                    const int_tp top_slice_axis,\n                                    const int_tp offset_slice_axis,\n                                    __global Dtype* out_data) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    const int_tp total_slice_size = slice_size * top_slice_axis;\n    const int_tp slice_num = index / total_slice_size;\n    const int_tp slice_index = index % total_slice_size;\n    const int_tp bottom_index = slice_index\n        + (slice_num * bottom_slice_axis + offset_slice_axis) * slice_size;\n    if (forward == 1) {\n      out_data[index] = in_data[bottom_index];\n    } else {\n      out_data[bottom_index] = in_data[index];\n    }\n  }\n}";  // NOLINT
 std::string softmax_loss_double = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n__kernel void TEMPLATE(softmax_loss_forward,Dtype)(\n    int_tp n, __global const Dtype* prob_data, __global const Dtype* label,\n    __global Dtype* loss,\n    const int_tp num, const int_tp dim, const int_tp spatial_dim,\n    const int has_ignore_label_, const int_tp ignore_label_,\n    __global Dtype* counts) {\n\n  for (int_tp index = get_global_id(0); index < n;\n      index += get_global_size(0)) {\n    const int_tp n = index / spatial_dim;\n    const int_tp s = index % spatial_dim;\n    const int_tp label_value = (int_tp) (label[n * spatial_dim + s]);\n    if (has_ignore_label_ == 1 && label_value == ignore_label_) {\n      loss[index] = 0;\n      counts[index] = 0;\n    } else {\n      loss[index] = -log(\n          max((Dtype) (prob_data[n * dim + label_value * spatial_dim + s]),\n              (Dtype) FLT_MIN));\n      counts[index] = 1;\n    }\n  }\n}\n\n__kernel void TEMPLATE(softmax_loss_backward,Dtype)(const int_tp nthreads,\n                                                    __global const Dtype* top,\n                                                    __global const Dtype* label,\n                                                    __global Dtype* bottom_diff,\n                                                    const int_tp num,\n                                                    const int_tp dim,\n                                                    const int_tp spatial_dim,\n                                                    const int has_ignore_label_,\n                                                    const int_tp ignore_label_,\n                                                    __global Dtype* counts) {\n\n  const int_tp channels = dim / spatial_dim;\n\n  for (int_tp index = get_global_id(0); index < nthreads; index +=\n      get_global_size(0)) {\n    {\n      const int_tp n = index / spatial_dim;\n      const int_tp s = index % spatial_dim;\n      const int_tp label_value = (int_tp) (label[n * spatial_dim + s]);\n\n      if (has_ignore_label_ == 1 && label_value == ignore_label_) {\n        for (int_tp c = 0; c < channels; ++c) {\n          bottom_diff[n * dim + c * spatial_dim + s] = 0;\n        }\n        counts[index] = 0;\n      } else {\n        bottom_diff[n * dim + label_value * spatial_dim + s] -= 1;\n        counts[index] = 1;\n      }\n    }\n  }\n}";  // NOLINT
+std::string solvers_double = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n// Fused solver updates. Each kernel scales the gradient g for iter_size,\n// adds the L2 and L1 weight decay of the parameter w, updates the history,\n// and leaves the update value in g after subtracting it from w.\n\n__kernel void TEMPLATE(sgd_update,Dtype)(const int_tp n, __global Dtype* w,\n                                         __global Dtype* g,\n                                         __global Dtype* h,\n                                         const Dtype scale,\n                                         const Dtype l2_decay,\n                                         const Dtype l1_decay,\n                                         const Dtype momentum,\n                                         const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = momentum * h[i] + local_rate * gi;\n    h[i] = hi;\n    g[i] = hi;\n    w[i] = wi - hi;\n  }\n}\n\n__kernel void TEMPLATE(nesterov_update,Dtype)(const int_tp n,\n                                              __global Dtype* w,\n                                              __global Dtype* g,\n                                              __global Dtype* h,\n                                              const Dtype scale,\n                                              const Dtype l2_decay,\n                                              const Dtype l1_decay,\n                                              const Dtype momentum,\n                                              const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi_old = h[i];\n    const Dtype hi = momentum * hi_old + local_rate * gi;\n    const Dtype ui = ((Dtype)1 + momentum) * hi - momentum * hi_old;\n    h[i] = hi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}\n\n__kernel void TEMPLATE(adagrad_update,Dtype)(const int_tp n,\n                                             __global Dtype* w,\n                                             __global Dtype* g,\n                                             __global Dtype* h,\n                                             const Dtype scale,\n                                             const Dtype l2_decay,\n                                             const Dtype l1_decay,\n                                             const Dtype delta,\n                                             const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = h[i] + gi * gi;\n    const Dtype ui = local_rate * (gi / (sqrt(hi) + delta));\n    h[i] = hi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}\n\n__kernel void TEMPLATE(rmsprop_update,Dtype)(const int_tp n,\n                                             __global Dtype* w,\n                                             __global Dtype* g,\n                                             __global Dtype* h,\n                                             const Dtype scale,\n                                             const Dtype l2_decay,\n                                             const Dtype l1_decay,\n                                             const Dtype rms_decay,\n                                             const Dtype delta,\n                                             const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = rms_decay * h[i] + ((Dtype)1 - rms_decay) * gi * gi;\n    const Dtype ui = local_rate * (gi / (sqrt(hi) + delta));\n    h[i] = hi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}\n\n__kernel void TEMPLATE(adadelta_update,Dtype)(const int_tp n,\n                                              __global Dtype* w,\n                                              __global Dtype* g,\n                                              __global Dtype* h,\n                                              __global Dtype* h2,\n                                              const Dtype scale,\n                                              const Dtype l2_decay,\n                                              const Dtype l1_decay,\n                                              const Dtype momentum,\n                                              const Dtype delta,\n                                              const Dtype local_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype hi = momentum * h[i] + ((Dtype)1 - momentum) * gi * gi;\n    const Dtype ui = gi * sqrt((h2[i] + delta) / (hi + delta));\n    h[i] = hi;\n    h2[i] = momentum * h2[i] + ((Dtype)1 - momentum) * ui * ui;\n    g[i] = local_rate * ui;\n    w[i] = wi - local_rate * ui;\n  }\n}\n\n__kernel void TEMPLATE(adam_update,Dtype)(const int_tp n, __global Dtype* w,\n                                          __global Dtype* g,\n                                          __global Dtype* m,\n                                          __global Dtype* v,\n                                          const Dtype scale,\n                                          const Dtype l2_decay,\n                                          const Dtype l1_decay,\n                                          const Dtype beta1,\n                                          const Dtype beta2,\n                                          const Dtype eps_hat,\n                                          const Dtype corrected_rate) {\n  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {\n    const Dtype wi = w[i];\n    const Dtype gi = g[i] * scale + l2_decay * wi\n        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));\n    const Dtype mi = beta1 * m[i] + ((Dtype)1 - beta1) * gi;\n    const Dtype vi = beta2 * v[i] + ((Dtype)1 - beta2) * gi * gi;\n    const Dtype ui = corrected_rate * (mi / (sqrt(vi) + eps_hat));\n    m[i] = mi;\n    v[i] = vi;\n    g[i] = ui;\n    w[i] = wi - ui;\n  }\n}";  // NOLINT
 std::string tile_double = "#ifndef __OPENCL_VERSION__\n#include \"header.cl\"\n#endif\n\n\n__kernel void TEMPLATE(tile,Dtype)(const int_tp nthreads, __global const Dtype* bottom_data,\n                                   const int_tp tile_size, const int_tp num_tiles,\n                                   const int_tp bottom_tile_axis,\n                                   __global Dtype* top_data) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    const int_tp d = index % tile_size;\n    const int_tp b = (index / tile_size / num_tiles) % bottom_tile_axis;\n    const int_tp n = index / tile_size / num_tiles / bottom_tile_axis;\n    const int_tp bottom_index = (n * bottom_tile_axis + b) * tile_size + d;\n    top_data[index] = bottom_data[bottom_index];\n  }\n}\n\n\n__kernel void TEMPLATE(tile_backward,Dtype)(const int_tp nthreads,\n                                            __global const Dtype* top_diff,\n                                            const int_tp tile_size,\n                                            const int_tp num_tiles,\n                                            const int_tp bottom_tile_axis,\n                                            __global Dtype* bottom_diff) {\n  for (int_tp index = get_global_id(0); index < nthreads;\n      index += get_global_size(0)) {\n    const int_tp d = index % tile_size;\n    const int_tp b = (index / tile_size) % bottom_tile_axis;\n    const int_tp n = index / tile_size / bottom_tile_axis;\n    bottom_diff[index] = 0;\n    int_tp top_index = (n * num_tiles * bottom_tile_axis + b) * tile_size + d;\n    for (int_tp t = 0; t < num_tiles; ++t) {\n      bottom_diff[index] += top_diff[top_index];\n      top_index += bottom_tile_axis * tile_size;\n    }\n  }\n}";  // NOLINT
 viennacl::ocl::program & RegisterKernels(viennacl::ocl::context *ctx) {
   std::stringstream ss;
@@ -83,6 +85,7 @@ viennacl::ocl::program & RegisterKernels(viennacl::ocl::context *ctx) {
   ss << pooling_sk_float << "\n\n";  // NOLINT
   ss << slice_float << "\n\n";  // NOLINT
   ss << softmax_loss_float << "\n\n";  // NOLINT
+  ss << solvers_float << "\n\n";  // NOLINT
   ss << tile_float << "\n\n";  // NOLINT
   ss << "#ifdef DOUBLE_SUPPORT_AVAILABLE" << "\n\n";  // NOLINT
   ss << "#undef Dtype" << "\n\n";  // NOLINT
@@ -112,6 +115,7 @@ viennacl::ocl::program & RegisterKernels(viennacl::ocl::context *ctx) {
   ss << pooling_sk_double << "\n\n";  // NOLINT
   ss << slice_double << "\n\n";  // NOLINT
   ss << softmax_loss_double << "\n\n";  // NOLINT
+  ss << solvers_double << "\n\n";  // NOLINT
   ss << tile_double << "\n\n";  // NOLINT
   ss << "#endif" << "\n\n";
   std::string kernel_string = ss.str();
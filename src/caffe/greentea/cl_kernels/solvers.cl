@@ -0,0 +1,140 @@
+#ifndef __OPENCL_VERSION__
+#include "header.cl"
+#endif
+
+// Fused solver updates. Each kernel scales the gradient g for iter_size,
+// adds the L2 and L1 weight decay of the parameter w, updates the history,
+// and leaves the update value in g after subtracting it from w.
+
+__kernel void TEMPLATE(sgd_update,Dtype)(const int_tp n, __global Dtype* w,
+                                         __global Dtype* g,
+                                         __global Dtype* h,
+                                         const Dtype scale,
+                                         const Dtype l2_decay,
+                                         const Dtype l1_decay,
+                                         const Dtype momentum,
+                                         const Dtype local_rate) {
+  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));
+    const Dtype hi = momentum * h[i] + local_rate * gi;
+    h[i] = hi;
+    g[i] = hi;
+    w[i] = wi - hi;
+  }
+}
+
+__kernel void TEMPLATE(nesterov_update,Dtype)(const int_tp n,
+                                              __global Dtype* w,
+                                              __global Dtype* g,
+                                              __global Dtype* h,
+                                              const Dtype scale,
+                                              const Dtype l2_decay,
+                                              const Dtype l1_decay,
+                                              const Dtype momentum,
+                                              const Dtype local_rate) {
+  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));
+    const Dtype hi_old = h[i];
+    const Dtype hi = momentum * hi_old + local_rate * gi;
+    const Dtype ui = ((Dtype)1 + momentum) * hi - momentum * hi_old;
+    h[i] = hi;
+    g[i] = ui;
+    w[i] = wi - ui;
+  }
+}
+
+__kernel void TEMPLATE(adagrad_update,Dtype)(const int_tp n,
+                                             __global Dtype* w,
+                                             __global Dtype* g,
+                                             __global Dtype* h,
+                                             const Dtype scale,
+                                             const Dtype l2_decay,
+                                             const Dtype l1_decay,
+                                             const Dtype delta,
+                                             const Dtype local_rate) {
+  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));
+    const Dtype hi = h[i] + gi * gi;
+    const Dtype ui = local_rate * (gi / (sqrt(hi) + delta));
+    h[i] = hi;
+    g[i] = ui;
+    w[i] = wi - ui;
+  }
+}
+
+__kernel void TEMPLATE(rmsprop_update,Dtype)(const int_tp n,
+                                             __global Dtype* w,
+                                             __global Dtype* g,
+                                             __global Dtype* h,
+                                             const Dtype scale,
+                                             const Dtype l2_decay,
+                                             const Dtype l1_decay,
+                                             const Dtype rms_decay,
+                                             const Dtype delta,
+                                             const Dtype local_rate) {
+  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));
+    const Dtype hi = rms_decay * h[i] + ((Dtype)1 - rms_decay) * gi * gi;
+    const Dtype ui = local_rate * (gi / (sqrt(hi) + delta));
+    h[i] = hi;
+    g[i] = ui;
+    w[i] = wi - ui;
+  }
+}
+
+__kernel void TEMPLATE(adadelta_update,Dtype)(const int_tp n,
+                                              __global Dtype* w,
+                                              __global Dtype* g,
+                                              __global Dtype* h,
+                                              __global Dtype* h2,
+                                              const Dtype scale,
+                                              const Dtype l2_decay,
+                                              const Dtype l1_decay,
+                                              const Dtype momentum,
+                                              const Dtype delta,
+                                              const Dtype local_rate) {
+  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));
+    const Dtype hi = momentum * h[i] + ((Dtype)1 - momentum) * gi * gi;
+    const Dtype ui = gi * sqrt((h2[i] + delta) / (hi + delta));
+    h[i] = hi;
+    h2[i] = momentum * h2[i] + ((Dtype)1 - momentum) * ui * ui;
+    g[i] = local_rate * ui;
+    w[i] = wi - local_rate * ui;
+  }
+}
+
+__kernel void TEMPLATE(adam_update,Dtype)(const int_tp n, __global Dtype* w,
+                                          __global Dtype* g,
+                                          __global Dtype* m,
+                                          __global Dtype* v,
+                                          const Dtype scale,
+                                          const Dtype l2_decay,
+                                          const Dtype l1_decay,
+                                          const Dtype beta1,
+                                          const Dtype beta2,
+                                          const Dtype eps_hat,
+                                          const Dtype corrected_rate) {
+  for (int_tp i = get_global_id(0); i < n; i += get_global_size(0)) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * ((Dtype)(0 < wi) - (Dtype)(wi < 0));
+    const Dtype mi = beta1 * m[i] + ((Dtype)1 - beta1) * gi;
+    const Dtype vi = beta2 * v[i] + ((Dtype)1 - beta2) * gi * gi;
+    const Dtype ui = corrected_rate * (mi / (sqrt(vi) + eps_hat));
+    m[i] = mi;
+    v[i] = vi;
+    g[i] = ui;
+    w[i] = wi - ui;
+  }
+}
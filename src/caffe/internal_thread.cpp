@@ -27,11 +27,14 @@ void InternalThread::StartInternalThread(device* device_context) {
   int_tp rand_seed = caffe_rng_rand();
   int_tp solver_count = Caffe::solver_count();
   bool root_solver = Caffe::root_solver();
+  int rank = Caffe::rank();
+  int rank_count = Caffe::rank_count();
 
   try {
     thread_.reset(
         new boost::thread(&InternalThread::entry, this, thread_device_,
-                          mode, rand_seed, solver_count, root_solver));
+                          mode, rand_seed, solver_count, root_solver, rank,
+                          rank_count));
   } catch (std::exception& e) {
     LOG(FATAL)<< "Thread exception: " << e.what();
   }
@@ -39,12 +42,15 @@ void InternalThread::StartInternalThread(device* device_context) {
 
 void InternalThread::entry(device* device_context, Caffe::Brew mode,
                            int_tp rand_seed,
-                           int_tp solver_count, bool root_solver) {
+                           int_tp solver_count, bool root_solver, int rank,
+                           int rank_count) {
   Caffe::SelectDevice(device_context);
   Caffe::set_mode(mode);
   Caffe::set_random_seed(rand_seed);
   Caffe::set_solver_count(solver_count);
   Caffe::set_root_solver(root_solver);
+  Caffe::set_rank(rank);
+  Caffe::set_rank_count(rank_count);
 
   InternalThreadEntry();
 }
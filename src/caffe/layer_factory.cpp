@@ -26,7 +26,13 @@ shared_ptr<Layer<Dtype> > GetConvolutionLayer(const LayerParameter& param) {
     engine = ConvolutionParameter_Engine_CUDNN;
 #endif
   }
-  if (engine == ConvolutionParameter_Engine_CAFFE
+  if (engine == ConvolutionParameter_Engine_DIRECT) {
+    return shared_ptr<Layer<Dtype> >(
+        new DirectConvolutionLayer<Dtype>(param));
+  } else if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return shared_ptr<Layer<Dtype> >(
+        new WinogradConvolutionLayer<Dtype>(param));
+  } else if (engine == ConvolutionParameter_Engine_CAFFE
       || Caffe::GetDefaultDevice()->backend() == BACKEND_OpenCL) {
     return shared_ptr<Layer<Dtype> >(new ConvolutionLayer<Dtype>(param));
 #ifdef USE_CUDNN
@@ -208,6 +208,23 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   weight_offset_ = conv_out_channels_ * kernel_dim_ / group_;
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // Set up the ReLU folded into the output, if any.
+  fused_relu_ = conv_param.fused_relu();
+  if (fused_relu_) {
+    CHECK(!reverse_dimensions())
+        << "Only convolutions support a fused ReLU.";
+    CHECK_EQ(channel_axis_, 1)
+        << "A fused ReLU needs the channels on axis 1.";
+    const int_tp num_slopes = conv_param.fused_relu_slope_size();
+    CHECK(num_slopes <= 1 || num_slopes == num_output_)
+        << "fused_relu_slope needs one value or one per output.";
+    fused_relu_slope_.Reshape(vector<int_tp>(1, num_output_));
+    Dtype* slope_data = fused_relu_slope_.mutable_cpu_data();
+    for (int_tp c = 0; c < num_output_; ++c) {
+      slope_data[c] = num_slopes == 0 ? Dtype(0) :
+          conv_param.fused_relu_slope(num_slopes == 1 ? 0 : c);
+    }
+  }
 }
 
 template<typename Dtype>
@@ -283,6 +300,27 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
   num_kernels_col2im_ = reverse_dimensions() ? top_dim_ : bottom_dim_;
 
+  // In CPU mode, several images can share one (larger) column buffer if the
+  // memory budget allows it. Deconvolution keeps the per-image layout.
+  col_batch_size_ = 1;
+  const uint_tp batch_memory =
+      this->layer_param_.convolution_param().cpu_batch_memory();
+  if (batch_memory > 0 && !reverse_dimensions()) {
+    const uint_tp image_memory = (kernel_dim_ * group_ + conv_out_channels_)
+        * conv_out_spatial_dim_ * sizeof(Dtype);
+    col_batch_size_ = std::max(std::min(num_,
+        static_cast<int_tp>(batch_memory / image_memory)),
+        static_cast<int_tp>(1));
+  }
+  if (col_batch_size_ > 1) {
+    vector<int_tp> batch_col_shape(1, col_batch_size_ * kernel_dim_ * group_
+                                      * conv_out_spatial_dim_);
+    batch_col_buffer_.Reshape(batch_col_shape);
+    vector<int_tp> batch_output_shape(1, col_batch_size_ * conv_out_channels_
+                                         * conv_out_spatial_dim_);
+    batch_output_buffer_.Reshape(batch_output_shape);
+  }
+
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   out_spatial_dim_ = top[0]->count(first_spatial_axis);
   if (bias_term_) {
@@ -322,9 +360,23 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
 template<typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
                                                    const Dtype* bias) {
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-                        out_spatial_dim_, 1, (Dtype) 1., bias,
-                        bias_multiplier_.cpu_data(), (Dtype) 1., output);
+  if (!fused_relu_) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+                          out_spatial_dim_, 1, (Dtype) 1., bias,
+                          bias_multiplier_.cpu_data(), (Dtype) 1., output);
+    return;
+  }
+  const Dtype* slope_data = fused_relu_slope_.cpu_data();
+#pragma omp parallel for
+  for (int_tp c = 0; c < num_output_; ++c) {
+    const Dtype bias_value = bias ? bias[c] : Dtype(0);
+    const Dtype slope = slope_data[c];
+    Dtype* output_channel = output + c * out_spatial_dim_;
+    for (int_tp i = 0; i < out_spatial_dim_; ++i) {
+      const Dtype value = output_channel[i] + bias_value;
+      output_channel[i] = value > 0 ? value : value * slope;
+    }
+  }
 }
 
 template<typename Dtype>
@@ -372,6 +424,86 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
                         bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template<typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_im2col_batch_cpu(const Dtype* data,
+                                                        const int_tp batch,
+                                                        Dtype* col_buff) {
+  const int_tp col_rows = kernel_dim_ * group_;
+  const int_tp batch_dim = batch * conv_out_spatial_dim_;
+  for (int_tp b = 0; b < batch; ++b) {
+    const Dtype* image_col = data + b * bottom_dim_;
+    if (!is_1x1_) {
+      conv_im2col_cpu(image_col, col_buffer_.mutable_cpu_data());
+      image_col = col_buffer_.cpu_data();
+    }
+    for (int_tp r = 0; r < col_rows; ++r) {
+      caffe_cpu_copy(conv_out_spatial_dim_,
+                     image_col + r * conv_out_spatial_dim_,
+                     col_buff + r * batch_dim + b * conv_out_spatial_dim_);
+    }
+  }
+}
+
+template<typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_batch(const Dtype* input,
+                                                         const Dtype* weights,
+                                                         Dtype* output,
+                                                         const int_tp batch) {
+  if (batch == 1) {
+    forward_cpu_gemm(input, weights, output);
+    return;
+  }
+  const int_tp batch_dim = batch * conv_out_spatial_dim_;
+  Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+  Dtype* out_buff = batch_output_buffer_.mutable_cpu_data();
+  conv_im2col_batch_cpu(input, batch, col_buff);
+  for (int_tp g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
+                          conv_out_channels_ / group_, batch_dim,
+                          kernel_dim_, (Dtype) 1., weights + weight_offset_ * g,
+                          col_buff + col_offset_ * batch * g, (Dtype) 0.,
+                          out_buff + output_offset_ * batch * g);
+  }
+  // Scatter the batched result back into the per-image output layout.
+  for (int_tp b = 0; b < batch; ++b) {
+    for (int_tp r = 0; r < conv_out_channels_; ++r) {
+      caffe_cpu_copy(conv_out_spatial_dim_,
+                     out_buff + r * batch_dim + b * conv_out_spatial_dim_,
+                     output + b * top_dim_ + r * conv_out_spatial_dim_);
+    }
+  }
+}
+
+template<typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_batch(const Dtype* input,
+                                                        const Dtype* output,
+                                                        Dtype* weights,
+                                                        const int_tp batch) {
+  if (batch == 1) {
+    weight_cpu_gemm(input, output, weights);
+    return;
+  }
+  const int_tp batch_dim = batch * conv_out_spatial_dim_;
+  Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+  Dtype* out_buff = batch_output_buffer_.mutable_cpu_data();
+  conv_im2col_batch_cpu(input, batch, col_buff);
+  // Gather the output gradients into the batched layout.
+  for (int_tp b = 0; b < batch; ++b) {
+    for (int_tp r = 0; r < conv_out_channels_; ++r) {
+      caffe_cpu_copy(conv_out_spatial_dim_,
+                     output + b * top_dim_ + r * conv_out_spatial_dim_,
+                     out_buff + r * batch_dim + b * conv_out_spatial_dim_);
+    }
+  }
+  for (int_tp g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
+                          kernel_dim_, batch_dim, (Dtype) 1.,
+                          out_buff + output_offset_ * batch * g,
+                          col_buff + col_offset_ * batch * g, (Dtype) 1.,
+                          weights + weight_offset_ * g);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template<typename Dtype>
@@ -422,6 +554,24 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_gemm(const Dtype* input,
   }
 }
 
+template<typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_gpu_relu(
+    const vector<Blob<Dtype>*>& top) {
+  if (!fused_relu_layer_) {
+    LayerParameter relu_param;
+    relu_param.set_device(this->layer_param_.device());
+    fused_relu_layer_.reset(new PReLULayer<Dtype>(relu_param));
+    vector<Blob<Dtype>*> relu_top(1, top[0]);
+    fused_relu_layer_->SetUp(relu_top, relu_top);
+    caffe_copy(num_output_, fused_relu_slope_.cpu_data(),
+               fused_relu_layer_->blobs()[0]->mutable_cpu_data());
+  }
+  for (int_tp i = 0; i < top.size(); ++i) {
+    vector<Blob<Dtype>*> relu_top(1, top[i]);
+    fused_relu_layer_->Forward(relu_top, relu_top);
+  }
+}
+
 template<typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_gpu_bias(Dtype* output,
                                                    const int_tp output_off,
@@ -1,7 +1,14 @@
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/variate_generator.hpp>
 #include <boost/thread.hpp>
+
+#include <algorithm>
+#include <string>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
@@ -32,38 +39,69 @@ BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
     const LayerParameter& param)
     : BaseDataLayer<Dtype>(param),
       prefetch_free_(),
-      prefetch_full_() {
-  for (int_tp i = 0; i < PREFETCH_COUNT; ++i) {
-    prefetch_free_.push(&prefetch_[i]);
-  }
+      prefetch_full_(),
+      prefetch_wait_us_(0),
+      prefetch_waits_(0),
+      prefetch_pops_(0) {
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // The batches exist before DataLayerSetUp, which reshapes them.
+  const int_tp prefetch = prefetch_count();
+  CHECK_GT(prefetch, 0) << "prefetch must be positive";
+  Batch<Dtype>* batch;
+  while (prefetch_free_.try_pop(&batch)) {}
+  while (prefetch_full_.try_pop(&batch)) {}
+  prefetch_.clear();
+  for (int_tp i = 0; i < prefetch; ++i) {
+    prefetch_.push_back(shared_ptr<Batch<Dtype> >(new Batch<Dtype>()));
+    prefetch_free_.push(prefetch_[i].get());
+  }
+  prefetch_wait_us_ = 0;
+  prefetch_waits_ = 0;
+  prefetch_pops_ = 0;
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
   // Before starting the prefetch thread, we make cpu_data and gpu_data
   // calls so that the prefetch thread does not accidentally make simultaneous
   // cudaMalloc calls when the main thread is running. In some GPUs this
   // seems to cause failures if we do not so.
-  for (int_tp i = 0; i < PREFETCH_COUNT; ++i) {
-    prefetch_[i].data_.mutable_cpu_data();
+  for (int_tp i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->data_.mutable_cpu_data();
     if (this->output_labels_) {
-      prefetch_[i].label_.mutable_cpu_data();
+      prefetch_[i]->label_.mutable_cpu_data();
     }
   }
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
-    for (int_tp i = 0; i < PREFETCH_COUNT; ++i) {
-      prefetch_[i].data_.mutable_gpu_data();
+    for (int_tp i = 0; i < prefetch_.size(); ++i) {
+      prefetch_[i]->data_.mutable_gpu_data();
       if (this->output_labels_) {
-        prefetch_[i].label_.mutable_gpu_data();
+        prefetch_[i]->label_.mutable_gpu_data();
       }
     }
   }
 #endif
   DLOG(INFO) << "Initializing prefetch";
   this->data_transformer_->InitRand();
+  // The workers are seeded one after the other from the Caffe RNG, which
+  // keeps their random streams reproducible.
+  const int_tp workers = transform_threads();
+  CHECK_GT(workers, 0) << "transform_threads must be positive";
+  worker_transformers_.clear();
+  worker_transformed_data_.clear();
+  worker_transformers_.push_back(this->data_transformer_);
+  for (int_tp w = 1; w < workers; ++w) {
+    worker_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_, this->phase_,
+                                   this->device_)));
+    worker_transformers_[w]->InitRand();
+  }
+  for (int_tp w = 0; w < workers; ++w) {
+    worker_transformed_data_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+  }
   StartInternalThread(this->get_device());
   DLOG(INFO) << "Prefetch initialized.";
 }
@@ -79,6 +117,22 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
     }
   }
 #endif  // USE_CUDA
+#ifdef USE_GREENTEA
+  // Batches are uploaded on the last queue of the device, so that the copy
+  // overlaps with the kernels the solver runs on the others. The queue is
+  // taken by index, as SwitchQueue would switch the queue of the main thread.
+  // With a single queue nothing would overlap, so Forward uploads instead.
+  viennacl::ocl::command_queue* queue = NULL;
+  if (Caffe::mode() == Caffe::GPU) {
+    if (this->get_device()->backend() == BACKEND_OpenCL
+        && this->get_device()->num_queues() > 1) {
+      viennacl::ocl::context &ctx = viennacl::ocl::get_context(
+          this->get_device()->id());
+      queue = &ctx.get_queue(ctx.devices()[0].id(),
+                             this->get_device()->num_queues() - 1);
+    }
+  }
+#endif  // USE_GREENTEA
 #endif  // !CPU_ONLY
 
   try {
@@ -90,10 +144,22 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
       if (Caffe::mode() == Caffe::GPU) {
         if (this->get_device()->backend() == BACKEND_CUDA) {
           batch->data_.data().get()->async_gpu_push(stream);
+          if (this->output_labels_) {
+            batch->label_.data().get()->async_gpu_push(stream);
+          }
           CUDA_CHECK(cudaStreamSynchronize(stream));
         }
       }
 #endif  // USE_CUDA
+#ifdef USE_GREENTEA
+      if (queue != NULL) {
+        batch->data_.data().get()->async_gpu_push(*queue);
+        if (this->output_labels_) {
+          batch->label_.data().get()->async_gpu_push(*queue);
+        }
+        queue->finish();
+      }
+#endif  // USE_GREENTEA
 #endif  // !CPU_ONLY
       prefetch_full_.push(batch);
     }
@@ -111,10 +177,40 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif  // !CPU_ONLY
 }
 
+template <typename Dtype>
+Batch<Dtype>* BasePrefetchingDataLayer<Dtype>::PopFullBatch() {
+  Batch<Dtype>* batch;
+  if (!prefetch_full_.try_pop(&batch)) {
+    CPUTimer timer;
+    timer.Start();
+    batch = prefetch_full_.pop("Data layer prefetch queue empty");
+    __sync_fetch_and_add(&prefetch_wait_us_,
+                         static_cast<int64_t>(timer.MicroSeconds()));
+    __sync_fetch_and_add(&prefetch_waits_, 1);
+  }
+  if (__sync_add_and_fetch(&prefetch_pops_, 1) % PREFETCH_LOG_INTERVAL == 0) {
+    LOG(INFO) << this->layer_param_.name() << " waited "
+              << prefetch_wait_ms() << " ms for " << prefetch_waits()
+              << " of " << prefetch_pops_ << " batches";
+  }
+  return batch;
+}
+
+template <typename Dtype>
+double BasePrefetchingDataLayer<Dtype>::prefetch_wait_ms() const {
+  return __sync_fetch_and_add(const_cast<int64_t*>(&prefetch_wait_us_), 0)
+      / 1000.0;
+}
+
+template <typename Dtype>
+int_tp BasePrefetchingDataLayer<Dtype>::prefetch_waits() const {
+  return __sync_fetch_and_add(const_cast<int_tp*>(&prefetch_waits_), 0);
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
+  Batch<Dtype>* batch = PopFullBatch();
   // Reshape to loaded data.
   top[0]->ReshapeLike(batch->data_);
   // Copy the data
@@ -136,7 +232,101 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
 STUB_GPU_FORWARD(BasePrefetchingDataLayer, Forward);
 #endif
 
+template <typename Dtype>
+void BaseTopPrefetchingLayer<Dtype>::StartPrefetch(
+    const vector<vector<int_tp> >& top_shapes, int_tp prefetch,
+    const vector<Blob<Dtype>*>& top) {
+  CHECK_GT(prefetch, 0) << "prefetch must be positive";
+  TopBatch<Dtype>* batch;
+  while (prefetch_free_.try_pop(&batch)) {}
+  while (prefetch_full_.try_pop(&batch)) {}
+  prefetch_.clear();
+  for (int_tp i = 0; i < prefetch; ++i) {
+    prefetch_.push_back(shared_ptr<TopBatch<Dtype> >(new TopBatch<Dtype>()));
+    for (int_tp j = 0; j < top.size(); ++j) {
+      prefetch_[i]->blobs_.push_back(
+          shared_ptr<Blob<Dtype> >(new Blob<Dtype>(top_shapes[j])));
+      prefetch_[i]->blobs_[j]->mutable_cpu_data();
+    }
+    prefetch_free_.push(prefetch_[i].get());
+  }
+  for (int_tp j = 0; j < top.size(); ++j) {
+    top[j]->Reshape(top_shapes[j]);
+  }
+  StartInternalThread(this->get_device());
+}
+
+template <typename Dtype>
+void BaseTopPrefetchingLayer<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      TopBatch<Dtype>* batch = prefetch_free_.pop();
+      load_batch(batch);
+      prefetch_full_.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype>
+void BaseTopPrefetchingLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  TopBatch<Dtype>* batch =
+      prefetch_full_.pop("Data layer prefetch queue empty");
+  for (int_tp j = 0; j < top.size(); ++j) {
+    top[j]->ReshapeLike(*batch->blobs_[j]);
+    caffe_cpu_copy(batch->blobs_[j]->count(), batch->blobs_[j]->cpu_data(),
+                   top[j]->mutable_cpu_data());
+  }
+  prefetch_free_.push(batch);
+}
+
+template <typename Dtype>
+void BaseTopPrefetchingLayer<Dtype>::ClearPatchSources(
+    const vector<int_tp>& box_shape) {
+  patch_box_ = box_shape;
+  patch_spaces_.clear();
+  patch_positions_.clear();
+}
+
+template <typename Dtype>
+void BaseTopPrefetchingLayer<Dtype>::AddPatchSource(
+    const vector<int_tp>& space, const string& name) {
+  CHECK_EQ(space.size(), patch_box_.size());
+  uint_tp positions = 1;
+  for (int_tp k = 0; k < patch_box_.size(); ++k) {
+    CHECK_GE(space[k], patch_box_[k]) << "Patch larger than " << name;
+    positions *= space[k] - patch_box_[k] + 1;
+  }
+  patch_spaces_.push_back(space);
+  patch_positions_.push_back(positions
+      + (patch_positions_.empty() ? 0 : patch_positions_.back()));
+}
+
+template <typename Dtype>
+int_tp BaseTopPrefetchingLayer<Dtype>::SamplePatch(vector<int_tp>* offset) {
+  boost::uniform_int<uint_tp> distribution(0, patch_positions_.back() - 1);
+  boost::variate_generator<rng_t*, boost::uniform_int<uint_tp> >
+      generator(caffe_rng(), distribution);
+  uint_tp position = generator();
+  const int_tp source = std::upper_bound(patch_positions_.begin(),
+      patch_positions_.end(), position) - patch_positions_.begin();
+  if (source > 0) {
+    position -= patch_positions_[source - 1];
+  }
+  const vector<int_tp>& space = patch_spaces_[source];
+  offset->resize(patch_box_.size());
+  for (int_tp k = patch_box_.size() - 1; k >= 0; --k) {
+    const uint_tp range = space[k] - patch_box_[k] + 1;
+    (*offset)[k] = position % range;
+    position /= range;
+  }
+  return source;
+}
+
 INSTANTIATE_CLASS(BaseDataLayer);
 INSTANTIATE_CLASS(BasePrefetchingDataLayer);
+INSTANTIATE_CLASS(BaseTopPrefetchingLayer);
 
 }  // namespace caffe
@@ -8,7 +8,7 @@ template<typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
 
-  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
+  Batch<Dtype>* batch = PopFullBatch();
 
   if (this->device_->backend() == BACKEND_CUDA) {
 #ifdef USE_CUDA
@@ -47,6 +47,9 @@ void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
                            (cl_mem) (batch->label_.gpu_data()), 0,
                            (cl_mem) (top[1]->mutable_gpu_data()), 0, &ctx);
     }
+    // The prefetch thread uploads the next batch on another queue, so the
+    // copy has to be done before the batch is handed back.
+    ctx.get_queue().finish();
 #endif  // USE_GREENTEA
   }
 
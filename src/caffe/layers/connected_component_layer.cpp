@@ -1,6 +1,6 @@
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
+#include <stdint.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -10,74 +10,237 @@
 
 namespace caffe {
 
-// Derived from
-// http://nghiaho.com/uploads/code/opencv_connected_component/blob.cpp
-template<typename Dtype>
-cv::Mat ConnectedComponentLayer<Dtype>::FindBlobs(int_tp maxlabel,
-                                                  const cv::Mat &input) {
-  // Fill the label_image with the blobs
-  cv::Mat label_image;
-  input.convertTo(label_image, CV_32SC1);
-
-  int_tp label_count = maxlabel + 1;
-
-  // Segment into label numbers higher than the original label numbers
-  for (int_tp y = 0; y < label_image.rows; y++) {
-    int_tp *row = reinterpret_cast<int_tp*>(label_image.ptr(y));
-    for (int_tp x = 0; x < label_image.cols; x++) {
-      // Skip background and already labeled areas
-      if (row[x] > maxlabel || row[x] == 0) {
+// Number of blocks a single large slice is split into.
+#define CC_CHUNKS 64
+// Slices with fewer voxels are labeled one per thread instead.
+#define CC_MIN_CHUNKED_SLICE 65536
+
+// Neighbors that precede a voxel in raster order, as (dz, dy, dx). The first
+// three are the face neighbors, all 13 together the full (8/26) neighborhood.
+static const int_tp cc_neighbors[13][3] = {
+  { -1, 0, 0 }, { 0, -1, 0 }, { 0, 0, -1 },
+  { -1, -1, -1 }, { -1, -1, 0 }, { -1, -1, 1 }, { -1, 0, -1 }, { -1, 0, 1 },
+  { -1, 1, -1 }, { -1, 1, 0 }, { -1, 1, 1 }, { 0, -1, -1 }, { 0, -1, 1 }
+};
+
+template <typename Index>
+inline Index cc_find(const Index* parent, Index v) {
+  while (parent[v] != v) {
+    v = parent[v];
+  }
+  return v;
+}
+
+// Joins the sets of a and b under the smaller root, so every component is
+// rooted at its first voxel in raster order.
+template <typename Index>
+inline void cc_union(Index* parent, Index a, Index b) {
+  while (parent[a] != a) {
+    parent[a] = parent[parent[a]];
+    a = parent[a];
+  }
+  while (parent[b] != b) {
+    parent[b] = parent[parent[b]];
+    b = parent[b];
+  }
+  if (a < b) {
+    parent[b] = a;
+  } else if (b < a) {
+    parent[a] = b;
+  }
+}
+
+// Joins every nonzero voxel in rows [row_begin, row_end) of a (D, H, W)
+// volume (row r is z = r / H, y = r % H) with its preceding neighbors j of the
+// same value, for j in [j_begin, j_end).
+template <typename Dtype, typename Index>
+void cc_join_rows(const Dtype* data, const int_tp height, const int_tp width,
+                  const int_tp neighbors, const int_tp row_begin,
+                  const int_tp row_end, const int_tp j_begin,
+                  const int_tp j_end, Index* parent) {
+  const int_tp plane = height * width;
+  const bool full = neighbors > 3;
+  // Neighbor offsets valid for the first, inner and last voxel of a row,
+  // and the subset ahead in x (dx = 1) of an inner voxel.
+  int_tp offsets[3][13];
+  int_tp num_offsets[3];
+  int_tp ahead[13];
+  int_tp num_ahead;
+  for (int_tp r = row_begin; r < row_end; ++r) {
+    const int_tp z = r / height;
+    const int_tp y = r % height;
+    num_offsets[0] = num_offsets[1] = num_offsets[2] = num_ahead = 0;
+    for (int_tp k = 0; k < neighbors; ++k) {
+      const int_tp* d = cc_neighbors[k];
+      if ((d[0] < 0 && z == 0) || (d[1] < 0 && y == 0)
+          || (d[1] > 0 && y == height - 1)) {
+        continue;
+      }
+      const int_tp offset = d[0] * plane + d[1] * width + d[2];
+      for (int_tp pos = 0; pos < 3; ++pos) {
+        if ((d[2] < 0 && (pos == 0 || width == 1))
+            || (d[2] > 0 && (pos == 2 || width == 1))) {
+          continue;
+        }
+        offsets[pos][num_offsets[pos]++] = offset;
+      }
+      if (d[2] > 0) {
+        ahead[num_ahead++] = offset;
+      }
+    }
+    const int_tp row = r * width;
+    for (int_tp x = 0; x < width; ++x) {
+      const int_tp i = row + x;
+      const Dtype value = data[i];
+      if (value == 0) {
         continue;
       }
-      cv::Rect rect;
-      cv::floodFill(label_image, cv::Point(x, y), label_count, &rect, 0, 0, 4);
-      label_count++;
+      const int_tp pos = x == 0 ? 0 : (x == width - 1 ? 2 : 1);
+      if (full && pos > 0 && data[i - 1] == value) {
+        // With full connectivity, every neighbor with dx <= 0 also touches
+        // voxel i - 1, which was already joined with it.
+        if (i - 1 >= j_begin && i - 1 < j_end) {
+          cc_union(parent, static_cast<Index>(i), static_cast<Index>(i - 1));
+        }
+        for (int_tp k = 0; pos == 1 && k < num_ahead; ++k) {
+          const int_tp j = i + ahead[k];
+          if (j >= j_begin && j < j_end && data[j] == value) {
+            cc_union(parent, static_cast<Index>(i), static_cast<Index>(j));
+          }
+        }
+        continue;
+      }
+      for (int_tp k = 0; k < num_offsets[pos]; ++k) {
+        const int_tp j = i + offsets[pos][k];
+        if (j >= j_begin && j < j_end && data[j] == value) {
+          cc_union(parent, static_cast<Index>(i), static_cast<Index>(j));
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+template<typename Index>
+void ConnectedComponentLayer<Dtype>::LabelSlice(const Dtype* data,
+    const Dtype first_label, const int_tp chunks_in, Dtype* labels) {
+  const int_tp rows = depth_ * height_;
+  const int_tp count = rows * width_;
+  const int_tp neighbors = full_connectivity_ ? 13 : 3;
+  // Blocks are ranges of planes in 3D and of rows in 2D.
+  const int_tp outer = depth_ > 1 ? depth_ : height_;
+  const int_tp outer_rows = rows / outer;
+  const int_tp chunks = std::max(static_cast<int_tp>(1),
+                                 std::min(chunks_in, outer));
+  vector<Index> parent_vec(count);
+  Index* parent = &parent_vec[0];
+  vector<int_tp> chunk_roots(chunks + 1, 0);
+
+  // Union-find inside every block. Neighbors in the previous block are
+  // joined afterwards, so blocks only ever touch their own voxels.
+#pragma omp parallel for
+  for (int_tp c = 0; c < chunks; ++c) {
+    const int_tp row_begin = outer * c / chunks * outer_rows;
+    const int_tp row_end = outer * (c + 1) / chunks * outer_rows;
+    for (int_tp i = row_begin * width_; i < row_end * width_; ++i) {
+      parent[i] = i;
+    }
+    cc_join_rows(data, height_, width_, neighbors, row_begin, row_end,
+                 row_begin * width_, count, parent);
+  }
+  // Join the first row/plane of every block with the block before.
+  for (int_tp c = 1; c < chunks; ++c) {
+    const int_tp row_begin = outer * c / chunks * outer_rows;
+    cc_join_rows(data, height_, width_, neighbors, row_begin,
+                 row_begin + outer_rows, 0, row_begin * width_, parent);
+  }
+
+  // Number the roots in raster order, then copy the numbers to all voxels.
+#pragma omp parallel for
+  for (int_tp c = 0; c < chunks; ++c) {
+    const int_tp end = outer * (c + 1) / chunks * outer_rows * width_;
+    for (int_tp i = outer * c / chunks * outer_rows * width_; i < end; ++i) {
+      chunk_roots[c + 1] += (data[i] != 0 && parent[i] == i);
+    }
+  }
+  for (int_tp c = 0; c < chunks; ++c) {
+    chunk_roots[c + 1] += chunk_roots[c];
+  }
+#pragma omp parallel for
+  for (int_tp c = 0; c < chunks; ++c) {
+    const int_tp end = outer * (c + 1) / chunks * outer_rows * width_;
+    Dtype label = first_label + chunk_roots[c];
+    for (int_tp i = outer * c / chunks * outer_rows * width_; i < end; ++i) {
+      if (data[i] != 0 && parent[i] == i) {
+        labels[i] = label;
+        label += 1;
+      }
+    }
+  }
+#pragma omp parallel for
+  for (int_tp i = 0; i < count; ++i) {
+    if (data[i] == 0) {
+      labels[i] = 0;
+    } else if (parent[i] != i) {
+      labels[i] = labels[cc_find(parent, static_cast<Index>(i))];
     }
   }
-  return label_image;
 }
 
 template<typename Dtype>
 void ConnectedComponentLayer<Dtype>::LayerSetUp(
               const vector<Blob<Dtype>*>& bottom,
               const vector<Blob<Dtype>*>& top) {
+  const int_tp num_axes = bottom[0]->num_axes();
+  CHECK(num_axes == 4 || num_axes == 5)
+      << "ConnectedComponentLayer takes (N, C, H, W) or (N, C, D, H, W) "
+      << "blobs.";
+  const uint_tp connectivity =
+      this->layer_param_.connected_component_param().connectivity();
+  if (num_axes == 4) {
+    CHECK(connectivity == 0 || connectivity == 4 || connectivity == 8)
+        << "2D connectivity must be 4 or 8.";
+  } else {
+    CHECK(connectivity == 0 || connectivity == 6 || connectivity == 26)
+        << "3D connectivity must be 6 or 26.";
+  }
+  full_connectivity_ = connectivity == 8 || connectivity == 26;
 }
 
 template<typename Dtype>
 void ConnectedComponentLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
                                     const vector<Blob<Dtype>*>& top) {
   top[0]->ReshapeLike(*bottom[0]);
+  depth_ = bottom[0]->num_axes() == 5 ? bottom[0]->shape(2) : 1;
+  height_ = bottom[0]->shape(-2);
+  width_ = bottom[0]->shape(-1);
 }
 
 template<typename Dtype>
 void ConnectedComponentLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
+  const int_tp slices = bottom[0]->count(0, 2);
+  const int_tp slice_size = bottom[0]->count(2);
+  const bool wide_index = slice_size > UINT32_MAX;
 
-  cv::Mat img(bottom[0]->height(), bottom[0]->width(), CV_8SC1);
-
-  for (int_tp nc = 0; nc < bottom[0]->num() * bottom[0]->channels(); ++nc) {
-    int_tp maxlabel = 0;
-    for (int_tp y = 0; y < bottom[0]->height(); ++y) {
-      for (int_tp x = 0; x < bottom[0]->width(); ++x) {
-        int_tp val = bottom_data[nc * bottom[0]->width() * bottom[0]->height()
-                                          + bottom[0]->width() * y + x];
-        if (val > maxlabel) {
-          maxlabel = val;
-        }
-        img.at<unsigned char>(y, x) = val;
-      }
-    }
-    cv::Mat seg = FindBlobs(maxlabel, img);
-#pragma omp parallel for
-    for (int_tp y = 0; y < seg.rows; ++y) {
-      for (int_tp x = 0; x < seg.cols; ++x) {
-        top_data[nc * bottom[0]->width() * bottom[0]->height()
-            + bottom[0]->width() * y + x] = seg.at<int_tp>(y, x);
-      }
+  // Large slices are labeled one after another with blocks in parallel,
+  // small ones one slice per thread.
+  const bool chunked = slice_size >= CC_MIN_CHUNKED_SLICE;
+#pragma omp parallel for if (!chunked)
+  for (int_tp nc = 0; nc < slices; ++nc) {
+    const Dtype* slice_data = bottom_data + nc * slice_size;
+    Dtype* slice_labels = top_data + nc * slice_size;
+    // New labels start above the largest label of the slice.
+    const Dtype first_label = std::max(Dtype(0), *std::max_element(
+        slice_data, slice_data + slice_size)) + 1;
+    const int_tp chunks = chunked ? CC_CHUNKS : 1;
+    if (wide_index) {
+      LabelSlice<uint64_t>(slice_data, first_label, chunks, slice_labels);
+    } else {
+      LabelSlice<uint32_t>(slice_data, first_label, chunks, slice_labels);
     }
   }
 }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/vision_layers.hpp"
@@ -28,12 +29,16 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   for (int_tp i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
-    for (int_tp n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
-      if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
-        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+    for (int_tp n = 0; n < this->num_; n += this->col_batch_size_) {
+      const int_tp batch = std::min(this->col_batch_size_, this->num_ - n);
+      this->forward_cpu_gemm_batch(bottom_data + n * this->bottom_dim_, weight,
+          top_data + n * this->top_dim_, batch);
+      if (this->bias_term_ || this->fused_relu_) {
+        const Dtype* bias = this->bias_term_ ?
+            this->blobs_[1]->cpu_data() : NULL;
+        for (int_tp b = n; b < n + batch; ++b) {
+          this->forward_cpu_bias(top_data + b * this->top_dim_, bias);
+        }
       }
     }
   }
@@ -42,6 +47,8 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!this->fused_relu_) << "Convolutions with a fused ReLU cannot be "
+                            << "trained.";
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   for (int_tp i = 0; i < top.size(); ++i) {
@@ -55,10 +62,18 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
+    if (this->param_propagate_down_[0] && this->col_batch_size_ > 1) {
+      // gradient w.r.t. weight, several images per GEMM.
+      for (int_tp n = 0; n < this->num_; n += this->col_batch_size_) {
+        const int_tp batch = std::min(this->col_batch_size_, this->num_ - n);
+        this->weight_cpu_gemm_batch(bottom_data + n * this->bottom_dim_,
+            top_diff + n * this->top_dim_, weight_diff, batch);
+      }
+    }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
       for (int_tp n = 0; n < this->num_; ++n) {
         // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
+        if (this->param_propagate_down_[0] && this->col_batch_size_ == 1) {
           this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
               top_diff + n * this->top_dim_, weight_diff);
         }
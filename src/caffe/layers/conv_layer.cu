@@ -32,11 +32,16 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     // Multi queue execution, finish all queues
     this->device_->FinishQueues();
   }
+  if (this->fused_relu_) {
+    this->forward_gpu_relu(top);
+  }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!this->fused_relu_) << "Convolutions with a fused ReLU cannot be "
+                            << "trained.";
   const Dtype* weight = this->blobs_[0]->gpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
   for (int_tp i = 0; i < top.size(); ++i) {
@@ -43,11 +43,16 @@ void CuDNNConvolutionLayer<Dtype>::Forward_gpu(
     // NOLINT_NEXT_LINE(whitespace/operators)
     sync_conv_groups CUDA_KERNEL(1, 1)();
   }
+  if (this->fused_relu_) {
+    this->forward_gpu_relu(top);
+  }
 }
 
 template <typename Dtype>
 void CuDNNConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!this->fused_relu_) << "Convolutions with a fused ReLU cannot be "
+                            << "trained.";
   const Dtype* weight = NULL;
   Dtype* weight_diff = NULL;
   if (this->param_propagate_down_[0]) {
@@ -3,14 +3,27 @@
 #endif  // USE_OPENCV
 #include <stdint.h>
 
+#include <string>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/decoded_cache.hpp"
+#include "caffe/util/io.hpp"
 
 namespace caffe {
 
+#ifdef USE_OPENCV
+// Decodes an encoded datum as DataTransformer::Transform does.
+static cv::Mat DecodeDatumToTransform(const Datum& datum,
+    const TransformationParameter& param) {
+  if (param.force_color() || param.force_gray()) {
+    return DecodeDatumToCVMat(datum, param.force_color());
+  }
+  return DecodeDatumToCVMatNative(datum);
+}
+#endif  // USE_OPENCV
 
 template<typename Dtype>
 DataLayer<Dtype>::DataLayer(const LayerParameter& param)
@@ -27,7 +40,7 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
                                       const vector<Blob<Dtype>*>& top) {
   const int_tp batch_size = this->layer_param_.data_param().batch_size();
   // Read a data point, and use it to initialize the top blob.
-  Datum& datum = *(reader_.full().peek());
+  Datum& datum = reader_.full().peek()->datum_;
 
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int_tp> top_shape = this->data_transformer_->InferBlobShape(datum);
@@ -35,8 +48,8 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Reshape top[0] and prefetch_data according to the batch_size.
   top_shape[0] = batch_size;
   top[0]->Reshape(top_shape);
-  for (int_tp i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape);
+  for (int_tp i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
   }
   LOG(INFO)<< "output data size: " << top[0]->num() << ","
   << top[0]->channels() << "," << top[0]->height() << ","
@@ -45,10 +58,32 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   if (this->output_labels_) {
     vector<int_tp> label_shape(1, batch_size);
     top[1]->Reshape(label_shape);
-    for (int_tp i = 0; i < this->PREFETCH_COUNT; ++i) {
-      this->prefetch_[i].label_.Reshape(label_shape);
+    for (int_tp i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.Reshape(label_shape);
     }
   }
+  // Only encoded datums are cached, as raw ones need no decoding.
+  const DataParameter& data_param = this->layer_param_.data_param();
+  if (data_param.cache_bytes() > 0 && datum.encoded()) {
+#ifdef USE_OPENCV
+    // The database size is not known here, so the table is sized for the
+    // images that fit in the budget if they are as large as the first one.
+    cv::Mat cv_img = DecodeDatumToTransform(datum, this->transform_param_);
+    CHECK(cv_img.data) << "Could not decode datum";
+    const uint_tp image_bytes = cv_img.total() * cv_img.elemSize();
+    const string key = data_param.source()
+        + (this->transform_param_.force_color() ? " color" : "")
+        + (this->transform_param_.force_gray() ? " gray" : "");
+    LOG(INFO) << "Caching up to " << data_param.cache_bytes()
+              << " bytes of decoded images" << (data_param.cache_file().empty()
+                  ? "" : " in " + data_param.cache_file());
+    cache_.reset(new DecodedCache(key,
+        2 * (data_param.cache_bytes() / image_bytes + 1),
+        data_param.cache_bytes(), data_param.cache_file()));
+#else
+    LOG(WARNING) << "Decoding encoded datums needs OpenCV, not caching them";
+#endif  // USE_OPENCV
+  }
 }
 
 // This function is called on prefetch thread
@@ -65,7 +100,7 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   // Reshape according to the first datum of each batch
   // on single input batches allows for inputs of varying dimension.
   const int_tp batch_size = this->layer_param_.data_param().batch_size();
-  Datum& datum = *(reader_.full().peek());
+  Datum& datum = reader_.full().peek()->datum_;
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int_tp> top_shape = this->data_transformer_->InferBlobShape(datum);
   this->transformed_data_.Reshape(top_shape);
@@ -79,23 +114,62 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   if (this->output_labels_) {
     top_label = batch->label_.mutable_cpu_data();
   }
+  // get the datums
+  timer.Start();
+  vector<DatumSample*> samples(batch_size);
+  for (int_tp item_id = 0; item_id < batch_size; ++item_id) {
+    samples[item_id] = reader_.full().pop("Waiting for data");
+    if (cache_ && samples[item_id]->index_ == 0
+        && cache_->hits() + cache_->misses() > 0) {
+      LOG(INFO) << "Decoded cache epoch: " << cache_->hits() << " hits, "
+                << cache_->misses() << " misses, " << cache_->bytes_used()
+                << " of " << cache_->bytes() << " bytes used";
+      cache_->ResetCounters();
+    }
+  }
+  read_time += timer.MicroSeconds();
+  timer.Start();
+  // Apply data transformations (mirror, scale, crop...), decoding encoded
+  // datums or taking them from the cache, and reading raw pixels from the
+  // database where they are mapped, with each worker taking every workers-th
+  // item.
+  const int_tp workers = this->worker_transformers_.size();
+  for (int_tp w = 0; w < workers; ++w) {
+    this->worker_transformed_data_[w]->Reshape(
+        this->transformed_data_.shape());
+  }
+#pragma omp parallel for num_threads(workers)
+  for (int_tp w = 0; w < workers; ++w) {
+    Blob<Dtype>* transformed_data = this->worker_transformed_data_[w].get();
+    for (int_tp item_id = w; item_id < batch_size; item_id += workers) {
+      int_tp offset = batch->data_.offset(item_id);
+      transformed_data->set_cpu_data(top_data + offset);
+      const DatumSample& sample = *samples[item_id];
+#ifdef USE_OPENCV
+      if (cache_ && sample.datum_.encoded()) {
+        cv::Mat cv_img = cache_->FindMat(sample.index_);
+        if (!cv_img.data) {
+          cv_img = DecodeDatumToTransform(sample.datum_,
+                                          this->transform_param_);
+          CHECK(cv_img.data) << "Could not decode datum";
+          cache_->InsertMat(sample.index_, cv_img);
+        }
+        this->worker_transformers_[w]->Transform(cv_img, transformed_data);
+        continue;
+      }
+#endif  // USE_OPENCV
+      this->worker_transformers_[w]->Transform(sample.datum_, sample.pixels_,
+                                               transformed_data);
+    }
+  }
   for (int_tp item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
-    // get a datum
-    Datum& datum = *(reader_.full().pop("Waiting for data"));
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply data transformations (mirror, scale, crop...)
-    int_tp offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
     // Copy label.
     if (this->output_labels_) {
-      top_label[item_id] = datum.label();
+      top_label[item_id] = samples[item_id]->datum_.label();
     }
-    trans_time += timer.MicroSeconds();
-    reader_.free().push(const_cast<Datum*>(&datum));
+    reader_.free().push(samples[item_id]);
   }
+  trans_time += timer.MicroSeconds();
   timer.Stop();
   batch_timer.Stop();
   DLOG(INFO)<< "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
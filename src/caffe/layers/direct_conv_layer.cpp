@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Number of output channels accumulated together. Each loaded input row
+// feeds this many output rows, which stay in registers along the inner loop.
+#define DIRECT_CONV_BLOCK 4
+
+// Range [start, end) of output positions o for which the input position
+// o * stride + offset lies inside [0, size).
+inline void direct_conv_valid_range(const int_tp offset, const int_tp stride,
+                                    const int_tp size, const int_tp size_out,
+                                    int_tp* start, int_tp* end) {
+  *start = offset < 0 ? (-offset + stride - 1) / stride : 0;
+  *end = offset < size ? std::min((size - 1 - offset) / stride + 1, size_out)
+                       : 0;
+  *start = std::min(*start, *end);
+}
+
+// Accumulates one input row into block output rows:
+// out[b][o] += w[b] * in[o * stride] for o in [start, end).
+template <typename Dtype>
+inline void direct_conv_row(const Dtype* in, const int_tp stride,
+                            const int_tp start, const int_tp end,
+                            const int_tp block, const Dtype* w,
+                            Dtype* const* out) {
+  if (block == DIRECT_CONV_BLOCK) {
+    const Dtype w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3];
+    Dtype* o0 = out[0];
+    Dtype* o1 = out[1];
+    Dtype* o2 = out[2];
+    Dtype* o3 = out[3];
+    if (stride == 1) {
+      for (int_tp o = start; o < end; ++o) {
+        const Dtype x = in[o];
+        o0[o] += w0 * x;
+        o1[o] += w1 * x;
+        o2[o] += w2 * x;
+        o3[o] += w3 * x;
+      }
+    } else {
+      for (int_tp o = start; o < end; ++o) {
+        const Dtype x = in[o * stride];
+        o0[o] += w0 * x;
+        o1[o] += w1 * x;
+        o2[o] += w2 * x;
+        o3[o] += w3 * x;
+      }
+    }
+  } else {
+    for (int_tp b = 0; b < block; ++b) {
+      const Dtype wb = w[b];
+      Dtype* ob = out[b];
+      for (int_tp o = start; o < end; ++o) {
+        ob[o] += wb * in[o * stride];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  CHECK_GE(this->num_spatial_axes_, 1)
+      << "DirectConvolutionLayer needs at least one spatial axis.";
+  CHECK_LE(this->num_spatial_axes_, 3)
+      << "DirectConvolutionLayer supports up to three spatial axes.";
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::direct_geometry(int_tp* in_shape,
+    int_tp* out_shape, int_tp* kernel, int_tp* pad, int_tp* stride,
+    int_tp* kstride) {
+  const int_tp skip = 3 - this->num_spatial_axes_;
+  for (int_tp i = 0; i < 3; ++i) {
+    if (i < skip) {
+      in_shape[i] = out_shape[i] = kernel[i] = stride[i] = kstride[i] = 1;
+      pad[i] = 0;
+    } else {
+      const int_tp j = i - skip;
+      in_shape[i] = this->input_shape(j + 1);
+      out_shape[i] = this->output_shape_[j];
+      kernel[i] = this->kernel_shape_.cpu_data()[j];
+      pad[i] = this->pad_.cpu_data()[j];
+      stride[i] = this->stride_.cpu_data()[j];
+      kstride[i] = this->kstride_.cpu_data()[j];
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  int_tp in_shape[3], out_shape[3], kernel[3], pad[3], stride[3], kstride[3];
+  direct_geometry(in_shape, out_shape, kernel, pad, stride, kstride);
+  const int_tp in_spatial = in_shape[0] * in_shape[1] * in_shape[2];
+  const int_tp out_spatial = out_shape[0] * out_shape[1] * out_shape[2];
+  const int_tp kernel_size = kernel[0] * kernel[1] * kernel[2];
+  const int_tp in_group = this->channels_ / this->group_;
+  const int_tp out_group = this->num_output_ / this->group_;
+  const int_tp blocks_group =
+      (out_group + DIRECT_CONV_BLOCK - 1) / DIRECT_CONV_BLOCK;
+  const int_tp num_blocks = this->num_ * this->group_ * blocks_group;
+  // Valid output range along the width for every kernel column.
+  vector<int_tp> w_start(kernel[2]), w_end(kernel[2]);
+  for (int_tp kw = 0; kw < kernel[2]; ++kw) {
+    direct_conv_valid_range(kw * kstride[2] - pad[2], stride[2], in_shape[2],
+                            out_shape[2], &w_start[kw], &w_end[kw]);
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+#pragma omp parallel for
+    for (int_tp blk = 0; blk < num_blocks; ++blk) {
+      const int_tp n = blk / (this->group_ * blocks_group);
+      const int_tp g = (blk / blocks_group) % this->group_;
+      const int_tp o_first = g * out_group
+          + (blk % blocks_group) * DIRECT_CONV_BLOCK;
+      const int_tp block = std::min(static_cast<int_tp>(DIRECT_CONV_BLOCK),
+                                    (g + 1) * out_group - o_first);
+      Dtype* out[DIRECT_CONV_BLOCK];
+      Dtype w[DIRECT_CONV_BLOCK];
+      for (int_tp b = 0; b < block; ++b) {
+        out[b] = top_data + n * this->top_dim_ + (o_first + b) * out_spatial;
+        caffe_set(out_spatial, Dtype(0), out[b]);
+      }
+      const Dtype* in_image = bottom_data + n * this->bottom_dim_
+          + g * in_group * in_spatial;
+      for (int_tp c = 0; c < in_group; ++c) {
+        const Dtype* in_channel = in_image + c * in_spatial;
+        for (int_tp kd = 0; kd < kernel[0]; ++kd) {
+          for (int_tp kh = 0; kh < kernel[1]; ++kh) {
+            for (int_tp od = 0; od < out_shape[0]; ++od) {
+              const int_tp id = od * stride[0] + kd * kstride[0] - pad[0];
+              if (id < 0 || id >= in_shape[0]) {
+                continue;
+              }
+              for (int_tp oh = 0; oh < out_shape[1]; ++oh) {
+                const int_tp ih = oh * stride[1] + kh * kstride[1] - pad[1];
+                if (ih < 0 || ih >= in_shape[1]) {
+                  continue;
+                }
+                const Dtype* in_row = in_channel
+                    + (id * in_shape[1] + ih) * in_shape[2];
+                Dtype* out_row[DIRECT_CONV_BLOCK];
+                const int_tp out_offset =
+                    (od * out_shape[1] + oh) * out_shape[2];
+                for (int_tp b = 0; b < block; ++b) {
+                  out_row[b] = out[b] + out_offset;
+                }
+                for (int_tp kw = 0; kw < kernel[2]; ++kw) {
+                  const int_tp k = (kd * kernel[1] + kh) * kernel[2] + kw;
+                  for (int_tp b = 0; b < block; ++b) {
+                    w[b] = weight[((o_first + b) * in_group + c) * kernel_size
+                                  + k];
+                  }
+                  direct_conv_row(in_row + kw * kstride[2] - pad[2], stride[2],
+                                  w_start[kw], w_end[kw], block, w, out_row);
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    if (this->bias_term_ || this->fused_relu_) {
+      const Dtype* bias = this->bias_term_ ?
+          this->blobs_[1]->cpu_data() : NULL;
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!this->fused_relu_) << "Convolutions with a fused ReLU cannot be "
+                            << "trained.";
+  int_tp in_shape[3], out_shape[3], kernel[3], pad[3], stride[3], kstride[3];
+  direct_geometry(in_shape, out_shape, kernel, pad, stride, kstride);
+  const int_tp in_spatial = in_shape[0] * in_shape[1] * in_shape[2];
+  const int_tp out_spatial = out_shape[0] * out_shape[1] * out_shape[2];
+  const int_tp kernel_size = kernel[0] * kernel[1] * kernel[2];
+  const int_tp in_group = this->channels_ / this->group_;
+  const int_tp out_group = this->num_output_ / this->group_;
+  vector<int_tp> w_start(kernel[2]), w_end(kernel[2]);
+  for (int_tp kw = 0; kw < kernel[2]; ++kw) {
+    direct_conv_valid_range(kw * kstride[2] - pad[2], stride[2], in_shape[2],
+                            out_shape[2], &w_start[kw], &w_end[kw]);
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  for (int_tp i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    // Gradient w.r.t. weight: every output channel owns its filter, so the
+    // output channels are processed in parallel and accumulate over images.
+    if (this->param_propagate_down_[0]) {
+#pragma omp parallel for
+      for (int_tp o = 0; o < this->num_output_; ++o) {
+        const int_tp g = o / out_group;
+        Dtype* o_weight_diff = weight_diff + o * in_group * kernel_size;
+        for (int_tp n = 0; n < this->num_; ++n) {
+          const Dtype* o_top_diff = top_diff + n * this->top_dim_
+              + o * out_spatial;
+          const Dtype* in_image = bottom_data + n * this->bottom_dim_
+              + g * in_group * in_spatial;
+          for (int_tp c = 0; c < in_group; ++c) {
+            const Dtype* in_channel = in_image + c * in_spatial;
+            for (int_tp k = 0; k < kernel_size; ++k) {
+              const int_tp kw = k % kernel[2];
+              const int_tp kh = (k / kernel[2]) % kernel[1];
+              const int_tp kd = k / kernel[2] / kernel[1];
+              const int_tp w_off = kw * kstride[2] - pad[2];
+              Dtype sum = 0;
+              for (int_tp od = 0; od < out_shape[0]; ++od) {
+                const int_tp id = od * stride[0] + kd * kstride[0] - pad[0];
+                if (id < 0 || id >= in_shape[0]) {
+                  continue;
+                }
+                for (int_tp oh = 0; oh < out_shape[1]; ++oh) {
+                  const int_tp ih = oh * stride[1] + kh * kstride[1] - pad[1];
+                  if (ih < 0 || ih >= in_shape[1]) {
+                    continue;
+                  }
+                  const Dtype* in_row = in_channel
+                      + (id * in_shape[1] + ih) * in_shape[2] + w_off;
+                  const Dtype* diff_row = o_top_diff
+                      + (od * out_shape[1] + oh) * out_shape[2];
+                  for (int_tp ow = w_start[kw]; ow < w_end[kw]; ++ow) {
+                    sum += diff_row[ow] * in_row[ow * stride[2]];
+                  }
+                }
+              }
+              o_weight_diff[c * kernel_size + k] += sum;
+            }
+          }
+        }
+      }
+    }
+    // Gradient w.r.t. bottom data: scatter the output gradient back through
+    // the filters, in parallel over the input channels of every image.
+    if (propagate_down[i]) {
+      Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
+#pragma omp parallel for
+      for (int_tp nc = 0; nc < this->num_ * this->channels_; ++nc) {
+        const int_tp n = nc / this->channels_;
+        const int_tp c_all = nc % this->channels_;
+        const int_tp g = c_all / in_group;
+        const int_tp c = c_all % in_group;
+        Dtype* in_diff = bottom_diff + n * this->bottom_dim_
+            + c_all * in_spatial;
+        caffe_set(in_spatial, Dtype(0), in_diff);
+        for (int_tp o = g * out_group; o < (g + 1) * out_group; ++o) {
+          const Dtype* o_top_diff = top_diff + n * this->top_dim_
+              + o * out_spatial;
+          const Dtype* o_weight = weight + (o * in_group + c) * kernel_size;
+          for (int_tp k = 0; k < kernel_size; ++k) {
+            const int_tp kw = k % kernel[2];
+            const int_tp kh = (k / kernel[2]) % kernel[1];
+            const int_tp kd = k / kernel[2] / kernel[1];
+            const int_tp w_off = kw * kstride[2] - pad[2];
+            const Dtype w = o_weight[k];
+            for (int_tp od = 0; od < out_shape[0]; ++od) {
+              const int_tp id = od * stride[0] + kd * kstride[0] - pad[0];
+              if (id < 0 || id >= in_shape[0]) {
+                continue;
+              }
+              for (int_tp oh = 0; oh < out_shape[1]; ++oh) {
+                const int_tp ih = oh * stride[1] + kh * kstride[1] - pad[1];
+                if (ih < 0 || ih >= in_shape[1]) {
+                  continue;
+                }
+                Dtype* in_row = in_diff
+                    + (id * in_shape[1] + ih) * in_shape[2] + w_off;
+                const Dtype* diff_row = o_top_diff
+                    + (od * out_shape[1] + oh) * out_shape[2];
+                for (int_tp ow = w_start[kw]; ow < w_end[kw]; ++ow) {
+                  in_row[ow * stride[2]] += w * diff_row[ow];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(DirectConvolutionLayer);
+
+}  // namespace caffe
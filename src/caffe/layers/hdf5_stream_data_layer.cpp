@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "hdf5.h"
+
+#include "caffe/data_layers.hpp"
+#include "caffe/util/hdf5.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+HDF5StreamDataLayer<Dtype>::~HDF5StreamDataLayer<Dtype>() {
+  this->StopInternalThread();
+  CloseFiles();
+}
+
+template <typename Dtype>
+void HDF5StreamDataLayer<Dtype>::CloseFiles() {
+  HDF5Lock lock;
+  for (int_tp i = 0; i < dataset_ids_.size(); ++i) {
+    for (int_tp j = 0; j < dataset_ids_[i].size(); ++j) {
+      H5Dclose(dataset_ids_[i][j]);
+    }
+  }
+  for (int_tp i = 0; i < file_ids_.size(); ++i) {
+    H5Fclose(file_ids_[i]);
+  }
+  dataset_ids_.clear();
+  dataset_shapes_.clear();
+  file_ids_.clear();
+}
+
+template <typename Dtype>
+void HDF5StreamDataLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // Refuse transformation parameters since HDF5 is totally generic.
+  CHECK(!this->layer_param_.has_transform_param()) <<
+      this->type() << " does not transform data.";
+  this->StopInternalThread();
+  CloseFiles();
+  const HDF5DataParameter& param = this->layer_param_.hdf5_data_param();
+  // Read the source to parse the filenames.
+  const string& source = param.source();
+  LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
+  hdf_filenames_.clear();
+  std::ifstream source_file(source.c_str());
+  if (source_file.is_open()) {
+    std::string line;
+    while (source_file >> line) {
+      hdf_filenames_.push_back(line);
+    }
+  } else {
+    LOG(FATAL) << "Failed to open source file: " << source;
+  }
+  source_file.close();
+  const int_tp num_files = hdf_filenames_.size();
+  LOG(INFO) << "Number of HDF5 files: " << num_files;
+  CHECK_GE(num_files, 1) << "Must have at least 1 HDF5 filename listed in "
+    << source;
+
+  // Open every dataset, which are then read by the prefetch thread only.
+  const int_tp top_size = this->layer_param_.top_size();
+  {
+    HDF5Lock lock;
+    hid_t access_id = H5Pcreate(H5P_DATASET_ACCESS);
+    if (param.chunk_cache_bytes() > 0) {
+      H5Pset_chunk_cache(access_id, H5D_CHUNK_CACHE_NSLOTS_DEFAULT,
+                         param.chunk_cache_bytes(), H5D_CHUNK_CACHE_W0_DEFAULT);
+    }
+    for (int_tp i = 0; i < num_files; ++i) {
+      hid_t file_id = H5Fopen(hdf_filenames_[i].c_str(), H5F_ACC_RDONLY,
+                              H5P_DEFAULT);
+      if (file_id < 0) {
+        LOG(FATAL) << "Failed opening HDF5 file: " << hdf_filenames_[i];
+      }
+      file_ids_.push_back(file_id);
+      dataset_ids_.push_back(vector<hid_t>());
+      dataset_shapes_.push_back(vector<vector<hsize_t> >());
+      for (int_tp j = 0; j < top_size; ++j) {
+        const string& name = this->layer_param_.top(j);
+        hid_t dataset_id = H5Dopen2(file_id, name.c_str(), access_id);
+        if (dataset_id < 0) {
+          LOG(FATAL) << "Failed to find HDF5 dataset " << name << " in "
+                     << hdf_filenames_[i];
+        }
+        dataset_ids_[i].push_back(dataset_id);
+        dataset_shapes_[i].push_back(hdf5_get_dataset_shape(dataset_id));
+      }
+    }
+    H5Pclose(access_id);
+  }
+
+  // Check the shapes, and set the top shapes from the first file.
+  patch_shape_.assign(param.patch_shape().begin(), param.patch_shape().end());
+  const int_tp patch_axes = patch_shape_.size();
+  const int_tp batch_size = param.batch_size();
+  vector<vector<int_tp> > top_shapes(top_size);
+  for (int_tp j = 0; j < top_size; ++j) {
+    const vector<hsize_t>& shape = dataset_shapes_[0][j];
+    CHECK_GE(shape.size(), 1) << "Input must have at least 1 axis.";
+    // Rows are read along the first axis, and the other axes whole. Patches
+    // are read along the last axes, and the leading axes whole.
+    const int_tp leading_axes = shape.size() - patch_axes;
+    CHECK_GE(leading_axes, 0) << "Dataset " << this->layer_param_.top(j)
+        << " has fewer axes than patch_shape";
+    const int_tp first_axis = patch_axes ? 0 : 1;
+    top_shapes[j].push_back(batch_size);
+    for (int_tp k = first_axis; k < leading_axes; ++k) {
+      top_shapes[j].push_back(shape[k]);
+    }
+    for (int_tp k = 0; k < patch_axes; ++k) {
+      top_shapes[j].push_back(patch_shape_[k]);
+    }
+    for (int_tp i = 0; i < num_files; ++i) {
+      const vector<hsize_t>& file_shape = dataset_shapes_[i][j];
+      CHECK_EQ(file_shape.size(), shape.size())
+          << "Datasets must have the same axes in all files";
+      for (int_tp k = first_axis; k < leading_axes; ++k) {
+        CHECK_EQ(file_shape[k], shape[k])
+            << "Datasets must have the same shape in all files";
+      }
+      for (int_tp k = 0; k < patch_axes; ++k) {
+        CHECK_EQ(file_shape[leading_axes + k],
+                 dataset_shapes_[i][0][dataset_shapes_[i][0].size()
+                                       - patch_axes + k])
+            << "Datasets of a file must have the same patch axes";
+      }
+      if (!patch_axes) {
+        CHECK_EQ(file_shape[0], dataset_shapes_[i][0][0])
+            << "Datasets of a file must have the same number of rows";
+      }
+    }
+  }
+  if (patch_axes) {
+    this->ClearPatchSources(vector<int_tp>(patch_shape_.begin(),
+                                           patch_shape_.end()));
+    for (int_tp i = 0; i < num_files; ++i) {
+      const vector<hsize_t>& shape = dataset_shapes_[i][0];
+      this->AddPatchSource(vector<int_tp>(shape.end() - patch_axes,
+                                          shape.end()), hdf_filenames_[i]);
+    }
+    LOG(INFO) << "Sampling patches from " << this->patch_positions_.back()
+              << " positions";
+  }
+
+  // Rows are only read from files that have some.
+  file_permutation_.clear();
+  for (int_tp i = 0; i < num_files; ++i) {
+    if (patch_axes || dataset_shapes_[i][0][0] > 0) {
+      file_permutation_.push_back(i);
+    } else {
+      LOG(WARNING) << "Skipping HDF5 file without rows: "
+                   << hdf_filenames_[i];
+    }
+  }
+  CHECK(!file_permutation_.empty()) << "No rows in the HDF5 files listed in "
+      << source;
+  current_file_ = 0;
+  this->StartPrefetch(top_shapes, param.prefetch(), top);
+}
+
+// Starts reading rows from the current file.
+template <typename Dtype>
+void HDF5StreamDataLayer<Dtype>::StartFile() {
+  const hsize_t rows = dataset_shapes_[file_permutation_[current_file_]][0][0];
+  data_permutation_.resize(rows);
+  for (hsize_t i = 0; i < rows; ++i) {
+    data_permutation_[i] = i;
+  }
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    shuffle(data_permutation_.begin(), data_permutation_.end(), caffe_rng());
+  }
+  current_row_ = 0;
+}
+
+template <typename Dtype>
+void HDF5StreamDataLayer<Dtype>::InternalThreadEntry() {
+  // The thread shuffles with its own RNG, seeded by StartInternalThread.
+  if (patch_shape_.empty()) {
+    if (this->layer_param_.hdf5_data_param().shuffle()) {
+      shuffle(file_permutation_.begin(), file_permutation_.end(),
+              caffe_rng());
+    }
+    StartFile();
+  }
+  BaseTopPrefetchingLayer<Dtype>::InternalThreadEntry();
+}
+
+template <typename Dtype>
+void HDF5StreamDataLayer<Dtype>::load_batch(TopBatch<Dtype>* batch) {
+  if (patch_shape_.empty()) {
+    LoadRows(batch);
+  } else {
+    LoadPatches(batch);
+  }
+}
+
+// Reads the rows of a batch, as runs of consecutive rows unless shuffled.
+template <typename Dtype>
+void HDF5StreamDataLayer<Dtype>::LoadRows(TopBatch<Dtype>* batch) {
+  const HDF5DataParameter& param = this->layer_param_.hdf5_data_param();
+  const hsize_t batch_size = param.batch_size();
+  const int_tp num_files = file_permutation_.size();
+  hsize_t item = 0;
+  while (item < batch_size) {
+    const uint_tp file = file_permutation_[current_file_];
+    const hsize_t rows = dataset_shapes_[file][0][0];
+    if (current_row_ == rows) {
+      if (num_files > 1) {
+        ++current_file_;
+        if (current_file_ == num_files) {
+          current_file_ = 0;
+          if (param.shuffle()) {
+            shuffle(file_permutation_.begin(), file_permutation_.end(),
+                    caffe_rng());
+          }
+          DLOG(INFO) << "Looping around to first file.";
+        }
+      }
+      StartFile();
+      continue;
+    }
+    const hsize_t run = param.shuffle() ? 1 :
+        std::min(batch_size - item, rows - current_row_);
+    for (int_tp j = 0; j < dataset_ids_[file].size(); ++j) {
+      Blob<Dtype>* blob = batch->blobs_[j].get();
+      vector<hsize_t> offset(dataset_shapes_[file][j].size(), 0);
+      vector<hsize_t> count(dataset_shapes_[file][j]);
+      offset[0] = data_permutation_[current_row_];
+      count[0] = run;
+      hdf5_read_hyperslab(dataset_ids_[file][j], offset, count,
+                          blob->mutable_cpu_data() + item * blob->count(1));
+    }
+    item += run;
+    current_row_ += run;
+  }
+}
+
+// Reads a patch at a random position of a random file for every item.
+template <typename Dtype>
+void HDF5StreamDataLayer<Dtype>::LoadPatches(TopBatch<Dtype>* batch) {
+  const int_tp batch_size = this->layer_param_.hdf5_data_param().batch_size();
+  const int_tp patch_axes = patch_shape_.size();
+  vector<int_tp> position;
+  for (int_tp item = 0; item < batch_size; ++item) {
+    const int_tp file = this->SamplePatch(&position);
+    const vector<hsize_t> patch_offset(position.begin(), position.end());
+    for (int_tp j = 0; j < dataset_ids_[file].size(); ++j) {
+      Blob<Dtype>* blob = batch->blobs_[j].get();
+      const int_tp leading_axes = dataset_shapes_[file][j].size() - patch_axes;
+      vector<hsize_t> offset(leading_axes, 0);
+      vector<hsize_t> count(dataset_shapes_[file][j].begin(),
+                            dataset_shapes_[file][j].begin() + leading_axes);
+      offset.insert(offset.end(), patch_offset.begin(), patch_offset.end());
+      count.insert(count.end(), patch_shape_.begin(), patch_shape_.end());
+      hdf5_read_hyperslab(dataset_ids_[file][j], offset, count,
+                          blob->mutable_cpu_data() + item * blob->count(1));
+    }
+  }
+}
+
+INSTANTIATE_CLASS(HDF5StreamDataLayer);
+REGISTER_LAYER_CLASS(HDF5StreamData);
+
+}  // namespace caffe
@@ -3,18 +3,38 @@
 
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
+#include <map>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/decoded_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+// Reads an image, or takes it decoded and resized from the cache if given.
+static cv::Mat ReadCachedImageToCVMat(DecodedCache* cache, int_tp index,
+    const string& filename, const int_tp height, const int_tp width,
+    const bool is_color) {
+  if (cache) {
+    cv::Mat cv_img = cache->FindMat(index);
+    if (cv_img.data) {
+      return cv_img;
+    }
+  }
+  cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color);
+  if (cache && cv_img.data) {
+    cache->InsertMat(index, cv_img);
+  }
+  return cv_img;
+}
+
 template <typename Dtype>
 ImageDataLayer<Dtype>::~ImageDataLayer<Dtype>() {
   this->StopInternalThread();
@@ -41,6 +61,24 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     lines_.push_back(std::make_pair(filename, label));
   }
 
+  const uint_tp cache_bytes =
+      this->layer_param_.image_data_param().cache_bytes();
+  if (cache_bytes > 0) {
+    cache_index_.clear();
+    for (int_tp i = 0; i < lines_.size(); ++i) {
+      cache_index_.insert(std::make_pair(lines_[i].first, i));
+    }
+    std::ostringstream key;
+    key << source << " " << root_folder << " " << new_height << "x"
+        << new_width << (is_color ? " color" : " gray");
+    const string& cache_file =
+        this->layer_param_.image_data_param().cache_file();
+    LOG(INFO) << "Caching up to " << cache_bytes << " bytes of decoded images"
+              << (cache_file.empty() ? "" : " in " + cache_file);
+    cache_.reset(new DecodedCache(key.str(), 2 * cache_index_.size(),
+                                  cache_bytes, cache_file));
+  }
+
   if (this->layer_param_.image_data_param().shuffle()) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
@@ -60,8 +98,9 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     lines_id_ = skip;
   }
   // Read an image, and use it to initialize the top blob.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-                                    new_height, new_width, is_color);
+  cv::Mat cv_img = ReadCachedImageToCVMat(cache_.get(),
+      cache_index(lines_[lines_id_].first), root_folder
+      + lines_[lines_id_].first, new_height, new_width, is_color);
   CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
   // Use data_transformer to infer the expected blob shape from a cv_image.
   vector<int_tp> top_shape = this->data_transformer_->InferBlobShape(cv_img);
@@ -70,8 +109,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int_tp batch_size = this->layer_param_.image_data_param().batch_size();
   CHECK_GT(batch_size, 0) << "Positive batch size required";
   top_shape[0] = batch_size;
-  for (int_tp i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape);
+  for (int_tp i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
   }
   top[0]->Reshape(top_shape);
 
@@ -81,8 +120,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // label
   vector<int_tp> label_shape(1, batch_size);
   top[1]->Reshape(label_shape);
-  for (int_tp i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].label_.Reshape(label_shape);
+  for (int_tp i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.Reshape(label_shape);
   }
 }
 
@@ -100,7 +139,6 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   batch_timer.Start();
   double read_time = 0;
   double trans_time = 0;
-  CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
   ImageDataParameter image_data_param = this->layer_param_.image_data_param();
@@ -112,8 +150,9 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
 
   // Reshape according to the first image of each batch
   // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
+  cv::Mat cv_img = ReadCachedImageToCVMat(cache_.get(),
+      cache_index(lines_[lines_id_].first), root_folder
+      + lines_[lines_id_].first, new_height, new_width, is_color);
   CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
   // Use data_transformer to infer the expected blob shape from a cv_img.
   vector<int_tp> top_shape = this->data_transformer_->InferBlobShape(cv_img);
@@ -127,33 +166,66 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
 
   // datum scales
   const int_tp lines_size = lines_.size();
+  vector<std::pair<std::string, int_tp> > batch_lines(batch_size);
+  vector<int_tp> batch_cache_index(batch_size);
+  bool epoch_done = false;
   for (int_tp item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
     CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int_tp offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
+    batch_lines[item_id] = lines_[lines_id_];
+    batch_cache_index[item_id] = cache_index(lines_[lines_id_].first);
     prefetch_label[item_id] = lines_[lines_id_].second;
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
       // We have reached the end. Restart from the first.
       DLOG(INFO) << "Restarting data prefetching from start.";
+      epoch_done = true;
       lines_id_ = 0;
       if (this->layer_param_.image_data_param().shuffle()) {
         ShuffleImages();
       }
     }
   }
+  // Decode and transform the images, with each worker taking every
+  // workers-th image.
+  const int_tp workers = this->worker_transformers_.size();
+  vector<double> worker_read_time(workers, 0);
+  vector<double> worker_trans_time(workers, 0);
+  for (int_tp w = 0; w < workers; ++w) {
+    this->worker_transformed_data_[w]->Reshape(
+        this->transformed_data_.shape());
+  }
+#pragma omp parallel for num_threads(workers)
+  for (int_tp w = 0; w < workers; ++w) {
+    CPUTimer worker_timer;
+    Blob<Dtype>* transformed_data = this->worker_transformed_data_[w].get();
+    for (int_tp item_id = w; item_id < batch_size; item_id += workers) {
+      // get a blob
+      worker_timer.Start();
+      const string& filename = batch_lines[item_id].first;
+      cv::Mat cv_img = ReadCachedImageToCVMat(cache_.get(),
+          batch_cache_index[item_id], root_folder + filename, new_height,
+          new_width, is_color);
+      CHECK(cv_img.data) << "Could not load " << filename;
+      worker_read_time[w] += worker_timer.MicroSeconds();
+      worker_timer.Start();
+      // Apply transformations (mirror, crop...) to the image
+      int_tp offset = batch->data_.offset(item_id);
+      transformed_data->set_cpu_data(prefetch_data + offset);
+      this->worker_transformers_[w]->Transform(cv_img, transformed_data);
+      worker_trans_time[w] += worker_timer.MicroSeconds();
+    }
+  }
+  for (int_tp w = 0; w < workers; ++w) {
+    read_time += worker_read_time[w];
+    trans_time += worker_trans_time[w];
+  }
+  if (cache_ && epoch_done) {
+    LOG(INFO) << "Decoded cache epoch: " << cache_->hits() << " hits, "
+              << cache_->misses() << " misses, " << cache_->bytes_used()
+              << " of " << cache_->bytes() << " bytes used";
+    cache_->ResetCounters();
+  }
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
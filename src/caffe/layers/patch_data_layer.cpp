@@ -0,0 +1,473 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hdf5.h"
+
+#include "caffe/data_layers.hpp"
+#include "caffe/util/hdf5.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+// A volume read box by box.
+template <typename Dtype>
+class PatchVolume {
+ public:
+  virtual ~PatchVolume() {}
+  inline const vector<int_tp>& shape() const { return shape_; }
+  // Reads the box of count elements per axis at offset in row-major order.
+  virtual void Read(const vector<int_tp>& offset, const vector<int_tp>& count,
+                    Dtype* data) = 0;
+
+ protected:
+  vector<int_tp> shape_;
+};
+
+template <typename Dtype>
+class HDF5PatchVolume : public PatchVolume<Dtype> {
+ public:
+  HDF5PatchVolume(const string& filename, const string& dataset,
+                  uint_tp chunk_cache_bytes) {
+    HDF5Lock lock;
+    file_id_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id_ < 0) {
+      LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+    }
+    hid_t access_id = H5Pcreate(H5P_DATASET_ACCESS);
+    if (chunk_cache_bytes > 0) {
+      H5Pset_chunk_cache(access_id, H5D_CHUNK_CACHE_NSLOTS_DEFAULT,
+                         chunk_cache_bytes, H5D_CHUNK_CACHE_W0_DEFAULT);
+    }
+    dataset_id_ = H5Dopen2(file_id_, dataset.c_str(), access_id);
+    H5Pclose(access_id);
+    if (dataset_id_ < 0) {
+      LOG(FATAL) << "Failed to find HDF5 dataset " << dataset << " in "
+                 << filename;
+    }
+    vector<hsize_t> shape = hdf5_get_dataset_shape(dataset_id_);
+    this->shape_.assign(shape.begin(), shape.end());
+  }
+  virtual ~HDF5PatchVolume() {
+    HDF5Lock lock;
+    H5Dclose(dataset_id_);
+    H5Fclose(file_id_);
+  }
+  virtual void Read(const vector<int_tp>& offset, const vector<int_tp>& count,
+                    Dtype* data) {
+    hdf5_read_hyperslab(dataset_id_,
+        vector<hsize_t>(offset.begin(), offset.end()),
+        vector<hsize_t>(count.begin(), count.end()), data);
+  }
+
+ private:
+  hid_t file_id_;
+  hid_t dataset_id_;
+};
+
+// A little-endian, C-ordered NumPy array file, mapped into memory.
+template <typename Dtype>
+class NpyPatchVolume : public PatchVolume<Dtype> {
+ public:
+  explicit NpyPatchVolume(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "Could not open " << filename;
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << "Could not stat " << filename;
+    size_ = st.st_size;
+    void* memory = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(memory != MAP_FAILED) << "Could not map " << filename;
+    memory_ = static_cast<const char*>(memory);
+
+    // The header is a magic string, a version, the header length, and a
+    // Python dict literal with the type, the order and the shape.
+    CHECK(size_ >= 10 && memcmp(memory_, "\x93NUMPY", 6) == 0)
+        << filename << " is not a NumPy file";
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(memory_);
+    uint_tp header_size;
+    uint_tp header_offset;
+    if (bytes[6] == 1) {
+      header_size = bytes[8] | (bytes[9] << 8);
+      header_offset = 10;
+    } else {
+      CHECK_GE(size_, 12) << filename << " is not a NumPy file";
+      header_size = bytes[8] | (bytes[9] << 8) | (bytes[10] << 16)
+          | (static_cast<uint_tp>(bytes[11]) << 24);
+      header_offset = 12;
+    }
+    CHECK_LE(header_offset + header_size, size_) << filename
+        << " is truncated";
+    const string header(memory_ + header_offset, header_size);
+    CHECK(header.find("'fortran_order': False") != string::npos)
+        << filename << " must be in C order";
+    const size_t descr = header.find("'descr':");
+    CHECK(descr != string::npos) << "No type in " << filename;
+    const size_t type_begin = header.find('\'', descr + 8) + 1;
+    type_ = header.substr(type_begin, header.find('\'', type_begin)
+                          - type_begin);
+    CHECK(type_.size() > 1 && (type_[0] == '<' || type_[0] == '|'))
+        << "Unsupported type " << type_ << " in " << filename;
+    type_ = type_.substr(1);
+    const size_t shape = header.find("'shape':");
+    CHECK(shape != string::npos) << "No shape in " << filename;
+    const size_t shape_begin = header.find('(', shape) + 1;
+    std::istringstream shape_stream(header.substr(shape_begin,
+        header.find(')', shape_begin) - shape_begin));
+    string dim;
+    while (std::getline(shape_stream, dim, ',')) {
+      if (dim.find_first_not_of(' ') != string::npos) {
+        this->shape_.push_back(atoll(dim.c_str()));
+      }
+    }
+    data_ = memory_ + header_offset + header_size;
+    int_tp count = 1;
+    for (int_tp i = 0; i < this->shape_.size(); ++i) {
+      count *= this->shape_[i];
+    }
+    CHECK_LE(header_offset + header_size + count * ElementSize(), size_)
+        << filename << " is truncated";
+  }
+  virtual ~NpyPatchVolume() {
+    munmap(const_cast<char*>(memory_), size_);
+  }
+  virtual void Read(const vector<int_tp>& offset, const vector<int_tp>& count,
+                    Dtype* data) {
+    if (type_ == "u1") {
+      ReadAs<uint8_t>(offset, count, data);
+    } else if (type_ == "u2") {
+      ReadAs<uint16_t>(offset, count, data);
+    } else if (type_ == "u4") {
+      ReadAs<uint32_t>(offset, count, data);
+    } else if (type_ == "u8") {
+      ReadAs<uint64_t>(offset, count, data);
+    } else if (type_ == "i1") {
+      ReadAs<int8_t>(offset, count, data);
+    } else if (type_ == "i2") {
+      ReadAs<int16_t>(offset, count, data);
+    } else if (type_ == "i4") {
+      ReadAs<int32_t>(offset, count, data);
+    } else if (type_ == "i8") {
+      ReadAs<int64_t>(offset, count, data);
+    } else if (type_ == "f4") {
+      ReadAs<float>(offset, count, data);
+    } else if (type_ == "f8") {
+      ReadAs<double>(offset, count, data);
+    } else {
+      LOG(FATAL) << "Unsupported NumPy type " << type_;
+    }
+  }
+
+ private:
+  int_tp ElementSize() const {
+    return atoi(type_.c_str() + 1);
+  }
+  // Copies the box row by row along the last axis.
+  template <typename T>
+  void ReadAs(const vector<int_tp>& offset, const vector<int_tp>& count,
+              Dtype* data) const {
+    const T* source = reinterpret_cast<const T*>(data_);
+    const int_tp axes = this->shape_.size();
+    vector<int_tp> strides(axes, 1);
+    for (int_tp i = axes - 2; i >= 0; --i) {
+      strides[i] = strides[i + 1] * this->shape_[i + 1];
+    }
+    int_tp rows = 1;
+    for (int_tp i = 0; i < axes - 1; ++i) {
+      rows *= count[i];
+    }
+    const int_tp row_size = count[axes - 1];
+    vector<int_tp> index(offset.begin(), offset.end());
+    for (int_tp row = 0; row < rows; ++row) {
+      int_tp source_index = 0;
+      for (int_tp i = 0; i < axes; ++i) {
+        source_index += index[i] * strides[i];
+      }
+      const T* source_row = source + source_index;
+      for (int_tp i = 0; i < row_size; ++i) {
+        data[i] = static_cast<Dtype>(source_row[i]);
+      }
+      data += row_size;
+      for (int_tp i = axes - 2; i >= 0; --i) {
+        if (++index[i] < offset[i] + count[i]) {
+          break;
+        }
+        index[i] = offset[i];
+      }
+    }
+  }
+
+  const char* memory_;
+  uint_tp size_;
+  const char* data_;
+  string type_;
+};
+
+// Where to read an item, and how to augment it.
+struct PatchSample {
+  int_tp volume;
+  vector<int_tp> offset;
+  vector<int_tp> axes;
+  vector<bool> mirror;
+};
+
+// Writes the patch of shape permuted along axes and mirrored, one block of
+// the patch size per leading index.
+template <typename Dtype>
+static void AugmentPatch(const Dtype* patch, const vector<int_tp>& shape,
+                         const PatchSample& sample, int_tp blocks,
+                         Dtype* data) {
+  const int_tp axes = shape.size();
+  vector<int_tp> strides(axes, 1);
+  for (int_tp i = axes - 2; i >= 0; --i) {
+    strides[i] = strides[i + 1] * shape[i + 1];
+  }
+  // Output axis a walks source axis axes[a], backwards if mirrored.
+  vector<int_tp> steps(axes);
+  int_tp start = 0;
+  for (int_tp a = 0; a < axes; ++a) {
+    const int_tp source_axis = sample.axes[a];
+    if (sample.mirror[source_axis]) {
+      steps[a] = -strides[source_axis];
+      start += (shape[source_axis] - 1) * strides[source_axis];
+    } else {
+      steps[a] = strides[source_axis];
+    }
+  }
+  const int_tp block_size = strides[0] * shape[0];
+  for (int_tp block = 0; block < blocks; ++block) {
+    const Dtype* source = patch + block * block_size + start;
+    vector<int_tp> index(axes, 0);
+    int_tp source_index = 0;
+    for (int_tp i = 0; i < block_size; ++i) {
+      *data++ = source[source_index];
+      for (int_tp a = axes - 1; a >= 0; --a) {
+        source_index += steps[a];
+        if (++index[a] < shape[a]) {
+          break;
+        }
+        source_index -= shape[a] * steps[a];
+        index[a] = 0;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+PatchDataLayer<Dtype>::~PatchDataLayer<Dtype>() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void PatchDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  this->StopInternalThread();
+  const PatchDataParameter& param = this->layer_param_.patch_data_param();
+  const int_tp top_size = this->layer_param_.top_size();
+  CHECK_EQ(param.patch_shape_size(), top_size)
+      << "Specify a patch_shape for every top";
+  patch_shapes_.clear();
+  for (int_tp j = 0; j < top_size; ++j) {
+    patch_shapes_.push_back(vector<int_tp>(
+        param.patch_shape(j).dim().begin(), param.patch_shape(j).dim().end()));
+    CHECK_EQ(patch_shapes_[j].size(), patch_shapes_[0].size())
+        << "The patches of all tops must have the same number of axes";
+  }
+  const int_tp patch_axes = patch_shapes_[0].size();
+  CHECK_GT(patch_axes, 0) << "Patches need at least one axis";
+  vector<int_tp> box_shape(patch_axes, 0);
+  for (int_tp j = 0; j < top_size; ++j) {
+    for (int_tp k = 0; k < patch_axes; ++k) {
+      CHECK_GT(patch_shapes_[j][k], 0) << "Patch sizes must be positive";
+      box_shape[k] = std::max(box_shape[k], patch_shapes_[j][k]);
+    }
+  }
+  this->ClearPatchSources(box_shape);
+
+  // Open the volumes.
+  const string& source = param.source();
+  LOG(INFO) << "Loading list of volumes from: " << source;
+  std::ifstream source_file(source.c_str());
+  CHECK(source_file.is_open()) << "Failed to open source file: " << source;
+  volumes_.clear();
+  string line;
+  while (std::getline(source_file, line)) {
+    std::istringstream line_stream(line);
+    vector<string> filenames;
+    string filename;
+    while (line_stream >> filename) {
+      filenames.push_back(filename);
+    }
+    if (filenames.empty()) {
+      continue;
+    }
+    vector<shared_ptr<PatchVolume<Dtype> > > volume;
+    const bool npy = filenames[0].size() > 4
+        && filenames[0].substr(filenames[0].size() - 4) == ".npy";
+    if (npy) {
+      CHECK_EQ(filenames.size(), top_size)
+          << "Name a .npy file for every top in " << line;
+    } else {
+      CHECK_EQ(filenames.size(), 1) << "Name one HDF5 file in " << line;
+    }
+    for (int_tp j = 0; j < top_size; ++j) {
+      if (npy) {
+        volume.push_back(shared_ptr<PatchVolume<Dtype> >(
+            new NpyPatchVolume<Dtype>(filenames[j])));
+      } else {
+        volume.push_back(shared_ptr<PatchVolume<Dtype> >(
+            new HDF5PatchVolume<Dtype>(filenames[0],
+                this->layer_param_.top(j), param.chunk_cache_bytes())));
+      }
+    }
+    volumes_.push_back(volume);
+  }
+  LOG(INFO) << "Number of volumes: " << volumes_.size();
+  CHECK_GE(volumes_.size(), 1) << "Must have at least 1 volume listed in "
+      << source;
+
+  // Check the shapes, and count the positions of the largest patch.
+  vector<vector<int_tp> > top_shapes(top_size);
+  for (int_tp i = 0; i < volumes_.size(); ++i) {
+    const vector<int_tp>& first_shape = volumes_[i][0]->shape();
+    CHECK_GE(first_shape.size(), patch_axes)
+        << "Volumes must have at least the patch axes";
+    const vector<int_tp> patch_space(first_shape.end() - patch_axes,
+                                     first_shape.end());
+    for (int_tp j = 0; j < top_size; ++j) {
+      const vector<int_tp>& shape = volumes_[i][j]->shape();
+      CHECK_GE(shape.size(), patch_axes)
+          << "Volumes must have at least the patch axes";
+      CHECK(vector<int_tp>(shape.end() - patch_axes, shape.end())
+            == patch_space) << "The volumes of all tops must be aligned";
+      const vector<int_tp> leading(shape.begin(), shape.end() - patch_axes);
+      if (i == 0) {
+        top_shapes[j].push_back(param.batch_size());
+        top_shapes[j].insert(top_shapes[j].end(), leading.begin(),
+                             leading.end());
+        top_shapes[j].insert(top_shapes[j].end(), patch_shapes_[j].begin(),
+                             patch_shapes_[j].end());
+      } else {
+        CHECK(leading == vector<int_tp>(top_shapes[j].begin() + 1,
+                                        top_shapes[j].end() - patch_axes))
+            << "The leading axes of a top must be the same in all volumes";
+      }
+    }
+    std::ostringstream name;
+    name << "volume " << i;
+    this->AddPatchSource(patch_space, name.str());
+  }
+  LOG(INFO) << "Sampling patches from " << this->patch_positions_.back()
+            << " positions";
+
+  transpose_groups_.clear();
+  if (param.transpose()) {
+    vector<bool> grouped(patch_axes, false);
+    for (int_tp k = 0; k < patch_axes; ++k) {
+      vector<int_tp> group(1, k);
+      for (int_tp l = k + 1; l < patch_axes && !grouped[k]; ++l) {
+        bool equal = true;
+        for (int_tp j = 0; j < top_size; ++j) {
+          equal = equal && patch_shapes_[j][k] == patch_shapes_[j][l];
+        }
+        if (equal) {
+          group.push_back(l);
+          grouped[l] = true;
+        }
+      }
+      if (group.size() > 1) {
+        transpose_groups_.push_back(group);
+      }
+    }
+  }
+
+  CHECK_GT(param.threads(), 0) << "threads must be positive";
+  this->StartPrefetch(top_shapes, param.prefetch(), top);
+}
+
+template <typename Dtype>
+void PatchDataLayer<Dtype>::load_batch(TopBatch<Dtype>* batch) {
+  const PatchDataParameter& param = this->layer_param_.patch_data_param();
+  const int_tp batch_size = param.batch_size();
+  const vector<int_tp>& box_shape = this->patch_box_;
+  const int_tp patch_axes = box_shape.size();
+  const bool augment = this->phase_ == TRAIN;
+  // Draw all samples on this thread, which keeps them reproducible.
+  vector<PatchSample> samples(batch_size);
+  for (int_tp item = 0; item < batch_size; ++item) {
+    PatchSample& sample = samples[item];
+    sample.volume = this->SamplePatch(&sample.offset);
+    sample.axes.resize(patch_axes);
+    for (int_tp k = 0; k < patch_axes; ++k) {
+      sample.axes[k] = k;
+    }
+    sample.mirror.assign(patch_axes, false);
+    if (augment) {
+      for (int_tp g = 0; g < transpose_groups_.size(); ++g) {
+        vector<int_tp> group = transpose_groups_[g];
+        shuffle(group.begin(), group.end(), caffe_rng());
+        for (int_tp i = 0; i < group.size(); ++i) {
+          sample.axes[transpose_groups_[g][i]] = group[i];
+        }
+      }
+      if (param.mirror()) {
+        for (int_tp k = 0; k < patch_axes; ++k) {
+          sample.mirror[k] = caffe_rng_rand() % 2;
+        }
+      }
+    }
+  }
+
+  // Read and augment the items, the patches of a top centered in the
+  // largest patch.
+  const int_tp top_size = batch->blobs_.size();
+#pragma omp parallel for num_threads(param.threads())
+  for (int_tp item = 0; item < batch_size; ++item) {
+    const PatchSample& sample = samples[item];
+    bool identity = true;
+    for (int_tp k = 0; k < patch_axes; ++k) {
+      identity = identity && sample.axes[k] == k && !sample.mirror[k];
+    }
+    vector<Dtype> patch;
+    for (int_tp j = 0; j < top_size; ++j) {
+      PatchVolume<Dtype>* volume = volumes_[sample.volume][j].get();
+      const vector<int_tp>& shape = volume->shape();
+      const int_tp leading_axes = shape.size() - patch_axes;
+      vector<int_tp> offset(leading_axes, 0);
+      vector<int_tp> count(shape.begin(), shape.begin() + leading_axes);
+      int_tp blocks = 1;
+      for (int_tp k = 0; k < leading_axes; ++k) {
+        blocks *= shape[k];
+      }
+      for (int_tp k = 0; k < patch_axes; ++k) {
+        offset.push_back(sample.offset[k]
+            + (box_shape[k] - patch_shapes_[j][k]) / 2);
+        count.push_back(patch_shapes_[j][k]);
+      }
+      Blob<Dtype>* blob = batch->blobs_[j].get();
+      Dtype* data = blob->mutable_cpu_data() + item * blob->count(1);
+      if (identity) {
+        volume->Read(offset, count, data);
+      } else {
+        patch.resize(blob->count(1));
+        volume->Read(offset, count, &patch[0]);
+        AugmentPatch(&patch[0], patch_shapes_[j], sample, blocks, data);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(PatchDataLayer);
+REGISTER_LAYER_CLASS(PatchData);
+
+}  // namespace caffe
@@ -10,6 +10,9 @@ namespace caffe {
 using std::min;
 using std::max;
 
+// Spatial axes supported by CPU pooling, as by the N-D GPU kernels.
+const int_tp kMaxPoolingAxes = 6;
+
 template<typename Dtype>
 void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
                                          const vector<Blob<Dtype>*>& top) {
@@ -31,6 +34,8 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int_tp num_axes = bottom[0]->num_axes();
   num_spatial_axes_ = num_axes - first_spatial_axis;
   CHECK_GE(num_spatial_axes_, 0);
+  CHECK_LE(num_spatial_axes_, kMaxPoolingAxes)
+      << "Pooling supports at most " << kMaxPoolingAxes << " spatial axes.";
 
   vector<int_tp> bottom_dim_blob_shape(1, num_spatial_axes_ + 1);
   vector<int_tp> spatial_dim_blob_shape(1, std::max(num_spatial_axes_, 1L));
@@ -229,114 +234,275 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+// Input positions [*begin, *end) touched along one axis by the window of
+// pooled index p, with the first tap moved into the input. Returns the number
+// of taps inside the padded input, which average pooling divides by.
+inline int_tp pool_axis_window(const int_tp p, const int_tp size,
+                               const int_tp ext_kernel, const int_tp stride,
+                               const int_tp kstride, const int_tp pad,
+                               int_tp* begin, int_tp* end) {
+  const int_tp first = p * stride - pad;
+  const int_tp padded_end = min(first + ext_kernel, size + pad);
+  *begin = first < 0 ? first + (kstride - 1 - first) / kstride * kstride
+      : first;
+  *end = min(padded_end, size);
+  return (padded_end - first - 1) / kstride + 1;
+}
+
+// Window of the pooled row `row` (the flat index over all but the last
+// pooled axis) along the outer axes. Returns the number of padded taps, or 0
+// if the window misses the input along some axis.
+inline int_tp pool_row_window(int_tp row, const int_tp outer_axes,
+                              const int_tp* size, const int_tp* pooled_size,
+                              const int_tp* ext_kernel, const int_tp* stride,
+                              const int_tp* kstride, const int_tp* pad,
+                              int_tp* begin, int_tp* end) {
+  int_tp taps = 1;
+  bool empty = false;
+  for (int_tp i = outer_axes - 1; i >= 0; --i) {
+    taps *= pool_axis_window(row % pooled_size[i], size[i], ext_kernel[i],
+                             stride[i], kstride[i], pad[i], &begin[i],
+                             &end[i]);
+    empty |= begin[i] >= end[i];
+    row /= pooled_size[i];
+  }
+  return empty ? 0 : taps;
+}
+
+// Offset of the input row at position iter along the outer axes.
+inline int_tp pool_row_offset(const int_tp outer_axes, const int_tp* size,
+                              const int_tp* iter) {
+  int_tp offset = 0;
+  for (int_tp i = 0; i < outer_axes; ++i) {
+    offset = offset * size[i] + iter[i];
+  }
+  return offset * size[outer_axes];
+}
+
+// Advances iter to the next window row in raster order; false when done.
+inline bool pool_next_row(const int_tp outer_axes, const int_tp* begin,
+                          const int_tp* end, const int_tp* kstride,
+                          int_tp* iter) {
+  for (int_tp i = outer_axes - 1; i >= 0; --i) {
+    iter[i] += kstride[i];
+    if (iter[i] < end[i]) {
+      return true;
+    }
+    iter[i] = begin[i];
+  }
+  return false;
+}
+
+// Range [*begin, *end) of pooled positions along the last axis for which
+// the tap at kernel position k falls inside the input.
+inline void pool_tap_range(const int_tp k, const int_tp size,
+                           const int_tp pooled_size, const int_tp stride,
+                           const int_tp kstride, const int_tp pad,
+                           int_tp* begin, int_tp* end) {
+  const int_tp shift = pad - k * kstride;
+  *begin = shift > 0 ? (shift + stride - 1) / stride : 0;
+  *end = size - 1 + shift >= 0 ?
+      min((size - 1 + shift) / stride + 1, pooled_size) : 0;
+  *begin = min(*begin, *end);
+}
+
+// Max pools one output row: taps are visited in raster order, so the first
+// of several equal maxima wins.
+template <typename Dtype, typename Mask>
+void max_pool_row(const Dtype* bottom_slice, const int_tp row_offset,
+                  const int_tp kernel_w, const int_tp stride_w,
+                  const int_tp kstride_w, const int_tp pad_w,
+                  const int_tp* tap_begin, const int_tp* tap_end,
+                  Dtype* top_row, Mask* mask_row) {
+  for (int_tp k = 0; k < kernel_w; ++k) {
+    const int_tp offset = row_offset + k * kstride_w - pad_w;
+    for (int_tp pw = tap_begin[k]; pw < tap_end[k]; ++pw) {
+      const int_tp index = offset + pw * stride_w;
+      if (bottom_slice[index] > top_row[pw]) {
+        top_row[pw] = bottom_slice[index];
+        mask_row[pw] = static_cast<Mask>(index);
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  int_tp kernel_h_ = kernel_shape_.cpu_data()[0];
-  int_tp kernel_w_ = kernel_shape_.cpu_data()[1];
-  int_tp stride_h_ = stride_.cpu_data()[0];
-  int_tp stride_w_ = stride_.cpu_data()[1];
-  int_tp pad_h_ = pad_.cpu_data()[0];
-  int_tp pad_w_ = pad_.cpu_data()[1];
-  int_tp height_ = size_.cpu_data()[0];
-  int_tp width_ = size_.cpu_data()[1];
-  int_tp pooled_height_ = pooled_size_.cpu_data()[0];
-  int_tp pooled_width_ = pooled_size_.cpu_data()[1];
-
+  const int_tp outer_axes = num_spatial_axes_ - 1;
+  const int_tp* size = size_.cpu_data();
+  const int_tp* pooled_size = pooled_size_.cpu_data();
+  const int_tp* kernel_shape = kernel_shape_.cpu_data();
+  const int_tp* ext_kernel_shape = ext_kernel_shape_.cpu_data();
+  const int_tp* stride = stride_.cpu_data();
+  const int_tp* kstride = kstride_.cpu_data();
+  const int_tp* pad = pad_.cpu_data();
+  const int_tp width = size[outer_axes];
+  const int_tp pooled_width = pooled_size[outer_axes];
+  const int_tp kernel_w = kernel_shape[outer_axes];
+  const int_tp ext_kernel_w = ext_kernel_shape[outer_axes];
+  const int_tp stride_w = stride[outer_axes];
+  const int_tp kstride_w = kstride[outer_axes];
+  const int_tp pad_w = pad[outer_axes];
+
+  const int_tp bottom_dim = bottom[0]->count(channel_axis_ + 1);
+  const int_tp top_dim = top[0]->count(channel_axis_ + 1);
+  const int_tp slice_rows = top_dim / pooled_width;
+  const int_tp rows = top[0]->count() / pooled_width;
+
+  // Along the last axis, every kernel tap covers a contiguous range of
+  // pooled positions, so rows are pooled one tap at a time.
+  vector<int_tp> tap_begin(kernel_w);
+  vector<int_tp> tap_end(kernel_w);
+  vector<int_tp> row_taps(pooled_width);
+  for (int_tp k = 0; k < kernel_w; ++k) {
+    pool_tap_range(k, width, pooled_width, stride_w, kstride_w, pad_w,
+                   &tap_begin[k], &tap_end[k]);
+  }
+  for (int_tp pw = 0; pw < pooled_width; ++pw) {
+    int_tp wstart, wend;
+    row_taps[pw] = pool_axis_window(pw, width, ext_kernel_w, stride_w,
+                                    kstride_w, pad_w, &wstart, &wend);
+  }
 
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int_tp top_count = top[0]->count();
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   int_tp* mask = NULL;  // suppress warnings about uninitalized variables
   Dtype* top_mask = NULL;
+  Dtype* rand_idx = NULL;
+  vector<int_tp> no_pad;
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
     } else {
       mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1L, mask);
     }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
     // The main loop
-    for (int_tp n = 0; n < bottom[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            int_tp hstart = ph * stride_h_ - pad_h_;
-            int_tp wstart = pw * stride_w_ - pad_w_;
-            int_tp hend = min(hstart + kernel_h_, height_);
-            int_tp wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0L);
-            wstart = max(wstart, 0L);
-            const int_tp pool_index = ph * pooled_width_ + pw;
-            for (int_tp h = hstart; h < hend; ++h) {
-              for (int_tp w = wstart; w < wend; ++w) {
-                const int_tp index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
+#pragma omp parallel for
+    for (int_tp r = 0; r < rows; ++r) {
+      const Dtype* bottom_slice = bottom_data + r / slice_rows * bottom_dim;
+      Dtype* top_row = top_data + r * pooled_width;
+      for (int_tp pw = 0; pw < pooled_width; ++pw) {
+        top_row[pw] = -FLT_MAX;
         if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
+          top_mask[r * pooled_width + pw] = -1;
         } else {
-          mask += top[0]->offset(0, 1);
+          mask[r * pooled_width + pw] = -1;
         }
       }
+      int_tp begin[kMaxPoolingAxes], end[kMaxPoolingAxes];
+      int_tp iter[kMaxPoolingAxes];
+      if (pool_row_window(r % slice_rows, outer_axes, size, pooled_size,
+                          ext_kernel_shape, stride, kstride, pad, begin,
+                          end) == 0) {
+        continue;
+      }
+      std::copy(begin, begin + outer_axes, iter);
+      do {
+        const int_tp row_offset = pool_row_offset(outer_axes, size, iter);
+        if (use_top_mask) {
+          max_pool_row(bottom_slice, row_offset, kernel_w, stride_w,
+                       kstride_w, pad_w, &tap_begin[0], &tap_end[0],
+                       top_row, top_mask + r * pooled_width);
+        } else {
+          max_pool_row(bottom_slice, row_offset, kernel_w, stride_w,
+                       kstride_w, pad_w, &tap_begin[0], &tap_end[0],
+                       top_row, mask + r * pooled_width);
+        }
+      } while (pool_next_row(outer_axes, begin, end, kstride, iter));
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    for (int_tp i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
-    }
     // The main loop
-    for (int_tp n = 0; n < bottom[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            int_tp hstart = ph * stride_h_ - pad_h_;
-            int_tp wstart = pw * stride_w_ - pad_w_;
-            int_tp hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int_tp wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int_tp pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0L);
-            wstart = max(wstart, 0L);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int_tp h = hstart; h < hend; ++h) {
-              for (int_tp w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
+#pragma omp parallel for
+    for (int_tp r = 0; r < rows; ++r) {
+      const Dtype* bottom_slice = bottom_data + r / slice_rows * bottom_dim;
+      Dtype* top_row = top_data + r * pooled_width;
+      for (int_tp pw = 0; pw < pooled_width; ++pw) {
+        top_row[pw] = 0;
+      }
+      int_tp begin[kMaxPoolingAxes], end[kMaxPoolingAxes];
+      int_tp iter[kMaxPoolingAxes];
+      const int_tp taps = pool_row_window(r % slice_rows, outer_axes, size,
+          pooled_size, ext_kernel_shape, stride, kstride, pad, begin, end);
+      if (taps == 0) {
+        continue;
+      }
+      std::copy(begin, begin + outer_axes, iter);
+      do {
+        const int_tp row_offset = pool_row_offset(outer_axes, size, iter);
+        for (int_tp k = 0; k < kernel_w; ++k) {
+          const Dtype* bottom_row = bottom_slice + row_offset
+              + k * kstride_w - pad_w;
+          for (int_tp pw = tap_begin[k]; pw < tap_end[k]; ++pw) {
+            top_row[pw] += bottom_row[pw * stride_w];
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
+      } while (pool_next_row(outer_axes, begin, end, kstride, iter));
+      for (int_tp pw = 0; pw < pooled_width; ++pw) {
+        top_row[pw] /= taps * row_taps[pw];
       }
     }
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
+    // Stochastic pooling windows are not padded, as on the GPU.
+    if (this->phase_ == TRAIN) {
+      rand_idx = rand_idx_.mutable_cpu_data();
+      caffe_rng_uniform(top[0]->count(), Dtype(0), Dtype(1), rand_idx);
+    }
+    no_pad.resize(num_spatial_axes_, 0);
+#pragma omp parallel for
+    for (int_tp r = 0; r < rows; ++r) {
+      const int_tp slice_offset = r / slice_rows * bottom_dim;
+      const Dtype* bottom_slice = bottom_data + slice_offset;
+      int_tp begin[kMaxPoolingAxes], end[kMaxPoolingAxes];
+      int_tp iter[kMaxPoolingAxes];
+      pool_row_window(r % slice_rows, outer_axes, size, pooled_size,
+                      ext_kernel_shape, stride, kstride, &no_pad[0], begin,
+                      end);
+      for (int_tp pw = 0; pw < pooled_width; ++pw) {
+        const int_tp wstart = pw * stride_w;
+        const int_tp wend = min(wstart + ext_kernel_w, width);
+        // First pass: get the sum (and the sum of squares for testing).
+        Dtype cumsum = this->phase_ == TRAIN ? Dtype(0) : Dtype(FLT_MIN);
+        Dtype cumvalues = 0;
+        std::copy(begin, begin + outer_axes, iter);
+        do {
+          const Dtype* bottom_row = bottom_slice
+              + pool_row_offset(outer_axes, size, iter);
+          for (int_tp w = wstart; w < wend; w += kstride_w) {
+            cumsum += bottom_row[w];
+            cumvalues += bottom_row[w] * bottom_row[w];
+          }
+        } while (pool_next_row(outer_axes, begin, end, kstride, iter));
+        const int_tp index = r * pooled_width + pw;
+        if (this->phase_ != TRAIN) {
+          top_data[index] = cumvalues / cumsum;
+          continue;
+        }
+        // Second pass: sample a tap with probability proportional to its
+        // value, and set the index.
+        const Dtype thres = rand_idx[index] * cumsum;
+        cumsum = 0;
+        bool found = false;
+        std::copy(begin, begin + outer_axes, iter);
+        do {
+          const int_tp row_offset = pool_row_offset(outer_axes, size, iter);
+          for (int_tp w = wstart; w < wend && !found; w += kstride_w) {
+            cumsum += bottom_slice[row_offset + w];
+            top_data[index] = bottom_slice[row_offset + w];
+            rand_idx[index] = slice_offset + row_offset + w;
+            found = cumsum >= thres;
+          }
+        } while (!found
+                 && pool_next_row(outer_axes, begin, end, kstride, iter));
+      }
+    }
     break;
   default:
     LOG(FATAL) << "Unknown pooling method.";
@@ -346,89 +512,114 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  int_tp kernel_h_ = kernel_shape_.cpu_data()[0];
-  int_tp kernel_w_ = kernel_shape_.cpu_data()[1];
-  int_tp stride_h_ = stride_.cpu_data()[0];
-  int_tp stride_w_ = stride_.cpu_data()[1];
-  int_tp pad_h_ = pad_.cpu_data()[0];
-  int_tp pad_w_ = pad_.cpu_data()[1];
-  int_tp height_ = size_.cpu_data()[0];
-  int_tp width_ = size_.cpu_data()[1];
-  int_tp pooled_height_ = pooled_size_.cpu_data()[0];
-  int_tp pooled_width_ = pooled_size_.cpu_data()[1];
-
   if (!propagate_down[0]) {
     return;
   }
+  const int_tp outer_axes = num_spatial_axes_ - 1;
+  const int_tp* size = size_.cpu_data();
+  const int_tp* pooled_size = pooled_size_.cpu_data();
+  const int_tp* kernel_shape = kernel_shape_.cpu_data();
+  const int_tp* ext_kernel_shape = ext_kernel_shape_.cpu_data();
+  const int_tp* stride = stride_.cpu_data();
+  const int_tp* kstride = kstride_.cpu_data();
+  const int_tp* pad = pad_.cpu_data();
+  const int_tp width = size[outer_axes];
+  const int_tp pooled_width = pooled_size[outer_axes];
+  const int_tp kernel_w = kernel_shape[outer_axes];
+  const int_tp ext_kernel_w = ext_kernel_shape[outer_axes];
+  const int_tp stride_w = stride[outer_axes];
+  const int_tp kstride_w = kstride[outer_axes];
+  const int_tp pad_w = pad[outer_axes];
+
+  const int_tp slices = top[0]->count(0, channel_axis_ + 1);
+  const int_tp bottom_dim = bottom[0]->count(channel_axis_ + 1);
+  const int_tp top_dim = top[0]->count(channel_axis_ + 1);
+  const int_tp slice_rows = top_dim / pooled_width;
+
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
   caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   const int_tp* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
+  // Windows overlap within a channel, so only channels run in parallel.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
     } else {
       mask = max_idx_.cpu_data();
     }
-    for (int_tp n = 0; n < top[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            const int_tp index = ph * pooled_width_ + pw;
-            const int_tp bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
+    // The main loop
+#pragma omp parallel for
+    for (int_tp s = 0; s < slices; ++s) {
+      Dtype* bottom_slice = bottom_diff + s * bottom_dim;
+      for (int_tp i = s * top_dim; i < (s + 1) * top_dim; ++i) {
+        const int_tp bottom_index =
+            use_top_mask ? static_cast<int_tp>(top_mask[i]) : mask[i];
+        if (bottom_index >= 0) {
+          bottom_slice[bottom_index] += top_diff[i];
         }
       }
     }
     break;
-  case PoolingParameter_PoolMethod_AVE:
+  case PoolingParameter_PoolMethod_AVE: {
+    vector<int_tp> tap_begin(kernel_w);
+    vector<int_tp> tap_end(kernel_w);
+    vector<int_tp> row_taps(pooled_width);
+    for (int_tp k = 0; k < kernel_w; ++k) {
+      pool_tap_range(k, width, pooled_width, stride_w, kstride_w, pad_w,
+                     &tap_begin[k], &tap_end[k]);
+    }
+    for (int_tp pw = 0; pw < pooled_width; ++pw) {
+      int_tp wstart, wend;
+      row_taps[pw] = pool_axis_window(pw, width, ext_kernel_w, stride_w,
+                                      kstride_w, pad_w, &wstart, &wend);
+    }
     // The main loop
-    for (int_tp n = 0; n < top[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            int_tp hstart = ph * stride_h_ - pad_h_;
-            int_tp wstart = pw * stride_w_ - pad_w_;
-            int_tp hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int_tp wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int_tp pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0L);
-            wstart = max(wstart, 0L);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int_tp h = hstart; h < hend; ++h) {
-              for (int_tp w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
+#pragma omp parallel for
+    for (int_tp s = 0; s < slices; ++s) {
+      Dtype* bottom_slice = bottom_diff + s * bottom_dim;
+      vector<Dtype> scaled_diff(pooled_width);
+      int_tp begin[kMaxPoolingAxes], end[kMaxPoolingAxes];
+      int_tp iter[kMaxPoolingAxes];
+      for (int_tp r = 0; r < slice_rows; ++r) {
+        const int_tp taps = pool_row_window(r, outer_axes, size, pooled_size,
+            ext_kernel_shape, stride, kstride, pad, begin, end);
+        if (taps == 0) {
+          continue;
+        }
+        const Dtype* top_row = top_diff + (s * slice_rows + r) * pooled_width;
+        for (int_tp pw = 0; pw < pooled_width; ++pw) {
+          scaled_diff[pw] = top_row[pw] / (taps * row_taps[pw]);
+        }
+        std::copy(begin, begin + outer_axes, iter);
+        do {
+          const int_tp row_offset = pool_row_offset(outer_axes, size, iter);
+          for (int_tp k = 0; k < kernel_w; ++k) {
+            Dtype* bottom_row = bottom_slice + row_offset
+                + k * kstride_w - pad_w;
+            for (int_tp pw = tap_begin[k]; pw < tap_end[k]; ++pw) {
+              bottom_row[pw * stride_w] += scaled_diff[pw];
             }
           }
-        }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
+        } while (pool_next_row(outer_axes, begin, end, kstride, iter));
       }
     }
     break;
-  case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
+  }
+  case PoolingParameter_PoolMethod_STOCHASTIC: {
+    // rand_idx_ holds the index of the sampled input in the whole blob.
+    const Dtype* rand_idx = rand_idx_.cpu_data();
+#pragma omp parallel for
+    for (int_tp s = 0; s < slices; ++s) {
+      for (int_tp i = s * top_dim; i < (s + 1) * top_dim; ++i) {
+        bottom_diff[static_cast<int_tp>(rand_idx[i])] += top_diff[i];
+      }
+    }
     break;
+  }
   default:
     LOG(FATAL) << "Unknown pooling method.";
   }
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Transform matrices of F(2x2, 3x3) and F(4x4, 3x3) (Lavin & Gray, 2015):
+// filter transform G, input transform B^T and output transform A^T.
+static const double winograd_g_2[4 * 3] = {
+  1.0,  0.0, 0.0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0.0,  0.0, 1.0
+};
+static const double winograd_bt_2[4 * 4] = {
+  1.0,  0.0, -1.0,  0.0,
+  0.0,  1.0,  1.0,  0.0,
+  0.0, -1.0,  1.0,  0.0,
+  0.0,  1.0,  0.0, -1.0
+};
+static const double winograd_at_2[2 * 4] = {
+  1.0, 1.0,  1.0,  0.0,
+  0.0, 1.0, -1.0, -1.0
+};
+static const double winograd_g_4[6 * 3] = {
+  1.0 / 4.0,   0.0,         0.0,
+  -1.0 / 6.0,  -1.0 / 6.0,  -1.0 / 6.0,
+  -1.0 / 6.0,  1.0 / 6.0,   -1.0 / 6.0,
+  1.0 / 24.0,  1.0 / 12.0,  1.0 / 6.0,
+  1.0 / 24.0,  -1.0 / 12.0, 1.0 / 6.0,
+  0.0,         0.0,         1.0
+};
+static const double winograd_bt_4[6 * 6] = {
+  4.0,  0.0, -5.0,  0.0, 1.0, 0.0,
+  0.0, -4.0, -4.0,  1.0, 1.0, 0.0,
+  0.0,  4.0, -4.0, -1.0, 1.0, 0.0,
+  0.0, -2.0, -1.0,  2.0, 1.0, 0.0,
+  0.0,  2.0, -1.0, -2.0, 1.0, 0.0,
+  0.0,  4.0,  0.0, -5.0, 0.0, 1.0
+};
+static const double winograd_at_4[4 * 6] = {
+  1.0, 1.0,  1.0, 1.0,  1.0, 0.0,
+  0.0, 1.0, -1.0, 2.0, -2.0, 0.0,
+  0.0, 1.0,  1.0, 4.0,  4.0, 0.0,
+  0.0, 1.0, -1.0, 8.0, -8.0, 1.0
+};
+
+// Largest transformed tile edge (F(4x4, 3x3)).
+#define WINOGRAD_MAX_ALPHA 6
+
+// Y = L * X * L^T, with L of size rows x cols and X of size cols x cols.
+template <typename Dtype>
+inline void winograd_sandwich(const double* L, const int_tp rows,
+                              const int_tp cols, const Dtype* X, Dtype* Y) {
+  Dtype tmp[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+  for (int_tp r = 0; r < rows; ++r) {
+    for (int_tp j = 0; j < cols; ++j) {
+      Dtype sum = 0;
+      for (int_tp k = 0; k < cols; ++k) {
+        sum += Dtype(L[r * cols + k]) * X[k * cols + j];
+      }
+      tmp[r * cols + j] = sum;
+    }
+  }
+  for (int_tp r = 0; r < rows; ++r) {
+    for (int_tp s = 0; s < rows; ++s) {
+      Dtype sum = 0;
+      for (int_tp j = 0; j < cols; ++j) {
+        sum += tmp[r * cols + j] * Dtype(L[s * cols + j]);
+      }
+      Y[r * rows + s] = sum;
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  tile_ = conv_param.winograd_tile();
+  CHECK(tile_ == 2 || tile_ == 4) << "winograd_tile must be 2 or 4.";
+  use_winograd_ = this->num_spatial_axes_ == 2;
+  for (int_tp i = 0; use_winograd_ && i < this->num_spatial_axes_; ++i) {
+    use_winograd_ = this->kernel_shape_.cpu_data()[i] == 3
+        && this->stride_.cpu_data()[i] == 1
+        && this->kstride_.cpu_data()[i] == 1;
+  }
+  if (!use_winograd_) {
+    LOG(INFO) << "Winograd convolution needs a 2D 3x3 kernel with stride 1, "
+              << this->layer_param_.name() << " uses the CAFFE engine.";
+    return;
+  }
+  winograd_transform_weights();
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  if (!use_winograd_) {
+    return;
+  }
+  tiles_h_ = (this->output_shape_[0] + tile_ - 1) / tile_;
+  tiles_w_ = (this->output_shape_[1] + tile_ - 1) / tile_;
+  const int_tp alpha = tile_ + 2;
+  vector<int_tp> buffer_shape(3);
+  buffer_shape[0] = alpha * alpha;
+  buffer_shape[1] = this->channels_;
+  buffer_shape[2] = tiles_h_ * tiles_w_;
+  winograd_input_.Reshape(buffer_shape);
+  buffer_shape[1] = this->num_output_;
+  winograd_output_.Reshape(buffer_shape);
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::winograd_transform_weights() {
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  if (weights.data() == winograd_weights_memory_
+      && weights.data()->version() == winograd_weights_version_) {
+    return;
+  }
+  winograd_weights_memory_ = weights.data();
+  winograd_weights_version_ = weights.data()->version();
+  const int_tp alpha = tile_ + 2;
+  const int_tp alpha_sq = alpha * alpha;
+  const int_tp in_group = this->channels_ / this->group_;
+  const int_tp out_group = this->num_output_ / this->group_;
+  const double* G = tile_ == 2 ? winograd_g_2 : winograd_g_4;
+  vector<int_tp> shape(4);
+  shape[0] = this->group_;
+  shape[1] = alpha_sq;
+  shape[2] = out_group;
+  shape[3] = in_group;
+  winograd_weights_.Reshape(shape);
+  const Dtype* weight = weights.cpu_data();
+  Dtype* transformed = winograd_weights_.mutable_cpu_data();
+#pragma omp parallel for
+  for (int_tp oc = 0; oc < this->num_output_ * in_group; ++oc) {
+    const int_tp o = oc / in_group;
+    const int_tp c = oc % in_group;
+    const int_tp g = o / out_group;
+    Dtype U[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+    winograd_sandwich(G, alpha, 3, weight + oc * 9, U);
+    for (int_tp xi = 0; xi < alpha_sq; ++xi) {
+      transformed[((g * alpha_sq + xi) * out_group + o % out_group) * in_group
+                  + c] = U[xi];
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!use_winograd_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  winograd_transform_weights();
+  const int_tp alpha = tile_ + 2;
+  const int_tp alpha_sq = alpha * alpha;
+  const double* BT = tile_ == 2 ? winograd_bt_2 : winograd_bt_4;
+  const double* AT = tile_ == 2 ? winograd_at_2 : winograd_at_4;
+  const int_tp height = this->input_shape(1);
+  const int_tp width = this->input_shape(2);
+  const int_tp out_height = this->output_shape_[0];
+  const int_tp out_width = this->output_shape_[1];
+  const int_tp pad_h = this->pad_.cpu_data()[0];
+  const int_tp pad_w = this->pad_.cpu_data()[1];
+  const int_tp tiles = tiles_h_ * tiles_w_;
+  const int_tp in_group = this->channels_ / this->group_;
+  const int_tp out_group = this->num_output_ / this->group_;
+  const Dtype* weight = winograd_weights_.cpu_data();
+  Dtype* V = winograd_input_.mutable_cpu_data();
+  Dtype* M = winograd_output_.mutable_cpu_data();
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int_tp n = 0; n < this->num_; ++n) {
+      const Dtype* in_image = bottom_data + n * this->bottom_dim_;
+      Dtype* out_image = top_data + n * this->top_dim_;
+      // Input transform, one (tile + 2)^2 patch per channel and tile.
+#pragma omp parallel for
+      for (int_tp ct = 0; ct < this->channels_ * tiles; ++ct) {
+        const int_tp c = ct / tiles;
+        const int_tp t = ct % tiles;
+        const int_tp h_off = (t / tiles_w_) * tile_ - pad_h;
+        const int_tp w_off = (t % tiles_w_) * tile_ - pad_w;
+        const Dtype* in_channel = in_image + c * height * width;
+        Dtype d[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+        Dtype v[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+        for (int_tp y = 0; y < alpha; ++y) {
+          const int_tp h = h_off + y;
+          for (int_tp x = 0; x < alpha; ++x) {
+            const int_tp w = w_off + x;
+            d[y * alpha + x] = (h >= 0 && h < height && w >= 0 && w < width)
+                ? in_channel[h * width + w] : Dtype(0);
+          }
+        }
+        winograd_sandwich(BT, alpha, alpha, d, v);
+        for (int_tp xi = 0; xi < alpha_sq; ++xi) {
+          V[(xi * this->channels_ + c) * tiles + t] = v[xi];
+        }
+      }
+      // Element-wise products, summed over the input channels.
+      for (int_tp g = 0; g < this->group_; ++g) {
+        for (int_tp xi = 0; xi < alpha_sq; ++xi) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_group, tiles,
+              in_group, (Dtype)1.,
+              weight + (g * alpha_sq + xi) * out_group * in_group,
+              V + (xi * this->channels_ + g * in_group) * tiles, (Dtype)0.,
+              M + (xi * this->num_output_ + g * out_group) * tiles);
+        }
+      }
+      // Output transform, cropping the tiles at the bottom and right edges.
+#pragma omp parallel for
+      for (int_tp ot = 0; ot < this->num_output_ * tiles; ++ot) {
+        const int_tp o = ot / tiles;
+        const int_tp t = ot % tiles;
+        const int_tp h_off = (t / tiles_w_) * tile_;
+        const int_tp w_off = (t % tiles_w_) * tile_;
+        Dtype m[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+        Dtype y[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+        for (int_tp xi = 0; xi < alpha_sq; ++xi) {
+          m[xi] = M[(xi * this->num_output_ + o) * tiles + t];
+        }
+        winograd_sandwich(AT, tile_, alpha, m, y);
+        Dtype* out_channel = out_image + o * out_height * out_width;
+        const int_tp h_end = std::min(tile_, out_height - h_off);
+        const int_tp w_end = std::min(tile_, out_width - w_off);
+        for (int_tp r = 0; r < h_end; ++r) {
+          for (int_tp s = 0; s < w_end; ++s) {
+            out_channel[(h_off + r) * out_width + w_off + s] = y[r * tile_ + s];
+          }
+        }
+      }
+      if (this->bias_term_ || this->fused_relu_) {
+        this->forward_cpu_bias(out_image, this->bias_term_ ?
+                               this->blobs_[1]->cpu_data() : NULL);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
@@ -297,6 +297,25 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  memory_planned_ = memory_used_ * sizeof(Dtype);
+  optimize_memory_ = param.optimize_memory();
+  if (optimize_memory_ && std::find(layer_need_backward_.begin(),
+      layer_need_backward_.end(), true) != layer_need_backward_.end()) {
+    LOG(WARNING) << "Ignoring optimize_memory: net " << name_
+                 << " needs backward computation.";
+    optimize_memory_ = false;
+  }
+  if (optimize_memory_) {
+    PlanMemory();
+  }
+  flat_param_data_ = NULL;
+  flat_param_diff_ = NULL;
+  flat_param_count_ = 0;
+  flat_param_offsets_.clear();
+  // Nets of parallel solvers use the params of the root net.
+  if (param.contiguous_params() && !root_net_) {
+    FlattenParams();
+  }
   if (Caffe::root_solver()) {
     LOG(INFO) << "Network initialization done.";
     LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
@@ -679,6 +698,9 @@ void Net<Dtype>::BackwardFromTo(int_tp start, int_tp end) {
         BackwardDebugInfo(i);
       }
     }
+    for (int_tp c = 0; c < after_backward_.size(); ++c) {
+      after_backward_[c]->on_layer_gradients_ready(i);
+    }
   }
 }
 
@@ -848,6 +870,228 @@ void Net<Dtype>::Reshape() {
   for (int_tp i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  // Blobs that grew got buffers of their own.
+  if (optimize_memory_) {
+    PlanMemory();
+  }
+}
+
+template<typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  // Blobs sharing a SyncedMemory are planned as one group. Blobs still in a
+  // buffer of the previous plan keep the group they had then.
+  set<SyncedMemory*> old_buffers;
+  for (int_tp i = 0; i < memory_buffers_.size(); ++i) {
+    old_buffers.insert(memory_buffers_[i].get());
+  }
+  map<SyncedMemory*, int_tp> memory_to_group;
+  map<int_tp, int_tp> old_group_to_group;
+  vector<uint_tp> group_bytes;
+  vector<device*> group_device;
+  vector<int_tp> blob_group(blobs_.size(), -1);
+  vector<uint_tp> blob_bytes(blobs_.size(), 0);
+  for (int_tp blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const shared_ptr<SyncedMemory>& memory = blobs_[blob_id]->data();
+    if (!memory) {
+      continue;
+    }
+    int_tp group = group_bytes.size();
+    uint_tp bytes = memory->size();
+    if (old_buffers.find(memory.get()) != old_buffers.end()) {
+      const int_tp old_group = blob_memory_group_[blob_id];
+      if (old_group_to_group.find(old_group) == old_group_to_group.end()) {
+        old_group_to_group[old_group] = group;
+      }
+      group = old_group_to_group[old_group];
+      bytes = blob_memory_bytes_[blob_id];
+    } else {
+      if (memory_to_group.find(memory.get()) == memory_to_group.end()) {
+        memory_to_group[memory.get()] = group;
+      }
+      group = memory_to_group[memory.get()];
+    }
+    if (group == group_bytes.size()) {
+      group_bytes.push_back(0);
+      group_device.push_back(blobs_[blob_id]->get_device());
+    }
+    group_bytes[group] = std::max(group_bytes[group], bytes);
+    blob_group[blob_id] = group;
+  }
+  const int_tp num_groups = group_bytes.size();
+
+  // Lifetime of every group as the range of layers touching it.
+  vector<int_tp> first_use(num_groups, layers_.size());
+  vector<int_tp> last_use(num_groups, -1);
+  vector<bool> pinned(num_groups, false);
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int_tp i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int_tp group = blob_group[bottom_id_vecs_[layer_id][i]];
+      if (group >= 0) {
+        first_use[group] = std::min(first_use[group], layer_id);
+        last_use[group] = std::max(last_use[group], layer_id);
+      }
+    }
+    for (int_tp i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int_tp group = blob_group[top_id_vecs_[layer_id][i]];
+      if (group >= 0) {
+        first_use[group] = std::min(first_use[group], layer_id);
+        last_use[group] = std::max(last_use[group], layer_id);
+        // Source layers may point their tops at memory of their own.
+        pinned[group] = pinned[group] || bottom_id_vecs_[layer_id].empty();
+      }
+    }
+  }
+  // Net inputs are not counted, as in memory_used_.
+  vector<bool> input(num_groups, false);
+  for (int_tp i = 0; i < net_input_blob_indices_.size(); ++i) {
+    const int_tp group = blob_group[net_input_blob_indices_[i]];
+    if (group >= 0) {
+      pinned[group] = true;
+      input[group] = true;
+    }
+  }
+  for (int_tp i = 0; i < net_output_blob_indices_.size(); ++i) {
+    const int_tp group = blob_group[net_output_blob_indices_[i]];
+    if (group >= 0) {
+      pinned[group] = true;
+    }
+  }
+
+  // Visit the groups by first use and give each the best fitting buffer
+  // that is no longer in use, or a new one.
+  vector<pair<int_tp, int_tp> > order;
+  for (int_tp group = 0; group < num_groups; ++group) {
+    order.push_back(make_pair(first_use[group], group));
+  }
+  std::sort(order.begin(), order.end());
+  vector<uint_tp> buffer_bytes;
+  vector<int_tp> buffer_last_use;
+  vector<device*> buffer_device;
+  vector<int_tp> group_buffer(num_groups, -1);
+  uint_tp naive_bytes = 0;
+  uint_tp planned_bytes = 0;
+  int_tp planned_groups = 0;
+  for (int_tp i = 0; i < num_groups; ++i) {
+    const int_tp group = order[i].second;
+    const uint_tp bytes = input[group] ? 0 : group_bytes[group];
+    naive_bytes += bytes;
+    if (pinned[group] || last_use[group] < 0) {
+      planned_bytes += bytes;
+      continue;
+    }
+    device* dev = group_device[group];
+    int_tp best = -1;
+    for (int_tp buffer = 0; buffer < buffer_bytes.size(); ++buffer) {
+      if (buffer_last_use[buffer] >= first_use[group]
+          || buffer_device[buffer] != dev) {
+        continue;
+      }
+      const bool fits = buffer_bytes[buffer] >= bytes;
+      const bool best_fits = best >= 0 && buffer_bytes[best] >= bytes;
+      if (best < 0
+          || (fits && (!best_fits || buffer_bytes[buffer] < buffer_bytes[best]))
+          || (!fits && !best_fits
+              && buffer_bytes[buffer] > buffer_bytes[best])) {
+        best = buffer;
+      }
+    }
+    if (best < 0) {
+      best = buffer_bytes.size();
+      buffer_bytes.push_back(0);
+      buffer_last_use.push_back(-1);
+      buffer_device.push_back(dev);
+    }
+    buffer_bytes[best] = std::max(buffer_bytes[best], bytes);
+    buffer_last_use[best] = last_use[group];
+    group_buffer[group] = best;
+    ++planned_groups;
+  }
+
+  memory_buffers_.resize(buffer_bytes.size());
+  for (int_tp buffer = 0; buffer < buffer_bytes.size(); ++buffer) {
+    memory_buffers_[buffer].reset(new SyncedMemory(buffer_bytes[buffer],
+                                                   buffer_device[buffer]));
+    planned_bytes += buffer_bytes[buffer];
+  }
+  blob_memory_group_ = blob_group;
+  blob_memory_bytes_.assign(blobs_.size(), 0);
+  for (int_tp blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int_tp group = blob_group[blob_id];
+    if (group >= 0 && group_buffer[group] >= 0) {
+      blobs_[blob_id]->ShareDataMemory(memory_buffers_[group_buffer[group]]);
+      blob_memory_bytes_[blob_id] = group_bytes[group];
+    }
+  }
+  memory_planned_ = planned_bytes;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Memory plan: " << planned_groups << " blobs in "
+      << memory_buffers_.size() << " shared buffers, " << planned_bytes
+      << " bytes of data instead of " << naive_bytes;
+}
+
+template<typename Dtype>
+void Net<Dtype>::FlattenParams() {
+  // Each param starts at a cache line, so that vectorized loops over a single
+  // param are aligned as well.
+  const uint_tp align = OPENCL_CACHE_ALIGN / sizeof(Dtype);
+  uint_tp count = 0;
+  for (int_tp i = 0; i < learnable_params_.size(); ++i) {
+    flat_param_offsets_.push_back(count);
+    count += (learnable_params_[i]->count() + align - 1) / align * align;
+  }
+  if (count == 0) {
+    flat_param_offsets_.clear();
+    return;
+  }
+  // The arenas are zeroed when allocated; the extra line aligns their start.
+  // They live on the device of the params they replace.
+  const uint_tp bytes = (count + align) * sizeof(Dtype);
+  device* dev = learnable_params_[0]->get_device();
+  flat_param_data_memory_.reset(new SyncedMemory(bytes, dev));
+  flat_param_diff_memory_.reset(new SyncedMemory(bytes, dev));
+  Dtype* arenas[2];
+  SyncedMemory* memory[2] = { flat_param_data_memory_.get(),
+                              flat_param_diff_memory_.get() };
+  for (int_tp k = 0; k < 2; ++k) {
+    char* start = static_cast<char*>(memory[k]->mutable_cpu_data());
+    const uint_tp misalignment =
+        reinterpret_cast<uintptr_t>(start) % OPENCL_CACHE_ALIGN;
+    if (misalignment > 0) {
+      start += OPENCL_CACHE_ALIGN - misalignment;
+    }
+    arenas[k] = reinterpret_cast<Dtype*>(start);
+  }
+  flat_param_data_ = arenas[0];
+  flat_param_diff_ = arenas[1];
+  flat_param_count_ = count;
+  // Shared params hold the SyncedMemory of their owner, so they follow it.
+  for (int_tp i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* blob = learnable_params_[i];
+    Dtype* data = flat_param_data_ + flat_param_offsets_[i];
+    Dtype* diff = flat_param_diff_ + flat_param_offsets_[i];
+    caffe_cpu_copy(blob->count(), blob->cpu_data(), data);
+    caffe_cpu_copy(blob->count(), blob->cpu_diff(), diff);
+    blob->data()->set_cpu_data(data);
+    blob->diff()->set_cpu_data(diff);
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Contiguous params: " << learnable_params_.size() << " blobs in "
+      << count * sizeof(Dtype) << " bytes";
+}
+
+template<typename Dtype>
+bool Net<Dtype>::FlatParamsInUse() const {
+  if (!flat_param_data_ || Caffe::mode() != Caffe::CPU) {
+    return false;
+  }
+  for (int_tp i = 0; i < learnable_params_.size(); ++i) {
+    const Blob<Dtype>* blob = learnable_params_[i];
+    if (blob->cpu_data() != flat_param_data_ + flat_param_offsets_[i]
+        || blob->cpu_diff() != flat_param_diff_ + flat_param_offsets_[i]) {
+      return false;
+    }
+  }
+  return true;
 }
 
 template<typename Dtype>
@@ -908,6 +1152,7 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
+  HDF5Lock lock;
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
@@ -974,6 +1219,7 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
+  HDF5Lock lock;
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -1031,13 +1277,30 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::Update() {
+  if (FlatParamsInUse()) {
+    caffe_axpy<Dtype>(flat_param_count_, Dtype(-1), flat_param_diff_,
+                      flat_param_data_);
+    MarkParamsWritten();
+    return;
+  }
   for (int_tp i = 0; i < learnable_params_.size(); ++i) {
     learnable_params_[i]->Update();
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::MarkParamsWritten() {
+  for (int_tp i = 0; i < learnable_params_.size(); ++i) {
+    learnable_params_[i]->data()->mutable_cpu_data();
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ClearParamDiffs() {
+  if (FlatParamsInUse()) {
+    caffe_set(flat_param_count_, Dtype(0), flat_param_diff_);
+    return;
+  }
   for (int_tp i = 0; i < learnable_params_.size(); ++i) {
     Blob<Dtype>* blob = learnable_params_[i];
     switch (Caffe::mode()) {
@@ -1067,6 +1330,30 @@ void Net<Dtype>::ClearParamDiffs() {
   }
 }
 
+template <typename Dtype>
+Dtype Net<Dtype>::SumsqParamDiffs() const {
+  if (FlatParamsInUse()) {
+    return caffe_cpu_dot(flat_param_count_, flat_param_diff_,
+                         flat_param_diff_);
+  }
+  Dtype sumsq = 0;
+  for (int_tp i = 0; i < learnable_params_.size(); ++i) {
+    sumsq += learnable_params_[i]->sumsq_diff();
+  }
+  return sumsq;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ScaleParamDiffs(Dtype scale) {
+  if (FlatParamsInUse()) {
+    caffe_scal(flat_param_count_, scale, flat_param_diff_);
+    return;
+  }
+  for (int_tp i = 0; i < learnable_params_.size(); ++i) {
+    learnable_params_[i]->scale_diff(scale);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ShareWeights() {
   for (int_tp i = 0; i < params_.size(); ++i) {
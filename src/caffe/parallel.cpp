@@ -9,15 +9,28 @@
 #endif  // !CPU_ONLY
 #include <glog/logging.h>
 #include <stdio.h>
-
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif  // __linux__
+#ifdef _OPENMP
+#include <omp.h>
+#endif  // _OPENMP
+
+#include <algorithm>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "boost/thread.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
 
+#ifdef USE_OPENBLAS
+extern "C" void openblas_set_num_threads(int num_threads);
+#endif  // USE_OPENBLAS
+
 namespace caffe {
 
 enum Op {
@@ -30,9 +43,9 @@ enum Op {
 
 template<typename Dtype>
 static void apply_buffers(const vector<Blob<Dtype>*>& blobs, Dtype* buffer,
-                          uint_tp total_size, Op op) {
-  Dtype* ptr = buffer;
+                          const vector<uint_tp>& offsets, Op op) {
   for (int i = 0; i < blobs.size(); ++i) {
+    Dtype* ptr = buffer + offsets[i];
     int_tp size = blobs[i]->count();
     switch (op) {
       case copy: {
@@ -55,18 +68,24 @@ static void apply_buffers(const vector<Blob<Dtype>*>& blobs, Dtype* buffer,
         blobs[i]->diff()->set_gpu_data(ptr);
         break;
     }
-    ptr += size;
   }
-  // total_size is at least one byte
-  CHECK_EQ(total_size, (ptr == buffer ? 1 : ptr - buffer));
 }
 
-// Buffer size necessary to store given blobs
+// Buffer size necessary to store given blobs, and their offsets in it. The
+// param arena of the net is reused as is, padding included.
 template<typename Dtype>
-static uint_tp total_size(const vector<Blob<Dtype>*>& params) {
+static uint_tp buffer_layout(const Net<Dtype>& net, vector<uint_tp>* offsets) {
+  if (net.FlatParamsInUse()) {
+    *offsets = net.flat_param_offsets();
+    return net.flat_param_count();
+  }
+  const vector<Blob<Dtype>*>& params = net.learnable_params();
   uint_tp size = 0;
-  for (int i = 0; i < params.size(); ++i)
+  offsets->clear();
+  for (int i = 0; i < params.size(); ++i) {
+    offsets->push_back(size);
     size += params[i]->count();
+  }
   // Size have at least one byte, otherwise cudaMalloc fails if net has no
   // learnable parameters.
   return (size > 0) ? size : 1;
@@ -74,8 +93,8 @@ static uint_tp total_size(const vector<Blob<Dtype>*>& params) {
 
 template<typename Dtype>
 Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
-    : size_(total_size<Dtype>(root_solver->net()->learnable_params())), data_(),
-      diff_() {
+    : size_(), offsets_(), data_(), diff_() {
+  size_ = buffer_layout(*root_solver->net(), &offsets_);
 }
 
 template<typename Dtype>
@@ -92,7 +111,7 @@ GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
 
   // Copy blob values
   const vector<Blob<Dtype>*>& net = root_solver->net()->learnable_params();
-  apply_buffers(net, data_, size_, copy);
+  apply_buffers(net, data_, this->offsets_, copy);
 
   CUDA_CHECK(cudaMalloc(&diff_, size_ * sizeof(Dtype)));
   caffe_gpu_set(size_, Dtype(0), diff_);
@@ -117,8 +136,50 @@ GPUParams<Dtype>::~GPUParams() {
 template<typename Dtype>
 void GPUParams<Dtype>::configure(Solver<Dtype>* solver) const {
   const vector<Blob<Dtype>*>& net = solver->net()->learnable_params();
-  apply_buffers(net, data_, size_, replace_gpu);
-  apply_buffers(net, diff_, size_, replace_gpu_diff);
+  apply_buffers(net, data_, this->offsets_, replace_gpu);
+  apply_buffers(net, diff_, this->offsets_, replace_gpu_diff);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(shared_ptr<Solver<Dtype> > root_solver,
+                            bool adopt_arena)
+    : Params<Dtype>(root_solver),
+      flat_(adopt_arena && root_solver->net()->FlatParamsInUse()),
+      data_flags_(), diff_flags_() {
+  if (flat_) {
+    // The blobs already are views of the arenas, so the update of the root
+    // solver keeps running over them in one pass.
+    data_ = root_solver->net()->flat_param_data();
+    diff_ = root_solver->net()->flat_param_diff();
+    caffe_set(size_, Dtype(0), diff_);
+    return;
+  }
+  CaffeMallocHost(reinterpret_cast<void**>(&data_), size_ * sizeof(Dtype),
+                  &data_flags_);
+
+  // Copy blob values
+  const vector<Blob<Dtype>*>& net = root_solver->net()->learnable_params();
+  apply_buffers(net, data_, this->offsets_, copy);
+
+  CaffeMallocHost(reinterpret_cast<void**>(&diff_), size_ * sizeof(Dtype),
+                  &diff_flags_);
+  caffe_set(size_, Dtype(0), diff_);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::~CPUParams() {
+  if (flat_) {
+    return;
+  }
+  CaffeFreeHost(data_, size_ * sizeof(Dtype), data_flags_);
+  CaffeFreeHost(diff_, size_ * sizeof(Dtype), diff_flags_);
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::configure(Solver<Dtype>* solver) const {
+  const vector<Blob<Dtype>*>& net = solver->net()->learnable_params();
+  apply_buffers(net, data_, this->offsets_, replace_cpu);
+  apply_buffers(net, diff_, this->offsets_, replace_cpu_diff);
 }
 
 void DevicePair::compute(const vector<device*> devices,
@@ -459,8 +520,309 @@ void P2PSync<Dtype>::run(const vector<device*>& gpus) {
   }
 }
 
+//
+
+// Cores the calling thread may run on.
+static vector<int> allowed_cores() {
+  vector<int> cores;
+#ifdef __linux__
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0) {
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+      if (CPU_ISSET(c, &mask)) {
+        cores.push_back(c);
+      }
+    }
+  }
+#endif  // __linux__
+  return cores;
+}
+
+// Restricts the calling thread, and the threads it starts afterwards such as
+// its OpenMP workers, to cores.
+static void pin_to_cores(const vector<int>& cores) {
+#ifdef __linux__
+  if (cores.empty()) {
+    return;
+  }
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (int i = 0; i < cores.size(); ++i) {
+    CPU_SET(cores[i], &mask);
+  }
+  CHECK_EQ(0, pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask))
+      << "Could not pin solver thread";
+#endif  // __linux__
+}
+
+// Sizes the OpenMP team and the BLAS threads of the calling thread.
+static void set_thread_count(int threads) {
+  if (threads <= 0) {
+    return;
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif  // _OPENMP
+#ifdef USE_MKL
+  mkl_set_num_threads_local(threads);
+#endif  // USE_MKL
+#ifdef USE_OPENBLAS
+  // OpenBLAS has a single count for the process, which fits as well since
+  // the replicas get as many cores, give or take one.
+  openblas_set_num_threads(threads);
+#endif  // USE_OPENBLAS
+}
+
+// Cores of the process, read before any replica is pinned.
+static const vector<int>& process_cores() {
+  static const vector<int> cores = allowed_cores();
+  return cores;
+}
+
+// Splits the cores in contiguous ranges, which on common machines keeps
+// each replica within one NUMA node. Replicas are left unpinned if there are
+// fewer cores than replicas.
+static vector<vector<int> > replica_cores(int replicas) {
+  const vector<int>& cores = process_cores();
+  vector<vector<int> > split(replicas);
+  if (cores.size() >= replicas) {
+    for (int i = 0; i < replicas; ++i) {
+      const int begin = cores.size() * i / replicas;
+      const int end = cores.size() * (i + 1) / replicas;
+      split[i].assign(cores.begin() + begin, cores.begin() + end);
+    }
+  }
+  return split;
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > root_solver,
+                        CPUSync<Dtype>* parent, const SolverParameter& param,
+                        int replica)
+    : CPUParams<Dtype>(root_solver, parent == NULL), parent_(parent),
+      children_(), queue_(),
+      initial_iter_(root_solver->iter()), replica_(replica),
+      parent_grads_(NULL), solver_() {
+  if (parent == NULL) {
+    solver_ = root_solver;
+  } else {
+    Caffe::set_root_solver(false);
+    solver_.reset(new WorkerSolver<Dtype>(param, root_solver.get()));
+    Caffe::set_root_solver(true);
+    CaffeMallocHost(reinterpret_cast<void**>(&parent_grads_),
+                    size_ * sizeof(Dtype), &parent_grads_flags_);
+  }
+  this->configure(solver_.get());
+  solver_->add_callback(this);
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::~CPUSync() {
+  if (parent_grads_) {
+    CaffeFreeHost(parent_grads_, size_ * sizeof(Dtype), parent_grads_flags_);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::InternalThreadEntry() {
+  pin_to_cores(cores_);
+  set_thread_count(cores_.size());
+  CHECK(Caffe::root_solver());
+  Caffe::set_root_solver(false);
+  // Give every replica its own random state, as P2PSync does per device.
+  if (solver_->param().random_seed() >= 0) {
+    Caffe::set_random_seed(solver_->param().random_seed() + replica_);
+  }
+  solver_->Step(solver_->param().max_iter() - initial_iter_);
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_start() {
+  // Wait for update from parent
+  if (parent_) {
+    CPUSync<Dtype> *parent = queue_.pop();
+    CHECK(parent == parent_);
+    // The parent wrote data_ through its own pointer, not the blobs.
+    solver_->net()->MarkParamsWritten();
+  }
+
+  // Update children
+  for (int i = children_.size() - 1; i >= 0; i--) {
+    caffe_cpu_copy(size_, data_, children_[i]->data_);
+    children_[i]->queue_.push(this);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  // Sum children gradients as they appear in the queue. A child only writes
+  // parent_grads_ again after the next on_start, so it is stable here.
+  for (int i = 0; i < children_.size(); ++i) {
+    CPUSync<Dtype> *child = queue_.pop();
+    caffe_add(size_, child->parent_grads_, diff_, diff_);
+  }
+
+  // Send gradients to parent
+  if (parent_) {
+    caffe_cpu_copy(size_, diff_, parent_grads_);
+    parent_->queue_.push(this);
+  } else {
+    // Loss functions divide gradients by the batch size, so to compensate
+    // for split batch, the root solver divides by number of solvers.
+    caffe_scal(size_, Dtype(1.0 / Caffe::solver_count()), diff_);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::PinRoot() {
+  const vector<int> cores = replica_cores(Caffe::solver_count())[0];
+  pin_to_cores(cores);
+  set_thread_count(cores.size());
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::run() {
+  const int replicas = Caffe::solver_count();
+  CHECK_GT(replicas, 1) << "Set Caffe::solver_count() to the replica count";
+  CHECK(parent_ == NULL) << "Run the root replica";
+  const vector<vector<int> > cores = replica_cores(replicas);
+
+  SolverParameter param(solver_->param());
+  vector<shared_ptr<CPUSync<Dtype> > > syncs(replicas);
+  for (int i = 1; i < replicas; ++i) {
+    CPUSync<Dtype>* parent = (i - 1) / 2 == 0 ? this : syncs[(i - 1) / 2].get();
+    syncs[i].reset(new CPUSync<Dtype>(solver_, parent, param, i));
+    syncs[i]->cores_ = cores[i];
+    parent->children_.push_back(syncs[i].get());
+  }
+
+  LOG(INFO)<< "Starting Optimization on " << replicas << " CPU replicas";
+
+  for (int i = 1; i < syncs.size(); ++i) {
+    syncs[i]->StartInternalThread(Caffe::GetDefaultDevice());
+  }
+
+  // Run root solver on current thread
+  PinRoot();
+  solver_->Solve();
+  pin_to_cores(process_cores());
+  set_thread_count(process_cores().size());
+
+  for (int i = 1; i < syncs.size(); ++i) {
+    syncs[i]->StopInternalThread();
+  }
+}
+
+template<typename Dtype>
+RingSync<Dtype>::RingSync(shared_ptr<Solver<Dtype> > solver,
+                          shared_ptr<RingTransport> transport,
+                          uint_tp bucket_size)
+    : CPUParams<Dtype>(solver, true), solver_(solver), transport_(transport),
+      bucket_size_(bucket_size), layer_ready_(), reduced_(size_) {
+  CHECK(Caffe::mode() == Caffe::CPU) << "Ring training runs CPU solvers";
+  CHECK_GT(bucket_size, 0) << "Ring buckets must hold values";
+  this->configure(solver_.get());
+  solver_->add_callback(this);
+  ring_broadcast(transport_.get(), data_, size_);
+
+  // Data layers read their own share of the source on each rank, and patch
+  // samplers draw from their own random state. Other readers would feed the
+  // same items to every rank.
+  const vector<shared_ptr<Layer<Dtype> > >& layers = solver_->net()->layers();
+  for (int i = 0; i < layers.size() && transport_->ranks() > 1; ++i) {
+    const LayerParameter& layer_param = layers[i]->layer_param();
+    const string type = layers[i]->type();
+    const bool shared_source = type == "HDF5Data" || type == "ImageData"
+        || (type == "HDF5StreamData"
+            && layer_param.hdf5_data_param().patch_shape_size() == 0);
+    CHECK(!shared_source) << "Layer " << layer_param.name() << " would read "
+        << "the same items on every rank; use a Data layer";
+  }
+
+  // With iter_size > 1, the gradients are only final after the last pass.
+  if (solver_->param().iter_size() == 1) {
+    const Net<Dtype>& net = *solver_->net();
+    layer_ready_.assign(net.layers().size(), size_);
+    int_tp learnable = 0;
+    for (int i = 0; i < net.params().size(); ++i) {
+      if (net.param_owners()[i] < 0) {
+        const int_tp layer_id = net.param_layer_indices()[i].first;
+        layer_ready_[layer_id] = std::min(layer_ready_[layer_id],
+                                          this->offsets_[learnable++]);
+      }
+    }
+    for (int_tp i = layer_ready_.size() - 2; i >= 0; --i) {
+      layer_ready_[i] = std::min(layer_ready_[i], layer_ready_[i + 1]);
+    }
+    solver_->net()->add_after_backward(this);
+  }
+  StartInternalThread(Caffe::GetDefaultDevice());
+}
+
+template<typename Dtype>
+RingSync<Dtype>::~RingSync() {
+  StopInternalThread();
+}
+
+template<typename Dtype>
+void RingSync<Dtype>::reduce(uint_tp offset, bool partial) {
+  // Buckets are cut from the end of diff_ in the same way on every rank.
+  while (reduced_ >= offset + (partial ? 1 : bucket_size_)) {
+    const uint_tp count = std::min(bucket_size_, reduced_ - offset);
+    reduced_ -= count;
+    buckets_.push(std::make_pair(reduced_, count));
+  }
+}
+
+template<typename Dtype>
+void RingSync<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      const std::pair<uint_tp, uint_tp> bucket = buckets_.pop();
+      if (bucket.second == 0) {
+        drained_.push(bucket);
+      } else {
+        ring_allreduce(transport_.get(), diff_ + bucket.first, bucket.second);
+      }
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template<typename Dtype>
+void RingSync<Dtype>::on_start() {
+  reduced_ = size_;
+}
+
+template<typename Dtype>
+void RingSync<Dtype>::on_layer_gradients_ready(int_tp layer_id) {
+  reduce(layer_ready_[layer_id], false);
+}
+
+template<typename Dtype>
+void RingSync<Dtype>::on_gradients_ready() {
+  reduce(0, true);
+  // Wait for the communication thread to sum every bucket.
+  buckets_.push(std::make_pair(uint_tp(0), uint_tp(0)));
+  drained_.pop();
+  // As in P2PSync, compensate for the batch split between the ranks.
+  caffe_scal(size_, Dtype(1.0 / transport_->ranks()), diff_);
+}
+
+template<typename Dtype>
+void RingSync<Dtype>::run() {
+  LOG(INFO)<< "Starting Optimization on rank " << transport_->rank()
+           << " of " << transport_->ranks();
+  solver_->Solve();
+}
+
 INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
+INSTANTIATE_CLASS(CPUParams);
 INSTANTIATE_CLASS(P2PSync);
+INSTANTIATE_CLASS(CPUSync);
+INSTANTIATE_CLASS(RingSync);
 
 }  // namespace caffe
@@ -17,223 +17,69 @@ void AdaDeltaSolver<Dtype>::AdaDeltaPreSolve() {
 }
 
 template <typename Dtype>
-void AdaDeltaSolver<Dtype>::ComputeUpdateValue(uint_tp param_id, Dtype rate) {
-  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
-  const vector<float>& net_params_lr = this->net_->params_lr();
-  Dtype delta = this->param_.delta();
-  Dtype momentum = this->param_.momentum();
-  Dtype local_rate = rate * net_params_lr[param_id];
-  uint_tp update_history_offset = net_params.size();
-  switch (Caffe::mode()) {
-  case Caffe::CPU: {
-    // compute square of gradient in update
-    caffe_powx(net_params[param_id]->count(),
-        net_params[param_id]->cpu_diff(), Dtype(2),
-        this->update_[param_id]->mutable_cpu_data());
-
-    // update history of gradients
-    caffe_cpu_axpby(net_params[param_id]->count(), Dtype(1) - momentum,
-        this->update_[param_id]->cpu_data(), momentum,
-        this->history_[param_id]->mutable_cpu_data());
-
-    // add delta to history to guard against dividing by zero later
-    caffe_set(net_params[param_id]->count(), delta,
-        this->temp_[param_id]->mutable_cpu_data());
-
-    caffe_add(net_params[param_id]->count(),
-        this->temp_[param_id]->cpu_data(),
-        this->history_[update_history_offset + param_id]->cpu_data(),
-        this->update_[param_id]->mutable_cpu_data());
-
-    caffe_add(net_params[param_id]->count(),
-        this->temp_[param_id]->cpu_data(),
-        this->history_[param_id]->cpu_data(),
-        this->temp_[param_id]->mutable_cpu_data());
-
-    // divide history of updates by history of gradients
-    caffe_div(net_params[param_id]->count(),
-        this->update_[param_id]->cpu_data(),
-        this->temp_[param_id]->cpu_data(),
-        this->update_[param_id]->mutable_cpu_data());
-
-    // jointly compute the RMS of both for update and gradient history
-    caffe_powx(net_params[param_id]->count(),
-        this->update_[param_id]->cpu_data(), Dtype(0.5),
-        this->update_[param_id]->mutable_cpu_data());
-
-    // compute the update
-    caffe_mul(net_params[param_id]->count(),
-        net_params[param_id]->cpu_diff(),
-        this->update_[param_id]->cpu_data(),
-        net_params[param_id]->mutable_cpu_diff());
-
-    // compute square of update
-    caffe_powx(net_params[param_id]->count(),
-        net_params[param_id]->cpu_diff(), Dtype(2),
-        this->update_[param_id]->mutable_cpu_data());
-
-    // update history of updates
-    caffe_cpu_axpby(net_params[param_id]->count(), Dtype(1) - momentum,
-        this->update_[param_id]->cpu_data(), momentum,
-        this->history_[update_history_offset + param_id]->mutable_cpu_data());
-
-    // apply learning rate
-    caffe_cpu_scale(net_params[param_id]->count(), local_rate,
-        net_params[param_id]->cpu_diff(),
-        net_params[param_id]->mutable_cpu_diff());
-    break;
+static void adadelta_update_cpu(int_tp n, Dtype* w, Dtype* g, Dtype* h,
+                                Dtype* h2, Dtype scale, Dtype l2_decay,
+                                Dtype l1_decay, Dtype momentum, Dtype delta,
+                                Dtype local_rate) {
+#pragma omp parallel for simd if (n >= kParallelUpdateMin)
+  for (int_tp i = 0; i < n; ++i) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * (Dtype(0 < wi) - Dtype(wi < 0));
+    // h holds the history of gradients and h2 that of updates
+    const Dtype hi = momentum * h[i] + (Dtype(1) - momentum) * gi * gi;
+    const Dtype ui = gi * std::sqrt((h2[i] + delta) / (hi + delta));
+    h[i] = hi;
+    h2[i] = momentum * h2[i] + (Dtype(1) - momentum) * ui * ui;
+    g[i] = local_rate * ui;
+    w[i] = wi - local_rate * ui;
   }
-  case Caffe::GPU: {
-#ifndef CPU_ONLY
-      if (this->device_->backend() == BACKEND_CUDA) {
-#ifdef USE_CUDA
-        // compute square of gradient in update
-        caffe_gpu_powx(net_params[param_id]->count(),
-                       net_params[param_id]->gpu_diff(), Dtype(2),
-                       this->update_[param_id]->mutable_gpu_data());
-
-        // update history of gradients
-        caffe_gpu_axpby(net_params[param_id]->count(), Dtype(1) - momentum,
-                        this->update_[param_id]->gpu_data(), momentum,
-                        this->history_[param_id]->mutable_gpu_data());
-
-        // add delta to history to guard against dividing by zero later
-        caffe_gpu_set(net_params[param_id]->count(), delta,
-                      this->temp_[param_id]->mutable_gpu_data());
-
-        caffe_gpu_add(
-            net_params[param_id]->count(), this->temp_[param_id]->gpu_data(),
-            this->history_[update_history_offset + param_id]->gpu_data(),
-            this->update_[param_id]->mutable_gpu_data());
-
-        caffe_gpu_add(net_params[param_id]->count(),
-                      this->temp_[param_id]->gpu_data(),
-                      this->history_[param_id]->gpu_data(),
-                      this->temp_[param_id]->mutable_gpu_data());
-
-        // divide history of updates by history of gradients
-        caffe_gpu_div(net_params[param_id]->count(),
-                      this->update_[param_id]->gpu_data(),
-                      this->temp_[param_id]->gpu_data(),
-                      this->update_[param_id]->mutable_gpu_data());
-
-        // jointly compute the RMS of both for update and gradient history
-        caffe_gpu_powx(net_params[param_id]->count(),
-                       this->update_[param_id]->gpu_data(), Dtype(0.5),
-                       this->update_[param_id]->mutable_gpu_data());
-
-        // compute the update and copy to net_diff
-        caffe_gpu_mul(net_params[param_id]->count(),
-                      net_params[param_id]->gpu_diff(),
-                      this->update_[param_id]->gpu_data(),
-                      net_params[param_id]->mutable_gpu_diff());
-
-        // compute square of update
-        caffe_gpu_powx(net_params[param_id]->count(),
-                       net_params[param_id]->gpu_diff(), Dtype(2),
-                       this->update_[param_id]->mutable_gpu_data());
-
-        // update history of updates
-        caffe_gpu_axpby(
-            net_params[param_id]->count(),
-            Dtype(1) - momentum,
-            this->update_[param_id]->gpu_data(),
-            momentum,
-            this->history_[update_history_offset + param_id]
-                           ->mutable_gpu_data());
-
-        // apply learning rate
-        caffe_gpu_scale(net_params[param_id]->count(), local_rate,
-                        net_params[param_id]->gpu_diff(),
-                        net_params[param_id]->mutable_gpu_diff());
-#endif  // USE_CUDA
-      } else {
-#ifdef USE_GREENTEA
-        // compute square of gradient in update
-        greentea_gpu_powx<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            (cl_mem) (net_params[param_id]->gpu_diff()), 0, Dtype(2),
-            (cl_mem) (this->update_[param_id]->mutable_gpu_data()), 0);
-
-        // update history of gradients
-        greentea_gpu_axpby<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            Dtype(1) - momentum, (cl_mem) (this->update_[param_id]->gpu_data()),
-            0, momentum,
-            (cl_mem) (this->history_[param_id]->mutable_gpu_data()), 0);
-
-        // add delta to history to guard against dividing by zero later
-        greentea_gpu_set<Dtype>(
-            this->device_->id(), net_params[param_id]->count(), delta,
-            (cl_mem) (this->temp_[param_id]->mutable_gpu_data()), 0);
-
-        greentea_gpu_add<Dtype>(
-            this->device_->id(),
-            net_params[param_id]->count(),
-            (cl_mem) (this->temp_[param_id]->gpu_data()),
-            0,
-            (cl_mem) (this->history_[update_history_offset + param_id]
-                                     ->gpu_data()),
-            0, (cl_mem) (this->update_[param_id]->mutable_gpu_data()), 0);
-
-        greentea_gpu_add<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            (cl_mem) (this->temp_[param_id]->gpu_data()), 0,
-            (cl_mem) (this->history_[param_id]->gpu_data()), 0,
-            (cl_mem) (this->temp_[param_id]->mutable_gpu_data()), 0);
-
-        // divide history of updates by history of gradients
-        greentea_gpu_div<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            (cl_mem) (this->update_[param_id]->gpu_data()), 0,
-            (cl_mem) (this->temp_[param_id]->gpu_data()), 0,
-            (cl_mem) (this->update_[param_id]->mutable_gpu_data()), 0);
-
-        // jointly compute the RMS of both for update and gradient history
-        greentea_gpu_powx<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            (cl_mem) (this->update_[param_id]->gpu_data()), 0, Dtype(0.5),
-            (cl_mem) (this->update_[param_id]->mutable_gpu_data()), 0);
-
-        // compute the update and copy to net_diff
-        greentea_gpu_mul<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            (cl_mem) (net_params[param_id]->gpu_diff()), 0,
-            (cl_mem) (this->update_[param_id]->gpu_data()), 0,
-            (cl_mem) (net_params[param_id]->mutable_gpu_diff()), 0);
-
-        // compute square of update
-        greentea_gpu_powx<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            (cl_mem) (net_params[param_id]->gpu_diff()), 0, Dtype(2),
-            (cl_mem) (this->update_[param_id]->mutable_gpu_data()), 0);
+}
 
-        // update history of updates
-        greentea_gpu_axpby<Dtype>(
-            this->device_->id(),
-            net_params[param_id]->count(),
-            Dtype(1) - momentum,
-            (cl_mem) (this->update_[param_id]->gpu_data()),
-            0,
-            momentum,
-            (cl_mem) (this->history_[update_history_offset + param_id]
-                ->mutable_gpu_data()),
-            0);
+#ifndef CPU_ONLY
+template <typename Dtype>
+void adadelta_update_gpu(device* dev, int_tp n, Dtype* w, Dtype* g, Dtype* h,
+                         Dtype* h2, Dtype scale, Dtype l2_decay, Dtype l1_decay,
+                         Dtype momentum, Dtype delta, Dtype local_rate);
+#endif  // !CPU_ONLY
 
-        // apply learning rate
-        greentea_gpu_scale<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            local_rate, (cl_mem) (net_params[param_id]->gpu_diff()), 0,
-            (cl_mem) (net_params[param_id]->mutable_gpu_diff()), 0);
-#endif  // USE_GREENTEA
-      }
+template <typename Dtype>
+void AdaDeltaSolver<Dtype>::ComputeUpdateValue(uint_tp param_id, Dtype rate) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  const Dtype delta = this->param_.delta();
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const uint_tp update_history_offset = this->net_->learnable_params().size();
+  Blob<Dtype>* update_history =
+      this->history_[update_history_offset + param_id].get();
+  Dtype scale, l2_decay, l1_decay;
+  this->GetRegularization(param_id, &scale, &l2_decay, &l1_decay);
+  switch (Caffe::mode()) {
+    case Caffe::CPU: {
+      adadelta_update_cpu(param->count(), param->mutable_cpu_data(),
+                          param->mutable_cpu_diff(),
+                          this->history_[param_id]->mutable_cpu_data(),
+                          update_history->mutable_cpu_data(),
+                          scale, l2_decay, l1_decay, momentum, delta,
+                          local_rate);
+      break;
+    }
+    case Caffe::GPU: {
+#ifndef CPU_ONLY
+      adadelta_update_gpu(this->device_, param->count(),
+                          param->mutable_gpu_data(), param->mutable_gpu_diff(),
+                          this->history_[param_id]->mutable_gpu_data(),
+                          update_history->mutable_gpu_data(),
+                          scale, l2_decay, l1_decay, momentum, delta,
+                          local_rate);
 #else
-    NO_GPU;
+      NO_GPU;
 #endif
-    break;
-  }
-  default:
-    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+      break;
+    }
+    default: {
+      LOG(FATAL)<< "Unknown caffe mode: " << Caffe::mode();
+    }
   }
 }
 
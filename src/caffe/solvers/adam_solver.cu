@@ -0,0 +1,77 @@
+#include "caffe/device.hpp"
+#include "caffe/sgd_solvers.hpp"
+
+#ifdef USE_GREENTEA
+#include "caffe/greentea/greentea.hpp"
+#endif
+
+namespace caffe {
+
+#ifndef CPU_ONLY
+#ifdef USE_CUDA
+template<typename Dtype>
+__global__ void AdamUpdate(const int_tp n, Dtype* w, Dtype* g, Dtype* m,
+                           Dtype* v, const Dtype scale, const Dtype l2_decay,
+                           const Dtype l1_decay, const Dtype beta1,
+                           const Dtype beta2, const Dtype eps_hat,
+                           const Dtype corrected_rate) {
+  CUDA_KERNEL_LOOP(i, n) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * (Dtype(0 < wi) - Dtype(wi < 0));
+    const Dtype mi = beta1 * m[i] + (Dtype(1) - beta1) * gi;
+    const Dtype vi = beta2 * v[i] + (Dtype(1) - beta2) * gi * gi;
+    const Dtype ui = corrected_rate * (mi / (sqrt(vi) + eps_hat));
+    m[i] = mi;
+    v[i] = vi;
+    g[i] = ui;
+    w[i] = wi - ui;
+  }
+}
+#endif  // USE_CUDA
+
+template<typename Dtype>
+void adam_update_gpu(device* dev, int_tp n, Dtype* w, Dtype* g, Dtype* m,
+                     Dtype* v, Dtype scale, Dtype l2_decay, Dtype l1_decay,
+                     Dtype beta1, Dtype beta2, Dtype eps_hat,
+                     Dtype corrected_rate) {
+  if (dev->backend() == BACKEND_CUDA) {
+#ifdef USE_CUDA
+    AdamUpdate<Dtype>  // NOLINT_NEXT_LINE(whitespace/operators)
+    CUDA_KERNEL(CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS)(
+        n, w, g, m, v, scale, l2_decay, l1_decay, beta1, beta2, eps_hat,
+        corrected_rate);
+    CUDA_POST_KERNEL_CHECK;
+#endif  // USE_CUDA
+  } else {
+#ifdef USE_GREENTEA
+    viennacl::ocl::context &ctx = viennacl::ocl::get_context(dev->id());
+    viennacl::ocl::program &program = Caffe::Get().GetDeviceProgram(
+        dev->id());
+    viennacl::ocl::kernel &oclk_adam_update = program.get_kernel(
+        CL_KERNEL_SELECT("adam_update"));
+    viennacl::ocl::enqueue(
+        oclk_adam_update(n, WrapHandle((cl_mem) w, &ctx),
+                         WrapHandle((cl_mem) g, &ctx),
+                         WrapHandle((cl_mem) m, &ctx),
+                         WrapHandle((cl_mem) v, &ctx), scale, l2_decay,
+                         l1_decay, beta1, beta2, eps_hat, corrected_rate),
+        ctx.get_queue());
+#endif  // USE_GREENTEA
+  }
+}
+
+template void adam_update_gpu<float>(device* dev, int_tp n, float* w, float* g,
+                                     float* m, float* v, float scale,
+                                     float l2_decay, float l1_decay,
+                                     float beta1, float beta2, float eps_hat,
+                                     float corrected_rate);
+template void adam_update_gpu<double>(device* dev, int_tp n, double* w,
+                                      double* g, double* m, double* v,
+                                      double scale, double l2_decay,
+                                      double l1_decay, double beta1,
+                                      double beta2, double eps_hat,
+                                      double corrected_rate);
+#endif  // !CPU_ONLY
+
+}  // namespace caffe
@@ -0,0 +1,69 @@
+#include "caffe/device.hpp"
+#include "caffe/sgd_solvers.hpp"
+
+#ifdef USE_GREENTEA
+#include "caffe/greentea/greentea.hpp"
+#endif
+
+namespace caffe {
+
+#ifndef CPU_ONLY
+#ifdef USE_CUDA
+template<typename Dtype>
+__global__ void NesterovUpdate(const int_tp n, Dtype* w, Dtype* g, Dtype* h,
+                               const Dtype scale, const Dtype l2_decay,
+                               const Dtype l1_decay, const Dtype momentum,
+                               const Dtype local_rate) {
+  CUDA_KERNEL_LOOP(i, n) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * (Dtype(0 < wi) - Dtype(wi < 0));
+    const Dtype hi_old = h[i];
+    const Dtype hi = momentum * hi_old + local_rate * gi;
+    const Dtype ui = (Dtype(1) + momentum) * hi - momentum * hi_old;
+    h[i] = hi;
+    g[i] = ui;
+    w[i] = wi - ui;
+  }
+}
+#endif  // USE_CUDA
+
+template<typename Dtype>
+void nesterov_update_gpu(device* dev, int_tp n, Dtype* w, Dtype* g, Dtype* h,
+                         Dtype scale, Dtype l2_decay, Dtype l1_decay,
+                         Dtype momentum, Dtype local_rate) {
+  if (dev->backend() == BACKEND_CUDA) {
+#ifdef USE_CUDA
+    NesterovUpdate<Dtype>  // NOLINT_NEXT_LINE(whitespace/operators)
+    CUDA_KERNEL(CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS)(
+        n, w, g, h, scale, l2_decay, l1_decay, momentum, local_rate);
+    CUDA_POST_KERNEL_CHECK;
+#endif  // USE_CUDA
+  } else {
+#ifdef USE_GREENTEA
+    viennacl::ocl::context &ctx = viennacl::ocl::get_context(dev->id());
+    viennacl::ocl::program &program = Caffe::Get().GetDeviceProgram(
+        dev->id());
+    viennacl::ocl::kernel &oclk_nesterov_update = program.get_kernel(
+        CL_KERNEL_SELECT("nesterov_update"));
+    viennacl::ocl::enqueue(
+        oclk_nesterov_update(n, WrapHandle((cl_mem) w, &ctx),
+                             WrapHandle((cl_mem) g, &ctx),
+                             WrapHandle((cl_mem) h, &ctx), scale, l2_decay,
+                             l1_decay, momentum, local_rate),
+        ctx.get_queue());
+#endif  // USE_GREENTEA
+  }
+}
+
+template void nesterov_update_gpu<float>(device* dev, int_tp n, float* w,
+                                         float* g, float* h, float scale,
+                                         float l2_decay, float l1_decay,
+                                         float momentum, float local_rate);
+template void nesterov_update_gpu<double>(device* dev, int_tp n, double* w,
+                                          double* g, double* h, double scale,
+                                          double l2_decay, double l1_decay,
+                                          double momentum, double local_rate);
+#endif  // !CPU_ONLY
+
+}  // namespace caffe
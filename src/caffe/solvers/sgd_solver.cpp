@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -67,19 +68,33 @@ void SGDSolver<Dtype>::PreSolve() {
   // Initialize the history
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
   history_.clear();
-  update_.clear();
-  temp_.clear();
   for (uint_tp i = 0; i < net_params.size(); ++i) {
     const vector<int_tp>& shape = net_params[i]->shape();
     history_.push_back(
         shared_ptr<Blob<Dtype>>(
             new Blob<Dtype>(shape, Caffe::GetDefaultDevice())));
-    update_.push_back(
-        shared_ptr<Blob<Dtype>>(
-            new Blob<Dtype>(shape, Caffe::GetDefaultDevice())));
-    temp_.push_back(
-        shared_ptr<Blob<Dtype>>(
-            new Blob<Dtype>(shape, Caffe::GetDefaultDevice())));
+  }
+  // With contiguous params, the history is laid out like the param arena, so
+  // that ApplyUpdate can walk both in one pass.
+  flat_history_memory_.reset();
+  flat_history_ = NULL;
+  if (!this->net_->FlatParamsInUse()) {
+    return;
+  }
+  const uint_tp align = OPENCL_CACHE_ALIGN / sizeof(Dtype);
+  const uint_tp count = this->net_->flat_param_count();
+  flat_history_memory_.reset(new SyncedMemory((count + align) * sizeof(Dtype),
+                                              Caffe::GetDefaultDevice()));
+  char* start = static_cast<char*>(flat_history_memory_->mutable_cpu_data());
+  const uint_tp misalignment =
+      reinterpret_cast<uintptr_t>(start) % OPENCL_CACHE_ALIGN;
+  if (misalignment > 0) {
+    start += OPENCL_CACHE_ALIGN - misalignment;
+  }
+  flat_history_ = reinterpret_cast<Dtype*>(start);
+  for (uint_tp i = 0; i < net_params.size(); ++i) {
+    history_[i]->data()->set_cpu_data(
+        flat_history_ + this->net_->flat_param_offsets()[i]);
   }
 }
 
@@ -87,20 +102,13 @@ template<typename Dtype>
 void SGDSolver<Dtype>::ClipGradients() {
   const Dtype clip_gradients = this->param_.clip_gradients();
   if (clip_gradients < 0) { return; }
-  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
-  Dtype sumsq_diff = 0;
-  for (uint_tp i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
-  }
-  const Dtype l2norm_diff = std::sqrt(sumsq_diff);
+  const Dtype l2norm_diff = std::sqrt(this->net_->SumsqParamDiffs());
   if (l2norm_diff > clip_gradients) {
     Dtype scale_factor = clip_gradients / l2norm_diff;
     LOG(INFO)<< "Gradient clipping: scaling down gradients (L2 norm "
     << l2norm_diff << " > " << clip_gradients << ") "
     << "by scale factor " << scale_factor;
-    for (uint_tp i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor);
-    }
+    this->net_->ScaleParamDiffs(scale_factor);
   }
 }
 
@@ -112,189 +120,126 @@ void SGDSolver<Dtype>::ApplyUpdate() {
     LOG(INFO)<< "Iteration " << this->iter_ << ", lr = " << rate;
   }
   ClipGradients();
+  // The updates also write the params, in place of Net::Update.
+  if (ApplyFlatUpdate(rate)) {
+    return;
+  }
   for (uint_tp param_id = 0; param_id < this->net_->learnable_params().size();
        ++param_id) {
-    Normalize(param_id);
-    Regularize(param_id);
     ComputeUpdateValue(param_id, rate);
   }
-  this->net_->Update();
 }
 
 template<typename Dtype>
-void SGDSolver<Dtype>::Normalize(uint_tp param_id) {
-  if (this->param_.iter_size() == 1) {
-    return;
-  }
+void SGDSolver<Dtype>::GetRegularization(uint_tp param_id, Dtype* scale,
+                                         Dtype* l2_decay, Dtype* l1_decay) {
   // Scale gradient to counterbalance accumulation.
-  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
-  const Dtype accum_normalization = Dtype(1.) / this->param_.iter_size();
-  switch (Caffe::mode()) {
-    case Caffe::CPU: {
-      caffe_scal(net_params[param_id]->count(), accum_normalization,
-                 net_params[param_id]->mutable_cpu_diff());
-      break;
-    }
-    case Caffe::GPU: {
-#ifndef CPU_ONLY
-      if (this->device_->backend() == BACKEND_CUDA) {
-#ifdef USE_CUDA
-        caffe_gpu_scal(net_params[param_id]->count(), accum_normalization,
-                       net_params[param_id]->mutable_gpu_diff());
-#endif  // USE_CUDA
-      } else {
-#ifdef USE_GREENTEA
-        greentea_gpu_scal(this->device_->id(),
-                          net_params[param_id]->count(), accum_normalization,
-                          (cl_mem) (net_params[param_id]->mutable_gpu_diff()),
-                          0);
-#endif  // USE_GREENTEA
-      }
-#else
-      NO_GPU;
-#endif
-      break;
-    }
-    default:
-      LOG(FATAL)<< "Unknown caffe mode: " << Caffe::mode();
+  *scale = Dtype(1.) / this->param_.iter_size();
+  const Dtype local_decay = this->param_.weight_decay()
+      * this->net_->params_weight_decay()[param_id];
+  const string& regularization_type = this->param_.regularization_type();
+  *l2_decay = 0;
+  *l1_decay = 0;
+  if (local_decay) {
+    if (regularization_type == "L2") {
+      *l2_decay = local_decay;
+    } else if (regularization_type == "L1") {
+      *l1_decay = local_decay;
+    } else {
+      LOG(FATAL)<< "Unknown regularization type: " << regularization_type;
     }
   }
+}
 
 template<typename Dtype>
-void SGDSolver<Dtype>::Regularize(uint_tp param_id) {
-  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
-  const vector<float>& net_params_weight_decay =
-      this->net_->params_weight_decay();
-  Dtype weight_decay = this->param_.weight_decay();
-  string regularization_type = this->param_.regularization_type();
-  Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
-  switch (Caffe::mode()) {
-    case Caffe::CPU: {
-      if (local_decay) {
-        if (regularization_type == "L2") {
-          // add weight decay
-          caffe_axpy(net_params[param_id]->count(), local_decay,
-                     net_params[param_id]->cpu_data(),
-                     net_params[param_id]->mutable_cpu_diff());
-        } else if (regularization_type == "L1") {
-          caffe_cpu_sign(net_params[param_id]->count(),
-                         net_params[param_id]->cpu_data(),
-                         temp_[param_id]->mutable_cpu_data());
-          caffe_axpy(net_params[param_id]->count(), local_decay,
-                     temp_[param_id]->cpu_data(),
-                     net_params[param_id]->mutable_cpu_diff());
-        } else {
-          LOG(FATAL)<< "Unknown regularization type: " << regularization_type;
-        }
-      }
-      break;
-    }
-    case Caffe::GPU: {
-#ifndef CPU_ONLY
-      if (this->device_->backend() == BACKEND_CUDA) {
-#ifdef USE_CUDA
-        if (local_decay) {
-          if (regularization_type == "L2") {
-            // add weight decay
-            caffe_gpu_axpy(net_params[param_id]->count(),
-                local_decay,
-                net_params[param_id]->gpu_data(),
-                net_params[param_id]->mutable_gpu_diff());
-          } else if (regularization_type == "L1") {
-            caffe_gpu_sign(net_params[param_id]->count(),
-                net_params[param_id]->gpu_data(),
-                temp_[param_id]->mutable_gpu_data());
-            caffe_gpu_axpy(net_params[param_id]->count(),
-                local_decay,
-                temp_[param_id]->gpu_data(),
-                net_params[param_id]->mutable_gpu_diff());
-          } else {
-            LOG(FATAL)<< "Unknown regularization type: "
-                << regularization_type;
-          }
-        }
-#endif  // USE_CUDA
-      } else {
-#ifdef USE_GREENTEA
-        if (local_decay) {
-          if (regularization_type == "L2") {
-            // add weight decay
-            greentea_gpu_axpy<Dtype>(this->device_->id(),
-                                     net_params[param_id]->count(),
-                local_decay,
-                (cl_mem)(net_params[param_id]->gpu_data()), 0,
-                (cl_mem)(net_params[param_id]->mutable_gpu_diff()), 0);
-          } else if (regularization_type == "L1") {
-            greentea_gpu_sign<Dtype>(this->device_->id(),
-                                     net_params[param_id]->count(),
-                (cl_mem)(net_params[param_id]->gpu_data()), 0,
-                (cl_mem)(temp_[param_id]->mutable_gpu_data()), 0);
-            greentea_gpu_axpy<Dtype>(this->device_->id(),
-                                     net_params[param_id]->count(),
-                local_decay,
-                (cl_mem)(temp_[param_id]->gpu_data()), 0,
-                (cl_mem)(net_params[param_id]->mutable_gpu_diff()), 0);
-          } else {
-            LOG(FATAL)<< "Unknown regularization type: "
-                << regularization_type;
-          }
-        }
-#endif  // USE_GREENTEA
-      }
-#else
-      NO_GPU;
-#endif
-      break;
-    }
-    default: {
-      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+static void sgd_update_cpu(int_tp n, Dtype* w, Dtype* g, Dtype* h,
+                           Dtype scale, Dtype l2_decay, Dtype l1_decay,
+                           Dtype momentum, Dtype local_rate) {
+#pragma omp parallel for simd if (n >= kParallelUpdateMin)
+  for (int_tp i = 0; i < n; ++i) {
+    const Dtype wi = w[i];
+    const Dtype gi = g[i] * scale + l2_decay * wi
+        + l1_decay * (Dtype(0 < wi) - Dtype(wi < 0));
+    const Dtype hi = momentum * h[i] + local_rate * gi;
+    h[i] = hi;
+    g[i] = hi;
+    w[i] = wi - hi;
+  }
+}
+
+template<typename Dtype>
+bool SGDSolver<Dtype>::ApplyFlatUpdate(Dtype rate) {
+  Net<Dtype>* net = this->net_.get();
+  if (!flat_history_ || !net->FlatParamsInUse()) {
+    return false;
+  }
+  const vector<uint_tp>& offsets = net->flat_param_offsets();
+  const int_tp num_params = offsets.size();
+  const Dtype momentum = this->param_.momentum();
+  vector<Dtype> local_rates(num_params);
+  vector<Dtype> l2_decays(num_params);
+  vector<Dtype> l1_decays(num_params);
+  Dtype scale = 1;
+  for (int_tp i = 0; i < num_params; ++i) {
+    local_rates[i] = rate * net->params_lr()[i];
+    GetRegularization(i, &scale, &l2_decays[i], &l1_decays[i]);
+  }
+  Dtype* data = net->flat_param_data();
+  Dtype* diff = net->flat_param_diff();
+  const uint_tp count = net->flat_param_count();
+  const int_tp blocks = (count + kFlatUpdateBlock - 1) / kFlatUpdateBlock;
+  // Every block looks up the params it covers by their offsets. The padding
+  // after a param is updated with its scalars, and stays zero.
+#pragma omp parallel for if (count >= kParallelUpdateMin)
+  for (int_tp block = 0; block < blocks; ++block) {
+    uint_tp begin = block * kFlatUpdateBlock;
+    const uint_tp end = std::min<uint_tp>(begin + kFlatUpdateBlock, count);
+    int_tp i = std::upper_bound(offsets.begin(), offsets.end(), begin)
+        - offsets.begin() - 1;
+    while (begin < end) {
+      const uint_tp stop =
+          i + 1 < num_params ? std::min(offsets[i + 1], end) : end;
+      sgd_update_cpu<Dtype>(stop - begin, data + begin, diff + begin,
+                            flat_history_ + begin, scale, l2_decays[i],
+                            l1_decays[i], momentum, local_rates[i]);
+      begin = stop;
+      ++i;
     }
   }
+  net->MarkParamsWritten();
+  return true;
 }
 
+#ifndef CPU_ONLY
+template<typename Dtype>
+void sgd_update_gpu(device* dev, int_tp n, Dtype* w, Dtype* g, Dtype* h,
+                    Dtype scale, Dtype l2_decay, Dtype l1_decay, Dtype momentum,
+                    Dtype local_rate);
+#endif  // !CPU_ONLY
+
 template<typename Dtype>
 void SGDSolver<Dtype>::ComputeUpdateValue(uint_tp param_id, Dtype rate) {
-  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
-  const vector<float>& net_params_lr = this->net_->params_lr();
-  Dtype momentum = this->param_.momentum();
-  Dtype local_rate = rate * net_params_lr[param_id];
-  // Compute the update to history, then copy it to the parameter diff.
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  Dtype scale, l2_decay, l1_decay;
+  GetRegularization(param_id, &scale, &l2_decay, &l1_decay);
+  // Compute the update to history, copy it to the parameter diff and apply
+  // it to the parameter.
   switch (Caffe::mode()) {
     case Caffe::CPU: {
-      caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-                      net_params[param_id]->cpu_diff(), momentum,
-                      history_[param_id]->mutable_cpu_data());
-      caffe_cpu_copy(net_params[param_id]->count(),
-                     history_[param_id]->cpu_data(),
-                 net_params[param_id]->mutable_cpu_diff());
+      sgd_update_cpu(param->count(), param->mutable_cpu_data(),
+                     param->mutable_cpu_diff(),
+                     history_[param_id]->mutable_cpu_data(), scale, l2_decay,
+                     l1_decay, momentum, local_rate);
       break;
     }
     case Caffe::GPU: {
 #ifndef CPU_ONLY
-      if (this->device_->backend() == BACKEND_CUDA) {
-#ifdef USE_CUDA
-        caffe_gpu_axpby(net_params[param_id]->count(), local_rate,
-                        net_params[param_id]->gpu_diff(), momentum,
-                        history_[param_id]->mutable_gpu_data());
-        caffe_copy(net_params[param_id]->count(),
-                   history_[param_id]->gpu_data(),
-                   net_params[param_id]->mutable_gpu_diff());
-#endif  // USE_CUDA
-      } else {
-#ifdef USE_GREENTEA
-        viennacl::ocl::context &ctx = viennacl::ocl::get_context(
-            this->device_->id());
-
-        greentea_gpu_axpby<Dtype>(
-            this->device_->id(), net_params[param_id]->count(),
-            local_rate, (cl_mem) (net_params[param_id]->gpu_diff()), 0,
-            momentum, (cl_mem) (history_[param_id]->mutable_gpu_data()), 0);
-        greentea_copy<Dtype>(
-            net_params[param_id]->count(),
-            (cl_mem) (history_[param_id]->gpu_data()), 0,
-            (cl_mem) (net_params[param_id]->mutable_gpu_diff()), 0, &ctx);
-#endif  // USE_GREENTEA
-      }
+      sgd_update_gpu(this->device_, param->count(),
+                     param->mutable_gpu_data(), param->mutable_gpu_diff(),
+                     history_[param_id]->mutable_gpu_data(), scale, l2_decay,
+                     l1_decay, momentum, local_rate);
 #else
       NO_GPU;
 #endif
@@ -342,6 +287,7 @@ void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(
     const string& model_filename) {
+  HDF5Lock lock;
   string snapshot_filename =
       Solver<Dtype>::SnapshotFilename(".solverstate.h5");
   LOG(INFO) << "Snapshotting solver state to HDF5 file " << snapshot_filename;
@@ -387,6 +333,7 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
 
 template <typename Dtype>
 void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
+  HDF5Lock lock;
   hid_t file_hid = H5Fopen(state_file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open solver state file " << state_file;
   this->iter_ = hdf5_load_int(file_hid, "iter");
@@ -4,6 +4,7 @@
 
 #include "../../include/caffe/device.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_pool.hpp"
 
 #ifdef USE_GREENTEA
 #include "caffe/greentea/greentea_im2col.hpp"
@@ -17,80 +18,92 @@ namespace caffe {
 // The improvement in performance seems negligible in the single GPU case,
 // but might be more significant for parallel training. Most importantly,
 // it improved stability for large models on many GPUs.
+// Freed blocks are cached in Caffe::host_memory_pool() by size class and by
+// how they were allocated, so that reshaped blobs reuse them.
 
-void CaffeMallocHost(void** ptr, int_tp size) {
+void CaffeMallocHost(void** ptr, int_tp size, int_tp* flags) {
+  *flags = CAFFE_HOST_MALLOC;
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
     if (Caffe::GetDefaultDevice()->backend() == BACKEND_CUDA) {
 #ifdef USE_CUDA
-      CUDA_CHECK(cudaMallocHost(ptr, size));
-      return;
+      *flags = CAFFE_HOST_PINNED;
 #endif  // USE_CUDA
     } else {
       // Make sure the memory is zero-copy usable in OpenCL
-      CHECK_EQ(0, posix_memalign(ptr, OPENCL_PAGE_ALIGN,
-              ((size - 1)/OPENCL_CACHE_ALIGN + 1) * OPENCL_CACHE_ALIGN))
-                  << "Host memory allocation error of size: "
-                  << size << " B";
-      return;
+      *flags = CAFFE_HOST_ALIGNED;
     }
   }
 #endif
-  *ptr = malloc(size);
-  CHECK(*ptr) << "host allocation of size " << size << " failed";
+  const uint_tp bytes = MemoryPool::SizeClass(size);
+  *ptr = Caffe::host_memory_pool().Take(bytes, *flags);
+  if (*ptr) {
+    return;
+  }
+  switch (*flags) {
+    case CAFFE_HOST_PINNED: {
+#ifdef USE_CUDA
+      CUDA_CHECK(cudaMallocHost(ptr, bytes));
+#endif  // USE_CUDA
+      break;
+    }
+    case CAFFE_HOST_ALIGNED: {
+      // Size classes are multiples of OPENCL_CACHE_ALIGN
+      CHECK_EQ(0, posix_memalign(ptr, OPENCL_PAGE_ALIGN, bytes))
+          << "Host memory allocation error of size: " << size << " B";
+      break;
+    }
+    default: {
+      *ptr = malloc(bytes);
+      CHECK(*ptr) << "host allocation of size " << size << " failed";
+    }
+  }
 }
 
-void CaffeFreeHost(void* ptr) {
-#ifndef CPU_ONLY
-  if (Caffe::mode() == Caffe::GPU) {
-    if (Caffe::GetDefaultDevice()->backend() == BACKEND_CUDA) {
+static void CaffeReleaseHost(void* ptr, int_tp flags) {
+  if (flags == CAFFE_HOST_PINNED) {
 #ifdef USE_CUDA
-      cudaFreeHost(ptr);
-      return;
+    cudaFreeHost(ptr);
 #endif  // USE_CUDA
-    }
+    return;
   }
-#endif
   free(ptr);
 }
 
+void CaffeFreeHost(void* ptr, int_tp size, int_tp flags) {
+  if (!Caffe::host_memory_pool().Give(ptr, size, flags)) {
+    CaffeReleaseHost(ptr, flags);
+  }
+}
+
+void CaffeTrimHostPool() {
+  vector<MemoryPool::Block> blocks = Caffe::host_memory_pool().Trim();
+  for (int_tp i = 0; i < blocks.size(); ++i) {
+    CaffeReleaseHost(blocks[i].ptr, blocks[i].flags);
+  }
+}
+
 
 SyncedMemory::~SyncedMemory() {
 #ifndef CPU_ONLY
   if (gpu_ptr_ && own_gpu_data_) {
     if (device_->backend() == Backend::BACKEND_CUDA) {
 #ifdef USE_CUDA
-      // Free device memory
-      // Get current device active during call of destructor
-      int initial_device;
-      cudaGetDevice(&initial_device);
-      // We know that this memory blob belongs to the device_
-      cudaSetDevice(device_->id());
-      cudaFree(gpu_ptr_);
-      // Restore current device
-      cudaSetDevice(initial_device);
+      device_->FreeMemory(gpu_ptr_, size_);
       gpu_ptr_ = nullptr;
-      device_->DecreaseMemoryUsage(size_);
 #endif  // USE_CUDA
     } else {
 #ifdef USE_GREENTEA
-      // Free device memory
-      viennacl::ocl::context ctx = viennacl::ocl::get_context(
-          device_->id());
-      ctx.get_queue().finish();
-      CHECK_EQ(CL_SUCCESS, clReleaseMemObject(cl_gpu_mem_))
-          << "OpenCL memory corruption";
+      device_->FreeMemory(gpu_ptr_, size_);
       gpu_ptr_ = nullptr;
       cl_gpu_mem_ = nullptr;
-      ctx.get_queue().finish();
-      device_->DecreaseMemoryUsage(size_);
 #endif  // USE_GREENTEA
     }
   }
 #endif  // !CPU_ONLY
   // Free host memory
   if (cpu_ptr_ && own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_, cpu_malloc_flags_);
     cpu_ptr_ = nullptr;
   }
 }
@@ -98,7 +111,7 @@ SyncedMemory::~SyncedMemory() {
 inline void SyncedMemory::to_cpu() {
   switch (head_) {
     case UNINITIALIZED: {
-      CaffeMallocHost(&cpu_ptr_, size_);
+      CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_flags_);
       caffe_memset(size_, 0, cpu_ptr_);
       head_ = HEAD_AT_CPU;
       own_cpu_data_ = true;
@@ -107,7 +120,7 @@ inline void SyncedMemory::to_cpu() {
     case HEAD_AT_GPU: {
 #ifndef CPU_ONLY
       if (cpu_ptr_ == nullptr) {
-        CaffeMallocHost(&cpu_ptr_, size_);
+        CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_flags_);
         own_cpu_data_ = true;
       }
       if (device_->backend() == Backend::BACKEND_CUDA) {
@@ -140,8 +153,7 @@ inline void SyncedMemory::to_gpu() {
     case UNINITIALIZED: {
       if (device_->backend() == Backend::BACKEND_CUDA) {
 #ifdef USE_CUDA
-        CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
-        device_->IncreaseMemoryUsage(size_);
+        gpu_ptr_ = device_->MallocMemory(size_);
         caffe_gpu_memset(size_, 0, gpu_ptr_);
         own_gpu_data_ = true;
 #endif  // USE_CUDA
@@ -150,18 +162,7 @@ inline void SyncedMemory::to_gpu() {
         viennacl::ocl::context ctx = viennacl::ocl::get_context(
             device_->id());
         ctx.get_queue().finish();
-        cl_int err;
-        if (ctx.devices()[0].type() == CL_DEVICE_TYPE_CPU) {
-          cl_gpu_mem_ = clCreateBuffer(ctx.handle().get(),
-                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                     size_, nullptr, &err);
-        } else {
-          cl_gpu_mem_ = clCreateBuffer(ctx.handle().get(), CL_MEM_READ_WRITE,
-                                       size_, nullptr, &err);
-        }
-        CHECK_EQ(0, err) << "OpenCL buffer allocation of size "
-                        << size_ << " failed.";
-        device_->IncreaseMemoryUsage(size_);
+        cl_gpu_mem_ = static_cast<cl_mem>(device_->MallocMemory(size_));
         int_tp alpha = 0;
         greentea_memset(device_->id(), size_, alpha, cl_gpu_mem_, 0);
         gpu_ptr_ = reinterpret_cast<void*>(cl_gpu_mem_);
@@ -176,8 +177,7 @@ inline void SyncedMemory::to_gpu() {
       if (device_->backend() == Backend::BACKEND_CUDA) {
 #ifdef USE_CUDA
         if (gpu_ptr_ == nullptr) {
-          CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
-          device_->IncreaseMemoryUsage(size_);
+          gpu_ptr_ = device_->MallocMemory(size_);
         }
         caffe_gpu_memcpy(size_, cpu_ptr_, gpu_ptr_);
         own_gpu_data_ = true;
@@ -188,18 +188,7 @@ inline void SyncedMemory::to_gpu() {
             device_->id());
         ctx.get_queue().finish();
         if (gpu_ptr_ == nullptr) {
-          cl_int err;
-          if (ctx.devices()[0].type() == CL_DEVICE_TYPE_CPU) {
-            cl_gpu_mem_ = clCreateBuffer(
-                ctx.handle().get(), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                size_, nullptr, &err);
-          } else {
-            cl_gpu_mem_ = clCreateBuffer(ctx.handle().get(), CL_MEM_READ_WRITE,
-                                         size_, nullptr, &err);
-          }
-          CHECK_EQ(0, err) << "OpenCL buffer allocation of size "
-                          << size_ << " failed.";
-          device_->IncreaseMemoryUsage(size_);
+          cl_gpu_mem_ = static_cast<cl_mem>(device_->MallocMemory(size_));
           gpu_ptr_ = reinterpret_cast<void*>(cl_gpu_mem_);
           ctx.get_queue().finish();
         }
@@ -228,11 +217,12 @@ const void* SyncedMemory::cpu_data() {
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
   if (cpu_ptr_ && own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_, cpu_malloc_flags_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
   own_cpu_data_ = false;
+  ++version_;
 }
 
 const void* SyncedMemory::gpu_data() {
@@ -251,15 +241,12 @@ void SyncedMemory::set_gpu_data(void* data) {
 #ifdef USE_CUDA
   CHECK(data);
   if (own_gpu_data_) {
-    int initial_device;
-    cudaGetDevice(&initial_device);
-    CUDA_CHECK(cudaSetDevice(device_->id()));
-    CUDA_CHECK(cudaFree(gpu_ptr_));
-    cudaSetDevice(initial_device);
+    device_->FreeMemory(gpu_ptr_, size_);
   }
   gpu_ptr_ = data;
   head_ = HEAD_AT_GPU;
   own_gpu_data_ = false;
+  ++version_;
 #endif  // USE_CUDA
   } else {
 #ifdef USE_GREENTEA
@@ -274,6 +261,7 @@ void SyncedMemory::set_gpu_data(void* data) {
 void* SyncedMemory::mutable_cpu_data() {
   to_cpu();
   head_ = HEAD_AT_CPU;
+  ++version_;
   return cpu_ptr_;
 }
 
@@ -281,6 +269,7 @@ void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
   to_gpu();
   head_ = HEAD_AT_GPU;
+  ++version_;
   return gpu_ptr_;
 #else
   NO_GPU;
@@ -294,7 +283,7 @@ void* SyncedMemory::mutable_gpu_data() {
 void SyncedMemory::async_gpu_push(const cudaStream_t& stream) {
   CHECK(head_ == HEAD_AT_CPU);
   if (gpu_ptr_ == NULL) {
-    CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+    gpu_ptr_ = device_->MallocMemory(size_);
     own_gpu_data_ = true;
   }
   const cudaMemcpyKind put = cudaMemcpyHostToDevice;
@@ -303,6 +292,22 @@ void SyncedMemory::async_gpu_push(const cudaStream_t& stream) {
   head_ = SYNCED;
 }
 #endif  // USE_CUDA
+#ifdef USE_GREENTEA
+void SyncedMemory::async_gpu_push(const viennacl::ocl::command_queue& queue) {
+  CHECK(head_ == HEAD_AT_CPU);
+  if (gpu_ptr_ == NULL) {
+    cl_gpu_mem_ = static_cast<cl_mem>(device_->MallocMemory(size_));
+    gpu_ptr_ = reinterpret_cast<void*>(cl_gpu_mem_);
+    own_gpu_data_ = true;
+  }
+  // The host block is page aligned, which lets the driver transfer from it
+  // without staging.
+  CHECK_EQ(CL_SUCCESS, clEnqueueWriteBuffer(queue.handle().get(),
+                                            (cl_mem) gpu_ptr_, CL_FALSE, 0,
+                                            size_, cpu_ptr_, 0, NULL, NULL));
+  head_ = SYNCED;
+}
+#endif  // USE_GREENTEA
 #endif  // !CPU_ONLY
 
 }  // namespace caffe
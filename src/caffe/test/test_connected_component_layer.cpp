@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Breadth-first flood fill over one (D, H, W) slice, numbering components
+// in raster order from first_label.
+template <typename Dtype>
+void connected_components_reference(const Dtype* data, int_tp depth,
+                                    int_tp height, int_tp width, bool full,
+                                    Dtype first_label, Dtype* labels) {
+  const int_tp count = depth * height * width;
+  vector<bool> seen(count, false);
+  Dtype next = first_label;
+  for (int_tp i = 0; i < count; ++i) {
+    labels[i] = 0;
+  }
+  for (int_tp start = 0; start < count; ++start) {
+    if (data[start] == 0 || seen[start]) {
+      continue;
+    }
+    std::queue<int_tp> queue;
+    queue.push(start);
+    seen[start] = true;
+    while (!queue.empty()) {
+      const int_tp i = queue.front();
+      queue.pop();
+      labels[i] = next;
+      const int_tp z = i / (height * width);
+      const int_tp y = (i / width) % height;
+      const int_tp x = i % width;
+      for (int_tp dz = -1; dz <= 1; ++dz) {
+        for (int_tp dy = -1; dy <= 1; ++dy) {
+          for (int_tp dx = -1; dx <= 1; ++dx) {
+            const int_tp nonzero = (dz != 0) + (dy != 0) + (dx != 0);
+            if (nonzero == 0 || (!full && nonzero > 1)) {
+              continue;
+            }
+            const int_tp nz = z + dz, ny = y + dy, nx = x + dx;
+            if (nz < 0 || nz >= depth || ny < 0 || ny >= height || nx < 0
+                || nx >= width) {
+              continue;
+            }
+            const int_tp j = (nz * height + ny) * width + nx;
+            if (!seen[j] && data[j] == data[start]) {
+              seen[j] = true;
+              queue.push(j);
+            }
+          }
+        }
+      }
+    }
+    next += 1;
+  }
+}
+
+template <typename Dtype>
+class ConnectedComponentLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  ConnectedComponentLayerTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~ConnectedComponentLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+
+  // Fills the bottom with a few random labels, so that components of all
+  // shapes occur.
+  void FillRandom(const vector<int_tp>& shape, int_tp num_labels) {
+    blob_bottom_->Reshape(shape);
+    caffe_rng_uniform<Dtype>(blob_bottom_->count(), Dtype(0),
+                             Dtype(num_labels),
+                             blob_bottom_->mutable_cpu_data());
+    Dtype* data = blob_bottom_->mutable_cpu_data();
+    for (int_tp i = 0; i < blob_bottom_->count(); ++i) {
+      data[i] = static_cast<int_tp>(data[i]);
+    }
+  }
+
+  void CheckAgainstReference(uint_tp connectivity) {
+    LayerParameter layer_param;
+    layer_param.mutable_connected_component_param()->set_connectivity(
+        connectivity);
+    ConnectedComponentLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    const bool full = connectivity == 8 || connectivity == 26;
+    const int_tp depth = blob_bottom_->num_axes() == 5
+        ? blob_bottom_->shape(2) : 1;
+    const int_tp slice_size = blob_bottom_->count(2);
+    vector<Dtype> expected(slice_size);
+    for (int_tp nc = 0; nc < blob_bottom_->count(0, 2); ++nc) {
+      const Dtype* data = blob_bottom_->cpu_data() + nc * slice_size;
+      Dtype max_label = 0;
+      for (int_tp i = 0; i < slice_size; ++i) {
+        max_label = std::max(max_label, data[i]);
+      }
+      connected_components_reference(data, depth, blob_bottom_->shape(-2),
+          blob_bottom_->shape(-1), full, max_label + 1, &expected[0]);
+      const Dtype* labels = blob_top_->cpu_data() + nc * slice_size;
+      for (int_tp i = 0; i < slice_size; ++i) {
+        EXPECT_EQ(expected[i], labels[i]);
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(ConnectedComponentLayerTest, TestDtypes);
+
+TYPED_TEST(ConnectedComponentLayerTest, TestDiagonal2D) {
+  typedef TypeParam Dtype;
+  // 1 0 1
+  // 0 1 0
+  this->blob_bottom_->Reshape(1, 1, 2, 3);
+  Dtype* data = this->blob_bottom_->mutable_cpu_data();
+  data[0] = 1; data[1] = 0; data[2] = 1;
+  data[3] = 0; data[4] = 1; data[5] = 0;
+  LayerParameter layer_param;
+  ConnectedComponentLayer<Dtype> layer4(layer_param);
+  layer4.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer4.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* labels = this->blob_top_->cpu_data();
+  EXPECT_EQ(2, labels[0]);
+  EXPECT_EQ(0, labels[1]);
+  EXPECT_EQ(3, labels[2]);
+  EXPECT_EQ(4, labels[4]);
+  layer_param.mutable_connected_component_param()->set_connectivity(8);
+  ConnectedComponentLayer<Dtype> layer8(layer_param);
+  layer8.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer8.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  labels = this->blob_top_->cpu_data();
+  EXPECT_EQ(2, labels[0]);
+  EXPECT_EQ(2, labels[2]);
+  EXPECT_EQ(2, labels[4]);
+}
+
+TYPED_TEST(ConnectedComponentLayerTest, TestLargeLabels) {
+  typedef TypeParam Dtype;
+  // Labels above 127 must survive: two separate regions of label 300.
+  this->blob_bottom_->Reshape(1, 1, 1, 5);
+  Dtype* data = this->blob_bottom_->mutable_cpu_data();
+  data[0] = 300; data[1] = 300; data[2] = 0; data[3] = 300; data[4] = 200;
+  LayerParameter layer_param;
+  ConnectedComponentLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* labels = this->blob_top_->cpu_data();
+  EXPECT_EQ(301, labels[0]);
+  EXPECT_EQ(301, labels[1]);
+  EXPECT_EQ(0, labels[2]);
+  EXPECT_EQ(302, labels[3]);
+  EXPECT_EQ(303, labels[4]);
+}
+
+TYPED_TEST(ConnectedComponentLayerTest, TestRandom2D) {
+  vector<int_tp> shape(4);
+  shape[0] = 2;
+  shape[1] = 3;
+  shape[2] = 17;
+  shape[3] = 13;
+  this->FillRandom(shape, 3);
+  this->CheckAgainstReference(4);
+  this->CheckAgainstReference(8);
+}
+
+TYPED_TEST(ConnectedComponentLayerTest, TestRandom3D) {
+  vector<int_tp> shape(5);
+  shape[0] = 2;
+  shape[1] = 1;
+  shape[2] = 7;
+  shape[3] = 9;
+  shape[4] = 8;
+  this->FillRandom(shape, 3);
+  this->CheckAgainstReference(6);
+  this->CheckAgainstReference(26);
+}
+
+TYPED_TEST(ConnectedComponentLayerTest, TestLargeSlice2D) {
+  // Large enough to be split into blocks of rows labeled in parallel.
+  vector<int_tp> shape(4);
+  shape[0] = 1;
+  shape[1] = 1;
+  shape[2] = 300;
+  shape[3] = 250;
+  this->FillRandom(shape, 2);
+  this->CheckAgainstReference(4);
+  this->CheckAgainstReference(8);
+}
+
+TYPED_TEST(ConnectedComponentLayerTest, TestLargeSlice3D) {
+  // Large enough to be split into blocks labeled in parallel.
+  vector<int_tp> shape(5);
+  shape[0] = 1;
+  shape[1] = 1;
+  shape[2] = 70;
+  shape[3] = 40;
+  shape[4] = 30;
+  this->FillRandom(shape, 2);
+  this->CheckAgainstReference(6);
+  this->CheckAgainstReference(26);
+}
+
+}  // namespace caffe
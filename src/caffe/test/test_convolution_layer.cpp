@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -42,13 +44,22 @@ void caffe_conv(const Blob<Dtype>* in, ConvolutionParameter* conv_param,
   } else {
     stride_h = stride_w = conv_param->stride_size() ? conv_param->stride(0) : 1;
   }
-  int_tp kernel_d, pad_d, stride_d;
+  int_tp kstride_h, kstride_w;
+  if (conv_param->has_kstride_h() || conv_param->has_kstride_w()) {
+    kstride_h = conv_param->kstride_h();
+    kstride_w = conv_param->kstride_w();
+  } else {
+    kstride_h = kstride_w =
+        conv_param->kstride_size() ? conv_param->kstride(0) : 1;
+  }
+  int_tp kernel_d, pad_d, stride_d, kstride_d;
   if (has_depth) {
     kernel_d = kernel_h;
     stride_d = stride_h;
     pad_d = pad_h;
+    kstride_d = kstride_h;
   } else {
-    kernel_d = stride_d = 1;
+    kernel_d = stride_d = kstride_d = 1;
     pad_d = 0;
   }
   // Groups
@@ -73,9 +84,9 @@ void caffe_conv(const Blob<Dtype>* in, ConvolutionParameter* conv_param,
                 for (int_tp r = 0; r < kernel_d; r++) {
                   for (int_tp p = 0; p < kernel_h; p++) {
                     for (int_tp q = 0; q < kernel_w; q++) {
-                      int_tp in_z = z * stride_d - pad_d + r;
-                      int_tp in_y = y * stride_h - pad_h + p;
-                      int_tp in_x = x * stride_w - pad_w + q;
+                      int_tp in_z = z * stride_d - pad_d + r * kstride_d;
+                      int_tp in_y = y * stride_h - pad_h + p * kstride_h;
+                      int_tp in_x = x * stride_w - pad_w + q * kstride_w;
                       if (in_z >= 0 && in_z < (has_depth ? in->shape(2) : 1)
                           && in_y >= 0 && in_y < in->shape(2 + has_depth)
                           && in_x >= 0 && in_x < in->shape(3 + has_depth)) {
@@ -341,6 +352,125 @@ TYPED_TEST(ConvolutionLayerTest, TestSimple3DConvolution) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestDilatedConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(2);
+  convolution_param->add_kstride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->height(), 4);
+  EXPECT_EQ(this->blob_top_->width(), 2);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDilated3DConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  vector<int_tp> bottom_shape(5);
+  bottom_shape[0] = this->blob_bottom_vec_[0]->shape(0);
+  bottom_shape[1] = this->blob_bottom_vec_[0]->shape(1);
+  bottom_shape[2] = 5;
+  bottom_shape[3] = this->blob_bottom_vec_[0]->shape(2);
+  bottom_shape[4] = this->blob_bottom_vec_[0]->shape(3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int_tp i = 0; i < this->blob_bottom_vec_.size(); ++i) {
+    this->blob_bottom_vec_[i]->Reshape(bottom_shape);
+    filler.Fill(this->blob_bottom_vec_[i]);
+  }
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(2);
+  convolution_param->add_kstride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestBatchedConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Three images with room for two images per column buffer, so both a full
+  // and a partial batch are exercised.
+  vector<int_tp> bottom_shape = this->blob_bottom_->shape();
+  bottom_shape[0] = 3;
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  // Per image: 3 * 3 * 3 column rows and 4 output rows, 2 * 1 pixels each.
+  convolution_param->set_cpu_batch_memory(2 * (27 + 4) * 2 * sizeof(Dtype));
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, Test1x1Convolution) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -653,6 +783,71 @@ TYPED_TEST(ConvolutionLayerTest, TestGradient3D) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestGradientDilated) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->add_kernel_size(2);
+  convolution_param->add_kstride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientDilated3D) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  vector<int_tp> bottom_shape(5);
+  bottom_shape[0] = this->blob_bottom_vec_[0]->shape(0);
+  bottom_shape[1] = this->blob_bottom_vec_[0]->shape(1);
+  bottom_shape[2] = 5;
+  bottom_shape[3] = this->blob_bottom_vec_[0]->shape(2);
+  bottom_shape[4] = this->blob_bottom_vec_[0]->shape(3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int_tp i = 0; i < this->blob_bottom_vec_.size(); ++i) {
+    this->blob_bottom_vec_[i]->Reshape(bottom_shape);
+    filler.Fill(this->blob_bottom_vec_[i]);
+  }
+  convolution_param->add_kernel_size(2);
+  convolution_param->add_kstride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientBatched) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_cpu_batch_memory(1 << 20);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 TYPED_TEST(ConvolutionLayerTest, Test1x1Gradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -688,6 +883,295 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+template <typename Dtype>
+class DirectConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  DirectConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 6, 4)),
+        blob_top_(new Blob<Dtype>()),
+        ref_blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~DirectConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_top_;
+  }
+
+  void MakeBottom3D(int_tp depth, int_tp height, int_tp width) {
+    vector<int_tp> bottom_shape(5);
+    bottom_shape[0] = 2;
+    bottom_shape[1] = 3;
+    bottom_shape[2] = depth;
+    bottom_shape[3] = height;
+    bottom_shape[4] = width;
+    blob_bottom_->Reshape(bottom_shape);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+  }
+
+  // Runs the direct engine and checks it against the reference convolution.
+  void CheckForward(ConvolutionParameter* convolution_param,
+                    const LayerParameter& layer_param) {
+    DirectConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ref_blob_top_->ReshapeLike(*blob_top_);
+    caffe_set(ref_blob_top_->count(), Dtype(0),
+              ref_blob_top_->mutable_cpu_data());
+    caffe_conv(this->blob_bottom_, convolution_param, layer.blobs(),
+               ref_blob_top_);
+    const Dtype* top_data = blob_top_->cpu_data();
+    const Dtype* ref_top_data = ref_blob_top_->cpu_data();
+    for (int_tp i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const ref_blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(DirectConvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(DirectConvolutionLayerTest, TestSimpleConvolutionDirect) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckForward(convolution_param, layer_param);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestPaddedDilatedConvolutionDirect) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(2);
+  convolution_param->add_stride(2);
+  convolution_param->add_kstride(2);
+  convolution_param->set_num_output(5);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckForward(convolution_param, layer_param);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestConvolutionGroupDirect) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckForward(convolution_param, layer_param);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, Test3DConvolutionDirect) {
+  this->MakeBottom3D(5, 6, 4);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckForward(convolution_param, layer_param);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestGradientDirect) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(2);
+  convolution_param->add_stride(2);
+  convolution_param->add_kstride(2);
+  convolution_param->set_num_output(5);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  DirectConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestGradient3DGroupDirect) {
+  typedef TypeParam Dtype;
+  this->MakeBottom3D(3, 4, 3);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  DirectConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+template <typename Dtype>
+class WinogradConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  WinogradConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 9, 7)),
+        blob_top_(new Blob<Dtype>()),
+        ref_blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~WinogradConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_top_;
+  }
+
+  ConvolutionParameter* MakeParam(LayerParameter* layer_param,
+                                  uint_tp tile) {
+    ConvolutionParameter* convolution_param =
+        layer_param->mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->set_num_output(6);
+    convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+    convolution_param->set_winograd_tile(tile);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    return convolution_param;
+  }
+
+  // Checks the top of an already set up layer against the reference
+  // convolution. The Winograd transforms trade a few ulps of accuracy for
+  // fewer multiplies, so the tolerance is relative to the output magnitude.
+  void CheckTop(ConvolutionParameter* convolution_param,
+                const vector<shared_ptr<Blob<Dtype> > >& weights,
+                Dtype tolerance) {
+    ref_blob_top_->ReshapeLike(*blob_top_);
+    caffe_set(ref_blob_top_->count(), Dtype(0),
+              ref_blob_top_->mutable_cpu_data());
+    caffe_conv(this->blob_bottom_, convolution_param, weights,
+               ref_blob_top_);
+    const Dtype* top_data = blob_top_->cpu_data();
+    const Dtype* ref_top_data = ref_blob_top_->cpu_data();
+    for (int_tp i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i],
+                  tolerance * std::max(Dtype(1), std::abs(ref_top_data[i])));
+    }
+  }
+
+  void CheckForward(ConvolutionParameter* convolution_param,
+                    const LayerParameter& layer_param, Dtype tolerance) {
+    WinogradConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    CheckTop(convolution_param, layer.blobs(), tolerance);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const ref_blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(WinogradConvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWinogradF2) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = this->MakeParam(&layer_param, 2);
+  convolution_param->add_pad(1);
+  this->CheckForward(convolution_param, layer_param, 1e-4);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWinogradF4) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = this->MakeParam(&layer_param, 4);
+  convolution_param->add_pad(1);
+  this->CheckForward(convolution_param, layer_param, 1e-4);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWinogradPartialTiles) {
+  // 7 x 5 output: the last row and column of tiles are cropped.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = this->MakeParam(&layer_param, 4);
+  this->CheckForward(convolution_param, layer_param, 1e-4);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWinogradGroup) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = this->MakeParam(&layer_param, 4);
+  convolution_param->add_pad(2);
+  convolution_param->set_group(3);
+  this->CheckForward(convolution_param, layer_param, 1e-4);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWinogradWeightChange) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = this->MakeParam(&layer_param, 2);
+  convolution_param->add_pad(1);
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The transformed filters must follow updates of the weights.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(layer.blobs()[0].get());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckTop(convolution_param, layer.blobs(), 1e-4);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWinogradFallback) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = this->MakeParam(&layer_param, 2);
+  convolution_param->add_stride(2);
+  this->CheckForward(convolution_param, layer_param, 1e-4);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestGradientWinograd) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = this->MakeParam(&layer_param, 2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(2);
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
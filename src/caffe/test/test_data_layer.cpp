@@ -1,8 +1,12 @@
 #ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
 #include <string>
 #include <vector>
 
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
@@ -11,6 +15,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/decoded_cache.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -19,6 +24,43 @@ namespace caffe {
 
 using boost::scoped_ptr;
 
+// Prefetches a single batch, which is only loaded once the test opens the
+// gate, so that the test decides whether Forward has to wait for it.
+template <typename Dtype>
+class GatedDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit GatedDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param) {}
+  virtual ~GatedDataLayer() { this->StopInternalThread(); }
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+                              const vector<Blob<Dtype>*>& top) {
+    top[0]->Reshape(1, 1, 1, 1);
+    for (int_tp i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->data_.Reshape(1, 1, 1, 1);
+    }
+  }
+  virtual inline const char* type() const { return "GatedData"; }
+  virtual inline int_tp ExactNumTopBlobs() const { return 1; }
+
+  // Lets the prefetch thread load one batch after sleeping for ms.
+  void OpenAfter(int_tp ms) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(ms));
+    gate_.push(NULL);
+  }
+  // Number of batches loaded and not popped yet.
+  uint_tp loaded() const { return this->prefetch_full_.size(); }
+
+ protected:
+  virtual inline int_tp prefetch_count() const { return 1; }
+  virtual void load_batch(Batch<Dtype>* batch) {
+    gate_.pop();
+    batch->data_.mutable_cpu_data()[0] = 0;
+  }
+
+  // Holds one token per batch the thread may load.
+  BlockingQueue<Batch<Dtype>*> gate_;
+};
+
 template <typename TypeParam>
 class DataLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -67,7 +109,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int_tp prefetch = 4) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -75,6 +117,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_prefetch(prefetch);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -103,6 +146,155 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         }
       }
     }
+    EXPECT_LE(layer.prefetch_waits(), 100);
+    if (layer.prefetch_waits() == 0) {
+      EXPECT_EQ(0, layer.prefetch_wait_ms());
+    }
+  }
+
+  // Writes datums 0 ... num_inputs - 1, labeled and filled with their index,
+  // dealt to shards as convert_imageset --shards does.
+  void FillShards(DataParameter_DB backend, int_tp shards,
+                  int_tp num_inputs) {
+    backend_ = backend;
+    for (int_tp shard = 0; shard < shards; ++shard) {
+      stringstream source;
+      source << *filename_;
+      if (shards > 1) {
+        source << "_" << shard;
+      }
+      scoped_ptr<db::DB> db(db::GetDB(backend));
+      db->Open(source.str(), db::NEW);
+      scoped_ptr<db::Transaction> txn(db->NewTransaction());
+      for (int_tp i = shard; i < num_inputs; i += shards) {
+        Datum datum;
+        datum.set_label(i);
+        datum.set_channels(1);
+        datum.set_height(1);
+        datum.set_width(2);
+        datum.set_data(string(2, static_cast<char>(i)));
+        stringstream ss;
+        ss << i;
+        string out;
+        CHECK(datum.SerializeToString(&out));
+        txn->Put(ss.str(), out);
+      }
+      txn->Commit();
+      db->Close();
+    }
+  }
+
+  // Deals 6 images to shards as convert_imageset --shards does, and checks
+  // that the data layer reads them back in order.
+  void TestReadShards(DataParameter_DB backend) {
+    const int_tp shards = 2;
+    const int_tp num_inputs = 6;
+    FillShards(backend, shards, num_inputs);
+
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(num_inputs);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shards(shards);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), num_inputs);
+    EXPECT_EQ(blob_top_data_->count(1), 2);
+    for (int_tp iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int_tp i = 0; i < num_inputs; ++i) {
+        EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+        EXPECT_EQ(i, blob_top_data_->cpu_data()[i * 2]);
+        EXPECT_EQ(i, blob_top_data_->cpu_data()[i * 2 + 1]);
+      }
+    }
+  }
+
+  // Checks that rank 1 of 2 reads the odd datums of the source, wrapping
+  // around as the whole source would, whether sharded or not.
+  void TestReadRank(DataParameter_DB backend, int_tp shards) {
+    const int_tp num_inputs = 6;
+    FillShards(backend, shards, num_inputs);
+    Caffe::set_rank(1);
+    Caffe::set_rank_count(2);
+
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(2);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shards(shards);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int_tp iter = 0; iter < 6; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int_tp i = 0; i < 2; ++i) {
+        const int_tp index = (2 * (iter * 2 + i) + 1) % num_inputs;
+        EXPECT_EQ(index, blob_top_label_->cpu_data()[i]);
+        EXPECT_EQ(index, blob_top_data_->cpu_data()[i * 2]);
+      }
+    }
+    Caffe::set_rank(0);
+    Caffe::set_rank_count(1);
+  }
+
+  // Reads PNG images through a decoded cache that only holds three of them,
+  // checking that the others pass through without taking table entries.
+  void TestCacheOverBudget(DataParameter_DB backend) {
+    const int_tp num_inputs = 10;
+    const int_tp batch_size = 5;
+    backend_ = backend;
+    scoped_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(*filename_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int_tp i = 0; i < num_inputs; ++i) {
+      cv::Mat cv_img(3, 4, CV_8UC3, cv::Scalar::all(i));
+      vector<uchar> buf;
+      cv::imencode(".png", cv_img, buf);
+      Datum datum;
+      datum.set_label(i);
+      datum.set_encoded(true);
+      datum.set_data(string(reinterpret_cast<char*>(&buf[0]), buf.size()));
+      stringstream ss;
+      ss << i;
+      string out;
+      CHECK(datum.SerializeToString(&out));
+      txn->Put(ss.str(), out);
+    }
+    txn->Commit();
+    db->Close();
+
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    // A decoded image takes 64 aligned bytes.
+    data_param->set_cache_bytes(3 * 64);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    ASSERT_TRUE(layer.cache() != NULL);
+    EXPECT_EQ(blob_top_data_->count(1), 3 * 3 * 4);
+    for (int_tp iter = 0; iter < 4 * num_inputs / batch_size; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int_tp i = 0; i < batch_size; ++i) {
+        const int_tp index = (iter * batch_size + i) % num_inputs;
+        EXPECT_EQ(index, blob_top_label_->cpu_data()[i]);
+        for (int_tp j = 0; j < blob_top_data_->count(1); ++j) {
+          EXPECT_EQ(index, blob_top_data_->cpu_data()[
+              i * blob_top_data_->count(1) + j]);
+        }
+      }
+    }
+    EXPECT_EQ(3, layer.cache()->entries_used());
+    EXPECT_EQ(3 * 64, layer.cache()->bytes_used());
   }
 
   void TestReshape(DataParameter_DB backend) {
@@ -225,13 +417,14 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(const int_tp transform_threads = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_transform_threads(transform_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -357,10 +550,63 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadPrefetchOneLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(1);
+}
+
+TYPED_TEST(DataLayerTest, TestPrefetchWaits) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  GatedDataLayer<Dtype> layer(param);
+  vector<Blob<Dtype>*> top(1, this->blob_top_data_);
+  layer.SetUp(this->blob_bottom_vec_, top);
+
+  // The batch is loaded while Forward waits for it.
+  boost::thread first(&GatedDataLayer<Dtype>::OpenAfter, &layer, 50);
+  layer.Forward(this->blob_bottom_vec_, top);
+  first.join();
+  EXPECT_EQ(1, layer.prefetch_waits());
+  EXPECT_GT(layer.prefetch_wait_ms(), 0);
+  const double wait_ms = layer.prefetch_wait_ms();
+
+  // The batch is loaded before Forward, which does not wait.
+  layer.OpenAfter(0);
+  while (layer.loaded() == 0) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  }
+  layer.Forward(this->blob_bottom_vec_, top);
+  EXPECT_EQ(1, layer.prefetch_waits());
+  EXPECT_EQ(wait_ms, layer.prefetch_wait_ms());
+
+  boost::thread third(&GatedDataLayer<Dtype>::OpenAfter, &layer, 50);
+  layer.Forward(this->blob_bottom_vec_, top);
+  third.join();
+  EXPECT_EQ(2, layer.prefetch_waits());
+  EXPECT_GT(layer.prefetch_wait_ms(), wait_ms);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLevelDB) {
+  this->TestReadShards(DataParameter_DB_LEVELDB);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRankLevelDB) {
+  this->TestReadRank(DataParameter_DB_LEVELDB, 1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRankShardsLevelDB) {
+  this->TestReadRank(DataParameter_DB_LEVELDB, 2);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
 
+TYPED_TEST(DataLayerTest, TestCacheOverBudgetLevelDB) {
+  this->TestCacheOverBudget(DataParameter_DB_LEVELDB);
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLevelDB) {
   const bool unique_pixels = true;  // all images the same; pixels different
   this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
@@ -375,6 +621,14 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the sequence of random crops is also consistent when the batch
+// is transformed by several threads.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededThreadsLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -397,10 +651,32 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadPrefetchOneLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLMDB) {
+  this->TestReadShards(DataParameter_DB_LMDB);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRankLMDB) {
+  this->TestReadRank(DataParameter_DB_LMDB, 1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRankShardsLMDB) {
+  this->TestReadRank(DataParameter_DB_LMDB, 2);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
 
+TYPED_TEST(DataLayerTest, TestCacheOverBudgetLMDB) {
+  this->TestCacheOverBudget(DataParameter_DB_LMDB);
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLMDB) {
   const bool unique_pixels = true;  // all images the same; pixels different
   this->Fill(unique_pixels, DataParameter_DB_LMDB);
@@ -415,6 +691,14 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the sequence of random crops is also consistent when the batch
+// is transformed by several threads.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededThreadsLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
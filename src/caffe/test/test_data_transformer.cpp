@@ -1,4 +1,6 @@
 #ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
 #include <string>
 #include <vector>
 
@@ -361,5 +363,122 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestCropMirrorMeanFileScale) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int_tp label = 0;
+  const int_tp channels = 2;
+  const int_tp height = 5;
+  const int_tp width = 6;
+  const int_tp crop_size = 3;
+  const TypeParam scale = 0.25;
+  const int_tp size = channels * height * width;
+
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int_tp j = 0; j < size; ++j) {
+    blob_mean.add_data(0.5 * j);
+  }
+  WriteProtoToBinaryFile(blob_mean, mean_file);
+
+  transform_param.set_mean_file(mean_file);
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(scale);
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  Blob<TypeParam> blob(1, channels, crop_size, crop_size);
+  DataTransformer<TypeParam> transformer(transform_param, TEST,
+                                         Caffe::GetDefaultDevice());
+  Caffe::set_random_seed(this->seed_);
+  transformer.InitRand();
+  const int_tp h_off = (height - crop_size) / 2;
+  const int_tp w_off = (width - crop_size) / 2;
+  int_tp num_mirrored = 0;
+  for (int_tp iter = 0; iter < this->num_iter_; ++iter) {
+    transformer.Transform(datum, &blob);
+    // The center crop is either mirrored or not, as a whole.
+    const bool mirrored =
+        blob.cpu_data()[0] != 0.5 * (h_off * width + w_off) * scale;
+    num_mirrored += mirrored;
+    for (int_tp c = 0; c < channels; ++c) {
+      for (int_tp h = 0; h < crop_size; ++h) {
+        for (int_tp w = 0; w < crop_size; ++w) {
+          const int_tp w_in = mirrored ? crop_size - 1 - w : w;
+          const int_tp index =
+              (c * height + h_off + h) * width + w_off + w_in;
+          EXPECT_EQ(blob.data_at(0, c, h, w), (index - 0.5 * index) * scale);
+        }
+      }
+    }
+  }
+  EXPECT_GT(num_mirrored, 0);
+  EXPECT_LT(num_mirrored, this->num_iter_);
+}
+
+TYPED_TEST(DataTransformTest, TestFloatData) {
+  TransformationParameter transform_param;
+  const int_tp channels = 2;
+  const int_tp height = 3;
+  const int_tp width = 4;
+  transform_param.add_mean_value(1);
+  transform_param.add_mean_value(2);
+  transform_param.set_scale(2);
+  Datum datum;
+  datum.set_channels(channels);
+  datum.set_height(height);
+  datum.set_width(width);
+  for (int_tp j = 0; j < channels * height * width; ++j) {
+    datum.add_float_data(0.5 * j);
+  }
+  Blob<TypeParam> blob(1, channels, height, width);
+  DataTransformer<TypeParam> transformer(transform_param, TEST,
+                                         Caffe::GetDefaultDevice());
+  transformer.InitRand();
+  transformer.Transform(datum, &blob);
+  for (int_tp c = 0; c < channels; ++c) {
+    for (int_tp j = 0; j < height * width; ++j) {
+      const int_tp index = c * height * width + j;
+      EXPECT_EQ(blob.cpu_data()[index], (0.5 * index - (c + 1)) * 2);
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestMatMatchesDatum) {
+  TransformationParameter transform_param;
+  const int_tp height = 7;
+  const int_tp width = 9;
+  const int_tp crop_size = 5;
+  transform_param.set_crop_size(crop_size);
+  transform_param.add_mean_value(10);
+  transform_param.add_mean_value(20);
+  transform_param.add_mean_value(30);
+  transform_param.set_scale(0.5);
+  cv::Mat cv_img(height, width, CV_8UC3);
+  for (int_tp h = 0; h < height; ++h) {
+    uchar* ptr = cv_img.ptr<uchar>(h);
+    for (int_tp j = 0; j < width * 3; ++j) {
+      ptr[j] = static_cast<uchar>((h * 37 + j * 11) % 256);
+    }
+  }
+  Datum datum;
+  CVMatToDatum(cv_img, &datum);
+  DataTransformer<TypeParam> transformer(transform_param, TEST,
+                                         Caffe::GetDefaultDevice());
+  transformer.InitRand();
+  Blob<TypeParam> mat_blob(1, 3, crop_size, crop_size);
+  Blob<TypeParam> datum_blob(1, 3, crop_size, crop_size);
+  transformer.Transform(cv_img, &mat_blob);
+  transformer.Transform(datum, &datum_blob);
+  for (int_tp j = 0; j < mat_blob.count(); ++j) {
+    EXPECT_EQ(mat_blob.cpu_data()[j], datum_blob.cpu_data()[j]);
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
@@ -117,6 +117,37 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestKeyValueView) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_EQ(cursor->views_persist(),
+            TypeParam::backend == DataParameter_DB_LMDB);
+  for (int_tp i = 0; i < 2; ++i) {
+    EXPECT_TRUE(cursor->valid());
+    EXPECT_EQ(string(cursor->key_data(), cursor->key_size()), cursor->key());
+    EXPECT_EQ(string(cursor->value_data(), cursor->value_size()),
+              cursor->value());
+    Datum datum;
+    datum.ParseFromString(cursor->value());
+    Datum datum_view;
+    const char* data;
+    int_tp data_size;
+    EXPECT_TRUE(ParseDatumView(cursor->value_data(), cursor->value_size(),
+                               &datum_view, &data, &data_size));
+    EXPECT_EQ(string(data, data_size), datum.data());
+    EXPECT_GE(data, cursor->value_data());
+    EXPECT_LE(data + data_size, cursor->value_data() + cursor->value_size());
+    EXPECT_FALSE(datum_view.has_data());
+    EXPECT_EQ(datum_view.label(), i);
+    EXPECT_EQ(datum_view.channels(), datum.channels());
+    EXPECT_EQ(datum_view.height(), datum.height());
+    EXPECT_EQ(datum_view.width(), datum.width());
+    cursor->Next();
+  }
+  EXPECT_FALSE(cursor->valid());
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
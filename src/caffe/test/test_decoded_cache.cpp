@@ -0,0 +1,104 @@
+#include <boost/filesystem.hpp>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/decoded_cache.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DecodedCacheTest : public ::testing::Test {
+ protected:
+  DecodedCacheTest() : image_(2 * 3 * 4) {
+    for (int_tp i = 0; i < image_.size(); ++i) {
+      image_[i] = i;
+    }
+  }
+
+  void ExpectImage(DecodedCache* cache, int_tp index) {
+    int_tp height, width, channels;
+    const uint8_t* data = cache->Find(index, &height, &width, &channels);
+    ASSERT_TRUE(data != NULL);
+    EXPECT_EQ(2, height);
+    EXPECT_EQ(3, width);
+    EXPECT_EQ(4, channels);
+    for (int_tp i = 0; i < image_.size(); ++i) {
+      EXPECT_EQ(image_[i], data[i]);
+    }
+  }
+
+  vector<uint8_t> image_;
+};
+
+TEST_F(DecodedCacheTest, TestInsertFind) {
+  DecodedCache cache("images", 8, 1024, "");
+  int_tp height, width, channels;
+  EXPECT_TRUE(cache.Find(5, &height, &width, &channels) == NULL);
+  EXPECT_TRUE(cache.Insert(5, &image_[0], 2, 3, 4));
+  EXPECT_FALSE(cache.Insert(5, &image_[0], 2, 3, 4));
+  ExpectImage(&cache, 5);
+  EXPECT_TRUE(cache.Find(6, &height, &width, &channels) == NULL);
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(2, cache.misses());
+  cache.ResetCounters();
+  EXPECT_EQ(0, cache.hits());
+  EXPECT_EQ(0, cache.misses());
+}
+
+TEST_F(DecodedCacheTest, TestBudget) {
+  // Images take 64 aligned bytes, so three fit.
+  DecodedCache cache("images", 8, 3 * 64, "");
+  for (int_tp i = 0; i < 3; ++i) {
+    EXPECT_TRUE(cache.Insert(i, &image_[0], 2, 3, 4));
+  }
+  EXPECT_FALSE(cache.Insert(3, &image_[0], 2, 3, 4));
+  EXPECT_EQ(3 * 64, cache.bytes_used());
+  // Images over the budget take no entry.
+  EXPECT_EQ(3, cache.entries_used());
+  int_tp height, width, channels;
+  EXPECT_TRUE(cache.Find(3, &height, &width, &channels) == NULL);
+  for (int_tp i = 0; i < 3; ++i) {
+    ExpectImage(&cache, i);
+  }
+}
+
+TEST_F(DecodedCacheTest, TestFullTable) {
+  // The table is only filled to 3/4, so that probes stay short.
+  DecodedCache cache("images", 4, 1024, "");
+  for (int_tp i = 0; i < 3; ++i) {
+    EXPECT_TRUE(cache.Insert(i, &image_[0], 2, 3, 4));
+  }
+  EXPECT_FALSE(cache.Insert(3, &image_[0], 2, 3, 4));
+  EXPECT_EQ(3, cache.entries_used());
+  EXPECT_EQ(3 * 64, cache.bytes_used());
+  for (int_tp i = 0; i < 3; ++i) {
+    ExpectImage(&cache, i);
+  }
+}
+
+TEST_F(DecodedCacheTest, TestSharedFile) {
+  string filename;
+  MakeTempFilename(&filename);
+  {
+    DecodedCache writer("images", 8, 1024, filename);
+    DecodedCache reader("images", 8, 1024, filename);
+    EXPECT_TRUE(writer.Insert(1, &image_[0], 2, 3, 4));
+    ExpectImage(&reader, 1);
+    EXPECT_FALSE(reader.Insert(1, &image_[0], 2, 3, 4));
+    EXPECT_TRUE(reader.Insert(2, &image_[0], 2, 3, 4));
+    ExpectImage(&writer, 2);
+  }
+  // The file keeps the images for the next run.
+  DecodedCache cache("images", 8, 1024, filename);
+  ExpectImage(&cache, 1);
+  ExpectImage(&cache, 2);
+  EXPECT_EQ(2 * 64, cache.bytes_used());
+  boost::filesystem::remove(filename);
+}
+
+}  // namespace caffe
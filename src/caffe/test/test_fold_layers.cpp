@@ -0,0 +1,128 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/fold_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class FoldLayersTest : public CPUDeviceTest<Dtype> {
+ protected:
+  // Builds a TEST phase net from proto and gives every BatchNorm layer random
+  // statistics and every PReLU layer random slopes.
+  void InitNetFromProtoString(const string& proto) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.mutable_state()->set_phase(TEST);
+    net_.reset(new Net<Dtype>(param));
+    for (int_tp i = 0; i < net_->layers().size(); ++i) {
+      const string type = net_->layers()[i]->type();
+      vector<shared_ptr<Blob<Dtype> > >& blobs = net_->layers()[i]->blobs();
+      if (type == "BatchNorm") {
+        caffe_rng_uniform<Dtype>(blobs[0]->count(), Dtype(-2), Dtype(2),
+                                 blobs[0]->mutable_cpu_data());
+        caffe_rng_uniform<Dtype>(blobs[1]->count(), Dtype(0.5), Dtype(4),
+                                 blobs[1]->mutable_cpu_data());
+        blobs[2]->mutable_cpu_data()[0] = 2;
+      } else if (type == "PReLU") {
+        caffe_rng_uniform<Dtype>(blobs[0]->count(), Dtype(0), Dtype(0.5),
+                                 blobs[0]->mutable_cpu_data());
+      }
+    }
+  }
+
+  // Folds net_ into folded_ and returns the number of removed layers.
+  int_tp Fold() {
+    NetParameter folded_param;
+    const int_tp removed = FoldInferenceLayers(*net_, &folded_param);
+    folded_.reset(new Net<Dtype>(folded_param));
+    return removed;
+  }
+
+  shared_ptr<Net<Dtype> > net_;
+  shared_ptr<Net<Dtype> > folded_;
+};
+
+TYPED_TEST_CASE(FoldLayersTest, TestDtypes);
+
+TYPED_TEST(FoldLayersTest, TestFoldConvBatchNormReLU) {
+  const string proto =
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 6 dim: 5 } "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' convolution_param { num_output: 4 kernel_size: 3 "
+      "  pad: 1 weight_filler { type: 'gaussian' std: 0.5 } "
+      "  bias_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'conv1' } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' "
+      "  relu_param { negative_slope: 0.1 } } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'conv1' "
+      "  top: 'conv2' convolution_param { num_output: 5 kernel_size: 2 "
+      "  bias_term: false weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn2' type: 'BatchNorm' bottom: 'conv2' top: 'bn2' } "
+      "layer { name: 'prelu2' type: 'PReLU' bottom: 'bn2' top: 'prelu2' } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'prelu2' top: 'ip' "
+      "  inner_product_param { num_output: 3 "
+      "  weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn3' type: 'BatchNorm' bottom: 'ip' top: 'ip' } ";
+  this->InitNetFromProtoString(proto);
+  EXPECT_EQ(this->Fold(), 5);
+  ASSERT_EQ(this->folded_->layers().size(), 3);
+  EXPECT_EQ(this->folded_->layer_names()[0], "conv1");
+  EXPECT_EQ(this->folded_->layer_names()[1], "conv2");
+  EXPECT_EQ(this->folded_->layer_names()[2], "ip");
+  const ConvolutionParameter& conv2_param =
+      this->folded_->layers()[1]->layer_param().convolution_param();
+  EXPECT_TRUE(conv2_param.bias_term());
+  EXPECT_TRUE(conv2_param.fused_relu());
+  EXPECT_EQ(conv2_param.fused_relu_slope_size(), 5);
+  EXPECT_TRUE(this->folded_->has_blob("ip"));
+  EXPECT_FALSE(this->folded_->has_blob("conv2"));
+  for (int_tp i = 0; i < 3; ++i) {
+    EXPECT_LT(VerifyFoldedNet(this->net_.get(), this->folded_.get()), 1e-4);
+  }
+}
+
+TYPED_TEST(FoldLayersTest, TestNoFoldOfSharedBlob) {
+  // conv1 is also read by relu1, so bn1 cannot be folded into it.
+  const string proto =
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' convolution_param { num_output: 4 kernel_size: 1 "
+      "  weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'bn1' } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'relu1' } ";
+  this->InitNetFromProtoString(proto);
+  EXPECT_EQ(this->Fold(), 0);
+  EXPECT_EQ(VerifyFoldedNet(this->net_.get(), this->folded_.get()), 0);
+}
+
+TYPED_TEST(FoldLayersTest, TestNoFoldOfBatchStatistics) {
+  const string proto =
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' convolution_param { num_output: 4 kernel_size: 1 "
+      "  weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'conv1' "
+      "  batch_norm_param { use_global_stats: false } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } ";
+  this->InitNetFromProtoString(proto);
+  // bn1 normalizes with batch statistics and stays, so relu1 does not
+  // follow a convolution either.
+  EXPECT_EQ(this->Fold(), 0);
+  EXPECT_LT(VerifyFoldedNet(this->net_.get(), this->folded_.get()), 1e-5);
+}
+
+}  // namespace caffe
@@ -26,7 +26,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest()
       : seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-        share_(false) {
+        share_(false), contiguous_(false), bias_lr_mult_(1),
+        bias_decay_mult_(1) {
     input_file_ = new string(
     CMAKE_SOURCE_DIR "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT);
   }
@@ -37,11 +38,17 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   string snapshot_prefix_;
   shared_ptr<SGDSolver<Dtype> > solver_;
   shared_ptr<P2PSync<Dtype> > sync_;
+  shared_ptr<CPUSync<Dtype> > cpu_sync_;
   int seed_;
   // Dimensions are determined by generate_sample_data.py
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  // Whether the net keeps its params in one arena, and the multipliers of
+  // the bias, which make the solver scalars differ between the params.
+  bool contiguous_;
+  Dtype bias_lr_mult_;
+  Dtype bias_decay_mult_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -90,8 +97,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
         "iter_size: " << iter_size << " "
         "device_id: " << device_id << " "
         "net_param { "
-        "  name: 'TestNetwork' "
-        "  layer { "
+        "  name: 'TestNetwork' ";
+    if (contiguous_) {
+      proto << "  contiguous_params: true ";
+    }
+    proto << "  layer { "
         "    name: 'data' "
         "    type: 'HDF5Data' "
         "    hdf5_data_param { "
@@ -117,7 +127,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
           "    name: 'innerprod' "
           "    type: 'InnerProduct' "
           "    param { name: 'weights' } "
-          "    param { name: 'bias' } "
+          "    param { "
+          "      name: 'bias' "
+          "      lr_mult: " << bias_lr_mult_ << " "
+          "      decay_mult: " << bias_decay_mult_ << " "
+          "    } "
           "    inner_product_param { "
           "      num_output: 1 "
           "      weight_filler { "
@@ -139,7 +153,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
             "    name: 'innerprod2' "
             "    type: 'InnerProduct' "
             "    param { name: 'weights' } "
-            "    param { name: 'bias' } "
+            "    param { "
+            "      name: 'bias' "
+            "      lr_mult: " << bias_lr_mult_ << " "
+            "      decay_mult: " << bias_decay_mult_ << " "
+            "    } "
             "    inner_product_param { "
             "      num_output: 1 "
             "      weight_filler { "
@@ -194,6 +212,17 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO)<< "Multi-replica CPU test on " << devices << " replicas";
+      Caffe::set_solver_count(devices);
+      this->cpu_sync_.reset(new CPUSync<Dtype>(
+              this->solver_, NULL, this->solver_->param(), 0));
+      if (contiguous_) {
+        EXPECT_EQ(this->solver_->net()->flat_param_data(),
+                  this->cpu_sync_->data());
+      }
+      this->cpu_sync_->run();
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO)<< "Multi-GPU test on " << devices << " devices";
       vector<device*> gpus;
@@ -454,6 +483,69 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     EXPECT_NEAR(expected_bias, accum_bias, error_margin);
   }
 
+  // Checks that training with contiguous params gives the params and history
+  // of training param by param. The weights do not fill whole cache lines,
+  // so the arena has padding, which has to stay zero.
+  void CheckContiguousParams(const Dtype kLearningRate,
+                             const Dtype kWeightDecay, const Dtype kMomentum,
+                             const int kNumIters) {
+    const double kPrecision = 1e-4;
+    const double kMinPrecision = 1e-7;
+    contiguous_ = false;
+    this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+                                kNumIters);
+    vector<shared_ptr<Blob<Dtype> > > expected;
+    const vector<Blob<Dtype>*>& blob_params =
+        this->solver_->net()->learnable_params();
+    const vector<shared_ptr<Blob<Dtype> > >& blob_history =
+        this->solver_->history();
+    for (int i = 0; i < blob_params.size(); ++i) {
+      expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected.back()->CopyFrom(*blob_params[i], false, true);
+    }
+    for (int i = 0; i < blob_history.size(); ++i) {
+      expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected.back()->CopyFrom(*blob_history[i], false, true);
+    }
+
+    contiguous_ = true;
+    this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+                                kNumIters);
+    Net<Dtype>& net = *this->solver_->net();
+    const vector<Blob<Dtype>*>& params = net.learnable_params();
+    vector<Blob<Dtype>*> actual(params);
+    for (int i = 0; i < this->solver_->history().size(); ++i) {
+      actual.push_back(this->solver_->history()[i].get());
+    }
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int i = 0; i < actual.size(); ++i) {
+      ASSERT_EQ(expected[i]->count(), actual[i]->count());
+      for (int j = 0; j < actual[i]->count(); ++j) {
+        const Dtype expected_value = expected[i]->cpu_data()[j];
+        const Dtype actual_value = actual[i]->cpu_data()[j];
+        const Dtype error_margin = std::max(
+            kMinPrecision,
+            kPrecision * std::min(fabs(expected_value), fabs(actual_value)));
+        EXPECT_NEAR(expected_value, actual_value, error_margin)
+            << "blob " << i << " differed at dim " << j;
+      }
+    }
+    if (Caffe::mode() != Caffe::CPU) {
+      return;
+    }
+    ASSERT_TRUE(net.FlatParamsInUse());
+    const vector<uint_tp>& offsets = net.flat_param_offsets();
+    for (int i = 0; i < params.size(); ++i) {
+      const uint_tp end = i + 1 < params.size() ?
+          offsets[i + 1] : net.flat_param_count();
+      ASSERT_LE(offsets[i] + params[i]->count(), end);
+      for (uint_tp j = offsets[i] + params[i]->count(); j < end; ++j) {
+        EXPECT_EQ(0, net.flat_param_data()[j]) << "padding data at " << j;
+        EXPECT_EQ(0, net.flat_param_diff()[j]) << "padding diff at " << j;
+      }
+    }
+  }
+
   // Test that the correct update is computed for a regularized least squares
   // problem:
   //
@@ -475,8 +567,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
                               const int iter_to_check = 0) {
     const int kNum = num_;
     const int kIterSize = 1;
-    // Test over all numbers of devices.
-    int available_devices = 1;
+    // Test over all numbers of devices, or of replicas on the CPU.
+    int available_devices = Caffe::mode() == Caffe::CPU ? 3 : 1;
 #ifndef CPU_ONLY
 #ifdef USE_CUDA
     if (Caffe::mode() == Caffe::GPU
@@ -671,6 +763,19 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  // On the CPU, the root replica also trains on the arena of its net.
+  this->contiguous_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -717,6 +822,44 @@ TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestContiguousParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->bias_lr_mult_ = 2;
+  this->bias_decay_mult_ = 0;
+  this->CheckContiguousParams(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+}
+
+TYPED_TEST(SGDSolverTest, TestContiguousParamsShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->share_ = true;
+  this->bias_lr_mult_ = 0.5;
+  this->bias_decay_mult_ = 2;
+  this->CheckContiguousParams(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+}
+
+TYPED_TEST(SGDSolverTest, TestSnapshotContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->contiguous_ = true;
+  this->bias_lr_mult_ = 2;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 template<typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -926,6 +1069,17 @@ TYPED_TEST(NesterovSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(NesterovSolverTest, TestContiguousParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->bias_lr_mult_ = 2;
+  this->CheckContiguousParams(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+}
+
 TYPED_TEST(NesterovSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1,3 +1,4 @@
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
 
@@ -7,6 +8,8 @@
 #include "caffe/common.hpp"
 #include "caffe/data_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/hdf5.hpp"
+#include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -131,4 +134,164 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestStreamRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Streaming reads the same rows as TestRead, a few at a time.
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  param.add_top("label2");
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  int_tp batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  int_tp num_cols = 8;
+  int_tp height = 6;
+  int_tp width = 5;
+  HDF5StreamDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), batch_size);
+  EXPECT_EQ(this->blob_top_data_->channels(), num_cols);
+  EXPECT_EQ(this->blob_top_data_->height(), height);
+  EXPECT_EQ(this->blob_top_data_->width(), width);
+  EXPECT_EQ(this->blob_top_label_->num_axes(), 2);
+  EXPECT_EQ(this->blob_top_label_->shape(0), batch_size);
+  EXPECT_EQ(this->blob_top_label_->shape(1), 1);
+
+  const int_tp data_size = num_cols * height * width;
+  for (int_tp iter = 0; iter < 10; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    int_tp label_offset = 1 + ((iter % 2 == 0) ? 0 : batch_size);
+    int_tp data_offset = (iter % 2 == 0) ? 0 : batch_size * data_size;
+    int_tp file_offset = (iter % 4 < 2) ? 0 : 2400;
+    for (int_tp i = 0; i < batch_size; ++i) {
+      EXPECT_EQ(label_offset + i, this->blob_top_label_->cpu_data()[i]);
+      EXPECT_EQ(label_offset + i + 1, this->blob_top_label2_->cpu_data()[i]);
+    }
+    for (int_tp idx = 0; idx < batch_size * data_size; ++idx) {
+      EXPECT_EQ(file_offset + data_offset + idx,
+                this->blob_top_data_->cpu_data()[idx]) << "iter " << iter;
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestStreamShuffle) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Each pass over a file yields all of its labels once.
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  hdf5_data_param->set_batch_size(10);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_shuffle(true);
+  vector<Blob<Dtype>*> top_vec;
+  top_vec.push_back(this->blob_top_data_);
+  top_vec.push_back(this->blob_top_label_);
+  HDF5StreamDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, top_vec);
+  const int_tp data_size = 8 * 6 * 5;
+  for (int_tp iter = 0; iter < 4; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, top_vec);
+    vector<bool> seen(10, false);
+    for (int_tp i = 0; i < 10; ++i) {
+      const int_tp label = this->blob_top_label_->cpu_data()[i];
+      ASSERT_GE(label, 1);
+      ASSERT_LE(label, 10);
+      EXPECT_FALSE(seen[label - 1]);
+      seen[label - 1] = true;
+      // The data row goes with its label.
+      const Dtype* row = this->blob_top_data_->cpu_data() + i * data_size;
+      EXPECT_EQ((label - 1) * data_size, static_cast<int_tp>(row[0]) % 2400);
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestStreamPatches) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A 2 x 7 x 6 x 5 data volume with values numbered in row-major order, and
+  // a 7 x 6 x 5 label volume numbered likewise.
+  string filename;
+  MakeTempFilename(&filename);
+  vector<int_tp> data_shape(4);
+  data_shape[0] = 2;
+  data_shape[1] = 7;
+  data_shape[2] = 6;
+  data_shape[3] = 5;
+  Blob<Dtype> data(data_shape);
+  Blob<Dtype> label(vector<int_tp>(data_shape.begin() + 1, data_shape.end()));
+  for (int_tp i = 0; i < data.count(); ++i) {
+    data.mutable_cpu_data()[i] = i;
+  }
+  for (int_tp i = 0; i < label.count(); ++i) {
+    label.mutable_cpu_data()[i] = i;
+  }
+  hid_t file_id = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+                            H5P_DEFAULT);
+  ASSERT_GE(file_id, 0);
+  hdf5_save_nd_dataset(file_id, "data", data);
+  hdf5_save_nd_dataset(file_id, "label", label);
+  ASSERT_GE(H5Fclose(file_id), 0);
+  string source;
+  MakeTempFilename(&source);
+  std::ofstream source_file(source.c_str());
+  source_file << filename << std::endl;
+  source_file.close();
+
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  hdf5_data_param->set_batch_size(4);
+  hdf5_data_param->set_source(source);
+  hdf5_data_param->add_patch_shape(3);
+  hdf5_data_param->add_patch_shape(4);
+  hdf5_data_param->add_patch_shape(2);
+  vector<Blob<Dtype>*> top_vec;
+  top_vec.push_back(this->blob_top_data_);
+  top_vec.push_back(this->blob_top_label_);
+  {
+    HDF5StreamDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, top_vec);
+    EXPECT_EQ(5, this->blob_top_data_->num_axes());
+    EXPECT_EQ(4, this->blob_top_data_->shape(0));
+    EXPECT_EQ(2, this->blob_top_data_->shape(1));
+    EXPECT_EQ(3, this->blob_top_data_->shape(2));
+    EXPECT_EQ(4, this->blob_top_data_->shape(3));
+    EXPECT_EQ(2, this->blob_top_data_->shape(4));
+    EXPECT_EQ(4, this->blob_top_label_->num_axes());
+    for (int_tp iter = 0; iter < 3; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, top_vec);
+      for (int_tp n = 0; n < 4; ++n) {
+        // The patch position follows from its first label value, and the
+        // data patch is at the same position.
+        const Dtype* label_patch = this->blob_top_label_->cpu_data()
+            + n * 3 * 4 * 2;
+        const int_tp start = label_patch[0];
+        const int_tp z = start / 30, y = start / 5 % 6, x = start % 5;
+        EXPECT_LE(z, 7 - 3);
+        EXPECT_LE(y, 6 - 4);
+        EXPECT_LE(x, 5 - 2);
+        for (int_tp c = 0; c < 2; ++c) {
+          for (int_tp i = 0; i < 3; ++i) {
+            for (int_tp j = 0; j < 4; ++j) {
+              for (int_tp k = 0; k < 2; ++k) {
+                const int_tp index = ((z + i) * 6 + y + j) * 5 + x + k;
+                const int_tp patch_index = (i * 4 + j) * 2 + k;
+                if (c == 0) {
+                  EXPECT_EQ(index, label_patch[patch_index]);
+                }
+                EXPECT_EQ(c * 210 + index, this->blob_top_data_->cpu_data()[
+                    (n * 2 + c) * 3 * 4 * 2 + patch_index]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  boost::filesystem::remove(filename);
+  boost::filesystem::remove(source);
+}
+
 }  // namespace caffe
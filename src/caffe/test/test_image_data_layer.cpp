@@ -116,6 +116,37 @@ TYPED_TEST(ImageDataLayerTest, TestResize) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(1);
+  image_data_param->set_source(this->filename_reshape_.c_str());
+  image_data_param->set_shuffle(false);
+  ImageDataLayer<Dtype> reference_layer(param);
+  Blob<Dtype> reference_data;
+  Blob<Dtype> reference_label;
+  vector<Blob<Dtype>*> reference_top_vec;
+  reference_top_vec.push_back(&reference_data);
+  reference_top_vec.push_back(&reference_label);
+  reference_layer.SetUp(this->blob_bottom_vec_, reference_top_vec);
+  image_data_param->set_cache_bytes(4 << 20);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Images of the second epoch come from the cache.
+  for (int_tp iter = 0; iter < 4; ++iter) {
+    reference_layer.Forward(this->blob_bottom_vec_, reference_top_vec);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(reference_data.shape(), this->blob_top_data_->shape());
+    EXPECT_EQ(reference_label.cpu_data()[0],
+              this->blob_top_label_->cpu_data()[0]);
+    for (int_tp i = 0; i < reference_data.count(); ++i) {
+      EXPECT_EQ(reference_data.cpu_data()[i],
+                this->blob_top_data_->cpu_data()[i]);
+    }
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestReshape) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
@@ -421,5 +421,44 @@ TEST_F(IOTest, TestDecodeDatumToCVMatContentNative) {
   }
 }
 
+TEST_F(IOTest, TestParseDatumView) {
+  Datum datum;
+  datum.set_channels(2);
+  datum.set_height(1);
+  datum.set_width(3);
+  datum.set_data(string("\x01\x00\xff\x7f\x80\x02", 6));
+  datum.set_label(7);
+  datum.add_float_data(0.5);
+  string serialized;
+  CHECK(datum.SerializeToString(&serialized));
+  Datum datum_view;
+  const char* data;
+  int_tp data_size;
+  EXPECT_TRUE(ParseDatumView(serialized.data(), serialized.size(),
+                             &datum_view, &data, &data_size));
+  EXPECT_EQ(data_size, 6);
+  EXPECT_EQ(string(data, data_size), datum.data());
+  EXPECT_GE(data, serialized.data());
+  EXPECT_LE(data + data_size, serialized.data() + serialized.size());
+  EXPECT_FALSE(datum_view.has_data());
+  EXPECT_EQ(datum_view.channels(), 2);
+  EXPECT_EQ(datum_view.height(), 1);
+  EXPECT_EQ(datum_view.width(), 3);
+  EXPECT_EQ(datum_view.label(), 7);
+  ASSERT_EQ(datum_view.float_data_size(), 1);
+  EXPECT_EQ(datum_view.float_data(0), 0.5);
+  EXPECT_FALSE(datum_view.encoded());
+
+  // Without data, the datum is parsed as a whole.
+  datum.clear_data();
+  CHECK(datum.SerializeToString(&serialized));
+  EXPECT_TRUE(ParseDatumView(serialized.data(), serialized.size(),
+                             &datum_view, &data, &data_size));
+  EXPECT_TRUE(data == NULL);
+  EXPECT_EQ(data_size, 0);
+  EXPECT_EQ(datum_view.label(), 7);
+  EXPECT_EQ(datum_view.float_data_size(), 1);
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
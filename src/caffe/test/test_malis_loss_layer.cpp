@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/loss_layers.hpp"
+#include "caffe/util/malis.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Straightforward MALIS with std::sort, a plain union-find and std::map
+// overlaps, used as a reference for the flat implementation.
+template <typename Dtype>
+class MalisReferenceCompare {
+ public:
+  explicit MalisReferenceCompare(const Dtype* weights) : weights_(weights) {}
+  bool operator()(const int64_t a, const int64_t b) const {
+    return weights_[a] > weights_[b];
+  }
+ private:
+  const Dtype* weights_;
+};
+
+template <typename Dtype>
+void malis_reference(const Dtype* conn, const int_tp* dims,
+                     const int_tp* nhood, const Dtype* seg, const bool pos,
+                     Dtype* dloss, Dtype* loss_out) {
+  const int64_t nvert = dims[1] * dims[2] * dims[3];
+  vector<int64_t> edges;
+  for (int64_t d = 0, i = 0; d < dims[0]; ++d) {
+    for (int64_t z = 0; z < dims[1]; ++z) {
+      for (int64_t y = 0; y < dims[2]; ++y) {
+        for (int64_t x = 0; x < dims[3]; ++x, ++i) {
+          const int64_t nz = z + nhood[d * 3];
+          const int64_t ny = y + nhood[d * 3 + 1];
+          const int64_t nx = x + nhood[d * 3 + 2];
+          if (nz >= 0 && nz < dims[1] && ny >= 0 && ny < dims[2] && nx >= 0
+              && nx < dims[3]) {
+            edges.push_back(i);
+          }
+        }
+      }
+    }
+  }
+  std::sort(edges.begin(), edges.end(), MalisReferenceCompare<Dtype>(conn));
+  vector<int64_t> parent(nvert);
+  vector<std::map<int64_t, int64_t> > overlap(nvert);
+  int64_t n_labeled = 0, n_pair_pos = 0;
+  std::map<int64_t, int64_t> seg_sizes;
+  for (int64_t v = 0; v < nvert; ++v) {
+    parent[v] = v;
+    if (seg[v] != 0) {
+      overlap[v][static_cast<int64_t>(seg[v])] = 1;
+      n_pair_pos += seg_sizes[static_cast<int64_t>(seg[v])]++;
+      ++n_labeled;
+    }
+  }
+  const int64_t norm = pos ? n_pair_pos
+      : n_labeled * (n_labeled - 1) / 2 - n_pair_pos;
+  double loss = 0;
+  for (int64_t i = 0; i < edges.size(); ++i) {
+    const int64_t e = edges[i];
+    const int64_t v1 = e % nvert;
+    const int64_t d = e / nvert;
+    const int64_t v2 = v1 + (nhood[d * 3] * dims[2] + nhood[d * 3 + 1])
+        * dims[3] + nhood[d * 3 + 2];
+    int64_t s1 = v1, s2 = v2;
+    while (parent[s1] != s1) { s1 = parent[s1]; }
+    while (parent[s2] != s2) { s2 = parent[s2]; }
+    if (s1 == s2) {
+      continue;
+    }
+    std::map<int64_t, int64_t>::iterator it1, it2;
+    for (it1 = overlap[s1].begin(); it1 != overlap[s1].end(); ++it1) {
+      for (it2 = overlap[s2].begin(); it2 != overlap[s2].end(); ++it2) {
+        if ((it1->first == it2->first) == pos) {
+          const double dl = pos ? (1.0 - conn[e]) : -conn[e];
+          loss += dl * dl * it1->second * it2->second;
+          dloss[e] += dl * it1->second * it2->second / norm;
+        }
+      }
+    }
+    parent[s2] = s1;
+    for (it2 = overlap[s2].begin(); it2 != overlap[s2].end(); ++it2) {
+      overlap[s1][it2->first] += it2->second;
+    }
+  }
+  *loss_out = loss / norm;
+}
+
+template <typename Dtype>
+class MalisLossTest : public CPUDeviceTest<Dtype> {
+ protected:
+  MalisLossTest()
+      : conn_(new Blob<Dtype>()), seg_(new Blob<Dtype>()) {}
+  virtual ~MalisLossTest() {
+    delete conn_;
+    delete seg_;
+  }
+
+  // Random affinities on a (batch, 3, Z, Y, X) graph and a blocky
+  // segmentation with a background (0) border.
+  void MakeGraph(int_tp batch, int_tp depth, int_tp height, int_tp width) {
+    vector<int_tp> shape(5);
+    shape[0] = batch;
+    shape[1] = 3;
+    shape[2] = depth;
+    shape[3] = height;
+    shape[4] = width;
+    conn_->Reshape(shape);
+    shape[1] = 1;
+    seg_->Reshape(shape);
+    caffe_rng_uniform<Dtype>(conn_->count(), Dtype(0), Dtype(1),
+                             conn_->mutable_cpu_data());
+    Dtype* seg = seg_->mutable_cpu_data();
+    for (int_tp i = 0; i < seg_->count(); ++i) {
+      const int_tp x = i % width;
+      const int_tp y = (i / width) % height;
+      const int_tp z = (i / width / height) % depth;
+      seg[i] = (x == 0 || y == 0) ? 0 : 1 + (x / 3) + 4 * (y / 3) + 16 * z;
+    }
+    dims_.clear();
+    dims_.push_back(3);
+    dims_.push_back(depth);
+    dims_.push_back(height);
+    dims_.push_back(width);
+    const int_tp nhood[] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    nhood_.assign(nhood, nhood + 9);
+  }
+
+  void CheckPass(bool pos) {
+    vector<int64_t> edges;
+    malis_sort_edges(conn_->cpu_data(), &dims_[0], &nhood_[0], &edges);
+    vector<Dtype> dloss(conn_->count(), Dtype(0));
+    vector<Dtype> ref_dloss(conn_->count(), Dtype(0));
+    Dtype loss, classerr, rand_index, ref_loss;
+    malis_loss_cpu(conn_->cpu_data(), &dims_[0], &nhood_[0],
+                   seg_->cpu_data(), edges, pos, &dloss[0], &loss,
+                   &classerr, &rand_index);
+    malis_reference(conn_->cpu_data(), &dims_[0], &nhood_[0],
+                    seg_->cpu_data(), pos, &ref_dloss[0], &ref_loss);
+    EXPECT_NEAR(loss, ref_loss, 1e-4);
+    EXPECT_NEAR(classerr + rand_index, 1, 1e-6);
+    for (int_tp i = 0; i < conn_->count(); ++i) {
+      EXPECT_NEAR(dloss[i], ref_dloss[i], 1e-5);
+    }
+  }
+
+  Blob<Dtype>* const conn_;
+  Blob<Dtype>* const seg_;
+  vector<int_tp> dims_;
+  vector<int_tp> nhood_;
+};
+
+TYPED_TEST_CASE(MalisLossTest, TestDtypes);
+
+TYPED_TEST(MalisLossTest, TestSortEdges) {
+  typedef TypeParam Dtype;
+  this->MakeGraph(1, 3, 5, 6);
+  vector<int64_t> edges;
+  malis_sort_edges(this->conn_->cpu_data(), &this->dims_[0],
+                   &this->nhood_[0], &edges);
+  // Only edges whose neighbor lies inside the 3 x 5 x 6 volume are kept.
+  EXPECT_EQ(edges.size(), 2 * 5 * 6 + 3 * 4 * 6 + 3 * 5 * 5);
+  const Dtype* conn = this->conn_->cpu_data();
+  for (int_tp i = 1; i < edges.size(); ++i) {
+    EXPECT_GE(conn[edges[i - 1]], conn[edges[i]]);
+  }
+}
+
+TYPED_TEST(MalisLossTest, TestPositivePass) {
+  this->MakeGraph(1, 3, 7, 8);
+  this->CheckPass(true);
+}
+
+TYPED_TEST(MalisLossTest, TestNegativePass) {
+  this->MakeGraph(1, 3, 7, 8);
+  this->CheckPass(false);
+}
+
+TYPED_TEST(MalisLossTest, TestForward) {
+  typedef TypeParam Dtype;
+  this->MakeGraph(2, 2, 6, 7);
+  vector<Blob<Dtype>*> bottom;
+  vector<Blob<Dtype>*> top;
+  Blob<Dtype> affinity;
+  affinity.ReshapeLike(*this->conn_);
+  caffe_rng_uniform<Dtype>(affinity.count(), Dtype(0), Dtype(1),
+                           affinity.mutable_cpu_data());
+  Blob<Dtype> nhood(1, 1, 3, 3);
+  for (int_tp i = 0; i < 9; ++i) {
+    nhood.mutable_cpu_data()[i] = this->nhood_[i];
+  }
+  Blob<Dtype> loss;
+  bottom.push_back(this->conn_);
+  bottom.push_back(&affinity);
+  bottom.push_back(this->seg_);
+  bottom.push_back(&nhood);
+  top.push_back(&loss);
+  LayerParameter layer_param;
+  MalisLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom, top);
+  layer.Forward(bottom, top);
+  // Sum of the positive and negative passes of both items, averaged.
+  const int_tp conn_dim = this->conn_->count(1);
+  const int_tp seg_dim = this->seg_->count(1);
+  Dtype expected = 0;
+  for (int_tp n = 0; n < 2; ++n) {
+    vector<Dtype> pos_conn(conn_dim), neg_conn(conn_dim);
+    for (int_tp i = 0; i < conn_dim; ++i) {
+      const Dtype a = this->conn_->cpu_data()[n * conn_dim + i];
+      const Dtype b = affinity.cpu_data()[n * conn_dim + i];
+      pos_conn[i] = std::min(a, b);
+      neg_conn[i] = std::max(a, b);
+    }
+    vector<Dtype> dloss(conn_dim, Dtype(0));
+    Dtype pass_loss;
+    malis_reference(&pos_conn[0], &this->dims_[0], &this->nhood_[0],
+                    this->seg_->cpu_data() + n * seg_dim, true, &dloss[0],
+                    &pass_loss);
+    expected += pass_loss;
+    malis_reference(&neg_conn[0], &this->dims_[0], &this->nhood_[0],
+                    this->seg_->cpu_data() + n * seg_dim, false, &dloss[0],
+                    &pass_loss);
+    expected += pass_loss;
+  }
+  EXPECT_NEAR(loss.cpu_data()[0], expected / 2, 1e-4);
+}
+
+}  // namespace caffe
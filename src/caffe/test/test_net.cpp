@@ -552,8 +552,9 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitReshapableNet() {
-    const string& proto =
+  virtual void InitReshapableNet(const bool optimize_memory = false) {
+    string proto = optimize_memory ? "optimize_memory: true " : "";
+    proto +=
         "name: 'ReshapableNetwork' "
         "input: 'data' "
         "input_dim: 1 "
@@ -1342,6 +1343,39 @@ TYPED_TEST(NetTest, TestFromTo) {
   }
 }
 
+template <typename Dtype>
+class RecordBackwardCallback : public Net<Dtype>::Callback {
+ public:
+  vector<int_tp> layer_ids_;
+
+ protected:
+  void on_layer_gradients_ready(int_tp layer_id) {
+    layer_ids_.push_back(layer_id);
+  }
+};
+
+TYPED_TEST(NetTest, TestAfterBackwardCallback) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTinyNet();
+  RecordBackwardCallback<Dtype> callback;
+  this->net_->add_after_backward(&callback);
+  this->net_->ForwardPrefilled();
+
+  // Every layer is reported once its Backward is done, top down, including
+  // the data layer that needs no Backward.
+  this->net_->Backward();
+  ASSERT_EQ(3, callback.layer_ids_.size());
+  EXPECT_EQ(2, callback.layer_ids_[0]);
+  EXPECT_EQ(1, callback.layer_ids_[1]);
+  EXPECT_EQ(0, callback.layer_ids_[2]);
+
+  callback.layer_ids_.clear();
+  this->net_->BackwardFromTo(2, 1);
+  ASSERT_EQ(2, callback.layer_ids_.size());
+  EXPECT_EQ(2, callback.layer_ids_[0]);
+  EXPECT_EQ(1, callback.layer_ids_[1]);
+}
+
 class FilterNetTest : public ::testing::Test {
  protected:
   void RunFilterNetTest(
@@ -2331,6 +2365,148 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestOptimizeMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The planned net must compute the same outputs as the plain one, in less
+  // memory, also after its input grows.
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> blob1(2, 3, 12, 10);
+  Blob<Dtype> blob2(4, 3, 19, 21);
+  filler.Fill(&blob1);
+  filler.Fill(&blob2);
+  Blob<Dtype>* blobs[2] = { &blob1, &blob2 };
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet();
+  shared_ptr<Net<Dtype> > plain_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet(true);
+  shared_ptr<Net<Dtype> > planned_net = this->net_;
+  EXPECT_LT(planned_net->memory_planned(), plain_net->memory_planned());
+  EXPECT_EQ(plain_net->memory_used(), plain_net->memory_planned());
+  // conv1 (with relu1 in place) and norm1 can share one buffer.
+  EXPECT_EQ(planned_net->blob_by_name("conv1")->data().get(),
+            planned_net->blob_by_name("norm1")->data().get());
+  EXPECT_NE(planned_net->blob_by_name("conv1")->data().get(),
+            planned_net->blob_by_name("pool1")->data().get());
+
+  for (int_tp i = 0; i < 2; ++i) {
+    Net<Dtype>* nets[2] = { plain_net.get(), planned_net.get() };
+    for (int_tp j = 0; j < 2; ++j) {
+      Blob<Dtype>* input_blob = nets[j]->input_blobs()[0];
+      input_blob->ReshapeLike(*blobs[i]);
+      caffe_copy(blobs[i]->count(), blobs[i]->cpu_data(),
+                 input_blob->mutable_cpu_data());
+      nets[j]->Reshape();
+      nets[j]->ForwardPrefilled();
+    }
+    const Blob<Dtype>* expected = plain_net->output_blobs()[0];
+    const Blob<Dtype>* output = planned_net->output_blobs()[0];
+    ASSERT_EQ(expected->count(), output->count());
+    for (int_tp k = 0; k < expected->count(); ++k) {
+      EXPECT_FLOAT_EQ(expected->cpu_data()[k], output->cpu_data()[k]);
+    }
+  }
+  EXPECT_EQ(planned_net->blob_by_name("conv1")->data().get(),
+            planned_net->blob_by_name("norm1")->data().get());
+}
+
+TYPED_TEST(NetTest, TestOptimizeMemoryIgnoredForBackward) {
+  typedef typename TypeParam::Dtype Dtype;
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      "optimize_memory: true "
+      "force_backward: true "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 4 } } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      "  inner_product_param { num_output: 4 } } "
+      "layer { name: 'ip3' type: 'InnerProduct' bottom: 'ip2' top: 'ip3' "
+      "  inner_product_param { num_output: 4 } } ", &param));
+  Net<Dtype> net(param);
+  EXPECT_EQ(net.memory_used(), net.memory_planned());
+  EXPECT_NE(net.blob_by_name("ip1")->data().get(),
+            net.blob_by_name("ip3")->data().get());
+}
+
+TYPED_TEST(NetTest, TestContiguousParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The flat net must compute the same gradients and updates as the plain
+  // one, with its params as aligned views of the arenas.
+  const string proto =
+      "force_backward: true "
+      "input: 'data' input_shape { dim: 2 dim: 3 } "
+      "input: 'label' input_shape { dim: 2 dim: 5 } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 5 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } } } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      "  param { name: 'shared' } "
+      "  inner_product_param { num_output: 5 bias_term: false "
+      "    weight_filler { type: 'gaussian' } } } "
+      "layer { name: 'ip3' type: 'InnerProduct' bottom: 'ip2' top: 'ip3' "
+      "  param { name: 'shared' } "
+      "  inner_product_param { num_output: 5 bias_term: false "
+      "    weight_filler { type: 'gaussian' } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip3' "
+      "  bottom: 'label' top: 'loss' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> plain_net(param);
+  param.set_contiguous_params(true);
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> flat_net(param);
+  EXPECT_TRUE(plain_net.flat_param_data() == NULL);
+
+  const vector<Blob<Dtype>*>& params = flat_net.learnable_params();
+  ASSERT_EQ(3, params.size());
+  ASSERT_EQ(3, flat_net.flat_param_offsets().size());
+  // 15 + 5 + 25 values, each padded to a cache line.
+  const int_tp line = 64 / sizeof(Dtype);
+  EXPECT_EQ(((15 + line - 1) / line + 1 + (25 + line - 1) / line) * line,
+            flat_net.flat_param_count());
+  for (int_tp i = 0; i < params.size(); ++i) {
+    const uint_tp offset = flat_net.flat_param_offsets()[i];
+    EXPECT_EQ(0, offset % line);
+    EXPECT_EQ(flat_net.flat_param_data() + offset, params[i]->cpu_data());
+    EXPECT_EQ(flat_net.flat_param_diff() + offset, params[i]->cpu_diff());
+  }
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(flat_net.flat_param_data()) % 64);
+  EXPECT_EQ(flat_net.params()[2]->cpu_data(), flat_net.params()[3]->cpu_data());
+
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Net<Dtype>* nets[2] = { &plain_net, &flat_net };
+  for (int_tp j = 0; j < 2; ++j) {
+    Caffe::set_random_seed(this->seed_);
+    filler.Fill(nets[j]->input_blobs()[0]);
+    filler.Fill(nets[j]->input_blobs()[1]);
+    nets[j]->ClearParamDiffs();
+    nets[j]->ForwardPrefilled();
+    nets[j]->Backward();
+  }
+  EXPECT_NEAR(plain_net.SumsqParamDiffs(), flat_net.SumsqParamDiffs(), 1e-4);
+  EXPECT_GT(flat_net.SumsqParamDiffs(), 0);
+  for (int_tp j = 0; j < 2; ++j) {
+    nets[j]->ScaleParamDiffs(Dtype(0.5));
+    nets[j]->Update();
+  }
+  for (int_tp i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>* expected = plain_net.learnable_params()[i];
+    for (int_tp k = 0; k < expected->count(); ++k) {
+      EXPECT_NEAR(expected->cpu_data()[k], params[i]->cpu_data()[k], 1e-4);
+    }
+  }
+  flat_net.ClearParamDiffs();
+  EXPECT_EQ(0, flat_net.SumsqParamDiffs());
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/hdf5.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Writes a C-ordered NumPy file of uint16 or float32 values counting up
+// from 0 in row-major order.
+static void WriteNpy(const string& filename, const vector<int_tp>& shape,
+                     bool is_float) {
+  std::ostringstream header;
+  header << "{'descr': '" << (is_float ? "<f4" : "<u2")
+         << "', 'fortran_order': False, 'shape': (";
+  int_tp count = 1;
+  for (int_tp i = 0; i < shape.size(); ++i) {
+    header << shape[i] << ", ";
+    count *= shape[i];
+  }
+  header << "), }";
+  string header_string = header.str();
+  while ((10 + header_string.size() + 1) % 64 != 0) {
+    header_string += ' ';
+  }
+  header_string += '\n';
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  file.write("\x93NUMPY\x01\x00", 8);
+  const uint16_t header_size = header_string.size();
+  file.put(header_size & 0xff);
+  file.put(header_size >> 8);
+  file.write(header_string.data(), header_string.size());
+  for (int_tp i = 0; i < count; ++i) {
+    if (is_float) {
+      const float value = i;
+      file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    } else {
+      const uint16_t value = i;
+      file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+  }
+}
+
+template <typename TypeParam>
+class PatchDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  PatchDataLayerTest()
+      : blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    // A 2 x 6 x 7 x 8 data volume and its 6 x 7 x 8 label volume, as NumPy
+    // files and as an HDF5 file.
+    data_shape_.push_back(2);
+    data_shape_.push_back(6);
+    data_shape_.push_back(7);
+    data_shape_.push_back(8);
+    vector<int_tp> label_shape(data_shape_.begin() + 1, data_shape_.end());
+    MakeTempFilename(&data_npy_);
+    data_npy_ += ".npy";
+    MakeTempFilename(&label_npy_);
+    label_npy_ += ".npy";
+    WriteNpy(data_npy_, data_shape_, false);
+    WriteNpy(label_npy_, label_shape, true);
+    MakeTempFilename(&hdf5_);
+    Blob<Dtype> data(data_shape_);
+    Blob<Dtype> label(label_shape);
+    for (int_tp i = 0; i < data.count(); ++i) {
+      data.mutable_cpu_data()[i] = i;
+    }
+    for (int_tp i = 0; i < label.count(); ++i) {
+      label.mutable_cpu_data()[i] = i;
+    }
+    hid_t file_id = H5Fcreate(hdf5_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+                              H5P_DEFAULT);
+    ASSERT_GE(file_id, 0);
+    hdf5_save_nd_dataset(file_id, "data", data);
+    hdf5_save_nd_dataset(file_id, "label", label);
+    ASSERT_GE(H5Fclose(file_id), 0);
+    MakeTempFilename(&npy_source_);
+    std::ofstream npy_source(npy_source_.c_str());
+    npy_source << data_npy_ << " " << label_npy_ << std::endl;
+    MakeTempFilename(&hdf5_source_);
+    std::ofstream hdf5_source(hdf5_source_.c_str());
+    hdf5_source << hdf5_ << std::endl;
+  }
+
+  virtual ~PatchDataLayerTest() {
+    boost::filesystem::remove(data_npy_);
+    boost::filesystem::remove(label_npy_);
+    boost::filesystem::remove(hdf5_);
+    boost::filesystem::remove(npy_source_);
+    boost::filesystem::remove(hdf5_source_);
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  // A data patch of 4 x 5 x 6 around a label patch of 2 x 3 x 4.
+  void SetPatchParam(const string& source, LayerParameter* param) {
+    param->add_top("data");
+    param->add_top("label");
+    PatchDataParameter* patch_data_param = param->mutable_patch_data_param();
+    patch_data_param->set_source(source);
+    patch_data_param->set_batch_size(5);
+    BlobShape* data_patch = patch_data_param->add_patch_shape();
+    data_patch->add_dim(4);
+    data_patch->add_dim(5);
+    data_patch->add_dim(6);
+    BlobShape* label_patch = patch_data_param->add_patch_shape();
+    label_patch->add_dim(2);
+    label_patch->add_dim(3);
+    label_patch->add_dim(4);
+  }
+
+  // Checks that the patches are boxes of the volumes, with the label patch
+  // in the center of the data patch.
+  void CheckPatches() {
+    const int_tp volume_size = 6 * 7 * 8;
+    for (int_tp n = 0; n < 5; ++n) {
+      const Dtype* label = blob_top_label_->cpu_data() + n * 2 * 3 * 4;
+      const Dtype* data = blob_top_data_->cpu_data() + n * 2 * 4 * 5 * 6;
+      const int_tp start = label[0];
+      const int_tp z = start / 56 - 1, y = start / 8 % 7 - 1,
+          x = start % 8 - 1;
+      ASSERT_GE(z, 0);
+      ASSERT_GE(y, 0);
+      ASSERT_GE(x, 0);
+      ASSERT_LE(z, 6 - 4);
+      ASSERT_LE(y, 7 - 5);
+      ASSERT_LE(x, 8 - 6);
+      for (int_tp c = 0; c < 2; ++c) {
+        for (int_tp i = 0; i < 4; ++i) {
+          for (int_tp j = 0; j < 5; ++j) {
+            for (int_tp k = 0; k < 6; ++k) {
+              const int_tp index = ((z + i) * 7 + y + j) * 8 + x + k;
+              EXPECT_EQ(c * volume_size + index,
+                        data[((c * 4 + i) * 5 + j) * 6 + k]);
+              if (c == 0 && i >= 1 && i < 3 && j >= 1 && j < 4 && k >= 1
+                  && k < 5) {
+                EXPECT_EQ(index,
+                          label[((i - 1) * 3 + j - 1) * 4 + k - 1]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  vector<int_tp> data_shape_;
+  string data_npy_;
+  string label_npy_;
+  string hdf5_;
+  string npy_source_;
+  string hdf5_source_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(PatchDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(PatchDataLayerTest, TestNpyPatches) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  this->SetPatchParam(this->npy_source_, &param);
+  PatchDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(5, this->blob_top_data_->num_axes());
+  EXPECT_EQ(5, this->blob_top_data_->shape(0));
+  EXPECT_EQ(2, this->blob_top_data_->shape(1));
+  EXPECT_EQ(4, this->blob_top_data_->shape(2));
+  EXPECT_EQ(5, this->blob_top_data_->shape(3));
+  EXPECT_EQ(6, this->blob_top_data_->shape(4));
+  EXPECT_EQ(4, this->blob_top_label_->num_axes());
+  EXPECT_EQ(5, this->blob_top_label_->shape(0));
+  EXPECT_EQ(2, this->blob_top_label_->shape(1));
+  EXPECT_EQ(3, this->blob_top_label_->shape(2));
+  EXPECT_EQ(4, this->blob_top_label_->shape(3));
+  for (int_tp iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckPatches();
+  }
+}
+
+TYPED_TEST(PatchDataLayerTest, TestHDF5Patches) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  this->SetPatchParam(this->hdf5_source_, &param);
+  param.mutable_patch_data_param()->set_threads(2);
+  PatchDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int_tp iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckPatches();
+  }
+}
+
+TYPED_TEST(PatchDataLayerTest, TestThreadsDeterministic) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  this->SetPatchParam(this->npy_source_, &param);
+  param.mutable_patch_data_param()->set_mirror(true);
+  vector<vector<Dtype> > data;
+  for (int_tp threads = 1; threads <= 3; threads += 2) {
+    param.mutable_patch_data_param()->set_threads(threads);
+    Caffe::set_random_seed(1701);
+    PatchDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    data.push_back(vector<Dtype>(this->blob_top_data_->cpu_data(),
+        this->blob_top_data_->cpu_data() + this->blob_top_data_->count()));
+  }
+  for (int_tp i = 0; i < data[0].size(); ++i) {
+    EXPECT_EQ(data[0][i], data[1][i]);
+  }
+}
+
+TYPED_TEST(PatchDataLayerTest, TestMirrorTranspose) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Cubic patches of a single channel, so that all axes can be swapped.
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  param.add_top("data");
+  param.add_top("label");
+  PatchDataParameter* patch_data_param = param.mutable_patch_data_param();
+  patch_data_param->set_source(this->npy_source_);
+  patch_data_param->set_batch_size(5);
+  patch_data_param->set_mirror(true);
+  patch_data_param->set_transpose(true);
+  BlobShape* data_patch = patch_data_param->add_patch_shape();
+  BlobShape* label_patch = patch_data_param->add_patch_shape();
+  for (int_tp k = 0; k < 3; ++k) {
+    data_patch->add_dim(5);
+    label_patch->add_dim(3);
+  }
+  PatchDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  int_tp augmented = 0;
+  for (int_tp iter = 0; iter < 4; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int_tp n = 0; n < 5; ++n) {
+      // The label patch is augmented like the center of the data patch of
+      // the first channel, and the second channel like the first.
+      const Dtype* data = this->blob_top_data_->cpu_data() + n * 2 * 125;
+      const Dtype* label = this->blob_top_label_->cpu_data() + n * 27;
+      for (int_tp i = 0; i < 3; ++i) {
+        for (int_tp j = 0; j < 3; ++j) {
+          for (int_tp k = 0; k < 3; ++k) {
+            EXPECT_EQ(data[((i + 1) * 5 + j + 1) * 5 + k + 1],
+                      label[(i * 3 + j) * 3 + k]);
+          }
+        }
+      }
+      for (int_tp i = 0; i < 125; ++i) {
+        EXPECT_EQ(data[i] + 6 * 7 * 8, data[125 + i]);
+      }
+      // Neighbors along each output axis differ by a volume stride.
+      const int_tp steps[3] = { static_cast<int_tp>(data[25] - data[0]),
+                                static_cast<int_tp>(data[5] - data[0]),
+                                static_cast<int_tp>(data[1] - data[0]) };
+      vector<int_tp> strides;
+      for (int_tp a = 0; a < 3; ++a) {
+        strides.push_back(std::abs(steps[a]));
+      }
+      std::sort(strides.begin(), strides.end());
+      EXPECT_EQ(1, strides[0]);
+      EXPECT_EQ(8, strides[1]);
+      EXPECT_EQ(56, strides[2]);
+      if (steps[0] != 56 || steps[1] != 8 || steps[2] != 1) {
+        ++augmented;
+      }
+    }
+  }
+  EXPECT_GT(augmented, 0);
+}
+
+}  // namespace caffe
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cfloat>
 #include <cstring>
 #include <vector>
 
@@ -8,19 +9,20 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
-#ifndef CPU_ONLY  // CPU-GPU test
-
 namespace caffe {
 
 template<typename TypeParam>
-class PoolingNDLayerTest : public GPUDeviceTest<TypeParam> {
+class PoolingNDLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
  protected:
   PoolingNDLayerTest()
-      : blob_bottom_(new Blob<TypeParam>()),
-        blob_top_(new Blob<TypeParam>()) {
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
   }
 
   virtual void SetUp() {
@@ -64,16 +66,16 @@ class PoolingNDLayerTest : public GPUDeviceTest<TypeParam> {
 
     pooling_param->set_axis(1);
 
-    PoolingLayer<TypeParam> layer(layer_param);
+    PoolingLayer<Dtype> layer(layer_param);
     layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
 
     int_tp d = blob_bottom_->shape(2);
     int_tp h = blob_bottom_->shape(3);
     int_tp w = blob_bottom_->shape(4);
 
-    TypeParam *bottom_data = blob_bottom_->mutable_cpu_data();
+    Dtype *bottom_data = blob_bottom_->mutable_cpu_data();
 
-    std::vector<TypeParam> maxval(8 * 8);
+    std::vector<Dtype> maxval(8 * 8);
 
     for (int_tp cd = 0; cd < d; ++cd) {
       for (int_tp ch = 0; ch < h; ++ch) {
@@ -91,7 +93,7 @@ class PoolingNDLayerTest : public GPUDeviceTest<TypeParam> {
 
     layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
 
-    const TypeParam *top_data = blob_top_->cpu_data();
+    const Dtype *top_data = blob_top_->cpu_data();
 
     for (int i = 0; i < 2*2*2 * 8; ++i) {
       EXPECT_EQ(maxval[i % 8], top_data[i]);
@@ -113,16 +115,16 @@ class PoolingNDLayerTest : public GPUDeviceTest<TypeParam> {
 
     pooling_param->set_axis(1);
 
-    PoolingLayer<TypeParam> layer(layer_param);
+    PoolingLayer<Dtype> layer(layer_param);
     layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
 
     int_tp d = blob_bottom_->shape(2);
     int_tp h = blob_bottom_->shape(3);
     int_tp w = blob_bottom_->shape(4);
 
-    TypeParam *bottom_data = blob_bottom_->mutable_cpu_data();
+    Dtype *bottom_data = blob_bottom_->mutable_cpu_data();
 
-    std::vector<TypeParam> maxval(8);
+    std::vector<Dtype> maxval(8);
 
     for (int_tp cd = 0; cd < d; ++cd) {
       for (int_tp ch = 0; ch < h; ++ch) {
@@ -138,7 +140,7 @@ class PoolingNDLayerTest : public GPUDeviceTest<TypeParam> {
 
     layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
 
-    TypeParam *top_diff = blob_top_->mutable_cpu_diff();
+    Dtype *top_diff = blob_top_->mutable_cpu_diff();
     for (int i = 0; i < 2*2*2; ++i) {
       top_diff[i] = maxval[i];
     }
@@ -148,7 +150,7 @@ class PoolingNDLayerTest : public GPUDeviceTest<TypeParam> {
 
     layer.Backward(this->blob_top_vec_, prop_down, this->blob_bottom_vec_);
 
-    const TypeParam *bottom_diff = blob_bottom_->cpu_diff();
+    const Dtype *bottom_diff = blob_bottom_->cpu_diff();
 
     for (int_tp cd = 0; cd < d; ++cd) {
       for (int_tp ch = 0; ch < h; ++ch) {
@@ -164,16 +166,17 @@ class PoolingNDLayerTest : public GPUDeviceTest<TypeParam> {
     }
   }
 
-  Blob<TypeParam>* const blob_bottom_;
-  Blob<TypeParam>* const blob_top_;
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
 
-  vector<Blob<TypeParam>*> blob_bottom_vec_;
-  vector<Blob<TypeParam>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
 };
 
-TYPED_TEST_CASE(PoolingNDLayerTest, TestDtypes);
+TYPED_TEST_CASE(PoolingNDLayerTest, TestDtypesAndDevices);
 
 TYPED_TEST(PoolingNDLayerTest, TestSetup) {
+  typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
   PoolingParameter* pooling_param =
       layer_param.mutable_pooling_param();
@@ -189,7 +192,7 @@ TYPED_TEST(PoolingNDLayerTest, TestSetup) {
   pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
 
 
-  PoolingLayer<TypeParam> layer(layer_param);
+  PoolingLayer<Dtype> layer(layer_param);
   layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
 
   EXPECT_EQ(2, this->blob_top_->shape(2));
@@ -205,5 +208,155 @@ TYPED_TEST(PoolingNDLayerTest, TestBackward) {
   this->TestBackward();
 }
 
+// Brute force 3D pooling of one channel over all padded window taps.
+template <typename Dtype>
+void pooling_3d_reference(const Dtype* bottom, const int_tp* size,
+                          const int_tp* pooled_size, const int_tp kernel,
+                          const int_tp stride, const int_tp kstride,
+                          const int_tp pad, const bool max, Dtype* top) {
+  for (int_tp pd = 0; pd < pooled_size[0]; ++pd) {
+    for (int_tp ph = 0; ph < pooled_size[1]; ++ph) {
+      for (int_tp pw = 0; pw < pooled_size[2]; ++pw) {
+        const int_tp p[3] = { pd, ph, pw };
+        Dtype value = max ? -FLT_MAX : 0;
+        int_tp taps = 0;
+        for (int_tp kd = 0; kd < kernel; ++kd) {
+          for (int_tp kh = 0; kh < kernel; ++kh) {
+            for (int_tp kw = 0; kw < kernel; ++kw) {
+              const int_tp k[3] = { kd, kh, kw };
+              int_tp index = 0;
+              bool inside = true, padded = true;
+              for (int_tp i = 0; i < 3; ++i) {
+                const int_tp x = p[i] * stride - pad + k[i] * kstride;
+                inside &= x >= 0 && x < size[i];
+                padded &= x < size[i] + pad;
+                index = index * size[i] + x;
+              }
+              taps += padded;
+              if (inside) {
+                value = max ? std::max(value, bottom[index])
+                    : value + bottom[index];
+              }
+            }
+          }
+        }
+        top[(pd * pooled_size[1] + ph) * pooled_size[2] + pw] =
+            max ? value : value / taps;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+class CPUPoolingNDLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  CPUPoolingNDLayerTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
+  }
+
+  virtual void SetUp() {
+    vector<int_tp> shape(5);
+    shape[0] = 2;
+    shape[1] = 3;
+    shape[2] = 5;
+    shape[3] = 6;
+    shape[4] = 7;
+    blob_bottom_->Reshape(shape);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~CPUPoolingNDLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+
+  void SetParam(PoolingParameter_PoolMethod pool, int_tp kernel,
+                int_tp stride, int_tp kstride, int_tp pad,
+                LayerParameter* layer_param) {
+    PoolingParameter* pooling_param = layer_param->mutable_pooling_param();
+    pooling_param->set_pool(pool);
+    pooling_param->add_kernel_size(kernel);
+    pooling_param->add_stride(stride);
+    pooling_param->add_kstride(kstride);
+    pooling_param->add_pad(pad);
+  }
+
+  void CheckForward(PoolingParameter_PoolMethod pool, int_tp kernel,
+                    int_tp stride, int_tp kstride, int_tp pad) {
+    LayerParameter layer_param;
+    SetParam(pool, kernel, stride, kstride, pad, &layer_param);
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    const int_tp size[3] = { blob_bottom_->shape(2), blob_bottom_->shape(3),
+                             blob_bottom_->shape(4) };
+    const int_tp pooled_size[3] = { blob_top_->shape(2), blob_top_->shape(3),
+                                    blob_top_->shape(4) };
+    const int_tp bottom_dim = blob_bottom_->count(2);
+    const int_tp top_dim = blob_top_->count(2);
+    vector<Dtype> expected(top_dim);
+    for (int_tp nc = 0; nc < blob_bottom_->count(0, 2); ++nc) {
+      pooling_3d_reference(blob_bottom_->cpu_data() + nc * bottom_dim, size,
+                           pooled_size, kernel, stride, kstride, pad,
+                           pool == PoolingParameter_PoolMethod_MAX,
+                           &expected[0]);
+      for (int_tp i = 0; i < top_dim; ++i) {
+        EXPECT_NEAR(expected[i], blob_top_->cpu_data()[nc * top_dim + i],
+                    1e-5);
+      }
+    }
+  }
+
+  void CheckGradient(PoolingParameter_PoolMethod pool, int_tp kernel,
+                     int_tp stride, int_tp kstride, int_tp pad) {
+    // A smaller bottom keeps the exhaustive check fast.
+    vector<int_tp> shape(5);
+    shape[0] = 1;
+    shape[1] = 2;
+    shape[2] = 3;
+    shape[3] = 4;
+    shape[4] = 5;
+    blob_bottom_->Reshape(shape);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    LayerParameter layer_param;
+    SetParam(pool, kernel, stride, kstride, pad, &layer_param);
+    PoolingLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-4, 1e-2);
+    checker.CheckGradientExhaustive(&layer, blob_bottom_vec_, blob_top_vec_);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(CPUPoolingNDLayerTest, TestDtypes);
+
+TYPED_TEST(CPUPoolingNDLayerTest, TestForwardMax) {
+  this->CheckForward(PoolingParameter_PoolMethod_MAX, 3, 2, 1, 1);
+  this->CheckForward(PoolingParameter_PoolMethod_MAX, 2, 1, 2, 0);
+}
+
+TYPED_TEST(CPUPoolingNDLayerTest, TestForwardAve) {
+  this->CheckForward(PoolingParameter_PoolMethod_AVE, 3, 2, 1, 1);
+  this->CheckForward(PoolingParameter_PoolMethod_AVE, 2, 1, 2, 1);
+}
+
+TYPED_TEST(CPUPoolingNDLayerTest, TestGradientMax) {
+  this->CheckGradient(PoolingParameter_PoolMethod_MAX, 2, 2, 2, 1);
+}
+
+TYPED_TEST(CPUPoolingNDLayerTest, TestGradientAve) {
+  this->CheckGradient(PoolingParameter_PoolMethod_AVE, 2, 1, 2, 1);
+}
+
 }  // namespace caffe
-#endif  // !CPU_ONLY
@@ -11,16 +11,16 @@
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
-#ifndef CPU_ONLY  // CPU-GPU test
-
 namespace caffe {
 
 template<typename TypeParam>
-class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
+class PoolingNDSKLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
  protected:
   PoolingNDSKLayerTest()
-      : blob_bottom_(new Blob<TypeParam>()),
-        blob_top_(new Blob<TypeParam>()) {
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
   }
 
   virtual void SetUp() {
@@ -64,16 +64,16 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
 
     pooling_param->set_axis(1);
 
-    PoolingLayer<TypeParam> layer(layer_param);
+    PoolingLayer<Dtype> layer(layer_param);
     layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
 
     int_tp d = blob_bottom_->shape(2);
     int_tp h = blob_bottom_->shape(3);
     int_tp w = blob_bottom_->shape(4);
 
-    TypeParam *bottom_data = blob_bottom_->mutable_cpu_data();
+    Dtype *bottom_data = blob_bottom_->mutable_cpu_data();
 
-    TypeParam maxval = 0;
+    Dtype maxval = 0;
 
     for (int_tp cd = 0; cd < d; ++cd) {
       for (int_tp ch = 0; ch < h; ++ch) {
@@ -81,7 +81,7 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
           bottom_data[cw + ch * w + cd * w * h] =
               cw + ch * w + cd * w * h;
           if (cw % 2 == 0 && ch % 2 == 0 && cd % 2 == 0) {
-            maxval = std::max((TypeParam)(cw + ch * w + cd * w * h), maxval);
+            maxval = std::max((Dtype)(cw + ch * w + cd * w * h), maxval);
           }
         }
       }
@@ -89,7 +89,7 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
 
     layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
 
-    const TypeParam *top_data = blob_top_->cpu_data();
+    const Dtype *top_data = blob_top_->cpu_data();
 
     EXPECT_EQ(maxval, top_data[0]);
   }
@@ -109,16 +109,16 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
 
     pooling_param->set_axis(1);
 
-    PoolingLayer<TypeParam> layer(layer_param);
+    PoolingLayer<Dtype> layer(layer_param);
     layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
 
     int_tp d = blob_bottom_->shape(2);
     int_tp h = blob_bottom_->shape(3);
     int_tp w = blob_bottom_->shape(4);
 
-    TypeParam *bottom_data = blob_bottom_->mutable_cpu_data();
+    Dtype *bottom_data = blob_bottom_->mutable_cpu_data();
 
-    TypeParam maxval = 0;
+    Dtype maxval = 0;
 
     for (int_tp cd = 0; cd < d; ++cd) {
       for (int_tp ch = 0; ch < h; ++ch) {
@@ -126,7 +126,7 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
           bottom_data[cw + ch * w + cd * w * h] =
               cw + ch * w + cd * w * h;
           if (cw % 2 == 0 && ch % 2 == 0 && cd % 2 == 0) {
-            maxval = std::max((TypeParam)(cw + ch * w + cd * w * h), maxval);
+            maxval = std::max((Dtype)(cw + ch * w + cd * w * h), maxval);
           }
         }
       }
@@ -134,7 +134,7 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
 
     layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
 
-    TypeParam *top_diff = blob_top_->mutable_cpu_diff();
+    Dtype *top_diff = blob_top_->mutable_cpu_diff();
     top_diff[0] = maxval;
 
     std::vector<bool> prop_down;
@@ -142,7 +142,7 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
 
     layer.Backward(this->blob_top_vec_, prop_down, this->blob_bottom_vec_);
 
-    const TypeParam *bottom_diff = blob_bottom_->cpu_diff();
+    const Dtype *bottom_diff = blob_bottom_->cpu_diff();
 
     for (int_tp cd = 0; cd < d; ++cd) {
       for (int_tp ch = 0; ch < h; ++ch) {
@@ -155,16 +155,17 @@ class PoolingNDSKLayerTest : public GPUDeviceTest<TypeParam> {
     }
   }
 
-  Blob<TypeParam>* const blob_bottom_;
-  Blob<TypeParam>* const blob_top_;
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
 
-  vector<Blob<TypeParam>*> blob_bottom_vec_;
-  vector<Blob<TypeParam>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
 };
 
-TYPED_TEST_CASE(PoolingNDSKLayerTest, TestDtypes);
+TYPED_TEST_CASE(PoolingNDSKLayerTest, TestDtypesAndDevices);
 
 TYPED_TEST(PoolingNDSKLayerTest, TestSetup) {
+  typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
   PoolingParameter* pooling_param =
       layer_param.mutable_pooling_param();
@@ -180,7 +181,7 @@ TYPED_TEST(PoolingNDSKLayerTest, TestSetup) {
   pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
 
 
-  PoolingLayer<TypeParam> layer(layer_param);
+  PoolingLayer<Dtype> layer(layer_param);
   layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
 
   EXPECT_EQ(1, this->blob_top_->shape(2));
@@ -197,4 +198,3 @@ TYPED_TEST(PoolingNDSKLayerTest, TestBackward) {
 }
 
 }  // namespace caffe
-#endif  // !CPU_ONLY
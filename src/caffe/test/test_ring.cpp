@@ -0,0 +1,344 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/neuron_layers.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/sgd_solvers.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/ring.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Counts the messages a rank sends, whichever thread sends them.
+class CountingTransport : public RingTransport {
+ public:
+  explicit CountingTransport(shared_ptr<RingTransport> transport)
+      : RingTransport(transport->rank(), transport->ranks()),
+        transport_(transport), sends_(0) {}
+  virtual void SendRecv(const void* send, uint_tp send_bytes, void* recv,
+                        uint_tp recv_bytes) {
+    transport_->SendRecv(send, send_bytes, recv, recv_bytes);
+    __sync_fetch_and_add(&sends_, 1);
+  }
+  int_tp sends() { return __sync_fetch_and_add(&sends_, 0); }
+
+ private:
+  shared_ptr<RingTransport> transport_;
+  int_tp sends_;
+};
+
+// An identity layer whose Backward sleeps, counting the messages its rank
+// sends meanwhile.
+template <typename Dtype>
+class SlowBackwardLayer : public NeuronLayer<Dtype> {
+ public:
+  explicit SlowBackwardLayer(const LayerParameter& param)
+      : NeuronLayer<Dtype>(param), transport_(NULL), overlapped_sends_(0) {}
+  virtual inline const char* type() const { return "SlowBackward"; }
+
+  CountingTransport* transport_;
+  int_tp overlapped_sends_;
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    top[0]->ShareData(*bottom[0]);
+  }
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    const int_tp sends = transport_ ? transport_->sends() : 0;
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    if (transport_) {
+      overlapped_sends_ += transport_->sends() - sends;
+    }
+    caffe_cpu_copy(top[0]->count(), top[0]->cpu_diff(),
+                   bottom[0]->mutable_cpu_diff());
+  }
+};
+
+REGISTER_LAYER_CLASS(SlowBackward);
+
+template <typename TypeParam>
+class RingTest : public ::testing::Test {
+  typedef TypeParam Dtype;
+
+ protected:
+  RingTest() : ranks_(3), data_(ranks_), overlapped_sends_(ranks_) {}
+
+  static void RunRank(const string& address, int rank, int ranks,
+                      bool broadcast, vector<Dtype>* data) {
+    shared_ptr<RingTransport> transport(
+        RingTransport::Create(address, rank, ranks));
+    if (broadcast) {
+      ring_broadcast(transport.get(), &(*data)[0], data->size());
+    } else {
+      ring_allreduce(transport.get(), &(*data)[0], data->size());
+    }
+  }
+
+  // Runs every rank on its own thread, as the ranks block on each other.
+  void Run(const string& address, bool broadcast) {
+    vector<shared_ptr<boost::thread> > threads(ranks_);
+    for (int r = 0; r < ranks_; ++r) {
+      threads[r].reset(new boost::thread(boost::bind(&RingTest::RunRank,
+          address, r, ranks_, broadcast, &data_[r])));
+    }
+    for (int r = 0; r < ranks_; ++r) {
+      threads[r]->join();
+    }
+  }
+
+  // With slow, a SlowBackward layer sits between the inner products. With
+  // contiguous, the net keeps its params in one arena.
+  static SolverParameter TrainParam(int_tp iter_size, bool slow,
+                                    bool contiguous) {
+    const string ip2_bottom = slow ? "slow" : "ip1";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        "base_lr: 0.1 lr_policy: 'fixed' momentum: 0.9 max_iter: 4 display: 0 "
+        "snapshot_after_train: false random_seed: 1701 "
+        "net_param { "
+        "  layer { name: 'data' type: 'DummyData' top: 'data' top: 'label' "
+        "    dummy_data_param { "
+        "      shape { dim: 4 dim: 5 } shape { dim: 4 dim: 3 } "
+        "      data_filler { type: 'gaussian' } "
+        "      data_filler { type: 'gaussian' } } } "
+        "  layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' "
+        "    top: 'ip1' inner_product_param { num_output: 6 "
+        "      weight_filler { type: 'gaussian' std: 0.1 } "
+        "      bias_filler { type: 'gaussian' std: 0.1 } } } "
+        + string(slow ? "  layer { name: 'slow' type: 'SlowBackward' "
+                        "    bottom: 'ip1' top: 'slow' } " : "") +
+        "  layer { name: 'ip2' type: 'InnerProduct' bottom: '" + ip2_bottom
+        + "'    top: 'ip2' inner_product_param { num_output: 3 "
+        "      weight_filler { type: 'gaussian' std: 0.1 } "
+        "      bias_filler { type: 'gaussian' std: 0.1 } } } "
+        "  layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip2' "
+        "    bottom: 'label' top: 'loss' } "
+        "} ", &param));
+    param.set_iter_size(iter_size);
+    param.mutable_net_param()->set_contiguous_params(contiguous);
+    return param;
+  }
+
+  // Trains on every rank with the same data, and leaves the parameters of
+  // the net in data. With slow, also counts the messages sent while the
+  // SlowBackward layer ran.
+  static void TrainRank(device* device_context, const string& address,
+                        int rank, int ranks, const SolverParameter& param,
+                        uint_tp bucket_size, vector<Dtype>* data, bool slow,
+                        int_tp* overlapped_sends) {
+    Caffe::SelectDevice(device_context);
+    Caffe::set_random_seed(1701);
+    shared_ptr<Solver<Dtype> > solver(new SGDSolver<Dtype>(param));
+    shared_ptr<RingTransport> transport(
+        RingTransport::Create(address, rank, ranks));
+    SlowBackwardLayer<Dtype>* slow_layer = NULL;
+    if (slow) {
+      shared_ptr<CountingTransport> counting(new CountingTransport(transport));
+      slow_layer = dynamic_cast<SlowBackwardLayer<Dtype>*>(
+          solver->net()->layer_by_name("slow").get());
+      slow_layer->transport_ = counting.get();
+      transport = counting;
+    }
+    RingSync<Dtype> sync(solver, transport, bucket_size);
+    // The arena of the net is summed in place, padding included.
+    if (param.net_param().contiguous_params()) {
+      EXPECT_EQ(solver->net()->flat_param_data(), sync.data());
+      EXPECT_EQ(solver->net()->flat_param_count(), sync.size());
+    }
+    sync.run();
+    data->clear();
+    const vector<Blob<Dtype>*>& params = solver->net()->learnable_params();
+    for (int i = 0; i < params.size(); ++i) {
+      data->insert(data->end(), params[i]->cpu_data(),
+                   params[i]->cpu_data() + params[i]->count());
+    }
+    if (slow_layer) {
+      *overlapped_sends = slow_layer->overlapped_sends_;
+    }
+  }
+
+  // As the ranks see the same data, their mean gradient is the gradient of
+  // a single solver, which must end with the same parameters.
+  void TestRingSync(int_tp iter_size, uint_tp bucket_size,
+                    bool slow = false, bool contiguous = false) {
+    Caffe::set_random_seed(1701);
+    SGDSolver<Dtype> single(TrainParam(iter_size, slow, false));
+    single.Solve();
+
+    const SolverParameter param = TrainParam(iter_size, slow, contiguous);
+    vector<shared_ptr<boost::thread> > threads(ranks_);
+    for (int r = 0; r < ranks_; ++r) {
+      threads[r].reset(new boost::thread(boost::bind(&RingTest::TrainRank,
+          Caffe::GetDefaultDevice(), ShmAddress(), r, ranks_, param,
+          bucket_size, &data_[r], slow, &overlapped_sends_[r])));
+    }
+    for (int r = 0; r < ranks_; ++r) {
+      threads[r]->join();
+    }
+
+    const vector<Blob<Dtype>*>& params = single.net()->learnable_params();
+    for (int r = 0; r < ranks_; ++r) {
+      int_tp offset = 0;
+      for (int i = 0; i < params.size(); ++i) {
+        for (int_tp j = 0; j < params[i]->count(); ++j) {
+          EXPECT_NEAR(params[i]->cpu_data()[j], data_[r][offset++], 1e-5);
+        }
+      }
+      EXPECT_EQ(offset, data_[r].size());
+    }
+    // The buckets of ip2 are summed while the layers below run Backward.
+    for (int r = 0; r < ranks_ && slow; ++r) {
+      EXPECT_GT(overlapped_sends_[r], 0);
+    }
+  }
+
+  void Fill(int_tp count) {
+    for (int r = 0; r < ranks_; ++r) {
+      data_[r].resize(count);
+      for (int_tp i = 0; i < count; ++i) {
+        data_[r][i] = r * 1000 + i % 1000;
+      }
+    }
+  }
+
+  void TestAllreduce(const string& address, int_tp count) {
+    Fill(count);
+    Run(address, false);
+    for (int r = 0; r < ranks_; ++r) {
+      for (int_tp i = 0; i < count; ++i) {
+        // Sum of r * 1000 + i % 1000 over the ranks.
+        EXPECT_EQ(3000 + 3 * (i % 1000), data_[r][i]);
+      }
+    }
+  }
+
+  void TestBroadcast(const string& address, int_tp count) {
+    Fill(count);
+    Run(address, true);
+    for (int r = 0; r < ranks_; ++r) {
+      for (int_tp i = 0; i < count; ++i) {
+        EXPECT_EQ(i % 1000, data_[r][i]);
+      }
+    }
+  }
+
+  string ShmAddress() const {
+    std::ostringstream address;
+    address << "shm:caffe_test_ring_" << getpid();
+    return address.str();
+  }
+
+  // Leaves segments as a crashed run with the same name would: the size of
+  // a link, three cache lines of counters and the default 4 MB of queue,
+  // with every counter set.
+  void LeaveStaleSegments() const {
+    const uint_tp size = 3 * 64 + (4 << 20);
+    for (int r = 0; r < ranks_; ++r) {
+      std::ostringstream name;
+      name << "/" << ShmAddress().substr(4) << "_" << r;
+      const int fd = shm_open(name.str().c_str(), O_RDWR | O_CREAT, 0600);
+      ASSERT_GE(fd, 0);
+      ASSERT_EQ(0, ftruncate(fd, size));
+      void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                          0);
+      close(fd);
+      ASSERT_TRUE(memory != MAP_FAILED);
+      memset(memory, 0xff, size);
+      munmap(memory, size);
+    }
+  }
+
+  string TCPAddress() const {
+    std::ostringstream address;
+    const int port = 20000 + getpid() % 20000;
+    address << "tcp:";
+    for (int r = 0; r < ranks_; ++r) {
+      address << (r ? "," : "") << "127.0.0.1:" << port + r;
+    }
+    return address.str();
+  }
+
+  const int ranks_;
+  vector<vector<Dtype> > data_;
+  vector<int_tp> overlapped_sends_;
+};
+
+TYPED_TEST_CASE(RingTest, TestDtypes);
+
+TYPED_TEST(RingTest, TestAllreduceShm) {
+  this->TestAllreduce(this->ShmAddress(), 10001);
+}
+
+TYPED_TEST(RingTest, TestAllreduceShmStaleSegments) {
+  this->LeaveStaleSegments();
+  this->TestAllreduce(this->ShmAddress(), 10001);
+}
+
+TYPED_TEST(RingTest, TestAllreduceFewerValuesThanRanks) {
+  this->TestAllreduce(this->ShmAddress(), 2);
+}
+
+TYPED_TEST(RingTest, TestAllreduceTCP) {
+  this->TestAllreduce(this->TCPAddress(), 10001);
+}
+
+TYPED_TEST(RingTest, TestBroadcastShm) {
+  // Several broadcast chunks, the last one partial.
+  this->TestBroadcast(this->ShmAddress(), 700001);
+}
+
+TYPED_TEST(RingTest, TestBroadcastTCP) {
+  this->TestBroadcast(this->TCPAddress(), 700001);
+}
+
+TYPED_TEST(RingTest, TestRingSync) {
+  this->TestRingSync(1, 1 << 20);
+}
+
+TYPED_TEST(RingTest, TestRingSyncLayerBuckets) {
+  // 57 parameters in buckets of 7, most summed during Backward.
+  this->TestRingSync(1, 7);
+}
+
+TYPED_TEST(RingTest, TestRingSyncIterSize) {
+  this->TestRingSync(2, 7);
+}
+
+TYPED_TEST(RingTest, TestRingSyncOverlapsBackward) {
+  this->TestRingSync(1, 7, true);
+}
+
+TYPED_TEST(RingTest, TestRingSyncContiguous) {
+  // Buckets of 7 cut across the params and the padding between them.
+  this->TestRingSync(1, 7, false, true);
+}
+
+TYPED_TEST(RingTest, TestSingleRank) {
+  vector<TypeParam> data(5, TypeParam(2));
+  shared_ptr<RingTransport> transport(
+      RingTransport::Create(this->ShmAddress(), 0, 1));
+  ring_allreduce(transport.get(), &data[0], data.size());
+  ring_broadcast(transport.get(), &data[0], data.size());
+  for (int i = 0; i < data.size(); ++i) {
+    EXPECT_EQ(2, data[i]);
+  }
+}
+
+}  // namespace caffe
@@ -66,35 +66,29 @@ TYPED_TEST(CPUStochasticPoolingLayerTest, TestSetup) {
   EXPECT_EQ(this->blob_top_->width(), 2);
 }
 
-#ifndef CPU_ONLY
+TYPED_TEST_CASE(StochasticPoolingLayerTest, TestDtypesAndDevices);
 
-template <typename Dtype>
-class GPUStochasticPoolingLayerTest
-  : public StochasticPoolingLayerTest<GPUDevice<Dtype> > {
-};
-
-TYPED_TEST_CASE(GPUStochasticPoolingLayerTest, TestDtypes);
-
-TYPED_TEST(GPUStochasticPoolingLayerTest, TestStochastic) {
+TYPED_TEST(StochasticPoolingLayerTest, TestStochastic) {
+  typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
   layer_param.set_phase(TRAIN);
   PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
   pooling_param->add_kernel_size(3);
   pooling_param->add_stride(2);
   pooling_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
-  PoolingLayer<TypeParam> layer(layer_param);
+  PoolingLayer<Dtype> layer(layer_param);
   layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
   layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
 
   // Check if the output is correct - it should do random sampling
-  const TypeParam* bottom_data = this->blob_bottom_->cpu_data();
-  const TypeParam* top_data = this->blob_top_->cpu_data();
-  TypeParam total = 0;
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  Dtype total = 0;
   for (int_tp n = 0; n < this->blob_top_->num(); ++n) {
     for (int_tp c = 0; c < this->blob_top_->channels(); ++c) {
       for (int_tp ph = 0; ph < this->blob_top_->height(); ++ph) {
         for (int_tp pw = 0; pw < this->blob_top_->width(); ++pw) {
-          TypeParam pooled = top_data[this->blob_top_->offset(n, c, ph, pw)];
+          Dtype pooled = top_data[this->blob_top_->offset(n, c, ph, pw)];
           total += pooled;
           int_tp hstart = ph * 2;
           int_tp hend = min(hstart + 3, this->blob_bottom_->height());
@@ -118,25 +112,26 @@ TYPED_TEST(GPUStochasticPoolingLayerTest, TestStochastic) {
   EXPECT_GE(total / this->blob_top_->count(), 0.55);
 }
 
-TYPED_TEST(GPUStochasticPoolingLayerTest, TestStochasticTestPhase) {
+TYPED_TEST(StochasticPoolingLayerTest, TestStochasticTestPhase) {
+  typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
   layer_param.set_phase(TEST);
   PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
   pooling_param->add_kernel_size(3);
   pooling_param->add_stride(2);
   pooling_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
-  PoolingLayer<TypeParam> layer(layer_param);
+  PoolingLayer<Dtype> layer(layer_param);
   layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
   layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
 
   // Check if the output is correct - it should do random sampling
-  const TypeParam* bottom_data = this->blob_bottom_->cpu_data();
-  const TypeParam* top_data = this->blob_top_->cpu_data();
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
   for (int_tp n = 0; n < this->blob_top_->num(); ++n) {
     for (int_tp c = 0; c < this->blob_top_->channels(); ++c) {
       for (int_tp ph = 0; ph < this->blob_top_->height(); ++ph) {
         for (int_tp pw = 0; pw < this->blob_top_->width(); ++pw) {
-          TypeParam pooled = top_data[this->blob_top_->offset(n, c, ph, pw)];
+          Dtype pooled = top_data[this->blob_top_->offset(n, c, ph, pw)];
           int_tp hstart = ph * 2;
           int_tp hend = min(hstart + 3, this->blob_bottom_->height());
           int_tp wstart = pw * 2;
@@ -155,21 +150,20 @@ TYPED_TEST(GPUStochasticPoolingLayerTest, TestStochasticTestPhase) {
   }
 }
 
-TYPED_TEST(GPUStochasticPoolingLayerTest, TestGradient) {
+TYPED_TEST(StochasticPoolingLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
   layer_param.set_phase(TRAIN);
   PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
   pooling_param->add_kernel_size(3);
   pooling_param->add_stride(2);
   pooling_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
-  PoolingLayer<TypeParam> layer(layer_param);
-  GradientChecker<TypeParam> checker(1e-4, 1e-2);
+  PoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-4, 1e-2);
   // it is too expensive to call curand multiple times, so we don't do an
   // exhaustive gradient check.
   checker.CheckGradient(&layer, this->blob_bottom_vec_,
       this->blob_top_vec_);
 }
 
-#endif
-
 }  // namespace caffe
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +7,7 @@
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/device_alternate.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_pool.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -74,6 +76,20 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10, Caffe::GetDefaultDevice());
+  const uint_tp initial = mem.version();
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), initial);
+  mem.mutable_cpu_data();
+  EXPECT_EQ(mem.version(), initial + 1);
+  char data[10];
+  mem.set_cpu_data(data);
+  EXPECT_EQ(mem.version(), initial + 2);
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), initial + 2);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
@@ -175,4 +191,61 @@ TEST_F(SyncedMemoryTest, TestGPUWrite) {
 
 #endif
 
+TEST_F(SyncedMemoryTest, TestPoolSizeClass) {
+  EXPECT_EQ(MemoryPool::SizeClass(0), 64);
+  EXPECT_EQ(MemoryPool::SizeClass(64), 64);
+  EXPECT_EQ(MemoryPool::SizeClass(65), 128);
+  EXPECT_EQ(MemoryPool::SizeClass(1000), 1024);
+  EXPECT_EQ(MemoryPool::SizeClass(1025), 1280);
+  EXPECT_EQ(MemoryPool::SizeClass(1281), 1536);
+  for (uint_tp size = 1; size < 100000; size += 37) {
+    const uint_tp bytes = MemoryPool::SizeClass(size);
+    EXPECT_GE(bytes, size);
+    EXPECT_LT(bytes, size + std::max(size / 4, static_cast<uint_tp>(64)));
+    EXPECT_EQ(bytes % 64, 0);
+  }
+}
+
+TEST_F(SyncedMemoryTest, TestPoolLimit) {
+  MemoryPool pool;
+  int_tp a, b, c;
+  pool.set_limit(200);
+  EXPECT_TRUE(pool.Give(&a, 100, 0));
+  EXPECT_FALSE(pool.Give(&b, 100, 0));
+  EXPECT_EQ(pool.bytes_cached(), 128);
+  // Blocks are only reused for the same flags.
+  EXPECT_TRUE(pool.Take(100, 1) == NULL);
+  EXPECT_EQ(pool.Take(120, 0), &a);
+  EXPECT_EQ(pool.hits(), 1);
+  EXPECT_EQ(pool.misses(), 1);
+  pool.set_limit(0);
+  EXPECT_FALSE(pool.Give(&c, 1, 0));
+  EXPECT_EQ(pool.bytes_cached(), 0);
+}
+
+TEST_F(SyncedMemoryTest, TestHostPoolReuse) {
+  Caffe::TrimMemoryPools();
+  MemoryPool& pool = Caffe::host_memory_pool();
+  pool.ResetCounters();
+  SyncedMemory* mem = new SyncedMemory(1000, Caffe::GetCPUDevice());
+  void* cpu_data = mem->mutable_cpu_data();
+  caffe_memset(mem->size(), 1, cpu_data);
+  EXPECT_EQ(pool.misses(), 1);
+  delete mem;
+  EXPECT_EQ(pool.bytes_cached(), 1024);
+  // A blob of the same size class gets the cached block, zeroed again.
+  SyncedMemory reused(1010, Caffe::GetCPUDevice());
+  EXPECT_EQ(reused.cpu_data(), cpu_data);
+  EXPECT_EQ(pool.hits(), 1);
+  EXPECT_EQ(pool.bytes_cached(), 0);
+  for (int_tp i = 0; i < reused.size(); ++i) {
+    EXPECT_EQ((static_cast<const char*>(reused.cpu_data()))[i], 0);
+  }
+  SyncedMemory larger(2000, Caffe::GetCPUDevice());
+  EXPECT_NE(larger.cpu_data(), cpu_data);
+  EXPECT_EQ(pool.misses(), 2);
+  Caffe::TrimMemoryPools();
+  EXPECT_EQ(pool.bytes_cached(), 0);
+}
+
 }  // namespace caffe
@@ -1,5 +1,6 @@
 #include <boost/thread.hpp>
 #include <string>
+#include <utility>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/data_reader.hpp"
@@ -88,9 +89,14 @@ uint_tp BlockingQueue<T>::size() const {
 
 template class BlockingQueue<Batch<float>*>;
 template class BlockingQueue<Batch<double>*>;
-template class BlockingQueue<Datum*>;
+template class BlockingQueue<TopBatch<float>*>;
+template class BlockingQueue<TopBatch<double>*>;
+template class BlockingQueue<DatumSample*>;
 template class BlockingQueue<shared_ptr<DataReader::QueuePair> >;
 template class BlockingQueue<P2PSync<float>*>;
 template class BlockingQueue<P2PSync<double>*>;
+template class BlockingQueue<CPUSync<float>*>;
+template class BlockingQueue<CPUSync<double>*>;
+template class BlockingQueue<std::pair<uint_tp, uint_tp> >;
 
 }  // namespace caffe
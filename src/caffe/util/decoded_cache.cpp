@@ -0,0 +1,272 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "caffe/util/decoded_cache.hpp"
+
+namespace caffe {
+
+// The mapping holds the header, the entry table and the image data. Memory
+// shared between processes is only updated through the __sync builtins, as
+// std::atomic objects cannot be placed in it portably.
+struct DecodedCache::Header {
+  uint64_t magic;
+  uint64_t key_hash;
+  uint64_t num_entries;
+  uint64_t bytes;
+  volatile uint64_t used;
+  volatile uint64_t entries;
+};
+
+// An entry is owned by the first inserter to swap its key from 0 to
+// index + 1, which has already reserved its bytes. It then goes from
+// kWriting to kReady. Entries are never removed, so probes stop at the
+// first empty slot.
+struct DecodedCache::Entry {
+  volatile uint64_t key;
+  volatile uint64_t state;
+  uint64_t offset;
+  int32_t height;
+  int32_t width;
+  int32_t channels;
+  int32_t padding;
+};
+
+namespace {
+
+const uint64_t kMagic = 0x45484341434544ULL;  // "DECACHE"
+const uint64_t kWriting = 0;
+const uint64_t kReady = 1;
+// Images are stored at this alignment for the vectorized transform loops.
+const uint64_t kAlignment = 64;
+
+uint64_t HashKey(const string& key) {
+  // FNV-1a, which unlike std::hash is the same in every process.
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); ++i) {
+    hash = (hash ^ static_cast<uint8_t>(key[i])) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t HashIndex(uint64_t index) {
+  index ^= index >> 33;
+  index *= 0xff51afd7ed558ccdULL;
+  index ^= index >> 33;
+  return index;
+}
+
+// Adds amount to counter unless that takes it above limit. Returns whether
+// it did, and the value the counter had before in before.
+bool Reserve(volatile uint64_t* counter, uint64_t amount, uint64_t limit,
+             uint64_t* before) {
+  uint64_t value = *counter;
+  while (value + amount <= limit) {
+    const uint64_t seen = __sync_val_compare_and_swap(counter, value,
+                                                      value + amount);
+    if (seen == value) {
+      *before = value;
+      return true;
+    }
+    value = seen;
+  }
+  return false;
+}
+
+}  // namespace
+
+DecodedCache::DecodedCache(const string& key, int_tp num_entries,
+                           uint_tp bytes, const string& file)
+    : num_entries_(num_entries), bytes_(bytes), fd_(-1), hits_(0),
+      misses_(0) {
+  CHECK_GT(num_entries, 0) << "The decoded cache needs entries";
+  const uint_tp table_size = ((sizeof(Header) + num_entries * sizeof(Entry)
+                               + kAlignment - 1) / kAlignment) * kAlignment;
+  mapped_size_ = table_size + bytes;
+  void* memory;
+  if (file.empty()) {
+    memory = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANON, -1, 0);
+  } else {
+    fd_ = open(file.c_str(), O_RDWR | O_CREAT, 0644);
+    CHECK_GE(fd_, 0) << "Could not open decoded cache " << file;
+    struct stat st;
+    CHECK_EQ(fstat(fd_, &st), 0) << "Could not stat " << file;
+    // The first process sizes the file, which zeroes it; the processes that
+    // race it all write the same header below.
+    if (st.st_size == 0) {
+      CHECK_EQ(ftruncate(fd_, mapped_size_), 0)
+          << "Could not size decoded cache " << file;
+    } else {
+      CHECK_EQ(static_cast<uint_tp>(st.st_size), mapped_size_)
+          << "Decoded cache " << file << " was created with other sizes";
+    }
+    memory = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+                  0);
+  }
+  CHECK(memory != MAP_FAILED) << "Could not map the decoded cache";
+  memory_ = static_cast<char*>(memory);
+  header_ = reinterpret_cast<Header*>(memory_);
+  entries_ = reinterpret_cast<Entry*>(memory_ + sizeof(Header));
+  data_ = reinterpret_cast<uint8_t*>(memory_ + table_size);
+
+  const uint64_t key_hash = HashKey(key);
+  if (header_->magic == kMagic) {
+    CHECK_EQ(header_->key_hash, key_hash) << "Decoded cache " << file
+        << " was created for other images than " << key;
+  } else {
+    header_->key_hash = key_hash;
+    header_->num_entries = num_entries;
+    header_->bytes = bytes;
+    __sync_synchronize();
+    header_->magic = kMagic;
+  }
+  CHECK_EQ(header_->num_entries, num_entries);
+  CHECK_EQ(header_->bytes, bytes);
+}
+
+DecodedCache::~DecodedCache() {
+  munmap(memory_, mapped_size_);
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+const uint8_t* DecodedCache::Find(int_tp index, int_tp* height, int_tp* width,
+                                  int_tp* channels) {
+  const uint64_t key = index + 1;
+  uint64_t slot = HashIndex(key) % num_entries_;
+  for (int_tp probe = 0; probe < num_entries_; ++probe) {
+    Entry& entry = entries_[slot];
+    const uint64_t entry_key = entry.key;
+    if (entry_key == 0) {
+      break;
+    }
+    if (entry_key == key) {
+      if (entry.state == kReady) {
+        // Order the reads of the image after the state.
+        __sync_synchronize();
+        *height = entry.height;
+        *width = entry.width;
+        *channels = entry.channels;
+        __sync_fetch_and_add(&hits_, 1);
+        return data_ + entry.offset;
+      }
+      break;
+    }
+    slot = (slot + 1) % num_entries_;
+  }
+  __sync_fetch_and_add(&misses_, 1);
+  return NULL;
+}
+
+bool DecodedCache::Insert(int_tp index, const uint8_t* data, int_tp height,
+                          int_tp width, int_tp channels) {
+  const uint64_t key = index + 1;
+  const uint64_t size = height * width * channels;
+  const uint64_t aligned_size = (size + kAlignment - 1) / kAlignment
+      * kAlignment;
+  // Once the budget is used up, which is the steady state for data sets
+  // larger than it, inserts fail here without touching the table.
+  if (header_->used + aligned_size > bytes_
+      || header_->entries >= static_cast<uint64_t>(max_entries())) {
+    return false;
+  }
+  const uint64_t first_slot = HashIndex(key) % num_entries_;
+  uint64_t slot = first_slot;
+  for (int_tp probe = 0; probe < num_entries_; ++probe) {
+    const uint64_t entry_key = entries_[slot].key;
+    if (entry_key == key) {
+      return false;
+    }
+    if (entry_key == 0) {
+      break;
+    }
+    slot = (slot + 1) % num_entries_;
+  }
+  // Reserve a table entry, then the bytes. The table is kept below
+  // max_entries, so the slot claimed below always exists and probes stay
+  // short.
+  uint64_t unused;
+  if (!Reserve(&header_->entries, 1, max_entries(), &unused)) {
+    return false;
+  }
+  uint64_t offset;
+  if (!Reserve(&header_->used, aligned_size, bytes_, &offset)) {
+    __sync_fetch_and_sub(&header_->entries, 1);
+    return false;
+  }
+  Entry* entry = NULL;
+  slot = first_slot;
+  for (int_tp probe = 0; probe < num_entries_; ++probe) {
+    const uint64_t entry_key =
+        __sync_val_compare_and_swap(&entries_[slot].key, 0, key);
+    if (entry_key == 0) {
+      entry = &entries_[slot];
+      break;
+    }
+    if (entry_key == key) {
+      break;
+    }
+    slot = (slot + 1) % num_entries_;
+  }
+  if (entry == NULL) {
+    // Another thread or process inserted the index since the probe above.
+    // Its bytes stay reserved; this only happens on a race.
+    __sync_fetch_and_sub(&header_->entries, 1);
+    return false;
+  }
+  memcpy(data_ + offset, data, size);
+  entry->offset = offset;
+  entry->height = height;
+  entry->width = width;
+  entry->channels = channels;
+  // Publish the image before marking it ready.
+  __sync_synchronize();
+  entry->state = kReady;
+  return true;
+}
+
+#ifdef USE_OPENCV
+cv::Mat DecodedCache::FindMat(int_tp index) {
+  int_tp height, width, channels;
+  const uint8_t* data = Find(index, &height, &width, &channels);
+  if (data == NULL) {
+    return cv::Mat();
+  }
+  return cv::Mat(height, width, CV_8UC(channels), const_cast<uint8_t*>(data));
+}
+
+bool DecodedCache::InsertMat(int_tp index, const cv::Mat& cv_img) {
+  CHECK_EQ(cv_img.depth(), CV_8U) << "Only uint8 images can be cached";
+  cv::Mat continuous_img = cv_img.isContinuous() ? cv_img : cv_img.clone();
+  return Insert(index, continuous_img.data, continuous_img.rows,
+                continuous_img.cols, continuous_img.channels());
+}
+#endif  // USE_OPENCV
+
+uint_tp DecodedCache::bytes_used() const {
+  return header_->used;
+}
+
+int_tp DecodedCache::entries_used() const {
+  return header_->entries;
+}
+
+int_tp DecodedCache::max_entries() const {
+  return num_entries_ - num_entries_ / 4;
+}
+
+void DecodedCache::ResetCounters() {
+  hits_ = 0;
+  misses_ = 0;
+}
+
+}  // namespace caffe
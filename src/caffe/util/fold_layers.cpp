@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/fold_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Reads the values of a BlobProto in double precision.
+static void fold_read_blob(const BlobProto& proto, vector<double>* values) {
+  values->clear();
+  if (proto.double_data_size() > 0) {
+    values->assign(proto.double_data().begin(), proto.double_data().end());
+  } else {
+    values->assign(proto.data().begin(), proto.data().end());
+  }
+}
+
+// Writes values back to a BlobProto, in double precision if like was.
+static void fold_write_blob(const vector<double>& values,
+                            const BlobProto& like, BlobProto* proto) {
+  const bool use_double = like.double_data_size() > 0;
+  proto->clear_data();
+  proto->clear_double_data();
+  for (int_tp i = 0; i < values.size(); ++i) {
+    if (use_double) {
+      proto->add_double_data(values[i]);
+    } else {
+      proto->add_data(values[i]);
+    }
+  }
+}
+
+// Folds the stored statistics of a BatchNorm layer into the weights and bias
+// of the Convolution or InnerProduct layer computing its input.
+static bool fold_batch_norm(const LayerParameter& bn, LayerParameter* source) {
+  int_tp num_output;
+  bool bias_term;
+  if (source->type() == "Convolution") {
+    const ConvolutionParameter& conv_param = source->convolution_param();
+    if (conv_param.axis() != 1 || conv_param.fused_relu()) {
+      return false;
+    }
+    num_output = conv_param.num_output();
+    bias_term = conv_param.bias_term();
+  } else if (source->type() == "InnerProduct") {
+    const InnerProductParameter& ip_param = source->inner_product_param();
+    if (ip_param.axis() != 1) {
+      return false;
+    }
+    num_output = ip_param.num_output();
+    bias_term = ip_param.bias_term();
+  } else {
+    return false;
+  }
+  const BatchNormParameter& bn_param = bn.batch_norm_param();
+  const bool use_global_stats = bn_param.has_use_global_stats() ?
+      bn_param.use_global_stats() : bn.phase() == TEST;
+  if (!use_global_stats || bn.blobs_size() != 3
+      || source->blobs_size() != 1 + bias_term) {
+    return false;
+  }
+  vector<double> mean, variance, scale, weights, bias;
+  fold_read_blob(bn.blobs(0), &mean);
+  fold_read_blob(bn.blobs(1), &variance);
+  fold_read_blob(bn.blobs(2), &scale);
+  fold_read_blob(source->blobs(0), &weights);
+  if (mean.size() != num_output || variance.size() != num_output
+      || scale.size() != 1 || weights.size() % num_output != 0) {
+    return false;
+  }
+  if (bias_term) {
+    fold_read_blob(source->blobs(1), &bias);
+  } else {
+    bias.assign(num_output, 0);
+  }
+  // The same scaling of the moving averages as in BatchNormLayer.
+  const double scale_factor = scale[0] == 0 ? 0 : 1 / scale[0];
+  const int_tp weights_per_output = weights.size() / num_output;
+  for (int_tp c = 0; c < num_output; ++c) {
+    const double inv_std = 1 / std::sqrt(variance[c] * scale_factor
+                                         + bn_param.eps());
+    for (int_tp k = 0; k < weights_per_output; ++k) {
+      weights[c * weights_per_output + k] *= inv_std;
+    }
+    bias[c] = (bias[c] - mean[c] * scale_factor) * inv_std;
+  }
+  const BlobProto weights_proto = source->blobs(0);
+  fold_write_blob(weights, weights_proto, source->mutable_blobs(0));
+  if (!bias_term) {
+    BlobProto* bias_proto = source->add_blobs();
+    bias_proto->mutable_shape()->add_dim(num_output);
+    if (source->type() == "Convolution") {
+      source->mutable_convolution_param()->set_bias_term(true);
+    } else {
+      source->mutable_inner_product_param()->set_bias_term(true);
+    }
+  }
+  fold_write_blob(bias, weights_proto, source->mutable_blobs(1));
+  return true;
+}
+
+// Fuses a ReLU or PReLU layer into the output of a Convolution layer.
+static bool fold_relu(const LayerParameter& relu, LayerParameter* source) {
+  if (source->type() != "Convolution"
+      || source->convolution_param().axis() != 1
+      || source->convolution_param().fused_relu()) {
+    return false;
+  }
+  ConvolutionParameter* conv_param = source->mutable_convolution_param();
+  if (relu.type() == "ReLU") {
+    conv_param->set_fused_relu(true);
+    conv_param->clear_fused_relu_slope();
+    if (relu.relu_param().negative_slope() != 0) {
+      conv_param->add_fused_relu_slope(relu.relu_param().negative_slope());
+    }
+    return true;
+  }
+  if (relu.blobs_size() != 1) {
+    return false;
+  }
+  vector<double> slopes;
+  fold_read_blob(relu.blobs(0), &slopes);
+  if (slopes.size() != 1 && slopes.size() != conv_param->num_output()) {
+    return false;
+  }
+  conv_param->set_fused_relu(true);
+  conv_param->clear_fused_relu_slope();
+  for (int_tp c = 0; c < slopes.size(); ++c) {
+    conv_param->add_fused_relu_slope(slopes[c]);
+  }
+  return true;
+}
+
+template <typename Dtype>
+int_tp FoldInferenceLayers(const Net<Dtype>& net, NetParameter* folded) {
+  NetParameter param;
+  net.ToProto(&param);
+  param.mutable_state()->set_phase(net.phase());
+  for (int_tp i = 0; i < net.num_inputs(); ++i) {
+    BlobShape* shape = param.add_input_shape();
+    for (int_tp j = 0; j < net.input_blobs()[i]->num_axes(); ++j) {
+      shape->add_dim(net.input_blobs()[i]->shape(j));
+    }
+  }
+  // The layer producing each bottom (-1 for net inputs), and the number of
+  // consumers of each layer's first top.
+  const int_tp num_layers = param.layer_size();
+  vector<vector<int_tp> > producers(num_layers);
+  vector<int_tp> consumers(num_layers, 0);
+  std::map<string, int_tp> latest;
+  for (int_tp i = 0; i < num_layers; ++i) {
+    const LayerParameter& layer = param.layer(i);
+    for (int_tp j = 0; j < layer.bottom_size(); ++j) {
+      std::map<string, int_tp>::iterator it = latest.find(layer.bottom(j));
+      const int_tp producer = it == latest.end() ? -1 : it->second;
+      producers[i].push_back(producer);
+      if (producer >= 0 && param.layer(producer).top(0) == layer.bottom(j)) {
+        ++consumers[producer];
+      }
+    }
+    for (int_tp j = 0; j < layer.top_size(); ++j) {
+      latest[layer.top(j)] = i;
+    }
+  }
+
+  vector<bool> removed(num_layers, false);
+  int_tp num_removed = 0;
+  for (int_tp i = 0; i < num_layers; ++i) {
+    const LayerParameter& layer = param.layer(i);
+    const bool batch_norm = layer.type() == "BatchNorm";
+    const bool relu = layer.type() == "ReLU" || layer.type() == "PReLU";
+    if ((!batch_norm && !relu) || layer.bottom_size() != 1
+        || layer.top_size() != 1 || producers[i][0] < 0) {
+      continue;
+    }
+    const int_tp source_id = producers[i][0];
+    LayerParameter* source = param.mutable_layer(source_id);
+    if (source->top_size() != 1 || consumers[source_id] != 1) {
+      continue;
+    }
+    bool shared = false;
+    for (int_tp j = 0; j < source->param_size(); ++j) {
+      shared |= source->param(j).has_name();
+    }
+    if (shared || !(batch_norm ? fold_batch_norm(layer, source)
+                               : fold_relu(layer, source))) {
+      continue;
+    }
+    // The source now computes the top of the removed layer directly.
+    source->set_top(0, layer.top(0));
+    consumers[source_id] = consumers[i];
+    for (int_tp j = i + 1; j < num_layers; ++j) {
+      for (int_tp k = 0; k < producers[j].size(); ++k) {
+        if (producers[j][k] == i) {
+          producers[j][k] = source_id;
+        }
+      }
+    }
+    removed[i] = true;
+    ++num_removed;
+  }
+
+  folded->CopyFrom(param);
+  folded->clear_layer();
+  for (int_tp i = 0; i < num_layers; ++i) {
+    if (!removed[i]) {
+      folded->add_layer()->CopyFrom(param.layer(i));
+    }
+  }
+  return num_removed;
+}
+
+template <typename Dtype>
+Dtype VerifyFoldedNet(Net<Dtype>* net, Net<Dtype>* folded) {
+  CHECK_EQ(net->num_inputs(), folded->num_inputs())
+      << "The folded net has different inputs.";
+  for (int_tp i = 0; i < net->num_inputs(); ++i) {
+    Blob<Dtype>* input = net->input_blobs()[i];
+    caffe_rng_uniform<Dtype>(input->count(), Dtype(-1), Dtype(1),
+                             input->mutable_cpu_data());
+    folded->input_blobs()[i]->CopyFrom(*input, false, true);
+  }
+  net->ForwardPrefilled();
+  int_tp start = 0;
+  while (start < folded->layers().size()
+         && folded->bottom_vecs()[start].empty()) {
+    const LayerParameter& layer = folded->layers()[start]->layer_param();
+    for (int_tp j = 0; j < layer.top_size(); ++j) {
+      folded->blob_by_name(layer.top(j))->CopyFrom(
+          *net->blob_by_name(layer.top(j)), false, true);
+    }
+    ++start;
+  }
+  folded->ForwardFrom(start);
+  Dtype max_diff = 0;
+  for (int_tp i = 0; i < folded->num_outputs(); ++i) {
+    const string& name =
+        folded->blob_names()[folded->output_blob_indices()[i]];
+    CHECK(net->has_blob(name)) << "Output " << name << " of the folded net "
+                               << "is not in the original net.";
+    const Blob<Dtype>* expected = net->blob_by_name(name).get();
+    const Blob<Dtype>* actual = folded->output_blobs()[i];
+    CHECK_EQ(expected->count(), actual->count())
+        << "Output " << name << " changed its shape.";
+    for (int_tp j = 0; j < actual->count(); ++j) {
+      max_diff = std::max(max_diff, static_cast<Dtype>(std::fabs(
+          expected->cpu_data()[j] - actual->cpu_data()[j])));
+    }
+  }
+  return max_diff;
+}
+
+template int_tp FoldInferenceLayers<float>(const Net<float>& net,
+                                           NetParameter* folded);
+template int_tp FoldInferenceLayers<double>(const Net<double>& net,
+                                            NetParameter* folded);
+template float VerifyFoldedNet<float>(Net<float>* net, Net<float>* folded);
+template double VerifyFoldedNet<double>(Net<double>* net,
+                                        Net<double>* folded);
+
+}  // namespace caffe
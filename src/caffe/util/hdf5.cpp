@@ -1,15 +1,31 @@
 #include "caffe/util/hdf5.hpp"
 
+#include <boost/thread/recursive_mutex.hpp>
+
 #include <string>
 #include <vector>
 
 namespace caffe {
 
+static boost::recursive_mutex& hdf5_mutex() {
+  static boost::recursive_mutex mutex;
+  return mutex;
+}
+
+HDF5Lock::HDF5Lock() {
+  hdf5_mutex().lock();
+}
+
+HDF5Lock::~HDF5Lock() {
+  hdf5_mutex().unlock();
+}
+
 // Verifies format of data stored in HDF5 file and reshapes blob accordingly.
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob<Dtype>* blob) {
+  HDF5Lock lock;
   // Verify that the dataset exists.
   CHECK(H5LTfind_dataset(file_id, dataset_name_))
       << "Failed to find HDF5 dataset " << dataset_name_;
@@ -66,6 +82,7 @@ void hdf5_load_nd_dataset_helper(
 template <>
 void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<float>* blob) {
+  HDF5Lock lock;
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
   herr_t status = H5LTread_dataset_float(
     file_id, dataset_name_, blob->mutable_cpu_data());
@@ -75,6 +92,7 @@ void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
 template <>
 void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<double>* blob) {
+  HDF5Lock lock;
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
   herr_t status = H5LTread_dataset_double(
     file_id, dataset_name_, blob->mutable_cpu_data());
@@ -85,6 +103,7 @@ template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string& dataset_name, const Blob<float>& blob,
     bool write_diff) {
+  HDF5Lock lock;
   int num_axes = blob.num_axes();
   hsize_t *dims = new hsize_t[num_axes];
   for (int_tp i = 0; i < num_axes; ++i) {
@@ -106,6 +125,7 @@ template <>
 void hdf5_save_nd_dataset<double>(
     hid_t file_id, const string& dataset_name, const Blob<double>& blob,
     bool write_diff) {
+  HDF5Lock lock;
   int_tp num_axes = blob.num_axes();
   hsize_t *dims = new hsize_t[num_axes];
   for (int_tp i = 0; i < num_axes; ++i) {
@@ -123,7 +143,55 @@ void hdf5_save_nd_dataset<double>(
   delete[] dims;
 }
 
+static void hdf5_read_hyperslab_helper(
+    hid_t dataset_id, const vector<hsize_t>& offset,
+    const vector<hsize_t>& count, hid_t mem_type_id, void* data) {
+  HDF5Lock lock;
+  hid_t file_space_id = H5Dget_space(dataset_id);
+  CHECK_GE(file_space_id, 0) << "Failed to get HDF5 dataset space";
+  CHECK_EQ(H5Sget_simple_extent_ndims(file_space_id), offset.size());
+  herr_t status = H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET,
+      offset.data(), NULL, count.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select HDF5 hyperslab";
+  hid_t mem_space_id = H5Screate_simple(count.size(), count.data(), NULL);
+  CHECK_GE(mem_space_id, 0) << "Failed to create HDF5 memory space";
+  status = H5Dread(dataset_id, mem_type_id, mem_space_id, file_space_id,
+      H5P_DEFAULT, data);
+  CHECK_GE(status, 0) << "Failed to read HDF5 hyperslab";
+  H5Sclose(mem_space_id);
+  H5Sclose(file_space_id);
+}
+
+template <>
+void hdf5_read_hyperslab<float>(
+    hid_t dataset_id, const vector<hsize_t>& offset,
+    const vector<hsize_t>& count, float* data) {
+  hdf5_read_hyperslab_helper(dataset_id, offset, count, H5T_NATIVE_FLOAT,
+                             data);
+}
+
+template <>
+void hdf5_read_hyperslab<double>(
+    hid_t dataset_id, const vector<hsize_t>& offset,
+    const vector<hsize_t>& count, double* data) {
+  hdf5_read_hyperslab_helper(dataset_id, offset, count, H5T_NATIVE_DOUBLE,
+                             data);
+}
+
+vector<hsize_t> hdf5_get_dataset_shape(hid_t dataset_id) {
+  HDF5Lock lock;
+  hid_t space_id = H5Dget_space(dataset_id);
+  CHECK_GE(space_id, 0) << "Failed to get HDF5 dataset space";
+  const int ndims = H5Sget_simple_extent_ndims(space_id);
+  CHECK_GE(ndims, 0) << "Failed to get HDF5 dataset ndims";
+  vector<hsize_t> shape(ndims);
+  H5Sget_simple_extent_dims(space_id, shape.data(), NULL);
+  H5Sclose(space_id);
+  return shape;
+}
+
 string hdf5_load_string(hid_t loc_id, const string& dataset_name) {
+  HDF5Lock lock;
   // Get size of dataset
   uint_tp size;
   H5T_class_t class_;
@@ -141,6 +209,7 @@ string hdf5_load_string(hid_t loc_id, const string& dataset_name) {
 
 void hdf5_save_string(hid_t loc_id, const string& dataset_name,
                       const string& s) {
+  HDF5Lock lock;
   herr_t status = \
     H5LTmake_dataset_string(loc_id, dataset_name.c_str(), s.c_str());
   CHECK_GE(status, 0)
@@ -148,6 +217,7 @@ void hdf5_save_string(hid_t loc_id, const string& dataset_name,
 }
 
 int hdf5_load_int(hid_t loc_id, const string& dataset_name) {
+  HDF5Lock lock;
   int val;
   herr_t status = H5LTread_dataset_int(loc_id, dataset_name.c_str(), &val);
   CHECK_GE(status, 0)
@@ -156,6 +226,7 @@ int hdf5_load_int(hid_t loc_id, const string& dataset_name) {
 }
 
 void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i) {
+  HDF5Lock lock;
   hsize_t one = 1;
   herr_t status = \
     H5LTmake_dataset_int(loc_id, dataset_name.c_str(), 1, &one, &i);
@@ -164,6 +235,7 @@ void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i) {
 }
 
 int hdf5_get_num_links(hid_t loc_id) {
+  HDF5Lock lock;
   H5G_info_t info;
   herr_t status = H5Gget_info(loc_id, &info);
   CHECK_GE(status, 0) << "Error while counting HDF5 links.";
@@ -171,6 +243,7 @@ int hdf5_get_num_links(hid_t loc_id) {
 }
 
 string hdf5_get_name_by_idx(hid_t loc_id, int idx) {
+  HDF5Lock lock;
   int str_size = H5Lget_name_by_idx(
       loc_id, ".", H5_INDEX_NAME, H5_ITER_NATIVE, idx, NULL, 0, H5P_DEFAULT);
   CHECK_GE(str_size, 0) << "Error retrieving HDF5 dataset at index " << idx;
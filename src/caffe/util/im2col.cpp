@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/util/im2col.hpp"
@@ -200,4 +201,295 @@ template void col2im_nd_cpu<double>(const double* data_col,
     double* data_im);
 
 
+// Computes the range [start, end) of column indices col for which the image
+// index col * stride + offset lies inside [0, size). Hoisting this out of the
+// inner loops lets the strided-kernel (kstride) im2col/col2im below copy whole
+// rows without a bounds check per element.
+inline void im2col_valid_range(const int_tp offset, const int_tp stride,
+                               const int_tp size, const int_tp size_col,
+                               int_tp* start, int_tp* end) {
+  *start = offset < 0 ? (-offset + stride - 1) / stride : 0;
+  *end = offset < size ? std::min((size - 1 - offset) / stride + 1, size_col)
+                       : 0;
+  *start = std::min(*start, *end);
+}
+
+template<typename Dtype>
+void im2col_sk_cpu(const Dtype* data_im, const int_tp channels,
+                   const int_tp height, const int_tp width,
+                   const int_tp kernel_h, const int_tp kernel_w,
+                   const int_tp pad_h, const int_tp pad_w,
+                   const int_tp stride_h, const int_tp stride_w,
+                   const int_tp kstride_h, const int_tp kstride_w,
+                   Dtype* data_col) {
+  const int_tp ext_kernel_h = (kernel_h - 1) * kstride_h + 1;
+  const int_tp ext_kernel_w = (kernel_w - 1) * kstride_w + 1;
+  const int_tp height_col = (height + 2 * pad_h - ext_kernel_h) / stride_h + 1;
+  const int_tp width_col = (width + 2 * pad_w - ext_kernel_w) / stride_w + 1;
+  const int_tp channels_col = channels * kernel_h * kernel_w;
+#pragma omp parallel for
+  for (int_tp c = 0; c < channels_col; ++c) {
+    const int_tp w_offset = (c % kernel_w) * kstride_w - pad_w;
+    const int_tp h_offset = ((c / kernel_w) % kernel_h) * kstride_h - pad_h;
+    const int_tp c_im = c / kernel_h / kernel_w;
+    int_tp w_start, w_end;
+    im2col_valid_range(w_offset, stride_w, width, width_col, &w_start, &w_end);
+    const Dtype* im_ptr = data_im + c_im * height * width;
+    Dtype* col_ptr = data_col + c * height_col * width_col;
+    for (int_tp h = 0; h < height_col; ++h, col_ptr += width_col) {
+      const int_tp h_im = h * stride_h + h_offset;
+      if (h_im < 0 || h_im >= height) {
+        caffe_set(width_col, Dtype(0), col_ptr);
+        continue;
+      }
+      const Dtype* im_row = im_ptr + h_im * width + w_offset;
+      for (int_tp w = 0; w < w_start; ++w) {
+        col_ptr[w] = 0;
+      }
+      if (stride_w == 1) {
+        for (int_tp w = w_start; w < w_end; ++w) {
+          col_ptr[w] = im_row[w];
+        }
+      } else {
+        for (int_tp w = w_start; w < w_end; ++w) {
+          col_ptr[w] = im_row[w * stride_w];
+        }
+      }
+      for (int_tp w = w_end; w < width_col; ++w) {
+        col_ptr[w] = 0;
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void im2col_sk_cpu<float>(const float* data_im, const int_tp channels,
+                                   const int_tp height, const int_tp width,
+                                   const int_tp kernel_h, const int_tp kernel_w,
+                                   const int_tp pad_h, const int_tp pad_w,
+                                   const int_tp stride_h, const int_tp stride_w,
+                                   const int_tp kstride_h,
+                                   const int_tp kstride_w, float* data_col);
+template void im2col_sk_cpu<double>(const double* data_im,
+                                    const int_tp channels, const int_tp height,
+                                    const int_tp width, const int_tp kernel_h,
+                                    const int_tp kernel_w, const int_tp pad_h,
+                                    const int_tp pad_w, const int_tp stride_h,
+                                    const int_tp stride_w,
+                                    const int_tp kstride_h,
+                                    const int_tp kstride_w, double* data_col);
+
+template<typename Dtype>
+void col2im_sk_cpu(const Dtype* data_col, const int_tp channels,
+                   const int_tp height, const int_tp width,
+                   const int_tp patch_h, const int_tp patch_w,
+                   const int_tp pad_h, const int_tp pad_w,
+                   const int_tp stride_h, const int_tp stride_w,
+                   const int_tp kstride_h, const int_tp kstride_w,
+                   Dtype* data_im) {
+  const int_tp ext_patch_h = (patch_h - 1) * kstride_h + 1;
+  const int_tp ext_patch_w = (patch_w - 1) * kstride_w + 1;
+  const int_tp height_col = (height + 2 * pad_h - ext_patch_h) / stride_h + 1;
+  const int_tp width_col = (width + 2 * pad_w - ext_patch_w) / stride_w + 1;
+  const int_tp patch_size = patch_h * patch_w;
+  // Column channels of one image channel accumulate into the same image plane,
+  // so parallelize over image channels only.
+#pragma omp parallel for
+  for (int_tp c_im = 0; c_im < channels; ++c_im) {
+    Dtype* im_ptr = data_im + c_im * height * width;
+    caffe_set(height * width, Dtype(0), im_ptr);
+    for (int_tp k = 0; k < patch_size; ++k) {
+      const int_tp w_offset = (k % patch_w) * kstride_w - pad_w;
+      const int_tp h_offset = (k / patch_w) * kstride_h - pad_h;
+      int_tp w_start, w_end;
+      im2col_valid_range(w_offset, stride_w, width, width_col,
+                         &w_start, &w_end);
+      const Dtype* col_ptr = data_col
+          + (c_im * patch_size + k) * height_col * width_col;
+      for (int_tp h = 0; h < height_col; ++h, col_ptr += width_col) {
+        const int_tp h_im = h * stride_h + h_offset;
+        if (h_im < 0 || h_im >= height) {
+          continue;
+        }
+        Dtype* im_row = im_ptr + h_im * width + w_offset;
+        if (stride_w == 1) {
+          for (int_tp w = w_start; w < w_end; ++w) {
+            im_row[w] += col_ptr[w];
+          }
+        } else {
+          for (int_tp w = w_start; w < w_end; ++w) {
+            im_row[w * stride_w] += col_ptr[w];
+          }
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void col2im_sk_cpu<float>(const float* data_col, const int_tp channels,
+                                   const int_tp height, const int_tp width,
+                                   const int_tp patch_h, const int_tp patch_w,
+                                   const int_tp pad_h, const int_tp pad_w,
+                                   const int_tp stride_h, const int_tp stride_w,
+                                   const int_tp kstride_h,
+                                   const int_tp kstride_w, float* data_im);
+template void col2im_sk_cpu<double>(const double* data_col,
+                                    const int_tp channels, const int_tp height,
+                                    const int_tp width, const int_tp patch_h,
+                                    const int_tp patch_w, const int_tp pad_h,
+                                    const int_tp pad_w, const int_tp stride_h,
+                                    const int_tp stride_w,
+                                    const int_tp kstride_h,
+                                    const int_tp kstride_w, double* data_im);
+
+// Handles one column channel c of an N-D strided-kernel im2col (im2col = true)
+// or col2im (im2col = false). The innermost spatial axis is processed as a
+// contiguous row with precomputed valid bounds; the outer axes are counted
+// like the dense im2col_nd_core_cpu above.
+template <typename Dtype>
+inline void im2col_ndsk_channel_cpu(const Dtype* data_input, const bool im2col,
+                                    const int_tp c,
+                                    const int_tp num_spatial_axes,
+                                    const int_tp* im_shape,
+                                    const int_tp* col_shape,
+                                    const int_tp* kernel_shape,
+                                    const int_tp* pad, const int_tp* stride,
+                                    const int_tp* kstride,
+                                    Dtype* data_output) {
+  const int_tp last_axis = num_spatial_axes - 1;
+  const int_tp width = im_shape[num_spatial_axes];
+  const int_tp width_col = col_shape[num_spatial_axes];
+  const int_tp stride_w = stride[last_axis];
+  vector<int_tp> d_offset(num_spatial_axes, 0);
+  vector<int_tp> d_iter(num_spatial_axes, 0);
+  // Image offset of the kernel element handled by this column channel.
+  int_tp offset = c;
+  for (int_tp d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
+    d_offset[d_i] = (offset % kernel_shape[d_i]) * kstride[d_i] - pad[d_i];
+    offset /= kernel_shape[d_i];
+  }
+  const int_tp c_im = offset;
+  int_tp w_start, w_end;
+  im2col_valid_range(d_offset[last_axis], stride_w, width, width_col,
+                     &w_start, &w_end);
+  int_tp index_row = c;
+  for (int_tp d_i = 0; d_i < last_axis; ++d_i) {
+    index_row *= col_shape[d_i + 1];
+  }
+  for (bool incremented = true; incremented; ++index_row) {
+    int_tp index_im = c_im;
+    bool is_padding = false;
+    for (int_tp d_i = 0; d_i < last_axis; ++d_i) {
+      const int_tp d_im = d_iter[d_i] * stride[d_i] + d_offset[d_i];
+      is_padding |= d_im < 0 || d_im >= im_shape[d_i + 1];
+      index_im *= im_shape[d_i + 1];
+      index_im += d_im;
+    }
+    index_im = index_im * width + d_offset[last_axis];
+    const int_tp index_col = index_row * width_col;
+    if (im2col) {
+      Dtype* col_row = data_output + index_col;
+      if (is_padding) {
+        caffe_set(width_col, Dtype(0), col_row);
+      } else {
+        const Dtype* im_row = data_input + index_im;
+        for (int_tp w = 0; w < w_start; ++w) {
+          col_row[w] = 0;
+        }
+        for (int_tp w = w_start; w < w_end; ++w) {
+          col_row[w] = im_row[w * stride_w];
+        }
+        for (int_tp w = w_end; w < width_col; ++w) {
+          col_row[w] = 0;
+        }
+      }
+    } else if (!is_padding) {  // col2im
+      const Dtype* col_row = data_input + index_col;
+      Dtype* im_row = data_output + index_im;
+      for (int_tp w = w_start; w < w_end; ++w) {
+        im_row[w * stride_w] += col_row[w];
+      }
+    }
+    // Count through the outer spatial axes of the column.
+    incremented = false;
+    for (int_tp d_i = last_axis - 1; d_i >= 0; --d_i) {
+      if (d_iter[d_i] == col_shape[d_i + 1] - 1) {
+        d_iter[d_i] = 0;
+      } else {
+        ++d_iter[d_i];
+        incremented = true;
+        break;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void im2col_ndsk_cpu(const Dtype* data_im, const int_tp num_spatial_axes,
+                     const int_tp* im_shape, const int_tp* col_shape,
+                     const int_tp* kernel_shape, const int_tp* pad,
+                     const int_tp* stride, const int_tp* kstride,
+                     Dtype* data_col) {
+  const bool kIm2Col = true;
+  const int_tp channels_col = col_shape[0];
+#pragma omp parallel for
+  for (int_tp c = 0; c < channels_col; ++c) {
+    im2col_ndsk_channel_cpu(data_im, kIm2Col, c, num_spatial_axes, im_shape,
+                            col_shape, kernel_shape, pad, stride, kstride,
+                            data_col);
+  }
+}
+
+// Explicit instantiation
+template void im2col_ndsk_cpu<float>(const float* data_im,
+    const int_tp num_spatial_axes,
+    const int_tp* im_shape, const int_tp* col_shape,
+    const int_tp* kernel_shape, const int_tp* pad, const int_tp* stride,
+    const int_tp* kstride, float* data_col);
+template void im2col_ndsk_cpu<double>(const double* data_im,
+    const int_tp num_spatial_axes,
+    const int_tp* im_shape, const int_tp* col_shape,
+    const int_tp* kernel_shape, const int_tp* pad, const int_tp* stride,
+    const int_tp* kstride, double* data_col);
+
+template <typename Dtype>
+void col2im_ndsk_cpu(const Dtype* data_col, const int_tp num_spatial_axes,
+                     const int_tp* im_shape, const int_tp* col_shape,
+                     const int_tp* kernel_shape, const int_tp* pad,
+                     const int_tp* stride, const int_tp* kstride,
+                     Dtype* data_im) {
+  const bool kIm2Col = false;
+  int_tp kernel_size = 1;
+  int_tp im_spatial_dim = 1;
+  for (int_tp i = 0; i < num_spatial_axes; ++i) {
+    kernel_size *= kernel_shape[i];
+    im_spatial_dim *= im_shape[i + 1];
+  }
+  // All column channels of one image channel accumulate into the same image
+  // volume, so parallelize over image channels only.
+#pragma omp parallel for
+  for (int_tp c_im = 0; c_im < im_shape[0]; ++c_im) {
+    caffe_set(im_spatial_dim, Dtype(0), data_im + c_im * im_spatial_dim);
+    for (int_tp k = 0; k < kernel_size; ++k) {
+      im2col_ndsk_channel_cpu(data_col, kIm2Col, c_im * kernel_size + k,
+                              num_spatial_axes, im_shape, col_shape,
+                              kernel_shape, pad, stride, kstride, data_im);
+    }
+  }
+}
+
+// Explicit instantiation
+template void col2im_ndsk_cpu<float>(const float* data_col,
+    const int_tp num_spatial_axes,
+    const int_tp* im_shape, const int_tp* col_shape,
+    const int_tp* kernel_shape, const int_tp* pad, const int_tp* stride,
+    const int_tp* kstride, float* data_im);
+template void col2im_ndsk_cpu<double>(const double* data_col,
+    const int_tp num_spatial_axes,
+    const int_tp* im_shape, const int_tp* col_shape,
+    const int_tp* kernel_shape, const int_tp* pad, const int_tp* stride,
+    const int_tp* kstride, double* data_im);
+
+
 }  // namespace caffe
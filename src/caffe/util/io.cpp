@@ -2,6 +2,7 @@
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/wire_format_lite.h>
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -30,6 +31,7 @@ using google::protobuf::io::CodedInputStream;
 using google::protobuf::io::ZeroCopyOutputStream;
 using google::protobuf::io::CodedOutputStream;
 using google::protobuf::Message;
+using google::protobuf::internal::WireFormatLite;
 
 bool ReadProtoFromTextFile(const char* filename, Message* proto) {
   int_tp fd = open(filename, O_RDONLY);
@@ -162,6 +164,57 @@ bool ReadFileToDatum(const string& filename, const int_tp label,
   }
 }
 
+bool ParseDatumView(const char* serialized, int_tp size, Datum* datum,
+                    const char** data, int_tp* data_size) {
+  const uint8_t* buffer = reinterpret_cast<const uint8_t*>(serialized);
+  // Find the data field, then parse the fields before and after it.
+  CodedInputStream input(buffer, size);
+  int_tp field_begin = -1;
+  int_tp field_end = -1;
+  *data = NULL;
+  *data_size = 0;
+  while (true) {
+    const int_tp position = input.CurrentPosition();
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0) {
+      break;
+    }
+    if (WireFormatLite::GetTagFieldNumber(tag) == Datum::kDataFieldNumber
+        && WireFormatLite::GetTagWireType(tag)
+           == WireFormatLite::WIRETYPE_LENGTH_DELIMITED
+        && field_begin < 0) {
+      uint32_t length;
+      if (!input.ReadVarint32(&length)) {
+        return false;
+      }
+      *data = serialized + input.CurrentPosition();
+      *data_size = length;
+      if (!input.Skip(length)) {
+        return false;
+      }
+      field_begin = position;
+      field_end = input.CurrentPosition();
+    } else if (!WireFormatLite::SkipField(&input, tag)) {
+      return false;
+    }
+  }
+  if (field_begin < 0) {
+    return datum->ParseFromArray(serialized, size);
+  }
+  CodedInputStream before(buffer, field_begin);
+  CodedInputStream after(buffer + field_end, size - field_end);
+  if (!datum->ParseFromCodedStream(&before)
+      || !datum->MergeFromCodedStream(&after)) {
+    return false;
+  }
+  // A repeated data field overrides the first one.
+  if (datum->has_data()) {
+    *data = NULL;
+    *data_size = 0;
+  }
+  return true;
+}
+
 #ifdef USE_OPENCV
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum) {
   cv::Mat cv_img;
@@ -0,0 +1,344 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/malis.hpp"
+
+namespace caffe {
+
+// Number of chunks the radix sort splits the keys into. Every chunk counts
+// and scatters its own keys in order, so the result is stable and does not
+// depend on the number of threads.
+#define MALIS_SORT_CHUNKS 64
+
+template <typename Dtype> struct MalisSortKey;
+template <> struct MalisSortKey<float> { typedef uint32_t type; };
+template <> struct MalisSortKey<double> { typedef uint64_t type; };
+
+// Unsigned keys whose ascending order is the descending order of weights.
+inline uint32_t malis_descending_key(const float weight) {
+  uint32_t bits;
+  memcpy(&bits, &weight, sizeof(bits));
+  return (bits & 0x80000000u) ? bits : ~(bits | 0x80000000u);
+}
+
+inline uint64_t malis_descending_key(const double weight) {
+  uint64_t bits;
+  memcpy(&bits, &weight, sizeof(bits));
+  return (bits & 0x8000000000000000ull) ? bits
+                                         : ~(bits | 0x8000000000000000ull);
+}
+
+// Stable LSD radix sort of values by keys, one byte per pass.
+template <typename Key>
+void malis_radix_sort(std::vector<Key>* keys, std::vector<int64_t>* values) {
+  const int64_t n = keys->size();
+  if (n == 0) {
+    return;
+  }
+  const int64_t chunk = (n + MALIS_SORT_CHUNKS - 1) / MALIS_SORT_CHUNKS;
+  std::vector<Key> keys_tmp(n);
+  std::vector<int64_t> values_tmp(n);
+  std::vector<int64_t> hist(MALIS_SORT_CHUNKS * 256);
+  for (int_tp shift = 0; shift < static_cast<int_tp>(sizeof(Key)) * 8;
+       shift += 8) {
+    const Key* src_keys = &(*keys)[0];
+    const int64_t* src_values = &(*values)[0];
+    std::fill(hist.begin(), hist.end(), 0);
+#pragma omp parallel for
+    for (int_tp c = 0; c < MALIS_SORT_CHUNKS; ++c) {
+      int64_t* chunk_hist = &hist[c * 256];
+      const int64_t end = std::min(n, (c + 1) * chunk);
+      for (int64_t i = c * chunk; i < end; ++i) {
+        ++chunk_hist[(src_keys[i] >> shift) & 0xFF];
+      }
+    }
+    // Turn the counts into scatter offsets in (digit, chunk) order. A pass
+    // in which every key has the same digit would not move anything.
+    bool trivial = false;
+    int64_t offset = 0;
+    for (int_tp digit = 0; digit < 256; ++digit) {
+      const int64_t digit_begin = offset;
+      for (int_tp c = 0; c < MALIS_SORT_CHUNKS; ++c) {
+        const int64_t count = hist[c * 256 + digit];
+        hist[c * 256 + digit] = offset;
+        offset += count;
+      }
+      trivial = trivial || (offset - digit_begin == n);
+    }
+    if (trivial) {
+      continue;
+    }
+    Key* dst_keys = &keys_tmp[0];
+    int64_t* dst_values = &values_tmp[0];
+#pragma omp parallel for
+    for (int_tp c = 0; c < MALIS_SORT_CHUNKS; ++c) {
+      int64_t* chunk_hist = &hist[c * 256];
+      const int64_t end = std::min(n, (c + 1) * chunk);
+      for (int64_t i = c * chunk; i < end; ++i) {
+        const int64_t pos = chunk_hist[(src_keys[i] >> shift) & 0xFF]++;
+        dst_keys[pos] = src_keys[i];
+        dst_values[pos] = src_values[i];
+      }
+    }
+    keys->swap(keys_tmp);
+    values->swap(values_tmp);
+  }
+}
+
+template <typename Dtype>
+void malis_sort_edges(const Dtype* conn_data, const int_tp* conn_dims,
+                      const int_tp* nhood_data, std::vector<int64_t>* edges) {
+  typedef typename MalisSortKey<Dtype>::type Key;
+  const int64_t nedges = conn_dims[0];
+  const int64_t depth = conn_dims[1];
+  const int64_t height = conn_dims[2];
+  const int64_t width = conn_dims[3];
+  // Every edge direction is valid on a box of voxels: [lo, hi) per axis.
+  std::vector<int64_t> lo(nedges * 3), hi(nedges * 3), first(nedges + 1, 0);
+  for (int64_t d = 0; d < nedges; ++d) {
+    int64_t count = 1;
+    for (int_tp a = 0; a < 3; ++a) {
+      const int64_t off = nhood_data[d * 3 + a];
+      const int64_t size = conn_dims[a + 1];
+      lo[d * 3 + a] = std::max(static_cast<int64_t>(0), -off);
+      hi[d * 3 + a] = std::max(lo[d * 3 + a], std::min(size, size - off));
+      count *= hi[d * 3 + a] - lo[d * 3 + a];
+    }
+    first[d + 1] = first[d] + count;
+  }
+  edges->resize(first[nedges]);
+  std::vector<Key> keys(first[nedges]);
+#pragma omp parallel for
+  for (int64_t dz = 0; dz < nedges * depth; ++dz) {
+    const int64_t d = dz / depth;
+    const int64_t z = dz % depth;
+    const int64_t* d_lo = &lo[d * 3];
+    const int64_t* d_hi = &hi[d * 3];
+    if (z < d_lo[0] || z >= d_hi[0]) {
+      continue;
+    }
+    int64_t j = first[d]
+        + (z - d_lo[0]) * (d_hi[1] - d_lo[1]) * (d_hi[2] - d_lo[2]);
+    for (int64_t y = d_lo[1]; y < d_hi[1]; ++y) {
+      const int64_t row = ((d * depth + z) * height + y) * width;
+      for (int64_t x = d_lo[2]; x < d_hi[2]; ++x, ++j) {
+        (*edges)[j] = row + x;
+        keys[j] = malis_descending_key(conn_data[row + x]);
+      }
+    }
+  }
+  malis_radix_sort(&keys, edges);
+}
+
+// (label, number of voxels) of one segment inside a set.
+typedef std::pair<int64_t, int64_t> MalisOverlapEntry;
+
+inline bool malis_label_less(const MalisOverlapEntry& a,
+                             const MalisOverlapEntry& b) {
+  return a.first < b.first;
+}
+
+// Root of v, halving the path on the way.
+inline int64_t malis_find(int64_t* parent, int64_t v) {
+  while (parent[v] != v) {
+    parent[v] = parent[parent[v]];
+    v = parent[v];
+  }
+  return v;
+}
+
+// Overlap entries of the set with root r. Roots without an overlap array
+// are single voxels (or unlabeled sets) and use their voxel's own label.
+inline const MalisOverlapEntry* malis_overlap(
+    const std::vector<std::vector<MalisOverlapEntry> >& overlaps,
+    const int64_t index, const int64_t label, MalisOverlapEntry* single,
+    int64_t* size) {
+  if (index >= 0) {
+    *size = overlaps[index].size();
+    return &overlaps[index][0];
+  }
+  *single = MalisOverlapEntry(label, 1);
+  *size = label != 0 ? 1 : 0;
+  return single;
+}
+
+// Derived from https://github.com/srinituraga/malis/blob/master/matlab/malis_loss_mex.cpp
+template <typename Dtype>
+void malis_loss_cpu(const Dtype* conn_data, const int_tp* conn_dims,
+                    const int_tp* nhood_data, const Dtype* seg_data,
+                    const std::vector<int64_t>& edges, const bool pos,
+                    Dtype* dloss_data, Dtype* loss_out, Dtype* classerr_out,
+                    Dtype* rand_index_out) {
+  const int64_t nvert = static_cast<int64_t>(conn_dims[1]) * conn_dims[2]
+      * conn_dims[3];
+  // Linear offset of the neighbor along every edge direction.
+  std::vector<int64_t> nhood(conn_dims[0]);
+  for (int64_t d = 0; d < conn_dims[0]; ++d) {
+    nhood[d] = (nhood_data[d * 3] * conn_dims[2] + nhood_data[d * 3 + 1])
+        * conn_dims[3] + nhood_data[d * 3 + 2];
+  }
+
+  // Labels and the number of voxel pairs within each segment. Neighboring
+  // voxels mostly share a label, so the last segment is cached.
+  std::vector<int64_t> label(nvert);
+  std::map<int64_t, int64_t> seg_sizes;
+  std::map<int64_t, int64_t>::iterator last_seg = seg_sizes.end();
+  int64_t n_labeled = 0;
+  int64_t n_pair_pos = 0;
+  for (int64_t v = 0; v < nvert; ++v) {
+    label[v] = static_cast<int64_t>(seg_data[v]);
+    if (label[v] != 0) {
+      if (last_seg == seg_sizes.end() || last_seg->first != label[v]) {
+        last_seg = seg_sizes.insert(MalisOverlapEntry(label[v], 0)).first;
+      }
+      n_pair_pos += last_seg->second++;
+      ++n_labeled;
+    }
+  }
+  const int64_t n_pair_neg = n_labeled * (n_labeled - 1) / 2 - n_pair_pos;
+  const int64_t n_pair_norm = pos ? n_pair_pos : n_pair_neg;
+
+  // Flat union-find, union by size. set_labeled counts labeled voxels and
+  // set_overlap indexes the overlap array of every root (-1 for none).
+  std::vector<int64_t> parent(nvert);
+  std::vector<int64_t> set_size(nvert, 1);
+  std::vector<int64_t> set_labeled(nvert);
+  std::vector<int64_t> set_overlap(nvert, -1);
+  for (int64_t v = 0; v < nvert; ++v) {
+    parent[v] = v;
+    set_labeled[v] = label[v] != 0 ? 1 : 0;
+  }
+  std::vector<std::vector<MalisOverlapEntry> > overlaps;
+  std::vector<int64_t> free_overlaps;
+
+  double loss = 0;
+  int64_t n_pair_incorrect = 0;
+  MalisOverlapEntry single1, single2;
+  for (int64_t i = 0; i < edges.size(); ++i) {
+    const int64_t edge = edges[i];
+    const int64_t v1 = edge % nvert;
+    const int64_t v2 = v1 + nhood[edge / nvert];
+    int64_t set1 = malis_find(&parent[0], v1);
+    int64_t set2 = malis_find(&parent[0], v2);
+    if (set1 == set2) {
+      continue;
+    }
+    int64_t size1, size2;
+    const MalisOverlapEntry* overlap1 = malis_overlap(overlaps,
+        set_overlap[set1], label[set1], &single1, &size1);
+    const MalisOverlapEntry* overlap2 = malis_overlap(overlaps,
+        set_overlap[set2], label[set2], &single2, &size2);
+    // set1 holds the larger overlap from here on.
+    if (size1 < size2) {
+      std::swap(set1, set2);
+      std::swap(size1, size2);
+      std::swap(overlap1, overlap2);
+    }
+
+    // Pairs of voxels joined by this maximin edge.
+    int64_t n_same = 0;
+    for (int64_t j = 0; j < size2; ++j) {
+      const MalisOverlapEntry* it = std::lower_bound(overlap1,
+          overlap1 + size1, overlap2[j], malis_label_less);
+      if (it != overlap1 + size1 && it->first == overlap2[j].first) {
+        n_same += it->second * overlap2[j].second;
+      }
+    }
+    const int64_t n_pair = pos ? n_same
+        : set_labeled[set1] * set_labeled[set2] - n_same;
+    if (n_pair > 0) {
+      const Dtype weight = conn_data[edge];
+      const double dl = pos ? (Dtype(1.0) - weight) : -weight;
+      loss += dl * dl * n_pair;
+      if (n_pair_norm > 0) {
+        dloss_data[edge] += dl * n_pair / n_pair_norm;
+      }
+      if (pos ? (weight <= Dtype(0.5)) : (weight > Dtype(0.5))) {
+        n_pair_incorrect += n_pair;
+      }
+    }
+
+    // Link the sets, then merge the smaller overlap into the larger one,
+    // which moves to the new root.
+    const int64_t root = set_size[set1] >= set_size[set2] ? set1 : set2;
+    const int64_t child = root == set1 ? set2 : set1;
+    parent[child] = root;
+    set_size[root] += set_size[child];
+    set_labeled[root] += set_labeled[child];
+    if (size1 > 0) {
+      int64_t index = set_overlap[set1];
+      if (index < 0) {
+        if (free_overlaps.empty()) {
+          index = overlaps.size();
+          overlaps.push_back(std::vector<MalisOverlapEntry>());
+        } else {
+          index = free_overlaps.back();
+          free_overlaps.pop_back();
+        }
+        overlaps[index].push_back(MalisOverlapEntry(label[set1], 1));
+      }
+      // Re-fetch: adding an array may have moved the overlap arrays.
+      overlap2 = malis_overlap(overlaps, set_overlap[set2], label[set2],
+                               &single2, &size2);
+      std::vector<MalisOverlapEntry>& merged = overlaps[index];
+      const int64_t merged_size = merged.size();
+      for (int64_t j = 0; j < size2; ++j) {
+        std::vector<MalisOverlapEntry>::iterator it = std::lower_bound(
+            merged.begin(), merged.begin() + merged_size, overlap2[j],
+            malis_label_less);
+        if (it != merged.begin() + merged_size
+            && it->first == overlap2[j].first) {
+          it->second += overlap2[j].second;
+        } else {
+          merged.push_back(overlap2[j]);
+        }
+      }
+      if (merged.size() > merged_size) {
+        std::inplace_merge(merged.begin(), merged.begin() + merged_size,
+                           merged.end(), malis_label_less);
+      }
+      if (set_overlap[set2] >= 0) {
+        overlaps[set_overlap[set2]].clear();
+        free_overlaps.push_back(set_overlap[set2]);
+      }
+      set_overlap[set1] = -1;
+      set_overlap[set2] = -1;
+      set_overlap[root] = index;
+    }
+  }
+
+  /* Return items */
+  if (n_pair_norm > 0) {
+    loss /= n_pair_norm;
+  } else {
+    loss = 0;
+  }
+  *loss_out = loss;
+  const double classerr = n_pair_norm > 0 ? static_cast<double>(
+      n_pair_incorrect) / static_cast<double>(n_pair_norm) : 0;
+  *classerr_out = classerr;
+  *rand_index_out = 1.0 - classerr;
+}
+
+template void malis_sort_edges<float>(const float* conn_data,
+    const int_tp* conn_dims, const int_tp* nhood_data,
+    std::vector<int64_t>* edges);
+template void malis_sort_edges<double>(const double* conn_data,
+    const int_tp* conn_dims, const int_tp* nhood_data,
+    std::vector<int64_t>* edges);
+
+template void malis_loss_cpu<float>(const float* conn_data,
+    const int_tp* conn_dims, const int_tp* nhood_data, const float* seg_data,
+    const std::vector<int64_t>& edges, const bool pos, float* dloss_data,
+    float* loss_out, float* classerr_out, float* rand_index_out);
+template void malis_loss_cpu<double>(const double* conn_data,
+    const int_tp* conn_dims, const int_tp* nhood_data, const double* seg_data,
+    const std::vector<int64_t>& edges, const bool pos, double* dloss_data,
+    double* loss_out, double* classerr_out, double* rand_index_out);
+
+}  // namespace caffe
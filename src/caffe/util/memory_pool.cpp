@@ -0,0 +1,112 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "caffe/util/memory_pool.hpp"
+
+namespace caffe {
+
+MemoryPool::MemoryPool()
+    : limit_(std::numeric_limits<uint_tp>::max()), hits_(0), misses_(0),
+      bytes_cached_(0), mutex_(new boost::mutex()) {
+}
+
+MemoryPool::~MemoryPool() {
+}
+
+uint_tp MemoryPool::SizeClass(uint_tp size) {
+  const uint_tp min_size = 64;
+  if (size <= min_size) {
+    return min_size;
+  }
+  uint_tp power = min_size;
+  while (power * 2 < size) {
+    power *= 2;
+  }
+  // size lies in (power, 2 * power], which is split into four classes.
+  const uint_tp step = std::max(power / 4, min_size);
+  return (size + step - 1) / step * step;
+}
+
+void* MemoryPool::Take(uint_tp size, int_tp flags) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  const uint_tp bytes = SizeClass(size);
+  std::map<uint_tp, vector<Block> >::iterator it = blocks_.find(bytes);
+  if (it != blocks_.end()) {
+    vector<Block>& blocks = it->second;
+    for (int_tp i = blocks.size() - 1; i >= 0; --i) {
+      if (blocks[i].flags == flags) {
+        void* ptr = blocks[i].ptr;
+        blocks.erase(blocks.begin() + i);
+        bytes_cached_ -= bytes;
+        ++hits_;
+        return ptr;
+      }
+    }
+  }
+  ++misses_;
+  return NULL;
+}
+
+bool MemoryPool::Give(void* ptr, uint_tp size, int_tp flags) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  const uint_tp bytes = SizeClass(size);
+  if (bytes > limit_ || bytes_cached_ > limit_ - bytes) {
+    return false;
+  }
+  Block block;
+  block.ptr = ptr;
+  block.size = bytes;
+  block.flags = flags;
+  blocks_[bytes].push_back(block);
+  bytes_cached_ += bytes;
+  return true;
+}
+
+vector<MemoryPool::Block> MemoryPool::Trim() {
+  boost::mutex::scoped_lock lock(*mutex_);
+  vector<Block> trimmed;
+  for (std::map<uint_tp, vector<Block> >::iterator it = blocks_.begin();
+       it != blocks_.end(); ++it) {
+    trimmed.insert(trimmed.end(), it->second.begin(), it->second.end());
+  }
+  blocks_.clear();
+  bytes_cached_ = 0;
+  return trimmed;
+}
+
+void MemoryPool::set_limit(uint_tp bytes) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  limit_ = bytes;
+}
+
+uint_tp MemoryPool::limit() {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return limit_;
+}
+
+uint_tp MemoryPool::hits() {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return hits_;
+}
+
+uint_tp MemoryPool::misses() {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return misses_;
+}
+
+uint_tp MemoryPool::bytes_cached() {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return bytes_cached_;
+}
+
+void MemoryPool::ResetCounters() {
+  boost::mutex::scoped_lock lock(*mutex_);
+  hits_ = 0;
+  misses_ = 0;
+}
+
+}  // namespace caffe
@@ -0,0 +1,413 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/ring.hpp"
+
+namespace caffe {
+
+RingTransport::RingTransport(int rank, int ranks)
+    : rank_(rank), ranks_(ranks) {
+  CHECK_GT(ranks, 0) << "A ring needs ranks";
+  CHECK_GE(rank, 0) << "Rank " << rank << " is not in the ring";
+  CHECK_LT(rank, ranks) << "Rank " << rank << " is not in the ring";
+}
+
+RingTransport* RingTransport::Create(const string& address, int rank,
+                                     int ranks) {
+  if (address.compare(0, 4, "shm:") == 0) {
+    return new ShmRingTransport(address.substr(4), rank, ranks);
+  }
+  if (address.compare(0, 4, "tcp:") == 0) {
+    vector<string> addresses;
+    std::stringstream list(address.substr(4));
+    string item;
+    while (std::getline(list, item, ',')) {
+      addresses.push_back(item);
+    }
+    CHECK_EQ(addresses.size(), static_cast<size_t>(ranks))
+        << "The ring needs one address per rank: " << address;
+    return new TCPRingTransport(addresses, rank);
+  }
+  LOG(FATAL) << "Unknown ring transport " << address
+             << ", expected shm:NAME or tcp:HOST:PORT,...";
+  return NULL;
+}
+
+// The counters only grow; the queue holds head - tail bytes, which start at
+// data[tail % capacity]. Each counter has its own cache line, as it is
+// written by one side and polled by the other. attached is set once by the
+// receiving rank, so that a segment in use is never taken for a fresh one.
+struct ShmRingTransport::Link {
+  volatile uint64_t head;
+  char head_padding[56];
+  volatile uint64_t tail;
+  char tail_padding[56];
+  volatile uint64_t attached;
+  char attached_padding[56];
+  char data[1];
+};
+
+// Polls for the other rank every 100 ms, for up to a minute.
+static const int kShmRetries = 600;
+
+ShmRingTransport::ShmRingTransport(const string& name, int rank, int ranks,
+                                   uint_tp capacity)
+    : RingTransport(rank, ranks), capacity_(capacity),
+      mapped_size_(offsetof(Link, data) + capacity), send_(NULL),
+      recv_(NULL) {
+  if (ranks == 1) {
+    return;
+  }
+  std::ostringstream send_name, recv_name;
+  send_name << "/" << name << "_" << rank;
+  recv_name << "/" << name << "_" << (rank + ranks - 1) % ranks;
+  send_name_ = send_name.str();
+  send_ = CreateLink(send_name_);
+  recv_ = AttachLink(recv_name.str());
+  // A next rank that attached to a segment of an earlier run, just before it
+  // was replaced, would never see our data; fail instead of hanging.
+  for (int retry = 0; !send_->attached; ++retry) {
+    CHECK_LT(retry, kShmRetries) << "Rank " << (rank + 1) % ranks
+        << " did not attach to " << send_name_;
+    usleep(100000);
+  }
+}
+
+ShmRingTransport::~ShmRingTransport() {
+  if (send_) {
+    munmap(send_, mapped_size_);
+    shm_unlink(send_name_.c_str());
+  }
+  if (recv_) {
+    munmap(recv_, mapped_size_);
+  }
+}
+
+ShmRingTransport::Link* ShmRingTransport::CreateLink(const string& name) {
+  // A segment left by a crashed run holds its counters and bytes, so it is
+  // removed, and ours is created from scratch. Sizing it zeroes it.
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  CHECK_GE(fd, 0) << "Could not create shared memory " << name << ": "
+                  << strerror(errno);
+  CHECK_EQ(ftruncate(fd, mapped_size_), 0) << "Could not size " << name;
+  void* memory = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  close(fd);
+  CHECK(memory != MAP_FAILED) << "Could not map " << name;
+  return static_cast<Link*>(memory);
+}
+
+ShmRingTransport::Link* ShmRingTransport::AttachLink(const string& name) {
+  // Until the previous rank has replaced it, the segment may be missing,
+  // not sized yet, or left by an earlier run with its counters or attached
+  // set; none of these is taken.
+  for (int retry = 0; ; ++retry) {
+    CHECK_LT(retry, kShmRetries) << "Shared memory " << name
+        << " was not created by rank " << (rank_ + ranks_ - 1) % ranks_
+        << ", or holds the state of another run";
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      usleep(100000);
+      continue;
+    }
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << "Could not stat " << name;
+    if (static_cast<uint_tp>(st.st_size) != mapped_size_) {
+      close(fd);
+      usleep(100000);
+      continue;
+    }
+    void* memory = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(memory != MAP_FAILED) << "Could not map " << name;
+    Link* link = static_cast<Link*>(memory);
+    if (link->head == 0 && link->tail == 0
+        && __sync_bool_compare_and_swap(&link->attached, 0, 1)) {
+      return link;
+    }
+    munmap(memory, mapped_size_);
+    usleep(100000);
+  }
+}
+
+void ShmRingTransport::SendRecv(const void* send, uint_tp send_bytes,
+                                void* recv, uint_tp recv_bytes) {
+  if (ranks_ == 1) {
+    CHECK_EQ(send_bytes, recv_bytes);
+    memcpy(recv, send, send_bytes);
+    return;
+  }
+  const char* send_data = static_cast<const char*>(send);
+  char* recv_data = static_cast<char*>(recv);
+  uint_tp sent = 0;
+  uint_tp received = 0;
+  while (sent < send_bytes || received < recv_bytes) {
+    bool progress = false;
+    if (sent < send_bytes) {
+      const uint64_t head = send_->head;
+      const uint64_t space = capacity_ - (head - send_->tail);
+      const uint64_t offset = head % capacity_;
+      const uint_tp bytes = std::min<uint_tp>(
+          std::min<uint_tp>(space, capacity_ - offset), send_bytes - sent);
+      if (bytes > 0) {
+        memcpy(send_->data + offset, send_data + sent, bytes);
+        // Publish the bytes before moving the head past them.
+        __sync_synchronize();
+        send_->head = head + bytes;
+        sent += bytes;
+        progress = true;
+      }
+    }
+    if (received < recv_bytes) {
+      const uint64_t tail = recv_->tail;
+      const uint64_t available = recv_->head - tail;
+      const uint64_t offset = tail % capacity_;
+      const uint_tp bytes = std::min<uint_tp>(
+          std::min<uint_tp>(available, capacity_ - offset),
+          recv_bytes - received);
+      if (bytes > 0) {
+        // Read the bytes only after seeing the head past them.
+        __sync_synchronize();
+        memcpy(recv_data + received, recv_->data + offset, bytes);
+        __sync_synchronize();
+        recv_->tail = tail + bytes;
+        received += bytes;
+        progress = true;
+      }
+    }
+    if (!progress) {
+      sched_yield();
+    }
+  }
+}
+
+// Splits "HOST:PORT".
+static void split_address(const string& address, string* host,
+                          string* port) {
+  const size_t colon = address.rfind(':');
+  CHECK(colon != string::npos) << "Expected HOST:PORT, got " << address;
+  *host = address.substr(0, colon);
+  *port = address.substr(colon + 1);
+}
+
+TCPRingTransport::TCPRingTransport(const vector<string>& addresses, int rank)
+    : RingTransport(rank, addresses.size()), send_fd_(-1), recv_fd_(-1) {
+  if (ranks_ == 1) {
+    return;
+  }
+  string host, port;
+  split_address(addresses[rank], &host, &port);
+  const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd, 0) << "Could not create socket";
+  const int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in listen_address;
+  memset(&listen_address, 0, sizeof(listen_address));
+  listen_address.sin_family = AF_INET;
+  listen_address.sin_addr.s_addr = htonl(INADDR_ANY);
+  listen_address.sin_port = htons(atoi(port.c_str()));
+  CHECK_EQ(bind(listen_fd, reinterpret_cast<sockaddr*>(&listen_address),
+                sizeof(listen_address)), 0)
+      << "Could not bind port " << port << ": " << strerror(errno);
+  CHECK_EQ(listen(listen_fd, 1), 0) << "Could not listen on port " << port;
+
+  // The listen backlog completes the connection to the next rank before it
+  // accepts, so every rank can connect first and accept second.
+  split_address(addresses[(rank + 1) % ranks_], &host, &port);
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* next_address;
+  CHECK_EQ(getaddrinfo(host.c_str(), port.c_str(), &hints, &next_address), 0)
+      << "Could not resolve " << host;
+  const int kRetries = 600;
+  for (int retry = 0; send_fd_ < 0; ++retry) {
+    send_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(send_fd_, 0) << "Could not create socket";
+    if (connect(send_fd_, next_address->ai_addr,
+                next_address->ai_addrlen) != 0) {
+      close(send_fd_);
+      send_fd_ = -1;
+      CHECK_LT(retry, kRetries) << "Could not connect to rank "
+          << (rank + 1) % ranks_ << " at " << host << ":" << port;
+      usleep(100000);
+    }
+  }
+  freeaddrinfo(next_address);
+  recv_fd_ = accept(listen_fd, NULL, NULL);
+  CHECK_GE(recv_fd_, 0) << "Could not accept rank "
+      << (rank + ranks_ - 1) % ranks_;
+  close(listen_fd);
+
+  const int fds[] = { send_fd_, recv_fd_ };
+  for (int i = 0; i < 2; ++i) {
+    setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+  }
+}
+
+TCPRingTransport::~TCPRingTransport() {
+  if (send_fd_ >= 0) {
+    close(send_fd_);
+  }
+  if (recv_fd_ >= 0) {
+    close(recv_fd_);
+  }
+}
+
+void TCPRingTransport::SendRecv(const void* send, uint_tp send_bytes,
+                                void* recv, uint_tp recv_bytes) {
+  if (ranks_ == 1) {
+    CHECK_EQ(send_bytes, recv_bytes);
+    memcpy(recv, send, send_bytes);
+    return;
+  }
+  const char* send_data = static_cast<const char*>(send);
+  char* recv_data = static_cast<char*>(recv);
+  uint_tp sent = 0;
+  uint_tp received = 0;
+  while (sent < send_bytes || received < recv_bytes) {
+    pollfd fds[2];
+    int count = 0;
+    if (sent < send_bytes) {
+      fds[count].fd = send_fd_;
+      fds[count].events = POLLOUT;
+      ++count;
+    }
+    if (received < recv_bytes) {
+      fds[count].fd = recv_fd_;
+      fds[count].events = POLLIN;
+      ++count;
+    }
+    if (poll(fds, count, -1) < 0) {
+      CHECK_EQ(errno, EINTR) << "Ring poll failed: " << strerror(errno);
+      continue;
+    }
+    for (int i = 0; i < count; ++i) {
+      CHECK(!(fds[i].revents & (POLLERR | POLLNVAL)))
+          << "Ring connection failed";
+      if (fds[i].fd == send_fd_ && (fds[i].revents & POLLOUT)) {
+        const ssize_t bytes = ::send(send_fd_, send_data + sent,
+                                     send_bytes - sent, MSG_NOSIGNAL);
+        if (bytes > 0) {
+          sent += bytes;
+        } else {
+          CHECK(errno == EAGAIN || errno == EINTR)
+              << "Ring send failed: " << strerror(errno);
+        }
+      } else if (fds[i].fd == recv_fd_
+                 && (fds[i].revents & (POLLIN | POLLHUP))) {
+        const ssize_t bytes = ::recv(recv_fd_, recv_data + received,
+                                     recv_bytes - received, 0);
+        CHECK_NE(bytes, 0) << "Rank " << (rank_ + ranks_ - 1) % ranks_
+            << " closed the ring";
+        if (bytes > 0) {
+          received += bytes;
+        } else {
+          CHECK(errno == EAGAIN || errno == EINTR)
+              << "Ring receive failed: " << strerror(errno);
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ring_allreduce(RingTransport* transport, Dtype* data, uint_tp count) {
+  const int ranks = transport->ranks();
+  const int rank = transport->rank();
+  if (ranks == 1) {
+    return;
+  }
+  // Chunk c covers [begin(c), begin(c + 1)).
+  vector<uint_tp> begin(ranks + 1);
+  for (int c = 0; c <= ranks; ++c) {
+    begin[c] = count * c / ranks;
+  }
+  vector<Dtype> received(count / ranks + 1);
+  // Reduce-scatter: after step s, chunk rank - s - 1 holds the sum of s + 2
+  // ranks; in the end each rank holds the sum of chunk rank + 1.
+  for (int s = 0; s < ranks - 1; ++s) {
+    const int send_chunk = (rank - s + ranks) % ranks;
+    const int recv_chunk = (rank - s - 1 + ranks) % ranks;
+    const uint_tp recv_count = begin[recv_chunk + 1] - begin[recv_chunk];
+    transport->SendRecv(data + begin[send_chunk],
+        (begin[send_chunk + 1] - begin[send_chunk]) * sizeof(Dtype),
+        &received[0], recv_count * sizeof(Dtype));
+    caffe_axpy<Dtype>(recv_count, Dtype(1), &received[0],
+                      data + begin[recv_chunk]);
+  }
+  // Allgather: pass the summed chunks around the ring.
+  for (int s = 0; s < ranks - 1; ++s) {
+    const int send_chunk = (rank + 1 - s + ranks) % ranks;
+    const int recv_chunk = (rank - s + ranks) % ranks;
+    transport->SendRecv(data + begin[send_chunk],
+        (begin[send_chunk + 1] - begin[send_chunk]) * sizeof(Dtype),
+        data + begin[recv_chunk],
+        (begin[recv_chunk + 1] - begin[recv_chunk]) * sizeof(Dtype));
+  }
+}
+
+template <typename Dtype>
+void ring_broadcast(RingTransport* transport, Dtype* data, uint_tp count) {
+  const int ranks = transport->ranks();
+  const int rank = transport->rank();
+  if (ranks == 1) {
+    return;
+  }
+  // Rank r forwards chunk k - 1 while it receives chunk k.
+  const uint_tp kChunk = (1 << 20) / sizeof(Dtype);
+  const uint_tp chunks = (count + kChunk - 1) / kChunk;
+  const bool receives = rank != 0;
+  const bool forwards = rank != ranks - 1;
+  for (uint_tp k = 0; k <= chunks; ++k) {
+    const Dtype* send = NULL;
+    uint_tp send_count = 0;
+    Dtype* recv = NULL;
+    uint_tp recv_count = 0;
+    const uint_tp send_chunk = receives ? k - 1 : k;
+    if (forwards && (receives ? k > 0 : k < chunks)) {
+      send = data + send_chunk * kChunk;
+      send_count = std::min(kChunk, count - send_chunk * kChunk);
+    }
+    if (receives && k < chunks) {
+      recv = data + k * kChunk;
+      recv_count = std::min(kChunk, count - k * kChunk);
+    }
+    transport->SendRecv(send, send_count * sizeof(Dtype), recv,
+                        recv_count * sizeof(Dtype));
+  }
+}
+
+template void ring_allreduce<float>(RingTransport* transport, float* data,
+                                    uint_tp count);
+template void ring_allreduce<double>(RingTransport* transport, double* data,
+                                     uint_tp count);
+template void ring_broadcast<float>(RingTransport* transport, float* data,
+                                    uint_tp count);
+template void ring_broadcast<double>(RingTransport* transport, double* data,
+                                     uint_tp count);
+
+}  // namespace caffe
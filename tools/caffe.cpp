@@ -32,6 +32,21 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(cpu_replicas, 1,
+    "Optional; in CPU mode, train this many solver replicas data-parallel on "
+    "separate ranges of cores. The effective training batch size is "
+    "multiplied by the number of replicas.");
+DEFINE_string(ring, "",
+    "Optional; in CPU mode, train data-parallel with the other processes of "
+    "this ring, 'shm:NAME' on one host or 'tcp:HOST:PORT,...' with the "
+    "address of every rank.");
+DEFINE_int32(rank, 0,
+    "Optional; the rank of this process in the ring.");
+DEFINE_int32(ranks, 1,
+    "Optional; the number of processes in the ring.");
+DEFINE_int32(ring_bucket_mb, 4,
+    "Optional; the gradients are summed over the ring in buckets of this "
+    "many MB.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -188,6 +203,11 @@ int train() {
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    CHECK_GT(FLAGS_cpu_replicas, 0) << "cpu_replicas must be positive";
+    Caffe::set_solver_count(FLAGS_cpu_replicas);
+    if (FLAGS_cpu_replicas > 1) {
+      caffe::CPUSync<float>::PinRoot();
+    }
   } else {
 #ifndef CPU_ONLY
     // Load all devices that will be used
@@ -207,6 +227,28 @@ int train() {
 #endif  // !CPU_ONLY
   }
 
+  shared_ptr<caffe::RingTransport> ring;
+  if (FLAGS_ring.size()) {
+    CHECK_EQ(gpus.size(), 0) << "Ring training runs CPU solvers";
+    CHECK_EQ(FLAGS_cpu_replicas, 1) << "Ring ranks run a single replica";
+    CHECK_GT(FLAGS_ring_bucket_mb, 0) << "ring_bucket_mb must be positive";
+    ring.reset(caffe::RingTransport::Create(FLAGS_ring, FLAGS_rank,
+                                            FLAGS_ranks));
+    // Data layers give every rank its own share of their sources, and
+    // random layers draw differently. Rank 0 broadcasts the weights.
+    Caffe::set_rank(FLAGS_rank);
+    Caffe::set_rank_count(FLAGS_ranks);
+    if (solver_param.random_seed() >= 0) {
+      solver_param.set_random_seed(solver_param.random_seed() + FLAGS_rank);
+    }
+    // Rank 0 tests and snapshots for the ring.
+    if (FLAGS_rank > 0) {
+      solver_param.set_test_interval(0);
+      solver_param.set_snapshot(0);
+      solver_param.set_snapshot_after_train(false);
+    }
+  }
+
   caffe::SignalHandler signal_handler(
         GetRequestedAction(FLAGS_sigint_effect),
         GetRequestedAction(FLAGS_sighup_effect));
@@ -230,6 +272,14 @@ int train() {
       devices.push_back(Caffe::Get().GetDevice(i));
     }
     sync.run(devices);
+  } else if (ring) {
+    const uint_tp bucket_size =
+        (static_cast<uint_tp>(FLAGS_ring_bucket_mb) << 20) / sizeof(float);
+    caffe::RingSync<float> sync(solver, ring, bucket_size);
+    sync.run();
+  } else if (gpus.size() == 0 && FLAGS_cpu_replicas > 1) {
+    caffe::CPUSync<float> sync(solver, NULL, solver->param(), 0);
+    sync.run();
   } else {
     LOG(INFO) << "Starting Optimization";
     solver->Solve();
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <algorithm>
+#include <cmath>
 #include <string>
 #include <utility>
 #include <vector>
@@ -20,6 +21,10 @@ using boost::scoped_ptr;
 
 DEFINE_string(backend, "lmdb",
         "The backend {leveldb, lmdb} containing the images");
+DEFINE_int32(threads, 1,
+        "Number of threads decoding and summing the images");
+DEFINE_bool(variance, false,
+        "Also compute the per-channel variance of the pixels");
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -41,6 +46,9 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  const int_tp threads = FLAGS_threads;
+  CHECK_GT(threads, 0) << "threads must be positive";
+
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
   db->Open(argv[1], db::READ);
   scoped_ptr<db::Cursor> cursor(db->NewCursor());
@@ -60,61 +68,108 @@ int main(int argc, char** argv) {
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
   const int_tp data_size = datum.channels() * datum.height() * datum.width();
-  int_tp size_in_datum = std::max<int_tp>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int_tp i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
-  }
+  const int_tp channels = sum_blob.channels();
+  const int_tp dim = sum_blob.height() * sum_blob.width();
+
+  // The main thread reads blocks of serialized datums, and the block is split
+  // into one contiguous range per thread. Each thread decodes its range and
+  // sums it into its own accumulator, and the accumulators are reduced in a
+  // fixed order at the end, so the result does not depend on scheduling.
+  const int_tp kBlockSize = 1024;
+  vector<string> block(kBlockSize);
+  vector<vector<double> > sums(threads, vector<double>(data_size, 0.));
+  vector<vector<double> > squares(threads,
+      vector<double>(FLAGS_variance ? channels : 0, 0.));
   LOG(INFO) << "Starting Iteration";
   while (cursor->valid()) {
-    Datum datum;
-    datum.ParseFromString(cursor->value());
-    DecodeDatumNative(&datum);
-
-    const std::string& data = datum.data();
-    size_in_datum = std::max<int_tp>(datum.data().size(),
-        datum.float_data_size());
-    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-        size_in_datum;
-    if (data.size() != 0) {
-      CHECK_EQ(data.size(), size_in_datum);
-      for (int_tp i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-      }
-    } else {
-      CHECK_EQ(datum.float_data_size(), size_in_datum);
-      for (int_tp i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) +
-            static_cast<float>(datum.float_data(i)));
+    int_tp block_count = 0;
+    while (cursor->valid() && block_count < kBlockSize) {
+      block[block_count++].assign(cursor->value_data(), cursor->value_size());
+      cursor->Next();
+    }
+#pragma omp parallel for num_threads(threads)
+    for (int_tp t = 0; t < threads; ++t) {
+      vector<double>& sum = sums[t];
+      vector<double>& square = squares[t];
+      Datum datum;
+      for (int_tp item = block_count * t / threads;
+           item < block_count * (t + 1) / threads; ++item) {
+        datum.ParseFromString(block[item]);
+        DecodeDatumNative(&datum);
+
+        const std::string& data = datum.data();
+        const int_tp size_in_datum = std::max<int_tp>(datum.data().size(),
+            datum.float_data_size());
+        CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
+            size_in_datum;
+        if (data.size() != 0) {
+          CHECK_EQ(data.size(), size_in_datum);
+          for (int_tp i = 0; i < size_in_datum; ++i) {
+            sum[i] += static_cast<uint8_t>(data[i]);
+          }
+          for (int_tp c = 0; c < square.size(); ++c) {
+            double channel_square = 0.;
+            for (int_tp i = c * dim; i < (c + 1) * dim; ++i) {
+              const double value = static_cast<uint8_t>(data[i]);
+              channel_square += value * value;
+            }
+            square[c] += channel_square;
+          }
+        } else {
+          CHECK_EQ(datum.float_data_size(), size_in_datum);
+          for (int_tp i = 0; i < size_in_datum; ++i) {
+            sum[i] += datum.float_data(i);
+          }
+          for (int_tp c = 0; c < square.size(); ++c) {
+            double channel_square = 0.;
+            for (int_tp i = c * dim; i < (c + 1) * dim; ++i) {
+              const double value = datum.float_data(i);
+              channel_square += value * value;
+            }
+            square[c] += channel_square;
+          }
+        }
       }
     }
-    ++count;
-    if (count % 10000 == 0) {
-      LOG(INFO) << "Processed " << count << " files.";
+    if ((count + block_count) / 10000 != count / 10000) {
+      LOG(INFO) << "Processed " << count + block_count << " files.";
     }
-    cursor->Next();
+    count += block_count;
   }
 
   if (count % 10000 != 0) {
     LOG(INFO) << "Processed " << count << " files.";
   }
-  for (int_tp i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  for (int_tp t = 1; t < threads; ++t) {
+    for (int_tp i = 0; i < data_size; ++i) {
+      sums[0][i] += sums[t][i];
+    }
+    for (int_tp c = 0; c < squares[0].size(); ++c) {
+      squares[0][c] += squares[t][c];
+    }
+  }
+  for (int_tp i = 0; i < data_size; ++i) {
+    sum_blob.add_data(sums[0][i] / count);
   }
   // Write to disk
   if (argc == 3) {
     LOG(INFO) << "Write to " << argv[2];
     WriteProtoToBinaryFile(sum_blob, argv[2]);
   }
-  const int_tp channels = sum_blob.channels();
-  const int_tp dim = sum_blob.height() * sum_blob.width();
-  std::vector<float> mean_values(channels, 0.0);
+  std::vector<double> mean_values(channels, 0.0);
   LOG(INFO) << "Number of channels: " << channels;
   for (int_tp c = 0; c < channels; ++c) {
     for (int_tp i = 0; i < dim; ++i) {
-      mean_values[c] += sum_blob.data(dim * c + i);
+      mean_values[c] += sums[0][dim * c + i];
     }
-    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c] / dim;
+    mean_values[c] /= static_cast<double>(count) * dim;
+    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c];
+  }
+  for (int_tp c = 0; c < squares[0].size(); ++c) {
+    const double variance = std::max(0., squares[0][c]
+        / (static_cast<double>(count) * dim) - mean_values[c] * mean_values[c]);
+    LOG(INFO) << "variance channel [" << c << "]:" << variance
+              << " (std " << std::sqrt(variance) << ")";
   }
 #else
   LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
@@ -0,0 +1,78 @@
+// Folds the BatchNorm layers of a trained net into the Convolution and
+// InnerProduct layers before them and fuses ReLU/PReLU layers into
+// convolutions, for inference. The folded net is written as a prototxt and
+// a binary weights file, and optionally compared with the original.
+#include <algorithm>
+#include <string>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/fold_layers.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(model, "", "The TEST phase net prototxt.");
+DEFINE_string(weights, "", "The trained weights (.caffemodel).");
+DEFINE_string(output_model, "", "Where to write the folded net prototxt.");
+DEFINE_string(output_weights, "", "Where to write the folded weights.");
+DEFINE_bool(verify, true, "Check that the folded net computes the same "
+    "outputs as the original net.");
+DEFINE_double(tolerance, 1e-4, "Largest absolute output difference accepted "
+    "by --verify.");
+DEFINE_int32(iterations, 1, "Number of batches compared by --verify.");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Fold BatchNorm and ReLU layers into the layers "
+        "before them for inference\n"
+        "Usage:\n"
+        "    fold_layers --model=net.prototxt --weights=net.caffemodel \\\n"
+        "        --output_model=folded.prototxt "
+        "--output_weights=folded.caffemodel\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_model.empty() || FLAGS_weights.empty()
+      || FLAGS_output_model.empty() || FLAGS_output_weights.empty()) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/fold_layers");
+    return 1;
+  }
+  Caffe::set_mode(Caffe::CPU);
+
+  Net<float> net(FLAGS_model, TEST);
+  net.CopyTrainedLayersFrom(FLAGS_weights);
+  NetParameter folded_param;
+  const int_tp removed = FoldInferenceLayers(net, &folded_param);
+  LOG(INFO) << "Folded " << removed << " layers, "
+            << folded_param.layer_size() << " left.";
+
+  WriteProtoToBinaryFile(folded_param, FLAGS_output_weights);
+  NetParameter folded_model(folded_param);
+  for (int_tp i = 0; i < folded_model.layer_size(); ++i) {
+    folded_model.mutable_layer(i)->clear_blobs();
+  }
+  WriteProtoToTextFile(folded_model, FLAGS_output_model);
+
+  if (FLAGS_verify) {
+    Net<float> folded(folded_param);
+    float max_diff = 0;
+    for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+      max_diff = std::max(max_diff, VerifyFoldedNet(&net, &folded));
+    }
+    LOG(INFO) << "Largest output difference: " << max_diff;
+    if (max_diff > FLAGS_tolerance) {
+      LOG(ERROR) << "The folded net differs from the original net by more "
+                 << "than " << FLAGS_tolerance << ".";
+      return 1;
+    }
+  }
+  return 0;
+}
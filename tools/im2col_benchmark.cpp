@@ -0,0 +1,171 @@
+// Times the CPU im2col/col2im kernels used by BaseConvolutionLayer:
+// the dense 2D and N-D paths against the strided-kernel (kstride) paths.
+// With --kstride=1 both compute the same column buffer, which makes the
+// numbers directly comparable.
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(channels, 64, "Number of input channels.");
+DEFINE_int32(depth, 1, "Input depth; values > 1 benchmark 3D im2col.");
+DEFINE_int32(height, 128, "Input height.");
+DEFINE_int32(width, 128, "Input width.");
+DEFINE_int32(kernel, 3, "Kernel size along every spatial axis.");
+DEFINE_int32(kstride, 2, "Kernel stride along every spatial axis.");
+DEFINE_int32(pad, 0, "Padding along every spatial axis.");
+DEFINE_int32(stride, 1, "Stride along every spatial axis.");
+DEFINE_int32(iterations, 20, "Number of timed iterations per kernel.");
+
+template<typename Func>
+float TimeKernel(const std::string& name, Func func) {
+  func();  // Warm up caches and OpenMP threads.
+  CPUTimer timer;
+  timer.Start();
+  for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+    func();
+  }
+  timer.Stop();
+  const float ms = timer.MilliSeconds() / FLAGS_iterations;
+  LOG(INFO) << name << ": " << ms << " ms";
+  return ms;
+}
+
+struct Dense2D {
+  const float* im; float* col; int_tp k;
+  void operator()() const {
+    im2col_cpu(im, FLAGS_channels, FLAGS_height, FLAGS_width, k, k,
+               FLAGS_pad, FLAGS_pad, FLAGS_stride, FLAGS_stride, col);
+  }
+};
+
+struct Strided2D {
+  const float* im; float* col; int_tp k; int_tp ks;
+  void operator()() const {
+    im2col_sk_cpu(im, FLAGS_channels, FLAGS_height, FLAGS_width, k, k,
+                  FLAGS_pad, FLAGS_pad, FLAGS_stride, FLAGS_stride, ks, ks,
+                  col);
+  }
+};
+
+struct Col2imDense2D {
+  const float* col; float* im; int_tp k;
+  void operator()() const {
+    col2im_cpu(col, FLAGS_channels, FLAGS_height, FLAGS_width, k, k,
+               FLAGS_pad, FLAGS_pad, FLAGS_stride, FLAGS_stride, im);
+  }
+};
+
+struct Col2imStrided2D {
+  const float* col; float* im; int_tp k; int_tp ks;
+  void operator()() const {
+    col2im_sk_cpu(col, FLAGS_channels, FLAGS_height, FLAGS_width, k, k,
+                  FLAGS_pad, FLAGS_pad, FLAGS_stride, FLAGS_stride, ks, ks,
+                  im);
+  }
+};
+
+struct DenseND {
+  const float* im; float* col; int_tp axes;
+  const int_tp* im_shape; const int_tp* col_shape; const int_tp* kernel;
+  const int_tp* pad; const int_tp* stride;
+  void operator()() const {
+    im2col_nd_cpu(im, axes, im_shape, col_shape, kernel, pad, stride, col);
+  }
+};
+
+struct StridedND {
+  const float* im; float* col; int_tp axes;
+  const int_tp* im_shape; const int_tp* col_shape; const int_tp* kernel;
+  const int_tp* pad; const int_tp* stride; const int_tp* kstride;
+  void operator()() const {
+    im2col_ndsk_cpu(im, axes, im_shape, col_shape, kernel, pad, stride,
+                    kstride, col);
+  }
+};
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Benchmark the CPU im2col/col2im kernels with and "
+        "without a kernel stride (kstride)\n"
+        "Usage:\n"
+        "    im2col_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  const int_tp num_axes = FLAGS_depth > 1 ? 3 : 2;
+  const int_tp ext_kernel = (FLAGS_kernel - 1) * FLAGS_kstride + 1;
+  vector<int_tp> im_shape(1, FLAGS_channels);
+  if (num_axes == 3) {
+    im_shape.push_back(FLAGS_depth);
+  }
+  im_shape.push_back(FLAGS_height);
+  im_shape.push_back(FLAGS_width);
+  // The dense reference uses a kernel with the same number of taps as the
+  // strided kernel, so both paths move the same amount of column data.
+  vector<int_tp> col_shape(1, FLAGS_channels);
+  vector<int_tp> sk_col_shape(1, FLAGS_channels);
+  for (int_tp i = 0; i < num_axes; ++i) {
+    const int_tp dim = im_shape[i + 1] + 2 * FLAGS_pad;
+    CHECK_GE(dim, ext_kernel) << "Input too small for the strided kernel.";
+    col_shape[0] *= FLAGS_kernel;
+    sk_col_shape[0] *= FLAGS_kernel;
+    col_shape.push_back((dim - FLAGS_kernel) / FLAGS_stride + 1);
+    sk_col_shape.push_back((dim - ext_kernel) / FLAGS_stride + 1);
+  }
+  int_tp im_count = 1;
+  int_tp col_count = 1;
+  for (int_tp i = 0; i < im_shape.size(); ++i) {
+    im_count *= im_shape[i];
+    col_count *= std::max(col_shape[i], sk_col_shape[i]);
+  }
+  vector<float> im(im_count);
+  vector<float> col(col_count);
+  caffe_rng_uniform<float>(im_count, -1.0, 1.0, &im[0]);
+
+  const vector<int_tp> kernel(num_axes, FLAGS_kernel);
+  const vector<int_tp> pad(num_axes, FLAGS_pad);
+  const vector<int_tp> stride(num_axes, FLAGS_stride);
+  const vector<int_tp> kstride(num_axes, FLAGS_kstride);
+
+  LOG(INFO) << "Input " << FLAGS_channels << " x "
+            << (num_axes == 3 ? FLAGS_depth : 1) << " x " << FLAGS_height
+            << " x " << FLAGS_width << ", kernel " << FLAGS_kernel
+            << ", kstride " << FLAGS_kstride;
+  float dense_ms, strided_ms;
+  if (num_axes == 2) {
+    Dense2D dense = { &im[0], &col[0], FLAGS_kernel };
+    Strided2D strided = { &im[0], &col[0], FLAGS_kernel, FLAGS_kstride };
+    dense_ms = TimeKernel("im2col_cpu", dense);
+    strided_ms = TimeKernel("im2col_sk_cpu", strided);
+    Col2imDense2D col2im_dense = { &col[0], &im[0], FLAGS_kernel };
+    Col2imStrided2D col2im_strided = { &col[0], &im[0], FLAGS_kernel,
+                                       FLAGS_kstride };
+    TimeKernel("col2im_cpu", col2im_dense);
+    TimeKernel("col2im_sk_cpu", col2im_strided);
+  } else {
+    DenseND dense = { &im[0], &col[0], num_axes, &im_shape[0],
+                      &col_shape[0], &kernel[0], &pad[0], &stride[0] };
+    StridedND strided = { &im[0], &col[0], num_axes, &im_shape[0],
+                          &sk_col_shape[0], &kernel[0], &pad[0], &stride[0],
+                          &kstride[0] };
+    dense_ms = TimeKernel("im2col_nd_cpu", dense);
+    strided_ms = TimeKernel("im2col_ndsk_cpu", strided);
+  }
+  LOG(INFO) << "Strided / dense time ratio: " << strided_ms / dense_ms;
+  return 0;
+}
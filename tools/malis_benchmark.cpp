@@ -0,0 +1,126 @@
+// Times the MALIS loss on a synthetic affinity graph (128^3 voxels with
+// +Z, +Y, +X edges by default): the edge sort, the negative and positive
+// Kruskal passes, and a full MalisLossLayer forward pass.
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/loss_layers.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/malis.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(batch, 1, "Number of affinity graphs in the minibatch.");
+DEFINE_int32(size, 128, "Edge length of the cubic volume.");
+DEFINE_int32(segment, 16, "Edge length of the cubic ground truth segments.");
+DEFINE_int32(iterations, 3, "Number of timed iterations.");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Benchmark the MALIS loss on a synthetic "
+        "3D affinity graph\n"
+        "Usage:\n"
+        "    malis_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Caffe::set_mode(Caffe::CPU);
+
+  const int_tp size = FLAGS_size;
+  vector<int_tp> shape(5);
+  shape[0] = FLAGS_batch;
+  shape[1] = 3;
+  shape[2] = size;
+  shape[3] = size;
+  shape[4] = size;
+  Blob<float> prediction(shape);
+  Blob<float> affinity(shape);
+  shape[1] = 1;
+  Blob<float> seg(shape);
+  Blob<float> loss;
+
+  // Cubic segments separated by one voxel of background; the ground truth
+  // affinity is 1 inside a segment and 0 across boundaries.
+  const int_tp segments = (size + FLAGS_segment - 1) / FLAGS_segment;
+  float* seg_data = seg.mutable_cpu_data();
+  for (int_tp i = 0; i < seg.count(); ++i) {
+    const int_tp x = i % size;
+    const int_tp y = (i / size) % size;
+    const int_tp z = (i / size / size) % size;
+    const bool border = x % FLAGS_segment == 0 || y % FLAGS_segment == 0
+        || z % FLAGS_segment == 0;
+    seg_data[i] = border ? 0 : 1 + x / FLAGS_segment
+        + segments * (y / FLAGS_segment + segments * (z / FLAGS_segment));
+  }
+  const int_tp volume = size * size * size;
+  const int_tp offsets[] = { size * size, size, 1 };
+  float* affinity_data = affinity.mutable_cpu_data();
+  for (int_tp i = 0; i < affinity.count(); ++i) {
+    const int_tp v = i % volume;
+    const int_tp n = i / volume / 3;
+    const int_tp d = (i / volume) % 3;
+    const float* item_seg = seg_data + n * volume;
+    affinity_data[i] = (v + offsets[d] < volume && item_seg[v] != 0
+        && item_seg[v] == item_seg[v + offsets[d]]) ? 1 : 0;
+  }
+  caffe_rng_uniform<float>(prediction.count(), 0, 1,
+                           prediction.mutable_cpu_data());
+
+  const int_tp conn_dims[] = { 3, size, size, size };
+  const int_tp nhood[] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+  vector<int64_t> edges;
+  vector<float> dloss(3 * volume);
+  float pass_loss, classerr, rand_index;
+  CPUTimer timer;
+  double sort_ms = 0, neg_ms = 0, pos_ms = 0;
+  for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+    timer.Start();
+    malis_sort_edges(prediction.cpu_data(), conn_dims, nhood, &edges);
+    timer.Stop();
+    sort_ms += timer.MilliSeconds();
+    timer.Start();
+    malis_loss_cpu(prediction.cpu_data(), conn_dims, nhood, seg_data, edges,
+                   false, &dloss[0], &pass_loss, &classerr, &rand_index);
+    timer.Stop();
+    neg_ms += timer.MilliSeconds();
+    timer.Start();
+    malis_loss_cpu(prediction.cpu_data(), conn_dims, nhood, seg_data, edges,
+                   true, &dloss[0], &pass_loss, &classerr, &rand_index);
+    timer.Stop();
+    pos_ms += timer.MilliSeconds();
+  }
+  LOG(INFO) << "Volume " << size << "^3, " << edges.size() << " edges";
+  LOG(INFO) << "malis_sort_edges: " << sort_ms / FLAGS_iterations << " ms";
+  LOG(INFO) << "malis_loss_cpu (negative): " << neg_ms / FLAGS_iterations
+            << " ms";
+  LOG(INFO) << "malis_loss_cpu (positive): " << pos_ms / FLAGS_iterations
+            << " ms";
+
+  vector<Blob<float>*> bottom;
+  bottom.push_back(&prediction);
+  bottom.push_back(&affinity);
+  bottom.push_back(&seg);
+  vector<Blob<float>*> top(1, &loss);
+  LayerParameter layer_param;
+  MalisLossLayer<float> layer(layer_param);
+  layer.SetUp(bottom, top);
+  layer.Forward(bottom, top);
+  timer.Start();
+  for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+    layer.Forward(bottom, top);
+  }
+  timer.Stop();
+  LOG(INFO) << "MalisLossLayer forward (batch " << FLAGS_batch << "): "
+            << timer.MilliSeconds() / FLAGS_iterations << " ms, loss "
+            << loss.cpu_data()[0];
+  return 0;
+}
@@ -0,0 +1,288 @@
+// Times DataTransformer on raw uint8 datums (and cv::Mat images with
+// USE_OPENCV) against the per-pixel reference loop it used to run, and
+// reports the throughput of both in MB/s of transformed pixels.
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(channels, 3, "Number of image channels.");
+DEFINE_int32(height, 256, "Image height.");
+DEFINE_int32(width, 256, "Image width.");
+DEFINE_int32(crop_size, 227, "Center crop size; 0 disables cropping.");
+DEFINE_bool(mirror, true, "Mirror the crop.");
+DEFINE_bool(mean_file, true, "Subtract a mean image rather than a mean "
+    "value per channel.");
+DEFINE_double(scale, 0.00390625, "Scale applied after mean subtraction.");
+DEFINE_int32(iterations, 200, "Number of timed transformations.");
+
+// The per-pixel loop of the former Transform(const Datum&, Dtype*).
+void ReferenceTransform(const Datum& datum, const float* mean,
+                        const vector<float>& mean_values, bool do_mirror,
+                        int_tp h_off, int_tp w_off, int_tp height,
+                        int_tp width, float scale, float* transformed_data) {
+  const string& data = datum.data();
+  const int_tp datum_channels = datum.channels();
+  const int_tp datum_height = datum.height();
+  const int_tp datum_width = datum.width();
+  const bool has_mean_file = mean != NULL;
+  const bool has_mean_values = !has_mean_file;
+  const bool has_uint8 = data.size() > 0;
+  float datum_element;
+  int_tp top_index, data_index;
+  for (int_tp c = 0; c < datum_channels; ++c) {
+    for (int_tp h = 0; h < height; ++h) {
+      for (int_tp w = 0; w < width; ++w) {
+        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
+        if (do_mirror) {
+          top_index = (c * height + h) * width + (width - 1 - w);
+        } else {
+          top_index = (c * height + h) * width + w;
+        }
+        if (has_uint8) {
+          datum_element =
+              static_cast<float>(static_cast<uint8_t>(data[data_index]));
+        } else {
+          datum_element = datum.float_data(data_index);
+        }
+        if (has_mean_file) {
+          transformed_data[top_index] = (datum_element - mean[data_index])
+              * scale;
+        } else {
+          if (has_mean_values) {
+            transformed_data[top_index] = (datum_element - mean_values[c])
+                * scale;
+          } else {
+            transformed_data[top_index] = datum_element * scale;
+          }
+        }
+      }
+    }
+  }
+}
+
+#ifdef USE_OPENCV
+// The per-pixel loop of the former Transform(const cv::Mat&, Blob*).
+void ReferenceTransform(const cv::Mat& cv_img, const float* mean,
+                        const vector<float>& mean_values, bool do_mirror,
+                        int_tp h_off, int_tp w_off, int_tp height,
+                        int_tp width, float scale, float* transformed_data) {
+  const int_tp img_channels = cv_img.channels();
+  const int_tp img_height = cv_img.rows;
+  const int_tp img_width = cv_img.cols;
+  const bool has_mean_file = mean != NULL;
+  const bool has_mean_values = !has_mean_file;
+  cv::Mat cv_cropped_img = cv_img(cv::Rect(w_off, h_off, width, height));
+  int_tp top_index;
+  for (int_tp h = 0; h < height; ++h) {
+    const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
+    int_tp img_index = 0;
+    for (int_tp w = 0; w < width; ++w) {
+      for (int_tp c = 0; c < img_channels; ++c) {
+        if (do_mirror) {
+          top_index = (c * height + h) * width + (width - 1 - w);
+        } else {
+          top_index = (c * height + h) * width + w;
+        }
+        float pixel;
+        if (cv_img.depth() == CV_8U) {
+          pixel = static_cast<float>(ptr[img_index++]);
+        } else {
+          pixel = static_cast<float>((reinterpret_cast<const float*>(ptr))
+                                     [img_index++]);
+        }
+        if (has_mean_file) {
+          int_tp mean_index = (c * img_height + h_off + h) * img_width + w_off
+              + w;
+          transformed_data[top_index] = (pixel - mean[mean_index]) * scale;
+        } else {
+          if (has_mean_values) {
+            transformed_data[top_index] = (pixel - mean_values[c]) * scale;
+          } else {
+            transformed_data[top_index] = pixel * scale;
+          }
+        }
+      }
+    }
+  }
+}
+#endif  // USE_OPENCV
+
+template<typename Func>
+float TimeTransform(const string& name, int_tp bytes, Func func) {
+  func();  // Warm up caches.
+  CPUTimer timer;
+  timer.Start();
+  for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+    func();
+  }
+  timer.Stop();
+  const float mb_per_s = static_cast<float>(bytes) * FLAGS_iterations
+      / timer.Seconds() / (1024 * 1024);
+  LOG(INFO) << name << ": " << mb_per_s << " MB/s";
+  return mb_per_s;
+}
+
+struct DatumTransform {
+  DataTransformer<float>* transformer; const Datum* datum; Blob<float>* blob;
+  void operator()() const { transformer->Transform(*datum, blob); }
+};
+
+struct DatumReference {
+  const Datum* datum; const float* mean; const vector<float>* mean_values;
+  int_tp h_off, w_off, size; Blob<float>* blob;
+  void operator()() const {
+    ReferenceTransform(*datum, mean, *mean_values, FLAGS_mirror, h_off, w_off,
+                       size, size, FLAGS_scale, blob->mutable_cpu_data());
+  }
+};
+
+#ifdef USE_OPENCV
+struct MatTransform {
+  DataTransformer<float>* transformer; const cv::Mat* img; Blob<float>* blob;
+  void operator()() const { transformer->Transform(*img, blob); }
+};
+
+struct MatReference {
+  const cv::Mat* img; const float* mean; const vector<float>* mean_values;
+  int_tp h_off, w_off, size; Blob<float>* blob;
+  void operator()() const {
+    ReferenceTransform(*img, mean, *mean_values, FLAGS_mirror, h_off, w_off,
+                       size, size, FLAGS_scale, blob->mutable_cpu_data());
+  }
+};
+#endif  // USE_OPENCV
+
+float MaxDiff(const Blob<float>& a, const Blob<float>& b) {
+  float max_diff = 0;
+  for (int_tp i = 0; i < a.count(); ++i) {
+    max_diff = std::max(max_diff, std::fabs(a.cpu_data()[i]
+                                            - b.cpu_data()[i]));
+  }
+  return max_diff;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Benchmark the DataTransformer uint8 paths "
+        "against the former per-pixel loop\n"
+        "Usage:\n"
+        "    transform_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_LE(FLAGS_crop_size, std::min(FLAGS_height, FLAGS_width));
+  Caffe::set_mode(Caffe::CPU);
+
+  const int_tp count = FLAGS_channels * FLAGS_height * FLAGS_width;
+  vector<float> pixels(count);
+  caffe_rng_uniform<float>(count, 0, 256, &pixels[0]);
+  Datum datum;
+  datum.set_channels(FLAGS_channels);
+  datum.set_height(FLAGS_height);
+  datum.set_width(FLAGS_width);
+  string* data = datum.mutable_data();
+  for (int_tp i = 0; i < count; ++i) {
+    data->push_back(static_cast<uint8_t>(pixels[i]));
+  }
+
+  // The transformer mirrors at random, so it runs in TEST phase with a center
+  // crop and is checked against the reference only without --mirror.
+  TransformationParameter param;
+  param.set_crop_size(FLAGS_crop_size);
+  param.set_mirror(FLAGS_mirror);
+  param.set_scale(FLAGS_scale);
+  Blob<float> mean_blob(1, FLAGS_channels, FLAGS_height, FLAGS_width);
+  vector<float> mean_values(FLAGS_channels);
+  caffe_rng_uniform<float>(FLAGS_channels, 0, 256, &mean_values[0]);
+  string mean_file;
+  if (FLAGS_mean_file) {
+    caffe_rng_uniform<float>(count, 0, 256, mean_blob.mutable_cpu_data());
+    BlobProto mean_proto;
+    mean_blob.ToProto(&mean_proto);
+    MakeTempFilename(&mean_file);
+    WriteProtoToBinaryFile(mean_proto, mean_file);
+    param.set_mean_file(mean_file);
+  } else {
+    for (int_tp c = 0; c < FLAGS_channels; ++c) {
+      param.add_mean_value(mean_values[c]);
+    }
+  }
+  const float* mean = FLAGS_mean_file ? mean_blob.cpu_data() : NULL;
+  DataTransformer<float> transformer(param, TEST,
+                                     Caffe::Get().GetDefaultDevice());
+  transformer.InitRand();
+
+  const int_tp height = FLAGS_crop_size ? FLAGS_crop_size : FLAGS_height;
+  const int_tp width = FLAGS_crop_size ? FLAGS_crop_size : FLAGS_width;
+  CHECK_EQ(height, width) << "Use --crop_size or a square image.";
+  const int_tp h_off = (FLAGS_height - height) / 2;
+  const int_tp w_off = (FLAGS_width - width) / 2;
+  const int_tp bytes = FLAGS_channels * height * width;
+  Blob<float> blob(1, FLAGS_channels, height, width);
+  Blob<float> reference_blob(1, FLAGS_channels, height, width);
+
+  LOG(INFO) << "Image " << FLAGS_channels << " x " << FLAGS_height << " x "
+            << FLAGS_width << ", crop " << FLAGS_crop_size << ", mirror "
+            << FLAGS_mirror << ", mean " << (FLAGS_mean_file ? "file"
+                                                            : "values");
+  DatumTransform datum_transform = { &transformer, &datum, &blob };
+  DatumReference datum_reference = { &datum, mean, &mean_values, h_off,
+                                     w_off, height, &reference_blob };
+  const float datum_mb = TimeTransform("Datum transform", bytes,
+                                       datum_transform);
+  const float datum_reference_mb = TimeTransform("Datum reference", bytes,
+                                                 datum_reference);
+  LOG(INFO) << "Datum speedup: " << datum_mb / datum_reference_mb;
+  if (!FLAGS_mirror) {
+    LOG(INFO) << "Datum max difference: " << MaxDiff(blob, reference_blob);
+  }
+
+#ifdef USE_OPENCV
+  cv::Mat cv_img(FLAGS_height, FLAGS_width, CV_8UC(FLAGS_channels));
+  for (int_tp h = 0; h < FLAGS_height; ++h) {
+    uchar* ptr = cv_img.ptr<uchar>(h);
+    for (int_tp i = 0; i < FLAGS_width * FLAGS_channels; ++i) {
+      ptr[i] = static_cast<uchar>(pixels[h * FLAGS_width * FLAGS_channels
+                                         + i]);
+    }
+  }
+  MatTransform mat_transform = { &transformer, &cv_img, &blob };
+  MatReference mat_reference = { &cv_img, mean, &mean_values, h_off, w_off,
+                                 height, &reference_blob };
+  const float mat_mb = TimeTransform("cv::Mat transform", bytes,
+                                     mat_transform);
+  const float mat_reference_mb = TimeTransform("cv::Mat reference", bytes,
+                                               mat_reference);
+  LOG(INFO) << "cv::Mat speedup: " << mat_mb / mat_reference_mb;
+  if (!FLAGS_mirror) {
+    LOG(INFO) << "cv::Mat max difference: "
+              << MaxDiff(blob, reference_blob);
+  }
+#endif  // USE_OPENCV
+
+  if (!mean_file.empty()) {
+    boost::filesystem::remove(mean_file);
+  }
+  return 0;
+}